@@ -0,0 +1,62 @@
+#pragma once
+#include <stdint.h>
+
+// ATA disk driver for the PCI IDE controller (PIIX in QEMU)
+//
+// Both legacy channels are probed: primary at 0x1F0 on IRQ14, secondary
+// at 0x170 on IRQ15. PIO transfers poll the status register sector by
+// sector and are kept for bring-up and for controllers without bus
+// mastering. DMA transfers go through the controller's bus master with a
+// PRD (physical region descriptor) table built from the buffer's pages,
+// so the buffer need not be physically contiguous, though contiguous PMM
+// pages merge into few entries. DMA completion is signalled by the
+// channel's IRQ.
+
+#define ATA_MAX_DRIVES      4     // Two channels, master and slave
+#define ATA_SECTOR_SIZE     512
+#define ATA_MAX_SECTORS     256   // Per command; larger requests are split
+
+// Status codes
+#define ATA_SUCCESS          0
+#define ATA_ERROR_NO_DEVICE -1
+#define ATA_ERROR_INVALID   -2
+#define ATA_ERROR_IO        -3    // The drive reported an error
+#define ATA_ERROR_TIMEOUT   -4
+
+typedef struct {
+    uint8_t channel;        // 0 primary, 1 secondary
+    uint8_t slave;
+    uint8_t lba48;
+    uint8_t dma;            // Bus master DMA usable
+    uint64_t sectors;
+    char model[41];
+} ata_drive_t;
+
+typedef struct {
+    uint32_t pio_commands;
+    uint32_t dma_commands;
+    uint32_t irqs;
+    uint32_t spurious_irqs;  // Channel IRQs with no DMA transfer finished
+    uint32_t errors;
+} ata_stats_t;
+
+int ata_init(void);
+uint32_t ata_drive_count(void);
+const ata_drive_t* ata_get_drive(uint32_t drive);
+
+// 'buf' holds count * ATA_SECTOR_SIZE bytes of mapped kernel memory; DMA
+// buffers must be 2-byte aligned
+int ata_read_pio(uint32_t drive, uint64_t lba, uint32_t count, void* buf);
+int ata_write_pio(uint32_t drive, uint64_t lba, uint32_t count, const void* buf);
+int ata_read_dma(uint32_t drive, uint64_t lba, uint32_t count, void* buf);
+int ata_write_dma(uint32_t drive, uint64_t lba, uint32_t count, const void* buf);
+
+// DMA when the drive supports it, PIO otherwise
+int ata_read(uint32_t drive, uint64_t lba, uint32_t count, void* buf);
+int ata_write(uint32_t drive, uint64_t lba, uint32_t count, const void* buf);
+
+// Called from the IRQ14 (channel 0) and IRQ15 (channel 1) handlers
+void ata_irq_handler(uint32_t channel);
+
+ata_stats_t ata_get_stats(void);
+void ata_print_stats(void);
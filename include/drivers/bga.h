@@ -0,0 +1,23 @@
+#pragma once
+#include <stdint.h>
+
+// Bochs Graphics Adapter (QEMU/Bochs "VBE DISPI" interface)
+//
+// Modes are set with a few port writes from protected mode instead of a
+// real-mode INT 10h round trip. The first 256KB of video memory hold the
+// VGA planes (text and font), so graphics pages start above them and text
+// mode can be restored without the BIOS.
+
+#define BGA_PCI_VENDOR 0x1234
+#define BGA_PCI_DEVICE 0x1111
+
+#define BGA_MAX_PAGES 2
+
+int bga_init(void);
+int bga_present(void);
+int bga_set_mode(uint32_t width, uint32_t height, uint32_t bpp, uint32_t pages);
+void bga_disable(void);
+uint32_t bga_get_pitch(void);
+uint32_t bga_page_address(uint32_t page);
+uint32_t bga_pages_size(void);
+int bga_flip(uint32_t page);
@@ -0,0 +1,46 @@
+#pragma once
+#include <stdint.h>
+
+// Double-buffered linear framebuffer
+//
+// All drawing goes to a back buffer in ordinary write-back RAM and records
+// the rectangles it touched. fb_present() copies only those rectangles to
+// the (uncached) LFB through the blitter.
+
+// Dirty rectangles tracked between presents; when full they are merged
+// into their bounding box
+#define FB_MAX_DIRTY 32
+
+typedef struct {
+    uint32_t* pixels;   // Back buffer, 'stride' pixels per line
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+} fb_surface_t;
+
+typedef struct {
+    uint32_t x;
+    uint32_t y;
+    uint32_t w;
+    uint32_t h;
+} fb_rect_t;
+
+typedef struct {
+    uint32_t presents;
+    uint32_t rects;        // Dirty rectangles copied
+    uint64_t bytes;        // Bytes written to the LFB
+} fb_stats_t;
+
+int fb_init(uint32_t lfb, uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp);
+void fb_shutdown(void);
+int fb_active(void);
+const fb_surface_t* fb_surface(void);
+
+// Drawing into the back buffer; coordinates are clipped to the screen
+void fb_mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
+void fb_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color);
+void fb_blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint32_t* src, uint32_t src_stride);
+void fb_scroll_up(uint32_t lines, uint32_t fill);
+
+void fb_present(void);
+fb_stats_t fb_get_stats(void);
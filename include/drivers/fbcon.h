@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+// Framebuffer text console for VESA graphics modes
+//
+// Text is kept in a cell grid; writes only update cells and mark the
+// touched span of each line dirty, and fbcon_write() then draws the dirty
+// spans into the fb back buffer and presents them. Glyphs are pre-expanded
+// to 32 bpp in an atlas, so drawing a character is FBCON_CELL_HEIGHT row
+// copies.
+
+#define FBCON_CELL_WIDTH  8
+#define FBCON_CELL_HEIGHT 16  // 8x8 font, each row drawn twice
+
+#define FBCON_FG 0x00AAAAAA  // Light gray, as in VGA text mode
+#define FBCON_BG 0x00000000
+
+int fbcon_init(void);
+void fbcon_shutdown(void);
+int fbcon_active(void);
+void fbcon_write(const char* s, uint32_t len);
+void fbcon_clear(void);
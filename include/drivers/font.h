@@ -0,0 +1,12 @@
+#pragma once
+#include <stdint.h>
+
+// Embedded 8x8 bitmap font for printable ASCII (0x20-0x7E). Each glyph is
+// eight rows, top first; bit 0 of a row byte is the leftmost pixel.
+
+#define FONT_WIDTH  8
+#define FONT_HEIGHT 8
+#define FONT_FIRST  0x20
+#define FONT_COUNT  95
+
+extern const uint8_t font8x8[FONT_COUNT][FONT_HEIGHT];
@@ -1,5 +1,29 @@
 #pragma once
 #include <stdint.h>
 
+// Modifier state reported with each event
+#define KBD_MOD_SHIFT 0x01
+#define KBD_MOD_ALT   0x02
+#define KBD_MOD_CAPS  0x04
+
+// kbd_read_event() flags
+#define KBD_NONBLOCK 0x00
+#define KBD_BLOCK    0x01
+
+// Scancodes buffered between IRQ1 and the consumer (power of two)
+#define KBD_RING_SIZE 128
+
+// A translated key event
+typedef struct {
+    uint64_t timestamp;  // TSC value when IRQ1 received the scancode
+    uint8_t scancode;    // Set 1 scancode with the release bit stripped
+    uint8_t pressed;     // 1 = key press, 0 = key release
+    uint8_t modifiers;   // KBD_MOD_* state after this event
+    char ascii;          // Translated character, 0 if the key has none
+} kbd_event_t;
+
 void keyboard_init(void);
 void keyboard_handler(uint8_t scancode);
+int kbd_read_event(kbd_event_t* event, int flags);
+uint32_t kbd_dropped_scancodes(void);
+void keyboard_set_console_echo(int enable);
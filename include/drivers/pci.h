@@ -0,0 +1,57 @@
+#pragma once
+#include <stdint.h>
+
+// PCI configuration space access (mechanism #1, ports 0xCF8/0xCFC)
+//
+// pci_init() enumerates every bus once and keeps the functions it finds in
+// a small table; drivers look their hardware up there.
+
+#define PCI_MAX_DEVICES 32
+
+// Configuration space offsets
+#define PCI_VENDOR_ID   0x00
+#define PCI_DEVICE_ID   0x02
+#define PCI_COMMAND     0x04
+#define PCI_STATUS      0x06
+#define PCI_CLASS_REV   0x08
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0        0x10
+#define PCI_CAPABILITY_LIST 0x34
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_STATUS_CAP_LIST 0x0010
+
+// Capability IDs
+#define PCI_CAP_ID_VENDOR 0x09
+
+// PCI_COMMAND bits
+#define PCI_COMMAND_IO     0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_MASTER 0x0004
+
+typedef struct {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t func;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t irq;
+} pci_device_t;
+
+void pci_init(void);
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset);
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset);
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value);
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value);
+
+const pci_device_t* pci_find_device(uint16_t vendor, uint16_t device);
+const pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass);
+uint32_t pci_bar_address(const pci_device_t* dev, uint32_t bar);
+void pci_enable(const pci_device_t* dev, uint16_t command_bits);
+
+// Config space offset of the first capability with ID 'id' after offset
+// 'after' (0 to start at the head of the list), or 0 if there is none
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t id, uint8_t after);
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+// 16550A UART driver (COM1, IRQ4)
+//
+// Output is queued in a TX ring and fed to the 16-byte FIFO from the
+// THR-empty interrupt, so writers never wait for the line. Bulk output
+// that must arrive intact uses serial_write_sync(), which waits for room
+// instead of dropping bytes. Received bytes are moved from the FIFO into
+// an RX ring by the interrupt handler.
+
+#define SERIAL_COM1     0x3F8
+#define SERIAL_COM1_IRQ 4
+#define SERIAL_BAUD     115200
+
+// Ring sizes (powers of two)
+#define SERIAL_TX_RING_SIZE 8192
+#define SERIAL_RX_RING_SIZE 1024
+
+// serial_read() flags
+#define SERIAL_NONBLOCK 0x00
+#define SERIAL_BLOCK    0x01
+
+typedef struct {
+    uint32_t tx_bytes;
+    uint32_t tx_dropped;   // Bytes discarded because the TX ring was full
+    uint32_t rx_bytes;
+    uint32_t rx_dropped;   // Bytes discarded because the RX ring was full
+    uint32_t rx_overruns;  // FIFO overruns reported by the UART
+    uint32_t irqs;
+    uint32_t flood_entries;  // Switches to the coalescing RX trigger level
+} serial_stats_t;
+
+int serial_init(void);
+int serial_present(void);
+void serial_irq_handler(void);
+uint32_t serial_write(const char* data, uint32_t len);
+void serial_write_sync(const char* data, uint32_t len);
+void serial_flush_polled(void);
+int serial_read(char* buf, uint32_t len, int flags);
+void serial_set_console_input(int enable);
+serial_stats_t serial_get_stats(void);
+void serial_print_stats(void);
@@ -12,4 +12,5 @@ void vga_clear_screen_blue_immediate(void);  // Draw blue screen without debug o
 int vga_get_mode(void);
 uint32_t vga_get_lfb_address(void);  // Get linear framebuffer address
 uint32_t vesa_get_pitch(void);  // Get pitch of the framebuffer
+uint32_t vga_get_pitch(void);  // Pitch of the current graphics mode
 void vga_set_text_mode_80x25(void);  // Switch back to text mode
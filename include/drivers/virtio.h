@@ -0,0 +1,153 @@
+#pragma once
+#include <stdint.h>
+#include "drivers/pci.h"
+
+// Virtio over PCI: transport and split virtqueues
+//
+// Both transports are handled. Modern devices (virtio 1.0, PCI device IDs
+// 0x1040 and up) are found through vendor capabilities that point at
+// memory-mapped register blocks; legacy and transitional devices (0x1000
+// to 0x103F) without usable capabilities use the I/O port layout of
+// virtio 0.9.5. Interrupts arrive on the PCI INTx line; MSI-X is left off.
+//
+// A virtqueue lives in physically contiguous PMM pages laid out as legacy
+// devices require: descriptor table, available ring, then the used ring on
+// the next page boundary. Descriptors carry physical addresses, so drivers
+// can point them straight at caller buffers.
+
+#define VIRTIO_PCI_VENDOR 0x1AF4
+
+// Device status bits
+#define VIRTIO_STATUS_ACKNOWLEDGE 0x01
+#define VIRTIO_STATUS_DRIVER      0x02
+#define VIRTIO_STATUS_DRIVER_OK   0x04
+#define VIRTIO_STATUS_FEATURES_OK 0x08
+#define VIRTIO_STATUS_FAILED      0x80
+
+// Transport feature bits
+#define VIRTIO_F_INDIRECT_DESC 28
+#define VIRTIO_F_EVENT_IDX     29
+#define VIRTIO_F_VERSION_1     32
+
+// Descriptor flags
+#define VIRTQ_DESC_F_NEXT  0x1
+#define VIRTQ_DESC_F_WRITE 0x2   // Device writes this buffer
+
+// Ring flags
+#define VIRTQ_AVAIL_F_NO_INTERRUPT 0x1
+#define VIRTQ_USED_F_NO_NOTIFY     0x1
+
+#define VIRTQ_MAX_SIZE 256
+
+// Ring layouts; every field is naturally aligned
+
+typedef struct {
+    uint64_t addr;
+    uint32_t len;
+    uint16_t flags;
+    uint16_t next;
+} virtq_desc_t;
+
+// ring[size] is followed by used_event (VIRTIO_F_EVENT_IDX)
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    uint16_t ring[];
+} virtq_avail_t;
+
+typedef struct {
+    uint32_t id;
+    uint32_t len;
+} virtq_used_elem_t;
+
+// ring[size] is followed by avail_event (VIRTIO_F_EVENT_IDX)
+typedef struct {
+    uint16_t flags;
+    uint16_t idx;
+    virtq_used_elem_t ring[];
+} virtq_used_t;
+
+typedef struct {
+    const pci_device_t* pci;
+    int modern;
+    uint16_t io_base;               // Legacy: BAR0 I/O ports
+    volatile uint8_t* common;       // Modern: common configuration
+    volatile uint8_t* notify;       // Modern: queue notify area
+    uint32_t notify_multiplier;
+    volatile uint8_t* isr;          // Modern: ISR status
+    volatile uint8_t* device;       // Modern: device-specific configuration
+    uint64_t features;              // Negotiated
+} virtio_device_t;
+
+// One buffer of a descriptor chain
+typedef struct {
+    uint64_t addr;      // Physical
+    uint32_t len;
+    uint32_t write;     // Device writes (driver reads) this buffer
+} virtq_sg_t;
+
+typedef struct {
+    virtio_device_t* dev;
+    uint16_t index;
+    uint16_t size;
+    virtq_desc_t* desc;
+    virtq_avail_t* avail;
+    virtq_used_t* used;
+    uint32_t pages;
+    uint16_t free_head;         // Free descriptors are chained through next
+    uint16_t num_free;
+    uint16_t last_used;         // Next used entry to reap
+    uint16_t kicked_avail;      // avail->idx at the last notification
+    volatile uint16_t* notify_addr;
+} virtqueue_t;
+
+// Find the transport registers, reset the device and announce a driver
+int virtio_pci_init(virtio_device_t* dev, const pci_device_t* pci);
+
+// Accept the offered subset of 'wanted' (bit numbers as above). Modern
+// devices also get VIRTIO_F_VERSION_1. Returns -1 if the device refuses.
+int virtio_negotiate_features(virtio_device_t* dev, uint64_t wanted);
+int virtio_has_feature(const virtio_device_t* dev, uint32_t bit);
+
+uint32_t virtio_config_read32(virtio_device_t* dev, uint32_t offset);
+uint64_t virtio_config_read64(virtio_device_t* dev, uint32_t offset);
+
+void virtio_driver_ok(virtio_device_t* dev);
+
+// Stop the device; it no longer touches queue memory afterwards
+void virtio_reset(virtio_device_t* dev);
+void virtio_fail(virtio_device_t* dev);
+
+// Read (and so acknowledge) the interrupt status; 0 if the device did not
+// interrupt
+uint8_t virtio_read_isr(virtio_device_t* dev);
+
+// Allocate and register queue 'index' with at most 'max_size' entries
+int virtq_init(virtqueue_t* vq, virtio_device_t* dev, uint16_t index, uint16_t max_size);
+
+// Chain 'count' buffers (device-readable ones first) and queue the chain
+// without notifying the device. Returns the head descriptor, or -1 when
+// too few descriptors are free.
+int virtq_add(virtqueue_t* vq, const virtq_sg_t* sg, uint32_t count);
+
+// Head descriptor the next virtq_add() will use, so per-request data can
+// be indexed by it before the chain is built
+static inline uint16_t virtq_next_head(const virtqueue_t* vq) {
+    return vq->free_head;
+}
+
+// Notify the device of everything added since the last kick, unless it
+// asked not to be (event index or VIRTQ_USED_F_NO_NOTIFY). Returns 1 if
+// the device was notified.
+int virtq_kick(virtqueue_t* vq);
+
+int virtq_has_used(virtqueue_t* vq);
+
+// Reap one used chain and free its descriptors. Returns the head
+// descriptor, or -1 if the device has not used anything new.
+int virtq_get_used(virtqueue_t* vq, uint32_t* len);
+
+// Ask for an interrupt only once 'pending' more chains are used (one
+// interrupt per batch), or for none at all when 'pending' is 0. Without
+// VIRTIO_F_EVENT_IDX any nonzero count re-enables per-chain interrupts.
+void virtq_interrupt_after(virtqueue_t* vq, uint16_t pending);
@@ -0,0 +1,76 @@
+#pragma once
+#include <stdint.h>
+
+// Virtio block device driver (first virtio-blk device found)
+//
+// Requests point the device straight at the caller's buffer: a chain of
+// the request header, one descriptor per physically contiguous run of the
+// buffer and the status byte. Requests are submitted in batches; a batch
+// is queued in full and the device is notified once, and with
+// VIRTIO_F_EVENT_IDX it raises a single interrupt when the last request
+// of the batch completes. Buffers must be mapped kernel memory and must
+// not be touched until the request completes.
+
+#define VIRTIO_BLK_SECTOR_SIZE 512
+#define VIRTIO_BLK_MAX_SECTORS 256   // Per request; reads and writes split
+#define VIRTIO_BLK_BATCH_MAX   32
+
+// Request operations (virtio-blk request types)
+#define VIRTIO_BLK_OP_READ  0
+#define VIRTIO_BLK_OP_WRITE 1
+#define VIRTIO_BLK_OP_FLUSH 4
+
+// Status codes
+#define VIRTIO_BLK_SUCCESS          0
+#define VIRTIO_BLK_ERROR_NO_DEVICE -1
+#define VIRTIO_BLK_ERROR_INVALID   -2
+#define VIRTIO_BLK_ERROR_IO        -3
+#define VIRTIO_BLK_ERROR_TIMEOUT   -4
+#define VIRTIO_BLK_ERROR_READ_ONLY -5
+
+typedef struct {
+    uint32_t op;            // VIRTIO_BLK_OP_*
+    uint32_t count;         // Sectors; 0 for a flush
+    uint64_t sector;
+    void* buf;
+    int result;             // Set when the batch completes
+} virtio_blk_request_t;
+
+typedef struct {
+    uint32_t count;
+    virtio_blk_request_t requests[VIRTIO_BLK_BATCH_MAX];
+} virtio_blk_batch_t;
+
+typedef struct {
+    uint32_t requests;
+    uint32_t batches;
+    uint32_t kicks;             // Notifications sent to the device
+    uint32_t kicks_suppressed;  // Batches the device asked not to hear about
+    uint32_t irqs;
+    uint32_t spurious_irqs;     // Shared-line IRQs from another device
+    uint32_t errors;
+} virtio_blk_stats_t;
+
+int virtio_blk_init(void);
+int virtio_blk_present(void);
+uint64_t virtio_blk_capacity(void);     // In sectors
+
+void virtio_blk_batch_init(virtio_blk_batch_t* batch);
+
+// Returns -1 when the batch is full or the request is larger than
+// VIRTIO_BLK_MAX_SECTORS
+int virtio_blk_batch_add(virtio_blk_batch_t* batch, uint32_t op, uint64_t sector,
+                         uint32_t count, void* buf);
+
+// Queue every request, notify the device and sleep until all complete.
+// Returns the first failing request's result, or VIRTIO_BLK_SUCCESS.
+int virtio_blk_submit(virtio_blk_batch_t* batch);
+
+int virtio_blk_read(uint64_t sector, uint32_t count, void* buf);
+int virtio_blk_write(uint64_t sector, uint32_t count, const void* buf);
+
+// Make completed writes durable; a no-op without a volatile write cache
+int virtio_blk_flush(void);
+
+virtio_blk_stats_t virtio_blk_get_stats(void);
+void virtio_blk_print_stats(void);
@@ -15,4 +15,14 @@ void show_register_dump(struct interrupt_frame* frame);
 void kernel_panic(struct interrupt_frame* frame) __attribute__((noreturn));
 void irq_install(void);
 void irq_set_mask(unsigned char irq_line);
-void irq_clear_mask(unsigned char irq_line);
\ No newline at end of file
+void irq_clear_mask(unsigned char irq_line);
+
+// Route an IRQ line that has no fixed handler (a PCI device's INTx) to
+// 'handler' and unmask it. Returns -1 if the line already has one.
+typedef void (*irq_handler_t)(uint8_t irq);
+int irq_register_handler(uint8_t irq, irq_handler_t handler);
+
+// Acknowledge an IRQ at the interrupt controller (a static call, patched
+// at boot; the 8259 PIC is the default)
+void irq_eoi(uint8_t irq);
+void pic_send_eoi(uint8_t irq);
\ No newline at end of file
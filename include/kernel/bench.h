@@ -0,0 +1,41 @@
+#pragma once
+#include <stdint.h>
+
+// In-kernel micro-benchmarks
+//
+// Building with BENCH=1 defines CONFIG_BENCHMARKS; kernel_main then runs
+// every benchmark once the system is up and prints the results.
+
+#ifdef CONFIG_BENCHMARKS
+void bench_run_all(void);
+
+// Console output: per-character, batched and lazy-cursor kprintf
+void bench_kprintf(void);
+
+// ksnprintf formatting cost, without any output device
+void bench_ksnprintf(void);
+
+// memcpy/memset throughput per implementation and size class
+void bench_memory(void);
+
+// Kernel TLB refill cost after a CR3 reload and after a global flush
+void bench_tlb(void);
+
+// Address space create/clone cost and copy-on-write fault cost
+void bench_address_space(void);
+
+// vmalloc/vfree with lazy against per-free TLB purging
+void bench_vmalloc(void);
+
+// Blitter throughput, scalar against SIMD kernels
+void bench_blit(void);
+
+// Full-frame redraw rate, direct to the LFB and through the back buffer
+void bench_fb(void);
+
+// Disk read throughput, PIO against bus master DMA
+void bench_ata(void);
+
+// virtio-blk read throughput and IOPS, single requests against batches
+void bench_virtio_blk(void);
+#endif
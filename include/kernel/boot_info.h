@@ -0,0 +1,51 @@
+#pragma once
+#include <stdint.h>
+
+// What the boot loader tells the kernel
+//
+// The legacy boot sector passes nothing. A Multiboot or Multiboot2 loader
+// passes the firmware memory map and, when it set a video mode, the
+// framebuffer. boot_info_init() copies both out of the loader's structures
+// before the PMM can hand their memory out.
+
+#define BOOT_LOADER_LEGACY     0
+#define BOOT_LOADER_MULTIBOOT  1
+#define BOOT_LOADER_MULTIBOOT2 2
+
+#define BOOT_MAX_MEMORY_REGIONS 32
+#define BOOT_MEMORY_AVAILABLE   1   // Multiboot/E820 type of usable RAM
+
+#define BOOT_FRAMEBUFFER_NONE 0
+#define BOOT_FRAMEBUFFER_RGB  1     // Direct colour graphics mode
+#define BOOT_FRAMEBUFFER_TEXT 2     // EGA text mode
+
+typedef struct {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+} boot_memory_region_t;
+
+typedef struct {
+    uint64_t addr;          // Physical address
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t height;
+    uint32_t bpp;
+    uint32_t type;          // BOOT_FRAMEBUFFER_*
+} boot_framebuffer_t;
+
+typedef struct {
+    uint32_t loader;        // BOOT_LOADER_*
+    char loader_name[48];
+    uint32_t memory_region_count;   // 0 when there is no memory map
+    boot_memory_region_t memory_regions[BOOT_MAX_MEMORY_REGIONS];
+    boot_framebuffer_t framebuffer;
+} boot_info_t;
+
+// Must run before pmm_init()
+void boot_info_init(void);
+const boot_info_t* boot_info_get(void);
+
+// 1 if [base, base + length) lies within one usable region of the memory
+// map; always 1 when there is no map
+int boot_info_memory_usable(uint64_t base, uint64_t length);
@@ -0,0 +1,92 @@
+#pragma once
+#include <stdint.h>
+
+// Per-CPU helpers shared by the kernel subsystems
+
+// Upper bound for statically sized per-CPU data
+#define CPU_MAX 8
+
+// EFLAGS interrupt enable bit
+#define CPU_EFLAGS_IF 0x200
+
+// Only the bootstrap processor is running; AP bring-up will replace these.
+static inline uint32_t cpu_current_id(void) {
+    return 0;
+}
+
+static inline uint32_t cpu_online_count(void) {
+    return 1;
+}
+
+// Disable interrupts and return the previous EFLAGS
+static inline uint32_t cpu_irq_save(void) {
+    uint32_t flags;
+    __asm__ __volatile__("pushfl; popl %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Re-enable interrupts if they were enabled when the flags were saved
+static inline void cpu_irq_restore(uint32_t flags) {
+    if (flags & CPU_EFLAGS_IF) {
+        __asm__ __volatile__("sti" : : : "memory");
+    }
+}
+
+// Execute CPUID for 'leaf' and 'subleaf'
+static inline void cpu_cpuid_count(uint32_t leaf, uint32_t subleaf,
+                                   uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ __volatile__("cpuid"
+                         : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx)
+                         : "a"(leaf), "c"(subleaf));
+}
+
+// Execute CPUID for 'leaf' (subleaf 0)
+static inline void cpu_cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    cpu_cpuid_count(leaf, 0, eax, ebx, ecx, edx);
+}
+
+// Features found by cpu_init(). Plain hex: static call tables use them
+// from assembler.
+#define CPU_FEATURE_TSC           0x00000001
+#define CPU_FEATURE_SSE2          0x00000002  // Only set once SSE is enabled
+#define CPU_FEATURE_ERMS          0x00000004  // Fast rep movsb/stosb
+#define CPU_FEATURE_INVARIANT_TSC 0x00000008
+#define CPU_FEATURE_TSC_DEADLINE  0x00000010
+#define CPU_FEATURE_PAT           0x00000020
+#define CPU_FEATURE_PGE           0x00000040
+#define CPU_FEATURE_X2APIC        0x00000080
+#define CPU_FEATURE_RDTSCP        0x00000100
+#define CPU_FEATURE_CLFLUSH       0x00000200
+
+// Cache types reported by CPUID leaf 4
+#define CPU_CACHE_DATA        1
+#define CPU_CACHE_INSTRUCTION 2
+#define CPU_CACHE_UNIFIED     3
+
+#define CPU_MAX_CACHES 8
+
+typedef struct {
+    uint8_t level;
+    uint8_t type;         // CPU_CACHE_*
+    uint16_t ways;
+    uint32_t line_size;   // Bytes
+    uint32_t sets;
+    uint32_t size;        // Bytes
+    uint32_t shared_by;   // Logical CPUs sharing this cache
+} cpu_cache_t;
+
+// Boot-time CPU setup: probes CPUID and enables SSE when the CPU has SSE2
+void cpu_init(void);
+uint32_t cpu_features(void);
+int cpu_has_sse2(void);
+uint32_t cpu_cache_line_size(void);
+uint32_t cpu_get_caches(const cpu_cache_t** caches);
+
+static inline int cpu_has(uint32_t feature) {
+    return (cpu_features() & feature) == feature;
+}
+
+// Spin-wait hint for busy loops
+static inline void cpu_relax(void) {
+    __asm__ __volatile__("pause" : : : "memory");
+}
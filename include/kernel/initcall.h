@@ -0,0 +1,53 @@
+#pragma once
+#include <stdint.h>
+
+// Boot initialization steps
+//
+// Every step is an initcall_t in the .initcall section (collected by
+// kernel.ld between __initcall_start and __initcall_end) that names the
+// steps it needs. initcall_run_boot() runs each step not marked
+// INITCALL_DEFERRED after its dependencies, in table order otherwise, and
+// timestamps it. Deferred steps run one per idle-loop task once the system
+// is up, or at once when initcall_require() asks for them first.
+//
+// Steps run on the boot CPU in thread context; initcall_require() must not
+// be called from interrupt handlers.
+
+#define INITCALL_MAX_DEPS 4
+#define INITCALL_DEFERRED 0x1   // Not needed before "System ready"
+
+// Run state
+#define INITCALL_PENDING 0
+#define INITCALL_RUNNING 1
+#define INITCALL_DONE    2
+
+typedef struct {
+    const char* name;
+    void (*fn)(void);
+    uint32_t flags;
+    const char* deps[INITCALL_MAX_DEPS];   // Names of steps to run first
+    uint32_t state;
+    uint64_t start_tsc;
+    uint64_t end_tsc;
+} initcall_t;
+
+// Register 'fn' as step 'name' after the steps named in the trailing
+// string arguments
+#define INITCALL(name, fn, flags, ...)                                     \
+    static initcall_t initcall_##name                                      \
+        __attribute__((section(".initcall"), used, aligned(4))) =          \
+        { #name, fn, flags, { __VA_ARGS__ }, INITCALL_PENDING, 0, 0 }
+
+// Run every step that is not deferred. Returns 0, or -1 if a step has an
+// unknown or circular dependency (the step and its dependents are skipped).
+int initcall_run_boot(void);
+
+// Queue the deferred steps on the idle loop; the last one prints the
+// timeline
+void initcall_run_deferred(void);
+
+// Run step 'name' (and what it needs) now if it has not run yet
+int initcall_require(const char* name);
+
+// Per-step start and duration relative to initcall_run_boot()
+void initcall_print_timeline(void);
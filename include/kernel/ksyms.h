@@ -0,0 +1,13 @@
+#pragma once
+#include <stdint.h>
+
+// Embedded kernel symbol table (generated from kernel.elf at build time)
+
+// Look up the function containing 'addr'. Returns its name and stores the
+// offset into the function in *offset, or returns NULL if unknown.
+const char* ksym_lookup(uint32_t addr, uint32_t* offset);
+
+// Index of the function containing 'addr', or -1 if unknown
+int32_t ksym_index(uint32_t addr);
+const char* ksym_name(uint32_t index);
+uint32_t ksym_total(void);
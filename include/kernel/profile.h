@@ -0,0 +1,30 @@
+#pragma once
+#include <stdint.h>
+#include "interrupt/idt.h"
+
+// Sampling profiler driven by the timer interrupt
+//
+// Every timer tick records the interrupted EIP (and optionally the
+// frame-pointer call chain) into a per-CPU ring buffer. Dumps are
+// symbolized with the embedded kernel symbol table.
+
+#define PROFILE_RING_SIZE  4096  // Samples per CPU (power of two)
+#define PROFILE_MAX_DEPTH  8     // Return addresses kept per sample
+#define PROFILE_DEFAULT_HZ 1000
+
+// profile_start() flags
+#define PROFILE_CALLCHAIN 0x01   // Walk saved frame pointers on each sample
+
+typedef struct {
+    uint32_t eip;                          // Interrupted instruction
+    uint32_t depth;                        // Valid entries in callchain
+    uint32_t callchain[PROFILE_MAX_DEPTH]; // Return addresses, innermost first
+} profile_sample_t;
+
+int profile_start(uint32_t hz, uint32_t flags);
+void profile_stop(void);
+int profile_is_running(void);
+void profile_reset(void);
+void profile_tick(struct interrupt_frame* frame);
+void profile_dump_flat(uint32_t max_entries);
+void profile_dump_folded(void);
@@ -0,0 +1,180 @@
+#pragma once
+#include <stdint.h>
+#include "kernel/cpu.h"
+#ifdef CONFIG_LOCK_STATS
+#include "lib/timing.h"
+#endif
+
+// Kernel spinlocks
+//
+// spinlock_t is a FIFO ticket lock for short, lightly contended sections.
+// mcs_lock_t is an MCS queue lock: every waiter spins on its own node, so a
+// heavily contended lock does not bounce one cache line between all CPUs.
+// The _irqsave variants also disable interrupts on the local CPU and must be
+// used for any lock that an interrupt handler can take as well.
+//
+// Building with LOCK_STATS=1 defines CONFIG_LOCK_STATS, which records
+// acquisitions, contention, spin cycles and maximum hold time per lock.
+
+typedef struct lock_stats {
+    const char* name;
+    uint32_t acquisitions;      // Successful acquisitions
+    uint32_t contended;         // Acquisitions that had to wait
+    uint64_t spin_cycles;       // TSC cycles spent waiting in total
+    uint64_t hold_start;        // TSC at the current acquisition
+    uint32_t max_hold_cycles;   // Longest hold time seen (saturates)
+    uint32_t registered;        // Linked into the global stats list
+    struct lock_stats* next;
+} lock_stats_t;
+
+#ifdef CONFIG_LOCK_STATS
+#define LOCK_STATS_FIELD lock_stats_t stats;
+#define LOCK_STATS_INIT(n) , .stats = { .name = (n) }
+void lock_stats_acquired(lock_stats_t* stats, uint64_t wait_start, int contended);
+void lock_stats_released(lock_stats_t* stats);
+#else
+#define LOCK_STATS_FIELD
+#define LOCK_STATS_INIT(n)
+#endif
+
+void lock_stats_print(void);
+
+// Ticket lock
+typedef struct {
+    volatile uint32_t next;   // Next ticket to hand out
+    volatile uint32_t owner;  // Ticket currently being served
+    LOCK_STATS_FIELD
+} spinlock_t;
+
+#define SPINLOCK_INIT(n) { .next = 0, .owner = 0 LOCK_STATS_INIT(n) }
+
+// MCS queue lock; each acquirer supplies its own queue node
+typedef struct mcs_node {
+    struct mcs_node* volatile next;
+    volatile uint32_t locked;
+} mcs_node_t;
+
+typedef struct {
+    mcs_node_t* volatile tail;
+    LOCK_STATS_FIELD
+} mcs_lock_t;
+
+#define MCS_LOCK_INIT(n) { .tail = 0 LOCK_STATS_INIT(n) }
+
+static inline void spin_lock_init(spinlock_t* lock, const char* name) {
+    spinlock_t init = SPINLOCK_INIT(name);
+    (void)name;
+    *lock = init;
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+#ifdef CONFIG_LOCK_STATS
+    uint64_t wait_start = timing_read_tsc();
+#endif
+    uint32_t ticket = __atomic_fetch_add(&lock->next, 1, __ATOMIC_RELAXED);
+    int contended = 0;
+
+    while (__atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) != ticket) {
+        contended = 1;
+        cpu_relax();
+    }
+#ifdef CONFIG_LOCK_STATS
+    lock_stats_acquired(&lock->stats, wait_start, contended);
+#else
+    (void)contended;
+#endif
+}
+
+// Take the lock only if nobody holds or waits for it. Returns 1 on success.
+static inline int spin_trylock(spinlock_t* lock) {
+    uint32_t owner = __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE);
+    uint32_t expected = owner;
+
+    if (!__atomic_compare_exchange_n(&lock->next, &expected, owner + 1, 0,
+                                     __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+#ifdef CONFIG_LOCK_STATS
+    lock_stats_acquired(&lock->stats, timing_read_tsc(), 0);
+#endif
+    return 1;
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+#ifdef CONFIG_LOCK_STATS
+    lock_stats_released(&lock->stats);
+#endif
+    __atomic_store_n(&lock->owner, lock->owner + 1, __ATOMIC_RELEASE);
+}
+
+static inline int spin_is_locked(spinlock_t* lock) {
+    return __atomic_load_n(&lock->owner, __ATOMIC_ACQUIRE) !=
+           __atomic_load_n(&lock->next, __ATOMIC_ACQUIRE);
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = cpu_irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    cpu_irq_restore(flags);
+}
+
+static inline void mcs_lock(mcs_lock_t* lock, mcs_node_t* node) {
+#ifdef CONFIG_LOCK_STATS
+    uint64_t wait_start = timing_read_tsc();
+#endif
+    int contended = 0;
+
+    node->next = 0;
+    node->locked = 1;
+
+    mcs_node_t* prev = __atomic_exchange_n(&lock->tail, node, __ATOMIC_ACQ_REL);
+    if (prev) {
+        contended = 1;
+        __atomic_store_n(&prev->next, node, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&node->locked, __ATOMIC_ACQUIRE)) {
+            cpu_relax();
+        }
+    }
+#ifdef CONFIG_LOCK_STATS
+    lock_stats_acquired(&lock->stats, wait_start, contended);
+#else
+    (void)contended;
+#endif
+}
+
+static inline void mcs_unlock(mcs_lock_t* lock, mcs_node_t* node) {
+#ifdef CONFIG_LOCK_STATS
+    lock_stats_released(&lock->stats);
+#endif
+    mcs_node_t* next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+
+    if (!next) {
+        // No known successor: try to swing the tail back to empty
+        mcs_node_t* expected = node;
+        if (__atomic_compare_exchange_n(&lock->tail, &expected, 0, 0,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+            return;
+        }
+        // A successor is enqueueing itself; wait for it to link in
+        while (!(next = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE))) {
+            cpu_relax();
+        }
+    }
+    __atomic_store_n(&next->locked, 0, __ATOMIC_RELEASE);
+}
+
+static inline uint32_t mcs_lock_irqsave(mcs_lock_t* lock, mcs_node_t* node) {
+    uint32_t flags = cpu_irq_save();
+    mcs_lock(lock, node);
+    return flags;
+}
+
+static inline void mcs_unlock_irqrestore(mcs_lock_t* lock, mcs_node_t* node, uint32_t flags) {
+    mcs_unlock(lock, node);
+    cpu_irq_restore(flags);
+}
@@ -0,0 +1,50 @@
+#pragma once
+#include <stdint.h>
+#include "kernel/cpu.h"
+
+// Boot-time patched calls
+//
+// A static call is a global function whose body is a single 5-byte
+// "jmp rel32" to its current implementation. Callers call it like any
+// other function. static_call_init() rewrites each jump once, after
+// cpu_init(), to the best candidate for this CPU, so hot paths pay one
+// direct jump and never test a feature flag. Until then every static call
+// goes to its default, which must work on any CPU.
+//
+// Candidates live in the .static_call section (collected by kernel.ld
+// between __static_call_start and __static_call_end). For each call the
+// first candidate, in file order, whose CPU_FEATURE_* bits are all present
+// wins; list them from best to most generic next to STATIC_CALL_DEFINE.
+// Targets are named from assembler, so static ones need
+// __attribute__((used)).
+
+typedef struct {
+    uint8_t* site;       // The 5-byte jump
+    void* target;
+    uint32_t features;   // CPU_FEATURE_* bits the target needs
+} static_call_entry_t;
+
+#define STATIC_CALL_STR_(x) #x
+#define STATIC_CALL_STR(x)  STATIC_CALL_STR_(x)
+
+// Define the function 'name' as a jump to 'target'. 'name' must also be
+// declared with its C prototype.
+#define STATIC_CALL_DEFINE(name, target)                           \
+    __asm__(".pushsection .text.static_call, \"ax\"\n\t"           \
+            ".globl " #name "\n\t"                                 \
+            ".type " #name ", @function\n\t"                       \
+            ".p2align 3\n"                                         \
+            #name ":\n\t"                                          \
+            ".byte 0xE9\n\t"                                       \
+            ".long " #target " - (. + 4)\n\t"                      \
+            ".size " #name ", 5\n\t"                               \
+            ".popsection")
+
+// Offer 'target' for 'name' on CPUs with all of 'features' (0 = any CPU)
+#define STATIC_CALL_CANDIDATE(name, target, features)              \
+    __asm__(".pushsection .static_call, \"a\"\n\t"                 \
+            ".p2align 2\n\t"                                       \
+            ".long " #name ", " #target ", " STATIC_CALL_STR(features) "\n\t" \
+            ".popsection")
+
+void static_call_init(void);
@@ -0,0 +1,34 @@
+#pragma once
+#include <stdint.h>
+
+// Kernel task execution layer
+//
+// Every CPU owns a Chase-Lev work-stealing deque. task_spawn() pushes onto
+// the local deque, the owner pops from the bottom (LIFO) and idle CPUs steal
+// from the top (FIFO) of other CPUs' deques.
+
+#define TASK_DEQUE_SIZE 256  // Slots per CPU deque (power of two)
+
+typedef void (*task_fn_t)(void* arg);
+typedef void (*task_range_fn_t)(uint32_t start, uint32_t end, void* arg);
+
+// Per-CPU run queue statistics
+typedef struct {
+    uint32_t spawned;         // Tasks pushed onto this CPU's deque
+    uint32_t executed;        // Tasks run on this CPU (local + stolen)
+    uint32_t stolen;          // Tasks this CPU stole from other CPUs
+    uint32_t steal_attempts;  // Steal attempts on other CPUs' deques
+    uint32_t steal_failures;  // Attempts that found nothing or lost a race
+    uint32_t overflows;       // Spawns run inline because the deque was full
+    uint32_t max_depth;       // Deepest the deque has been
+} task_stats_t;
+
+void task_init(void);
+int task_spawn(task_fn_t fn, void* arg);
+int task_run_one(void);
+uint32_t task_run_pending(void);
+int task_pending(void);
+void task_parallel_for(uint32_t start, uint32_t end, uint32_t grain,
+                       task_range_fn_t fn, void* arg);
+task_stats_t task_get_stats(uint32_t cpu);
+void task_print_stats(void);
@@ -0,0 +1,86 @@
+#pragma once
+#include <stdint.h>
+#include "kernel/spinlock.h"
+
+// Wait queues and sleeping synchronization primitives
+//
+// A waiter links a wait_entry_t (usually on its stack) into a queue, then
+// sleeps: it runs queued tasks and halts the CPU until a waker marks the
+// entry as woken. Wakers may run in interrupt context.
+
+typedef struct wait_entry {
+    struct wait_entry* next;
+    volatile uint32_t woken;
+    uint32_t queued;
+} wait_entry_t;
+
+typedef struct {
+    spinlock_t lock;
+    wait_entry_t* head;
+    wait_entry_t* tail;
+} wait_queue_t;
+
+#define WAIT_QUEUE_INIT(n) { .lock = SPINLOCK_INIT(n), .head = 0, .tail = 0 }
+
+void wait_queue_init(wait_queue_t* wq, const char* name);
+void wait_prepare(wait_queue_t* wq, wait_entry_t* entry);
+void wait_finish(wait_queue_t* wq, wait_entry_t* entry);
+void wait_sleep(wait_entry_t* entry);
+uint32_t wake_up_one(wait_queue_t* wq);
+uint32_t wake_up_all(wait_queue_t* wq);
+
+// Sleep on 'wq' until 'cond' is true. The entry is queued before the
+// condition is tested, so a wakeup between test and sleep is not lost.
+#define wait_event(wq, cond)                      \
+    do {                                          \
+        wait_entry_t __wait = { 0, 0, 0 };        \
+        for (;;) {                                \
+            wait_prepare((wq), &__wait);          \
+            if (cond) {                           \
+                break;                            \
+            }                                     \
+            wait_sleep(&__wait);                  \
+        }                                         \
+        wait_finish((wq), &__wait);               \
+    } while (0)
+
+// Sleeping mutex
+typedef struct {
+    volatile uint32_t locked;
+    wait_queue_t waiters;
+} mutex_t;
+
+#define MUTEX_INIT(n) { .locked = 0, .waiters = WAIT_QUEUE_INIT(n) }
+
+void mutex_init(mutex_t* mutex, const char* name);
+void mutex_lock(mutex_t* mutex);
+int mutex_trylock(mutex_t* mutex);
+void mutex_unlock(mutex_t* mutex);
+
+// Counting semaphore
+typedef struct {
+    volatile int32_t count;
+    wait_queue_t waiters;
+} semaphore_t;
+
+#define SEMAPHORE_INIT(n, c) { .count = (c), .waiters = WAIT_QUEUE_INIT(n) }
+
+void semaphore_init(semaphore_t* sem, const char* name, int32_t count);
+void semaphore_down(semaphore_t* sem);
+int semaphore_trydown(semaphore_t* sem);
+void semaphore_up(semaphore_t* sem);
+
+// One-shot (or counted) event completion
+typedef struct {
+    volatile uint32_t done;
+    wait_queue_t waiters;
+} completion_t;
+
+#define COMPLETION_INIT(n) { .done = 0, .waiters = WAIT_QUEUE_INIT(n) }
+
+void completion_init(completion_t* comp, const char* name);
+void completion_reinit(completion_t* comp);
+void wait_for_completion(completion_t* comp);
+int try_wait_for_completion(completion_t* comp);
+void complete(completion_t* comp);
+void complete_all(completion_t* comp);
@@ -0,0 +1,55 @@
+#pragma once
+#include <stdint.h>
+
+// 2D blitter for framebuffers and off-screen surfaces
+//
+// Colours are passed as 0xAARRGGBB and converted to the surface format.
+// 32 bpp surfaces use SSE2 kernels when the CPU has them; 16 bpp (RGB565)
+// and 24 bpp (packed BGR) surfaces, and CPUs without SSE2, use the scalar
+// fallbacks. Rectangles are clipped to the surfaces.
+
+// Surface flags
+#define BLIT_SURFACE_DEVICE 0x01  // Video memory: write with streaming stores, never read
+
+// blit_glyph() flags
+#define BLIT_GLYPH_TRANSPARENT 0x01  // Leave clear bits untouched instead of painting bg
+
+typedef struct {
+    void* pixels;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;   // Bytes per line
+    uint32_t bpp;     // 16, 24 or 32
+    uint32_t flags;
+} blit_surface_t;
+
+// Row kernels for 32 bpp surfaces, chosen once by blit_init()
+typedef struct {
+    const char* name;
+    void (*fill)(uint32_t* dst, uint32_t color, uint32_t n, int stream);
+    void (*copy)(uint32_t* dst, const uint32_t* src, uint32_t n, int stream);  // Overlap-safe
+    void (*glyph)(uint32_t* dst, const uint8_t* bits, uint32_t n, uint32_t fg, uint32_t bg, int transparent);
+    void (*blend)(uint32_t* dst, const uint32_t* src, uint32_t n);
+} blit_ops_t;
+
+extern const blit_ops_t blit_ops_scalar;
+extern const blit_ops_t blit_ops_sse2;
+
+void blit_init(void);
+int blit_set_simd(int enable);
+const char* blit_backend(void);
+
+void blit_fill(const blit_surface_t* dst, int32_t x, int32_t y, uint32_t w, uint32_t h, uint32_t color);
+
+// Copy a w x h block; 'dst' and 'src' may be the same surface and the
+// areas may overlap. Both surfaces must have the same bpp.
+void blit_copy(const blit_surface_t* dst, int32_t dx, int32_t dy,
+               const blit_surface_t* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h);
+
+// Expand a 1 bpp bitmap ('stride' bytes per row, bit 0 = leftmost pixel)
+void blit_glyph(const blit_surface_t* dst, int32_t x, int32_t y, uint32_t w, uint32_t h,
+                const uint8_t* bits, uint32_t stride, uint32_t fg, uint32_t bg, uint32_t flags);
+
+// Draw 32 bpp ARGB pixels over 'dst' using their per-pixel alpha
+void blit_blend(const blit_surface_t* dst, int32_t x, int32_t y, uint32_t w, uint32_t h,
+                const uint32_t* src, uint32_t src_stride);
@@ -0,0 +1,22 @@
+#pragma once
+#include <stdint.h>
+
+// 64-bit by 32-bit division without libgcc's __udivdi3 (we link -nostdlib).
+// Divides the high word first so the final divl can never overflow.
+static inline uint64_t div_u64_u32(uint64_t dividend, uint32_t divisor, uint32_t* remainder) {
+    uint32_t high = (uint32_t)(dividend >> 32);
+    uint32_t low = (uint32_t)dividend;
+    uint32_t quot_high = 0;
+    uint32_t rem;
+
+    if (high >= divisor) {
+        quot_high = high / divisor;
+        high %= divisor;
+    }
+    __asm__("divl %4" : "=a"(low), "=d"(rem) : "a"(low), "d"(high), "rm"(divisor));
+
+    if (remainder) {
+        *remainder = rem;
+    }
+    return ((uint64_t)quot_high << 32) | low;
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include <stdarg.h>
+#include <stdint.h>
+
+// Kernel log
+//
+// Every kprintf()/klog() message becomes a record in a fixed-size ring.
+// Writers on any CPU or in any context claim a slot with one atomic add
+// and copy their text in; nothing else is done on the writer's side.
+// Console sinks (VGA, debugcon, ...) each keep their own read position and
+// drain the ring from a deferred task, so a slow device never holds up
+// the code that logged. A writer that finds the ring three quarters full
+// of unprinted records flushes it itself. If the ring still wraps before
+// a sink has caught up, the oldest records are lost for that sink and it
+// reports how many.
+
+// Log levels (lower is more severe)
+#define KLOG_ERR   3
+#define KLOG_WARN  4
+#define KLOG_INFO  6
+#define KLOG_DEBUG 7
+
+// Ring geometry: KLOG_RECORDS records of KLOG_RECORD_SIZE bytes each
+#define KLOG_RECORDS     512  // Power of two
+#define KLOG_RECORD_SIZE 128
+#define KLOG_TEXT_MAX    (KLOG_RECORD_SIZE - 16)
+
+typedef struct {
+    volatile uint32_t seq;  // Sequence number + 1 once committed, 0 while being written
+    uint16_t len;
+    uint8_t level;
+    uint8_t cpu;
+    uint64_t tsc;           // Timestamp when the record was written
+    char text[KLOG_TEXT_MAX];
+} klog_record_t;
+
+// A console sink. write() receives raw message text, which is not
+// necessarily a whole line. rate/burst limit how many records per second
+// the sink prints (0 = unlimited); excess records are counted and
+// summarized once output resumes.
+typedef struct klog_sink {
+    const char* name;
+    void (*write)(const char* text, uint32_t len);
+    // Optional: like write(), but waits for the device instead of dropping
+    // text. Used by klog_dmesg() and klog_dump().
+    void (*write_sync)(const char* text, uint32_t len);
+    uint32_t rate;        // Records per second, 0 = no limit
+    uint32_t burst;       // Records that may be printed back to back
+    int enabled;
+
+    // Private state
+    uint32_t next_seq;    // Next record to print
+    uint32_t tokens;
+    uint64_t last_refill;
+    uint32_t suppressed;  // Records skipped by the rate limit
+    uint32_t lost;        // Records overwritten before they were printed
+    struct klog_sink* next;
+} klog_sink_t;
+
+void klog(int level, const char* format, ...) __attribute__((format(printf, 2, 3)));
+void kvlog(int level, const char* format, va_list args) __attribute__((format(printf, 2, 0)));
+
+void klog_write(int level, const char* text, uint32_t len);
+void klog_register_sink(klog_sink_t* sink);
+void klog_sink_set_rate(klog_sink_t* sink, uint32_t rate, uint32_t burst);
+void klog_set_deferred(int enable);
+void klog_flush(void);
+void klog_panic_mode(void);
+void klog_dmesg(void);
+void klog_dump(const char* text, uint32_t len);
+
+// Built-in sinks
+extern klog_sink_t klog_vga_sink;
+extern klog_sink_t klog_debugcon_sink;
@@ -1,6 +1,14 @@
 #pragma once
+#include <stdint.h>
 
 void kputchar(char c);
-void kprintf(const char *format, ...);
+void kconsole_write(const char* s, uint32_t len);
+void kprintf(const char *format, ...) __attribute__((format(printf, 1, 2)));
 void kclear_screen(void);
-void kset_cursor_position(int x, int y);
\ No newline at end of file
+void kset_cursor_position(int x, int y);
+void kprintf_bust_lock(void);
+int kprintf_set_lazy_cursor(int enable);
+void kprintf_sync_cursor(void);
+uint32_t kprintf_cursor_updates(void);
+void kprintf_redraw(void);
+void kprintf_scroll_view(int lines);
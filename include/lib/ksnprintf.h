@@ -0,0 +1,31 @@
+#pragma once
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// printf-style formatting core shared by kprintf, the kernel log and
+// ksnprintf. Supports the flags "-+ #0", field width and precision (both
+// may be '*'), the length modifiers hh h l ll z t j and the conversions
+// d i u o x X p c s %.
+
+// Output target. With flush == NULL the text is truncated to fit 'buf'
+// and NUL-terminated (snprintf semantics). Otherwise flush() is called
+// whenever 'buf' fills up and must consume out->len bytes and reset it.
+typedef struct kformat_out {
+    char* buf;
+    uint32_t size;
+    uint32_t len;    // Bytes currently in buf
+    uint32_t total;  // Bytes produced overall, including truncated ones
+    void (*flush)(struct kformat_out* out);
+    void* ctx;
+} kformat_out_t;
+
+// Returns the number of characters produced
+int kvformat(kformat_out_t* out, const char* format, va_list args);
+
+// Return the length the full output would have; at most size - 1
+// characters are stored, always NUL-terminated when size > 0
+int kvsnprintf(char* buf, size_t size, const char* format, va_list args)
+    __attribute__((format(printf, 3, 0)));
+int ksnprintf(char* buf, size_t size, const char* format, ...)
+    __attribute__((format(printf, 3, 4)));
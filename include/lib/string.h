@@ -0,0 +1,36 @@
+#pragma once
+#include <stddef.h>
+#include <stdint.h>
+
+// Freestanding memory functions
+//
+// Sizes are dispatched by class: short copies use a simple loop, medium
+// ones rep movsd/stosd. Large ones go through static calls patched at boot
+// to SSE2 or fast rep movsb (ERMS) when the CPU has them, with
+// non-temporal stores once the data would not fit in the cache anyway.
+// gcc also calls memcpy/memset/memmove itself for large struct copies.
+
+#define MEM_SMALL_MAX  16          // Below this: plain loop
+#define MEM_BULK_MIN   512         // From here: best bulk variant for the CPU
+#define MEM_STREAM_MIN 0x40000     // From here: non-temporal stores
+
+void* memcpy(void* dst, const void* src, size_t n);
+void* memmove(void* dst, const void* src, size_t n);
+void* memset(void* dst, int c, size_t n);
+int memcmp(const void* a, const void* b, size_t n);
+
+// Zero whole pages with non-temporal stores, bypassing the cache
+void mem_zero_pages(void* dst, uint32_t pages);
+
+// Individual implementations, for benchmarks
+void* memcpy_rep(void* dst, const void* src, size_t n);
+void* memset_rep(void* dst, int c, size_t n);
+void* memcpy_sse2(void* dst, const void* src, size_t n);
+void* memset_sse2(void* dst, int c, size_t n);
+void* memcpy_sse2_stream(void* dst, const void* src, size_t n);
+void* memset_sse2_stream(void* dst, int c, size_t n);
+void* memcpy_erms(void* dst, const void* src, size_t n);
+void* memset_erms(void* dst, int c, size_t n);
+void mem_zero_pages_rep(void* dst, uint32_t pages);
+void mem_zero_pages_erms(void* dst, uint32_t pages);
+void mem_zero_pages_sse2(void* dst, uint32_t pages);
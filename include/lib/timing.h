@@ -21,6 +21,12 @@ uint64_t timing_read_tsc(void);
  */
 uint64_t timing_calibrate_tsc_frequency(void);
 
+/**
+ * @brief Get the calibrated TSC frequency
+ * @return TSC ticks per second, or 0 before timing_init()
+ */
+uint64_t timing_get_tsc_frequency(void);
+
 /**
  * @brief Delay execution for a specified number of seconds
  * @param seconds Number of seconds to delay
@@ -40,6 +46,24 @@ void timing_delay_milliseconds(uint32_t milliseconds);
  */
 uint64_t timing_get_elapsed_ticks(uint64_t start_tsc);
 
+/**
+ * @brief Count a timer interrupt (called from the IRQ0 handler)
+ */
+void timing_tick(void);
+
+/**
+ * @brief Get the number of timer interrupts since boot
+ * @return Timer tick count
+ */
+uint32_t timing_get_ticks(void);
+
+/**
+ * @brief Reprogram the timer interrupt rate (PIT channel 0)
+ * @param hz Interrupts per second, or 0 for the BIOS default (~18.2 Hz)
+ * @return The rate actually programmed
+ */
+uint32_t timing_set_timer_frequency(uint32_t hz);
+
 /**
  * @brief Initialize the timing subsystem
  * Performs initial TSC frequency calibration
@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+#include "memory/paging.h"
+#include "kernel/spinlock.h"
+
+// Address spaces
+//
+// Every address space has its own PDPT. The first and the last gigabyte
+// (PDPT entries 0 and 3: the identity-mapped kernel, its heap and MMIO)
+// point at the kernel's page directories, which all spaces share, so a
+// kernel mapping made in one space is visible in every other. The two
+// middle gigabytes are user space, with private page directories.
+//
+// Creating a space costs three pages however much it later maps. Cloning
+// copies only page tables: parent and child share every user page
+// read-only, and the first write to a shared page copies it (or, when
+// the writer is its last owner, just makes it writable again).
+
+#define AS_USER_START 0x40000000
+#define AS_USER_END   0xC0000000
+#define AS_FIRST_USER_DIR 1  // PDPT entries 1 and 2 are private
+#define AS_LAST_USER_DIR  2
+
+// Status codes
+#define AS_SUCCESS         0
+#define AS_ERROR_NO_MEMORY -1
+#define AS_ERROR_INVALID   -2
+
+typedef struct {
+    pdpt_t* pdpt;
+    page_directory_t* dirs[PDPT_ENTRIES];
+    spinlock_t lock;       // Protects the private page tables
+    uint32_t user_pages;   // Mapped user pages
+} address_space_t;
+
+void address_space_init(void);
+address_space_t* address_space_kernel(void);
+address_space_t* address_space_current(void);
+
+address_space_t* address_space_create(void);
+address_space_t* address_space_clone(address_space_t* parent);
+void address_space_destroy(address_space_t* as);
+void address_space_switch(address_space_t* as);
+
+// Map one user page. The space takes over the caller's reference to
+// 'phys' when it is a PMM page and drops it on unmap or destroy.
+int address_space_map(address_space_t* as, uint32_t vaddr, uint64_t phys, uint32_t flags);
+
+// Map a fresh zeroed page at 'vaddr'
+int address_space_alloc(address_space_t* as, uint32_t vaddr, uint32_t flags);
+int address_space_unmap(address_space_t* as, uint32_t vaddr);
+uint64_t address_space_lookup(address_space_t* as, uint32_t vaddr);
+
+// Page fault hook: resolves copy-on-write faults in the current space.
+// Returns 0 if the faulting access can be retried.
+int address_space_handle_fault(uint32_t vaddr, uint32_t error_code);
@@ -17,6 +17,12 @@
 #define PAGE_SIZE_FLAG  0x080  // For 2MB pages
 #define PAGE_GLOBAL     0x100
 #define PAGE_NX         0x8000000000000000ULL  // No-execute bit (bit 63)
+#define PAGE_COW        0x200  // Software bit: read-only until copied on write
+
+// Kernel mappings are global: with CR4.PGE their TLB entries survive CR3
+// reloads. map_page() never makes PAGE_USER mappings global, so
+// per-address-space entries are still dropped on every switch.
+#define PAGE_KERNEL (PAGE_PRESENT | PAGE_WRITABLE | PAGE_GLOBAL)
 
 // PAE structures (8-byte entries)
 typedef uint64_t pae_entry_t;
@@ -61,7 +67,9 @@ void enable_a20_gate(void);
 void paging_init(void);
 void enable_pae_paging(void);
 int map_page(uint32_t virtual_addr, uint64_t physical_addr, uint32_t flags);
-int unmap_page(uint32_t virtual_addr);
+int unmap_page(uint32_t virtual_addr);  // Frees the page table once it is empty
+uint64_t unmap_page_deferred(uint32_t virtual_addr);
+uint32_t paging_free_detached_tables(void);
 uint64_t get_physical_addr(uint32_t virtual_addr);
 void* allocate_physical_page(void);
 void free_physical_page(void* page);
@@ -69,5 +77,16 @@ void setup_identity_mapping(void);
 void setup_kernel_heap(void);
 void get_memory_stats(void);
 
-// Helper function (should be in kprintf.h but avoiding circular dependencies)
-void print_hex(uint32_t value);
+// TLB maintenance: one page (global or not), every non-global entry (CR3
+// reload), or everything including global kernel entries (CR4.PGE toggle;
+// needed after changing a kernel mapping without invalidating it per page)
+void tlb_flush_page(uint32_t virtual_addr);
+void tlb_flush(void);
+void tlb_flush_global(void);
+int paging_global_pages_enabled(void);
+
+// The boot (kernel) paging structures; address spaces share its kernel
+// page directories
+pdpt_t* paging_kernel_pdpt(void);
+page_directory_t* paging_kernel_directory(uint32_t pdpt_index);
+
@@ -5,6 +5,7 @@
 #define PMM_PAGE_SIZE 4096
 #define PMM_PAGES_PER_BITMAP_ENTRY 32
 #define PMM_BITMAP_ENTRY_SIZE 4  // 32 bits per entry
+#define PMM_PARALLEL_ZERO_PAGES 32  // Blocks this large are zeroed with task_parallel_for
 
 // Memory regions
 #define PMM_KERNEL_START    0x8000      // Kernel starts at 32KB
@@ -47,6 +48,7 @@ typedef struct {
 int pmm_init(void);
 void* pmm_alloc_page(void);
 void* pmm_alloc_pages(uint32_t count);
+void* pmm_alloc_pages_uninit(uint32_t count);
 int pmm_free_page(void* page);
 int pmm_free_pages(void* pages, uint32_t count);
 int pmm_reserve_region(uint32_t start, uint32_t size);
@@ -58,6 +60,13 @@ uint32_t pmm_get_free_memory(void);
 uint32_t pmm_get_used_memory(void);
 int pmm_is_page_allocated(void* page);
 
+// Pages shared between address spaces (copy-on-write). A page starts with
+// one owner; pmm_page_put() frees it when the last owner drops it. Pages
+// outside the managed range are not counted: pmm_page_owners() returns 0.
+void pmm_page_get(void* page);
+uint32_t pmm_page_put(void* page);
+uint32_t pmm_page_owners(void* page);
+
 // Internal functions (for debugging/testing)
 void pmm_dump_bitmap(uint32_t start_page, uint32_t count);
 uint32_t pmm_find_free_pages(uint32_t count);
@@ -0,0 +1,43 @@
+#pragma once
+#include <stdint.h>
+
+// Kernel virtual address areas
+//
+// vmalloc() and ioremap() hand out ranges of [VMALLOC_START, VMALLOC_END),
+// which every address space shares (PDPT entry 3). Free ranges are kept in
+// an AVL tree ordered by address and augmented with the largest free size
+// below each node, so the lowest fitting range is found in O(log n). Every
+// area is followed by an unmapped guard page.
+//
+// Freeing is lazy: the PTEs are cleared at once, but the TLB is flushed
+// (and the range reused) only after VMALLOC_LAZY_PAGES pages have piled
+// up, with one global flush for the whole batch. Page tables left empty
+// are freed at the same time.
+
+#define VMALLOC_START      0xC0000000
+#define VMALLOC_END        0xF0000000  // The top 256MB stays unused
+#define VMALLOC_MAX_AREAS  256         // Free plus allocated ranges
+#define VMALLOC_LAZY_PAGES 1024        // Freed pages batched per TLB flush
+
+typedef struct {
+    uint32_t areas;         // Allocated areas
+    uint32_t used_pages;    // Pages in allocated areas, guards included
+    uint32_t free_ranges;   // Nodes in the free tree
+    uint32_t lazy_pages;    // Freed but not yet purged
+    uint32_t purges;        // Batched TLB flushes so far
+} vmalloc_stats_t;
+
+void vmalloc_init(void);
+
+// Zeroed, page-granular kernel memory; not physically contiguous
+void* vmalloc(uint32_t size);
+void vfree(void* addr);
+
+// Map device memory uncached. The result keeps the offset of 'phys' within
+// its page.
+void* ioremap(uint64_t phys, uint32_t size);
+void iounmap(void* addr);
+
+// Flush the TLB now and make every lazily freed range reusable
+void vmalloc_purge(void);
+vmalloc_stats_t vmalloc_get_stats(void);
@@ -0,0 +1,57 @@
+#!/bin/sh
+# Generate the embedded kernel symbol table from a linked kernel ELF.
+# Usage: gen_ksyms.sh kernel.elf > ksyms_table.c
+#        gen_ksyms.sh            > ksyms_table.c   (empty table)
+#
+# Only text symbols are emitted, sorted by address. The table is pure
+# .rodata (no pointers), so adding it never moves any code.
+
+ELF="$1"
+
+{
+    if [ -n "$ELF" ]; then
+        nm -n --defined-only "$ELF" | awk '$2 ~ /^[tT]$/ && $3 !~ /^__x86\.get_pc_thunk/ { print $1, $3 }'
+    fi
+} | awk '
+BEGIN {
+    print "// Generated by scripts/gen_ksyms.sh - do not edit"
+    print "#include <stdint.h>"
+    print ""
+    n = 0
+    off = 0
+}
+{
+    # Keep one name per address (the first, which nm sorts stably)
+    if (n > 0 && addr[n - 1] == $1) {
+        next
+    }
+    addr[n] = $1
+    name[n] = $2
+    noff[n] = off
+    off += length($2) + 1
+    n++
+}
+END {
+    printf "const uint32_t ksym_count = %d;\n\n", n
+    print "const uint32_t ksym_addrs[] = {"
+    for (i = 0; i < n; i++) {
+        printf "    0x%s,\n", addr[i]
+    }
+    if (n == 0) {
+        print "    0"
+    }
+    print "};\n"
+    print "const uint32_t ksym_name_offsets[] = {"
+    for (i = 0; i < n; i++) {
+        printf "    %d,\n", noff[i]
+    }
+    if (n == 0) {
+        print "    0"
+    }
+    print "};\n"
+    print "const char ksym_names[] ="
+    for (i = 0; i < n; i++) {
+        printf "    \"%s\\0\"\n", name[i]
+    }
+    print "    \"\";"
+}'
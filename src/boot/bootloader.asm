@@ -1,8 +1,20 @@
 ; filepath: bootloader.asm
-; Minimal 512-byte bootloader for x86, loads 32 KiB kernel to 0x8000 and jumps there (Protected Mode)
+; 512-byte bootloader for x86. Loads the kernel image (its size comes from the
+; boot header below) to 1MB through a low bounce buffer, using extended LBA
+; reads when the BIOS has them and CHS reads otherwise, then copies it down
+; to 0x8000 in protected mode and jumps there.
 BITS 16
 ORG 0x7C00
 
+%ifndef KERNEL_SECTORS
+%define KERNEL_SECTORS 64
+%endif
+
+KERNEL_ADDR  equ 0x8000     ; Where the kernel is linked to run
+KERNEL_STAGE equ 0x100000   ; Where it is loaded, above the real mode memory
+BOUNCE_SEG   equ 0x1000     ; 0x10000: free until the final copy overwrites it
+BURST        equ 127        ; Sectors per LBA read; the most every BIOS accepts
+
 start:
     cli
     xor ax, ax
@@ -10,25 +22,75 @@ start:
     mov es, ax
     mov ss, ax
     mov sp, 0x7C00
+    cld
+    sti
     mov byte [boot_drive], dl
 
     ; Output kernel info
     mov si, kernel_load_msg
     call print_string
 
-    ; Load kernel (64 sectors) to 0x8000
-    mov ax, 0x0000
-    mov es, ax
-    mov bx, 0x8000
-    mov ah, 0x02          ; BIOS: read sectors
-    mov al, 64            ; 64 sectors (32 KiB)
-    mov ch, 0             ; cylinder 0
-    mov cl, 2             ; sector 2 (after boot sector)
-    mov dh, 0             ; head 0
+    ; Fast A20, needed before anything is written above 1MB
+    in al, 0x92
+    or al, 2
+    and al, 0xFE
+    out 0x92, al
+
+    ; Extended reads are used if the BIOS supports the packet interface
+    mov ah, 0x41
+    mov bx, 0x55AA
     mov dl, byte [boot_drive]
     int 0x13
+    jc .chs
+    cmp bx, 0xAA55
+    jne .chs
+    test cl, 1
+    jz .chs
+    mov byte [use_lba], 1
+    jmp .load
+
+.chs:
+    ; Fallback: CHS reads of at most one track, geometry from the BIOS
+    mov ah, 0x08
+    mov dl, byte [boot_drive]
+    push es
+    int 0x13
+    pop es
+    jc disk_error
+    and cx, 0x3F
+    mov word [sectors_per_track], cx
+    movzx dx, dh
+    inc dx
+    mov word [heads], dx
+
+.load:
+    mov ax, word [kernel_sectors]
+    mov word [sectors_left], ax
+    mov edi, KERNEL_STAGE
+.next_burst:
+    mov cx, word [sectors_left]
+    jcxz .loaded
+    cmp cx, BURST
+    jbe .count_ok
+    mov cx, BURST
+.count_ok:
+    mov word [dap_count], cx
+    call read_burst
     jc disk_error
 
+    ; Copy the burst from the bounce buffer to its place above 1MB
+    call enter_unreal
+    movzx ecx, word [dap_count]
+    shl ecx, 7
+    mov esi, BOUNCE_SEG * 16
+    a32 rep movsd
+
+    movzx eax, word [dap_count]
+    add dword [dap_lba], eax
+    sub word [sectors_left], ax
+    jmp .next_burst
+
+.loaded:
     ; Switch to Protected Mode
     mov si, kernel_jump_msg
     call print_string
@@ -40,6 +102,69 @@ start:
     mov cr0, eax
     jmp 0x08:protected_mode
 
+; Read [dap_count] sectors starting at [dap_lba] into the bounce buffer.
+; CHS reads stop at the end of the track and lower [dap_count] to match.
+; Returns with CF set on error.
+read_burst:
+    mov dl, byte [boot_drive]
+    cmp byte [use_lba], 0
+    je .chs
+    mov si, dap
+    mov ah, 0x42
+    int 0x13
+    ret
+.chs:
+    mov ax, word [dap_lba]
+    xor dx, dx
+    div word [sectors_per_track]    ; ax = track, dx = sector - 1
+    mov cx, word [sectors_per_track]
+    sub cx, dx
+    cmp cx, word [dap_count]
+    jae .track_ok
+    mov word [dap_count], cx
+.track_ok:
+    mov bx, dx
+    inc bx                          ; bl = sector
+    xor dx, dx
+    div word [heads]                ; ax = cylinder, dx = head
+    mov ch, al
+    mov cl, ah
+    shl cl, 6
+    or cl, bl
+    mov dh, dl
+    mov dl, byte [boot_drive]
+    push es
+    mov bx, BOUNCE_SEG
+    mov es, bx
+    xor bx, bx
+    mov al, byte [dap_count]
+    mov ah, 0x02
+    int 0x13
+    pop es
+    ret
+
+; Load DS and ES with 4GB limits and return to real mode: the limits stay
+; in the segment caches, so 32-bit addresses work until a BIOS call
+; reloads them. Called again before every copy for that reason.
+enter_unreal:
+    cli
+    push ds
+    push es
+    lgdt [gdt_desc]
+    mov eax, cr0
+    or al, 1
+    mov cr0, eax
+    jmp $+2
+    mov bx, 0x10
+    mov ds, bx
+    mov es, bx
+    and al, 0xFE
+    mov cr0, eax
+    pop es
+    pop ds
+    sti
+    ret
+
 disk_error:
     mov si, disk_error_msg
     call print_string
@@ -66,11 +191,25 @@ gdt_desc:
     dw gdt_end - gdt_start - 1
     dd gdt_start
 
+; Disk address packet for AH=42h
+dap:
+    db 0x10                       ; Packet size
+    db 0
+dap_count:
+    dw 0                          ; Sectors to read
+    dw 0, BOUNCE_SEG              ; Buffer offset, segment
+dap_lba:
+    dq 1                          ; The kernel follows the boot sector
+
 kernel_load_msg db "Loading kernel...", 0
 kernel_jump_msg db 13,10,"Jumping to kernel...", 0
 disk_error_msg db 13,10,"Disk read error!", 0
 
 boot_drive db 0
+use_lba db 0
+sectors_per_track dw 0
+heads dw 0
+sectors_left dw 0
 
 ; Protected Mode Entry
 protected_mode:
@@ -83,49 +222,23 @@ protected_mode:
     mov ss, ax
     mov esp, 0x90000
 
-    ;mov esi, 0x8000      ; Start address
-    ;mov ecx, 16          ; Number of bytes
-    ;call hexdump_pm
+    ; Move the kernel down to where it is linked
+    cld
+    mov esi, KERNEL_STAGE
+    mov edi, KERNEL_ADDR
+    movzx ecx, word [kernel_sectors]
+    shl ecx, 7
+    rep movsd
 
     ; Jump to kernel at 0x8000
-    jmp 0x08:0x8000
-
-hexdigit_table db '0123456789ABCDEF'
-
-hexdump_pm:
-    pusha
-    mov edi, 0xb8000         ; VGA textmode start address
-.nextbyte:
-    mov al, [esi]            ; load byte
-    mov ah, 0x07             ; attribute: light gray on black
-
-    ; High nibble
-    mov bl, al
-    shr bl, 4
-    movzx bx, bl
-    mov dl, [hexdigit_table + bx]
-    mov [edi], dl
-    mov [edi+1], ah
-    add edi, 2
-
-    ; Low nibble
-    mov bl, al
-    and bl, 0x0F
-    movzx bx, bl
-    mov dl, [hexdigit_table + bx]
-    mov [edi], dl
-    mov [edi+1], ah
-    add edi, 2
-
-    ; Space character
-    mov byte [edi], ' '
-    mov byte [edi+1], ah
-    add edi, 2
-
-    inc esi
-    loop .nextbyte
-    popa
-    ret
+    jmp 0x08:KERNEL_ADDR
+
+; Boot header at a fixed offset: the size of the kernel image that follows
+; the boot sector, passed in by the Makefile
+times 0x1F8-($-$$) db 0
+boot_header:
+    db "LKNG"                     ; Magic
+kernel_sectors:
+    dw KERNEL_SECTORS             ; Image size in 512-byte sectors
 
-times 510-($-$$) db 0
-dw 0xAA55
\ No newline at end of file
+dw 0xAA55
@@ -0,0 +1,75 @@
+; filepath: multiboot.asm
+; Multiboot headers and entry point, so GRUB (Multiboot2) and
+; "qemu-system-x86_64 -kernel kernel.elf" (QEMU only loads Multiboot v1)
+; can start kernel.elf without the boot sector. The legacy bootloader jumps
+; straight to kernel_main at 0x8000 and never runs this code.
+
+[BITS 32]
+extern kernel_main
+global multiboot_entry
+global multiboot_magic
+global multiboot_info
+
+MB2_MAGIC     equ 0xE85250D6
+MB2_ARCH_I386 equ 0
+MB1_MAGIC     equ 0x1BADB002
+MB1_MEMINFO   equ 0x00000002    ; Ask for mem_* and the memory map
+
+; kernel.ld places this section right after the VESA BIOS code, well inside
+; the first 8K of kernel.elf where both specifications look for it
+section .multiboot
+align 8
+mb2_header:
+    dd MB2_MAGIC
+    dd MB2_ARCH_I386
+    dd mb2_header_end - mb2_header
+    dd -(MB2_MAGIC + MB2_ARCH_I386 + (mb2_header_end - mb2_header))
+    ; End tag
+    dw 0, 0
+    dd 8
+mb2_header_end:
+
+align 4
+mb1_header:
+    dd MB1_MAGIC
+    dd MB1_MEMINFO
+    dd -(MB1_MAGIC + MB1_MEMINFO)
+
+section .data
+; Saved for boot_info_init(); both stay 0 on the legacy boot path
+multiboot_magic dd 0
+multiboot_info  dd 0
+
+; Same layout as the boot sector's GDT: the IDT and the VESA BIOS code use
+; selectors 0x08 and 0x10, and the loader's GDT may be anywhere
+align 8
+gdt_start:
+    dq 0x0000000000000000         ; Null descriptor
+    dq 0x00cf9a000000ffff         ; Code segment
+    dq 0x00cf92000000ffff         ; Data segment
+gdt_end:
+
+gdt_desc:
+    dw gdt_end - gdt_start - 1
+    dd gdt_start
+
+section .text
+; Entered in protected mode with paging off, EAX = loader magic and
+; EBX = physical address of the boot information
+multiboot_entry:
+    cli
+    mov [multiboot_magic], eax
+    mov [multiboot_info], ebx
+
+    lgdt [gdt_desc]
+    jmp 0x08:.reload
+.reload:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, 0x90000              ; Where the boot sector puts it too
+    cld
+    jmp kernel_main
@@ -0,0 +1,682 @@
+#include "drivers/ata.h"
+#include "drivers/pci.h"
+#include "interrupt/idt.h"
+#include "memory/paging.h"
+#include "memory/pmm.h"
+#include "kernel/cpu.h"
+#include "kernel/task.h"
+#include "kernel/wait.h"
+#include "lib/kprintf.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Task file register offsets from the command block base
+#define ATA_REG_DATA     0
+#define ATA_REG_ERROR    1
+#define ATA_REG_FEATURES 1
+#define ATA_REG_COUNT    2
+#define ATA_REG_LBA0     3
+#define ATA_REG_LBA1     4
+#define ATA_REG_LBA2     5
+#define ATA_REG_DRIVE    6
+#define ATA_REG_STATUS   7   // Read; reading acknowledges the IRQ
+#define ATA_REG_COMMAND  7   // Write
+
+// Control block: alternate status (read) / device control (write)
+#define ATA_REG_CONTROL  0
+
+#define ATA_STATUS_ERR  0x01
+#define ATA_STATUS_DRQ  0x08
+#define ATA_STATUS_DF   0x20
+#define ATA_STATUS_DRDY 0x40
+#define ATA_STATUS_BSY  0x80
+
+#define ATA_CONTROL_NIEN 0x02  // Mask the drive's IRQ
+#define ATA_CONTROL_SRST 0x04
+
+#define ATA_DRIVE_LBA   0xE0   // LBA mode, bits 7 and 5 set for old drives
+#define ATA_DRIVE_SLAVE 0x10
+
+#define ATA_CMD_READ_PIO      0x20
+#define ATA_CMD_READ_PIO_EXT  0x24
+#define ATA_CMD_READ_DMA_EXT  0x25
+#define ATA_CMD_WRITE_PIO     0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_READ_DMA      0xC8
+#define ATA_CMD_WRITE_DMA     0xCA
+#define ATA_CMD_FLUSH         0xE7
+#define ATA_CMD_FLUSH_EXT     0xEA
+#define ATA_CMD_IDENTIFY      0xEC
+
+// IDENTIFY words
+#define ATA_ID_MODEL        27
+#define ATA_ID_MODEL_WORDS  20
+#define ATA_ID_CAPABILITIES 49
+#define ATA_ID_LBA28        60
+#define ATA_ID_COMMAND_SET2 83
+#define ATA_ID_LBA48        100
+
+#define ATA_CAP_DMA    0x0100
+#define ATA_CAP_LBA    0x0200
+#define ATA_CMD2_LBA48 0x0400
+
+// Bus master registers, per channel from BAR4 (secondary at +8)
+#define BM_REG_COMMAND 0
+#define BM_REG_STATUS  2
+#define BM_REG_PRDT    4
+#define BM_CHANNEL_STRIDE 8
+
+#define BM_COMMAND_START 0x01
+#define BM_COMMAND_READ  0x08  // Device to memory
+
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERROR  0x02
+#define BM_STATUS_IRQ    0x04
+
+// PRD entries: 32-bit physical address, byte count (0 means 64K) and the
+// end-of-table flag. A region may not cross a 64K boundary.
+#define PRD_EOT        0x8000
+#define PRD_MAX_BYTES  0x10000
+#define PRD_MAX_ENTRIES (PMM_PAGE_SIZE / sizeof(ata_prd_t))
+
+#define LBA28_LIMIT 0x10000000ULL
+
+// Prog-if bits 0 and 2 set when a channel runs in PCI native mode
+#define IDE_PROG_IF_NATIVE 0x05
+
+#define ATA_TIMEOUT_MS 5000
+
+typedef struct __attribute__((packed)) {
+    uint32_t addr;
+    uint16_t count;
+    uint16_t flags;
+} ata_prd_t;
+
+typedef struct {
+    uint16_t base;          // Command block
+    uint16_t control;       // Control block
+    uint16_t bm;            // Bus master registers; 0 without DMA
+    uint8_t irq;
+    ata_prd_t* prdt;        // One PMM page, identity mapped
+    mutex_t lock;           // Held for a whole command
+    completion_t dma_done;  // Signalled from the channel's IRQ
+    volatile uint8_t dma_active;
+    volatile uint8_t dma_status;   // Bus master status at completion
+    volatile uint8_t ata_status;   // Drive status at completion
+} ata_channel_t;
+
+static ata_channel_t ata_channels[2] = {
+    { .base = 0x1F0, .control = 0x3F6, .irq = 14,
+      .lock = MUTEX_INIT("ata0"), .dma_done = COMPLETION_INIT("ata0_dma") },
+    { .base = 0x170, .control = 0x376, .irq = 15,
+      .lock = MUTEX_INIT("ata1"), .dma_done = COMPLETION_INIT("ata1_dma") },
+};
+
+static ata_drive_t ata_drives[ATA_MAX_DRIVES];
+static uint32_t ata_drive_total = 0;
+static int ata_initialized = 0;
+static ata_stats_t ata_stats;
+
+static void outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint8_t inb(uint16_t port) {
+    uint8_t result;
+    __asm__ __volatile__("inb %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static void outl(uint16_t port, uint32_t value) {
+    __asm__ __volatile__("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static void insw(uint16_t port, void* buf, uint32_t count) {
+    __asm__ __volatile__("cld; rep insw" : "+D"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+static void outsw(uint16_t port, const void* buf, uint32_t count) {
+    __asm__ __volatile__("cld; rep outsw" : "+S"(buf), "+c"(count) : "d"(port) : "memory");
+}
+
+static uint64_t ata_timeout_ticks(void) {
+    return div_u64_u32(timing_get_tsc_frequency(), 1000, NULL) * ATA_TIMEOUT_MS;
+}
+
+// Each alternate status read takes about 100ns; four cover the 400ns the
+// drive may take to update BSY after a command or drive select
+static void ata_delay_400ns(ata_channel_t* ch) {
+    for (int i = 0; i < 4; i++) {
+        inb(ch->control + ATA_REG_CONTROL);
+    }
+}
+
+static int ata_wait_not_busy(ata_channel_t* ch, uint8_t* status_out) {
+    uint64_t start = timing_read_tsc();
+    uint64_t timeout = ata_timeout_ticks();
+
+    for (;;) {
+        uint8_t status = inb(ch->control + ATA_REG_CONTROL);
+        if (!(status & ATA_STATUS_BSY)) {
+            if (status_out) {
+                *status_out = status;
+            }
+            return ATA_SUCCESS;
+        }
+        if (timing_get_elapsed_ticks(start) > timeout) {
+            return ATA_ERROR_TIMEOUT;
+        }
+        cpu_relax();
+    }
+}
+
+// Wait for the drive to be ready for the next PIO data block
+static int ata_wait_drq(ata_channel_t* ch) {
+    uint8_t status;
+    int result = ata_wait_not_busy(ch, &status);
+    if (result != ATA_SUCCESS) {
+        return result;
+    }
+    if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+        return ATA_ERROR_IO;
+    }
+    return (status & ATA_STATUS_DRQ) ? ATA_SUCCESS : ATA_ERROR_IO;
+}
+
+static void ata_select(ata_channel_t* ch, uint8_t slave) {
+    outb(ch->base + ATA_REG_DRIVE, ATA_DRIVE_LBA | (slave ? ATA_DRIVE_SLAVE : 0));
+    ata_delay_400ns(ch);
+}
+
+// Load the task file for an LBA28 or LBA48 command and issue it. LBA48
+// registers are FIFOs of two bytes: high-order bytes go in first.
+static void ata_issue(ata_channel_t* ch, const ata_drive_t* drive, uint64_t lba,
+                      uint32_t count, uint8_t command) {
+    uint16_t base = ch->base;
+
+    if (drive->lba48) {
+        outb(base + ATA_REG_DRIVE, ATA_DRIVE_LBA | (drive->slave ? ATA_DRIVE_SLAVE : 0));
+        outb(base + ATA_REG_COUNT, (uint8_t)(count >> 8));
+        outb(base + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(base + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(base + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+    } else {
+        outb(base + ATA_REG_DRIVE, ATA_DRIVE_LBA | (drive->slave ? ATA_DRIVE_SLAVE : 0) |
+                                   (uint8_t)((lba >> 24) & 0x0F));
+    }
+    outb(base + ATA_REG_COUNT, (uint8_t)count);   // 256 wraps to 0, as intended
+    outb(base + ATA_REG_LBA0, (uint8_t)lba);
+    outb(base + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(base + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+    outb(base + ATA_REG_COMMAND, command);
+    ata_delay_400ns(ch);
+}
+
+static const ata_drive_t* ata_lookup(uint32_t drive, uint64_t lba, uint32_t count, const void* buf) {
+    if (!ata_initialized || drive >= ATA_MAX_DRIVES || ata_drives[drive].sectors == 0) {
+        return NULL;
+    }
+    const ata_drive_t* d = &ata_drives[drive];
+    if (buf == NULL || count == 0 || lba + count > d->sectors || lba + count < lba) {
+        return NULL;
+    }
+    if (!d->lba48 && lba + count > LBA28_LIMIT) {
+        return NULL;
+    }
+    return d;
+}
+
+static int ata_lookup_error(uint32_t drive) {
+    if (!ata_initialized || drive >= ATA_MAX_DRIVES || ata_drives[drive].sectors == 0) {
+        return ATA_ERROR_NO_DEVICE;
+    }
+    return ATA_ERROR_INVALID;
+}
+
+// ---- PIO ----
+
+static int ata_pio_transfer(const ata_drive_t* drive, uint64_t lba, uint32_t count,
+                            uint8_t* buf, int write) {
+    ata_channel_t* ch = &ata_channels[drive->channel];
+    int result = ATA_SUCCESS;
+
+    mutex_lock(&ch->lock);
+    outb(ch->control + ATA_REG_CONTROL, ATA_CONTROL_NIEN);
+    ata_select(ch, drive->slave);
+
+    while (count > 0 && result == ATA_SUCCESS) {
+        uint32_t chunk = count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count;
+        uint8_t command;
+        if (write) {
+            command = drive->lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+        } else {
+            command = drive->lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+        }
+
+        result = ata_wait_not_busy(ch, NULL);
+        if (result != ATA_SUCCESS) {
+            break;
+        }
+        ata_issue(ch, drive, lba, chunk, command);
+        ata_stats.pio_commands++;
+
+        for (uint32_t i = 0; i < chunk; i++) {
+            result = ata_wait_drq(ch);
+            if (result != ATA_SUCCESS) {
+                break;
+            }
+            if (write) {
+                outsw(ch->base + ATA_REG_DATA, buf, ATA_SECTOR_SIZE / 2);
+            } else {
+                insw(ch->base + ATA_REG_DATA, buf, ATA_SECTOR_SIZE / 2);
+            }
+            buf += ATA_SECTOR_SIZE;
+        }
+
+        if (result == ATA_SUCCESS && write) {
+            // Nothing is on the media until the write cache is flushed
+            outb(ch->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+            uint8_t status;
+            result = ata_wait_not_busy(ch, &status);
+            if (result == ATA_SUCCESS && (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+                result = ATA_ERROR_IO;
+            }
+        }
+        lba += chunk;
+        count -= chunk;
+    }
+
+    if (result != ATA_SUCCESS) {
+        ata_stats.errors++;
+    }
+    mutex_unlock(&ch->lock);
+    return result;
+}
+
+int ata_read_pio(uint32_t drive, uint64_t lba, uint32_t count, void* buf) {
+    const ata_drive_t* d = ata_lookup(drive, lba, count, buf);
+    if (d == NULL) {
+        return ata_lookup_error(drive);
+    }
+    return ata_pio_transfer(d, lba, count, (uint8_t*)buf, 0);
+}
+
+int ata_write_pio(uint32_t drive, uint64_t lba, uint32_t count, const void* buf) {
+    const ata_drive_t* d = ata_lookup(drive, lba, count, buf);
+    if (d == NULL) {
+        return ata_lookup_error(drive);
+    }
+    return ata_pio_transfer(d, lba, count, (uint8_t*)buf, 1);
+}
+
+// ---- DMA ----
+
+// Describe [buf, buf + bytes) in the channel's PRD table. Pages are
+// translated one by one and physically adjacent ones merged, so a buffer
+// from pmm_alloc_pages() takes one entry per 64K.
+static int ata_build_prdt(ata_channel_t* ch, const uint8_t* buf, uint32_t bytes) {
+    uint32_t entries = 0;
+    uint32_t virt = (uint32_t)buf;
+
+    while (bytes > 0) {
+        uint64_t phys = get_physical_addr(virt);
+        uint32_t in_page = PMM_PAGE_SIZE - (virt & (PMM_PAGE_SIZE - 1));
+        uint32_t len = bytes < in_page ? bytes : in_page;
+        if (phys == 0 || phys + len > 0x100000000ULL) {
+            return ATA_ERROR_INVALID;
+        }
+
+        ata_prd_t* last = entries ? &ch->prdt[entries - 1] : NULL;
+        uint32_t last_len = last ? (last->count ? last->count : PRD_MAX_BYTES) : 0;
+        if (last != NULL && last->addr + last_len == (uint32_t)phys &&
+            last_len + len <= PRD_MAX_BYTES &&
+            (last->addr & ~(PRD_MAX_BYTES - 1)) == (((uint32_t)phys + len - 1) & ~(PRD_MAX_BYTES - 1))) {
+            last->count = (uint16_t)(last_len + len);  // 64K stores as 0
+        } else {
+            if (entries == PRD_MAX_ENTRIES) {
+                return ATA_ERROR_INVALID;
+            }
+            ch->prdt[entries].addr = (uint32_t)phys;
+            ch->prdt[entries].count = (uint16_t)len;
+            ch->prdt[entries].flags = 0;
+            entries++;
+        }
+        virt += len;
+        bytes -= len;
+    }
+    ch->prdt[entries - 1].flags = PRD_EOT;
+    return ATA_SUCCESS;
+}
+
+static void ata_dma_stop(ata_channel_t* ch) {
+    outb(ch->bm + BM_REG_COMMAND, 0);
+    ch->dma_status = inb(ch->bm + BM_REG_STATUS);
+    ch->ata_status = inb(ch->base + ATA_REG_STATUS);
+    // Error and interrupt bits clear when written as 1
+    outb(ch->bm + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+    ch->dma_active = 0;
+}
+
+void ata_irq_handler(uint32_t channel) {
+    if (channel >= 2) {
+        return;
+    }
+    ata_channel_t* ch = &ata_channels[channel];
+    ata_stats.irqs++;
+
+    if (!ch->dma_active || ch->bm == 0 || !(inb(ch->bm + BM_REG_STATUS) & BM_STATUS_IRQ)) {
+        // Not ours, or a stray from a PIO command: reading the status
+        // register still deasserts the drive's INTRQ
+        inb(ch->base + ATA_REG_STATUS);
+        ata_stats.spurious_irqs++;
+        return;
+    }
+    ata_dma_stop(ch);
+    complete(&ch->dma_done);
+}
+
+// Sleep until the IRQ handler completes the transfer. With interrupts
+// disabled nothing would wake us, so the bus master status is polled
+// instead. Like wait_sleep(), but bounded: the timer IRQ ends each hlt.
+static int ata_dma_wait(ata_channel_t* ch) {
+    uint64_t start = timing_read_tsc();
+    uint64_t timeout = ata_timeout_ticks();
+
+    while (!try_wait_for_completion(&ch->dma_done)) {
+        if (timing_get_elapsed_ticks(start) > timeout) {
+            uint32_t flags = cpu_irq_save();
+            if (ch->dma_active) {
+                ata_dma_stop(ch);
+                cpu_irq_restore(flags);
+                return ATA_ERROR_TIMEOUT;
+            }
+            cpu_irq_restore(flags);
+            continue;   // Completed just now
+        }
+        if (task_run_one()) {
+            continue;
+        }
+
+        uint32_t flags = cpu_irq_save();
+        if (!(flags & CPU_EFLAGS_IF)) {
+            if (inb(ch->bm + BM_REG_STATUS) & BM_STATUS_IRQ) {
+                ata_dma_stop(ch);
+                complete(&ch->dma_done);
+            } else {
+                cpu_relax();
+            }
+        } else if (ch->dma_active && !task_pending()) {
+            __asm__ __volatile__("sti; hlt" : : : "memory");
+        }
+        cpu_irq_restore(flags);
+    }
+
+    if ((ch->dma_status & BM_STATUS_ERROR) || (ch->ata_status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+        return ATA_ERROR_IO;
+    }
+    return ATA_SUCCESS;
+}
+
+static int ata_dma_transfer(const ata_drive_t* drive, uint64_t lba, uint32_t count,
+                            uint8_t* buf, int write) {
+    ata_channel_t* ch = &ata_channels[drive->channel];
+    int result = ATA_SUCCESS;
+
+    if (((uint32_t)buf & 1) != 0) {
+        return ATA_ERROR_INVALID;
+    }
+
+    mutex_lock(&ch->lock);
+    outb(ch->control + ATA_REG_CONTROL, 0);   // Drive IRQ on
+    ata_select(ch, drive->slave);
+
+    while (count > 0 && result == ATA_SUCCESS) {
+        uint32_t chunk = count > ATA_MAX_SECTORS ? ATA_MAX_SECTORS : count;
+        uint8_t command;
+        if (write) {
+            command = drive->lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+        } else {
+            command = drive->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+        }
+
+        result = ata_build_prdt(ch, buf, chunk * ATA_SECTOR_SIZE);
+        if (result != ATA_SUCCESS) {
+            break;
+        }
+        result = ata_wait_not_busy(ch, NULL);
+        if (result != ATA_SUCCESS) {
+            break;
+        }
+
+        outb(ch->bm + BM_REG_COMMAND, 0);
+        outl(ch->bm + BM_REG_PRDT, (uint32_t)get_physical_addr((uint32_t)ch->prdt));
+        outb(ch->bm + BM_REG_STATUS, BM_STATUS_ERROR | BM_STATUS_IRQ);
+        outb(ch->bm + BM_REG_COMMAND, write ? 0 : BM_COMMAND_READ);
+
+        completion_reinit(&ch->dma_done);
+        ch->dma_active = 1;
+        ata_issue(ch, drive, lba, chunk, command);
+        outb(ch->bm + BM_REG_COMMAND, (write ? 0 : BM_COMMAND_READ) | BM_COMMAND_START);
+        ata_stats.dma_commands++;
+
+        result = ata_dma_wait(ch);
+        buf += chunk * ATA_SECTOR_SIZE;
+        lba += chunk;
+        count -= chunk;
+    }
+
+    if (result == ATA_SUCCESS && write) {
+        // The flush completes with an IRQ too; mask it and poll, it is rare
+        outb(ch->control + ATA_REG_CONTROL, ATA_CONTROL_NIEN);
+        outb(ch->base + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+        ata_delay_400ns(ch);
+        uint8_t status;
+        result = ata_wait_not_busy(ch, &status);
+        if (result == ATA_SUCCESS && (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+            result = ATA_ERROR_IO;
+        }
+    }
+
+    if (result != ATA_SUCCESS) {
+        ata_stats.errors++;
+    }
+    mutex_unlock(&ch->lock);
+    return result;
+}
+
+int ata_read_dma(uint32_t drive, uint64_t lba, uint32_t count, void* buf) {
+    const ata_drive_t* d = ata_lookup(drive, lba, count, buf);
+    if (d == NULL) {
+        return ata_lookup_error(drive);
+    }
+    if (!d->dma) {
+        return ATA_ERROR_INVALID;
+    }
+    return ata_dma_transfer(d, lba, count, (uint8_t*)buf, 0);
+}
+
+int ata_write_dma(uint32_t drive, uint64_t lba, uint32_t count, const void* buf) {
+    const ata_drive_t* d = ata_lookup(drive, lba, count, buf);
+    if (d == NULL) {
+        return ata_lookup_error(drive);
+    }
+    if (!d->dma) {
+        return ATA_ERROR_INVALID;
+    }
+    return ata_dma_transfer(d, lba, count, (uint8_t*)buf, 1);
+}
+
+int ata_read(uint32_t drive, uint64_t lba, uint32_t count, void* buf) {
+    if (drive < ATA_MAX_DRIVES && ata_drives[drive].dma && ((uint32_t)buf & 1) == 0) {
+        return ata_read_dma(drive, lba, count, buf);
+    }
+    return ata_read_pio(drive, lba, count, buf);
+}
+
+int ata_write(uint32_t drive, uint64_t lba, uint32_t count, const void* buf) {
+    if (drive < ATA_MAX_DRIVES && ata_drives[drive].dma && ((uint32_t)buf & 1) == 0) {
+        return ata_write_dma(drive, lba, count, buf);
+    }
+    return ata_write_pio(drive, lba, count, buf);
+}
+
+// ---- Probing ----
+
+// IDENTIFY DEVICE. ATAPI and SATA devices abort it and leave their
+// signature in the LBA registers; those are skipped.
+static int ata_identify(ata_channel_t* ch, uint8_t slave, uint16_t* id) {
+    ata_select(ch, slave);
+    outb(ch->base + ATA_REG_COUNT, 0);
+    outb(ch->base + ATA_REG_LBA0, 0);
+    outb(ch->base + ATA_REG_LBA1, 0);
+    outb(ch->base + ATA_REG_LBA2, 0);
+    outb(ch->base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay_400ns(ch);
+
+    uint8_t status = inb(ch->base + ATA_REG_STATUS);
+    if (status == 0 || status == 0xFF) {
+        return ATA_ERROR_NO_DEVICE;   // Nothing attached or floating bus
+    }
+    if (ata_wait_not_busy(ch, &status) != ATA_SUCCESS) {
+        return ATA_ERROR_TIMEOUT;
+    }
+    if (inb(ch->base + ATA_REG_LBA1) != 0 || inb(ch->base + ATA_REG_LBA2) != 0) {
+        return ATA_ERROR_NO_DEVICE;   // Not an ATA disk
+    }
+    if (ata_wait_drq(ch) != ATA_SUCCESS) {
+        return ATA_ERROR_IO;
+    }
+    insw(ch->base + ATA_REG_DATA, id, 256);
+    return ATA_SUCCESS;
+}
+
+static void ata_copy_model(char* model, const uint16_t* id) {
+    // Each word holds two characters, the first in the high byte
+    for (uint32_t i = 0; i < ATA_ID_MODEL_WORDS; i++) {
+        model[i * 2] = (char)(id[ATA_ID_MODEL + i] >> 8);
+        model[i * 2 + 1] = (char)id[ATA_ID_MODEL + i];
+    }
+    int end = ATA_ID_MODEL_WORDS * 2;
+    while (end > 0 && model[end - 1] == ' ') {
+        end--;
+    }
+    model[end] = '\0';
+}
+
+static void ata_probe_channel(uint32_t channel) {
+    ata_channel_t* ch = &ata_channels[channel];
+    uint16_t id[256];
+
+    // Masked until DMA needs the IRQ; soft reset puts both drives in a
+    // known state
+    outb(ch->control + ATA_REG_CONTROL, ATA_CONTROL_NIEN | ATA_CONTROL_SRST);
+    ata_delay_400ns(ch);
+    outb(ch->control + ATA_REG_CONTROL, ATA_CONTROL_NIEN);
+    timing_delay_milliseconds(2);
+    if (inb(ch->control + ATA_REG_CONTROL) == 0xFF) {
+        return;   // No channel
+    }
+
+    for (uint8_t slave = 0; slave < 2; slave++) {
+        if (ata_identify(ch, slave, id) != ATA_SUCCESS || !(id[ATA_ID_CAPABILITIES] & ATA_CAP_LBA)) {
+            continue;
+        }
+
+        ata_drive_t* drive = &ata_drives[channel * 2 + slave];
+        drive->channel = (uint8_t)channel;
+        drive->slave = slave;
+        drive->lba48 = (id[ATA_ID_COMMAND_SET2] & ATA_CMD2_LBA48) != 0;
+        drive->dma = ch->bm != 0 && (id[ATA_ID_CAPABILITIES] & ATA_CAP_DMA) != 0;
+        if (drive->lba48) {
+            drive->sectors = (uint64_t)id[ATA_ID_LBA48] | ((uint64_t)id[ATA_ID_LBA48 + 1] << 16) |
+                             ((uint64_t)id[ATA_ID_LBA48 + 2] << 32) |
+                             ((uint64_t)id[ATA_ID_LBA48 + 3] << 48);
+        } else {
+            drive->sectors = (uint64_t)id[ATA_ID_LBA28] | ((uint64_t)id[ATA_ID_LBA28 + 1] << 16);
+        }
+        ata_copy_model(drive->model, id);
+        ata_drive_total++;
+
+        kprintf("ATA: hd%c %s, %u MB, LBA%s, %s\n", 'a' + channel * 2 + slave, drive->model,
+                (uint32_t)(drive->sectors >> 11), drive->lba48 ? "48" : "28",
+                drive->dma ? "DMA" : "PIO only");
+    }
+}
+
+int ata_init(void) {
+    if (ata_initialized) {
+        return ATA_SUCCESS;
+    }
+
+    const pci_device_t* dev = pci_find_class(0x01, 0x01);
+    if (dev == NULL) {
+        kprintf("ATA: no IDE controller found\n");
+        return ATA_ERROR_NO_DEVICE;
+    }
+    if (dev->prog_if & IDE_PROG_IF_NATIVE) {
+        // Native mode routes both channels to the PCI IRQ line instead
+        // of IRQ14/15; only legacy mode is wired up here
+        kprintf("ATA: IDE controller %04x:%04x is in native mode, not supported\n",
+                dev->vendor, dev->device);
+        return ATA_ERROR_NO_DEVICE;
+    }
+
+    // BAR4 holds the bus master registers when the controller has them
+    uint32_t bm = (dev->prog_if & 0x80) ? pci_bar_address(dev, 4) : 0;
+    if (bm != 0 && bm < 0x10000) {
+        pci_enable(dev, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+        for (uint32_t i = 0; i < 2; i++) {
+            ata_channels[i].prdt = (ata_prd_t*)pmm_alloc_page();
+            if (ata_channels[i].prdt != NULL) {
+                ata_channels[i].bm = (uint16_t)(bm + i * BM_CHANNEL_STRIDE);
+            }
+        }
+    } else {
+        pci_enable(dev, PCI_COMMAND_IO);
+    }
+    kprintf("ATA: IDE controller %04x:%04x, bus master %s\n", dev->vendor, dev->device,
+            ata_channels[0].bm ? "enabled" : "unavailable");
+
+    for (uint32_t channel = 0; channel < 2; channel++) {
+        ata_probe_channel(channel);
+    }
+    ata_initialized = 1;
+
+    if (ata_drive_total == 0) {
+        kprintf("ATA: no disks attached\n");
+        return ATA_ERROR_NO_DEVICE;
+    }
+
+    // The slave PIC reaches the CPU through the IRQ2 cascade
+    irq_clear_mask(2);
+    irq_clear_mask(14);
+    irq_clear_mask(15);
+    return ATA_SUCCESS;
+}
+
+uint32_t ata_drive_count(void) {
+    return ata_drive_total;
+}
+
+const ata_drive_t* ata_get_drive(uint32_t drive) {
+    if (drive >= ATA_MAX_DRIVES || ata_drives[drive].sectors == 0) {
+        return NULL;
+    }
+    return &ata_drives[drive];
+}
+
+ata_stats_t ata_get_stats(void) {
+    return ata_stats;
+}
+
+void ata_print_stats(void) {
+    kprintf("ATA: %u PIO commands, %u DMA commands, %u IRQs (%u spurious), %u errors\n",
+            ata_stats.pio_commands, ata_stats.dma_commands, ata_stats.irqs,
+            ata_stats.spurious_irqs, ata_stats.errors);
+}
@@ -0,0 +1,244 @@
+#include "drivers/bga.h"
+#include "drivers/pci.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+// DISPI index/data ports
+#define VBE_DISPI_IOPORT_INDEX 0x01CE
+#define VBE_DISPI_IOPORT_DATA  0x01CF
+
+// DISPI registers
+#define VBE_DISPI_INDEX_ID          0x0
+#define VBE_DISPI_INDEX_XRES        0x1
+#define VBE_DISPI_INDEX_YRES        0x2
+#define VBE_DISPI_INDEX_BPP         0x3
+#define VBE_DISPI_INDEX_ENABLE      0x4
+#define VBE_DISPI_INDEX_BANK        0x5
+#define VBE_DISPI_INDEX_VIRT_WIDTH  0x6
+#define VBE_DISPI_INDEX_VIRT_HEIGHT 0x7
+#define VBE_DISPI_INDEX_X_OFFSET    0x8
+#define VBE_DISPI_INDEX_Y_OFFSET    0x9
+#define VBE_DISPI_INDEX_VIDEO_MEMORY_64K 0xA
+
+#define VBE_DISPI_ID0 0xB0C0  // Oldest interface version
+#define VBE_DISPI_ID5 0xB0C5
+
+// VBE_DISPI_INDEX_ENABLE bits
+#define VBE_DISPI_DISABLED    0x00
+#define VBE_DISPI_ENABLED     0x01
+#define VBE_DISPI_LFB_ENABLED 0x40
+#define VBE_DISPI_NOCLEARMEM  0x80  // Clearing would wipe the VGA font
+
+// Without a PCI device the LFB is at the Bochs default address
+#define BGA_DEFAULT_LFB 0xE0000000
+
+// Video memory kept for the VGA planes
+#define BGA_VGA_RESERVED 0x40000
+
+// VGA register ports
+#define VGA_SEQ_INDEX  0x3C4
+#define VGA_SEQ_DATA   0x3C5
+#define VGA_GC_INDEX   0x3CE
+#define VGA_GC_DATA    0x3CF
+#define VGA_CRTC_INDEX 0x3D4
+#define VGA_CRTC_DATA  0x3D5
+
+#define VGA_CRTC_V_SYNC_END 0x11
+#define VGA_CR11_LOCK_CR0_CR7 0x80
+
+// VGA registers the DISPI enable rewrites for graphics, restored when
+// going back to text mode
+static const uint8_t bga_seq_regs[] = { 0x01, 0x02, 0x04 };
+static const uint8_t bga_gc_regs[] = { 0x05, 0x06 };
+static const uint8_t bga_crtc_regs[] = { 0x01, 0x07, 0x09, 0x12, 0x13, 0x17, 0x18 };
+
+typedef struct {
+    uint8_t seq[sizeof(bga_seq_regs)];
+    uint8_t gc[sizeof(bga_gc_regs)];
+    uint8_t crtc[sizeof(bga_crtc_regs)];
+    uint8_t cr11;
+} bga_vga_state_t;
+
+static int bga_found = 0;
+static int bga_enabled = 0;
+static uint16_t bga_version = 0;
+static uint32_t bga_lfb = 0;
+static uint32_t bga_vram_size = 0;
+static uint32_t bga_pitch = 0;
+static uint32_t bga_height = 0;
+static uint32_t bga_pages = 0;
+static uint32_t bga_first_line = 0;  // Y offset of page 0
+static bga_vga_state_t bga_text_state;
+
+static void outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint8_t inb(uint16_t port) {
+    uint8_t value;
+    __asm__ __volatile__("inb %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static void outw(uint16_t port, uint16_t value) {
+    __asm__ __volatile__("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint16_t inw(uint16_t port) {
+    uint16_t value;
+    __asm__ __volatile__("inw %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static void bga_write(uint16_t index, uint16_t value) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    outw(VBE_DISPI_IOPORT_DATA, value);
+}
+
+static uint16_t bga_read(uint16_t index) {
+    outw(VBE_DISPI_IOPORT_INDEX, index);
+    return inw(VBE_DISPI_IOPORT_DATA);
+}
+
+static uint8_t vga_reg_read(uint16_t index_port, uint8_t index) {
+    outb(index_port, index);
+    return inb(index_port + 1);
+}
+
+static void vga_reg_write(uint16_t index_port, uint8_t index, uint8_t value) {
+    outb(index_port, index);
+    outb(index_port + 1, value);
+}
+
+static void bga_save_vga(bga_vga_state_t* state) {
+    for (uint32_t i = 0; i < sizeof(bga_seq_regs); i++) {
+        state->seq[i] = vga_reg_read(VGA_SEQ_INDEX, bga_seq_regs[i]);
+    }
+    for (uint32_t i = 0; i < sizeof(bga_gc_regs); i++) {
+        state->gc[i] = vga_reg_read(VGA_GC_INDEX, bga_gc_regs[i]);
+    }
+    for (uint32_t i = 0; i < sizeof(bga_crtc_regs); i++) {
+        state->crtc[i] = vga_reg_read(VGA_CRTC_INDEX, bga_crtc_regs[i]);
+    }
+    state->cr11 = vga_reg_read(VGA_CRTC_INDEX, VGA_CRTC_V_SYNC_END);
+}
+
+static void bga_restore_vga(const bga_vga_state_t* state) {
+    for (uint32_t i = 0; i < sizeof(bga_seq_regs); i++) {
+        vga_reg_write(VGA_SEQ_INDEX, bga_seq_regs[i], state->seq[i]);
+    }
+    for (uint32_t i = 0; i < sizeof(bga_gc_regs); i++) {
+        vga_reg_write(VGA_GC_INDEX, bga_gc_regs[i], state->gc[i]);
+    }
+
+    // CRTC registers 0-7 are write-protected in text mode
+    vga_reg_write(VGA_CRTC_INDEX, VGA_CRTC_V_SYNC_END, state->cr11 & ~VGA_CR11_LOCK_CR0_CR7);
+    for (uint32_t i = 0; i < sizeof(bga_crtc_regs); i++) {
+        vga_reg_write(VGA_CRTC_INDEX, bga_crtc_regs[i], state->crtc[i]);
+    }
+    vga_reg_write(VGA_CRTC_INDEX, VGA_CRTC_V_SYNC_END, state->cr11);
+}
+
+// Look for the adapter: the DISPI ID register answers with 0xB0Cx
+int bga_init(void) {
+    uint16_t id = bga_read(VBE_DISPI_INDEX_ID);
+    if (id < VBE_DISPI_ID0 || id > VBE_DISPI_ID5) {
+        bga_found = 0;
+        return -1;
+    }
+    bga_version = id;
+
+    const pci_device_t* dev = pci_find_device(BGA_PCI_VENDOR, BGA_PCI_DEVICE);
+    bga_lfb = dev ? pci_bar_address(dev, 0) : 0;
+    if (bga_lfb == 0) {
+        bga_lfb = BGA_DEFAULT_LFB;
+    }
+
+    bga_vram_size = (uint32_t)bga_read(VBE_DISPI_INDEX_VIDEO_MEMORY_64K) << 16;
+    bga_found = 1;
+
+    kprintf("BGA: DISPI version 0x%04x, LFB at 0x%08x, %u KB video memory\n",
+            bga_version, bga_lfb, bga_vram_size >> 10);
+    return 0;
+}
+
+int bga_present(void) {
+    return bga_found;
+}
+
+// Switch to a linear framebuffer mode with 'pages' screens for flipping.
+// Page 0 is displayed afterwards; its contents are not cleared.
+int bga_set_mode(uint32_t width, uint32_t height, uint32_t bpp, uint32_t pages) {
+    if (!bga_found || pages == 0 || pages > BGA_MAX_PAGES) {
+        return -1;
+    }
+
+    uint32_t pitch = width * ((bpp + 7) / 8);
+    uint32_t first_line = (BGA_VGA_RESERVED + pitch - 1) / pitch;
+    uint32_t virt_height = first_line + height * pages;
+    if (bga_vram_size != 0 && virt_height * pitch > bga_vram_size) {
+        return -1;
+    }
+
+    if (!bga_enabled) {
+        bga_save_vga(&bga_text_state);
+    }
+
+    bga_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    bga_write(VBE_DISPI_INDEX_XRES, width);
+    bga_write(VBE_DISPI_INDEX_YRES, height);
+    bga_write(VBE_DISPI_INDEX_BPP, bpp);
+    bga_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_ENABLED | VBE_DISPI_LFB_ENABLED | VBE_DISPI_NOCLEARMEM);
+    // Enabling resets the virtual size; the height follows from video memory
+    bga_write(VBE_DISPI_INDEX_VIRT_WIDTH, width);
+
+    // The adapter rejects modes it cannot do; check what it accepted
+    if (bga_read(VBE_DISPI_INDEX_XRES) != width || bga_read(VBE_DISPI_INDEX_YRES) != height ||
+        bga_read(VBE_DISPI_INDEX_BPP) != bpp ||
+        bga_read(VBE_DISPI_INDEX_VIRT_HEIGHT) < virt_height) {
+        bga_enabled = 1;
+        bga_disable();
+        return -1;
+    }
+
+    bga_pitch = pitch;
+    bga_height = height;
+    bga_pages = pages;
+    bga_first_line = first_line;
+    bga_enabled = 1;
+    bga_flip(0);
+    return 0;
+}
+
+// Leave graphics mode and put the VGA back into the text mode it was in
+void bga_disable(void) {
+    if (!bga_enabled) {
+        return;
+    }
+    bga_write(VBE_DISPI_INDEX_ENABLE, VBE_DISPI_DISABLED);
+    bga_restore_vga(&bga_text_state);
+    bga_enabled = 0;
+}
+
+uint32_t bga_get_pitch(void) {
+    return bga_pitch;
+}
+
+uint32_t bga_page_address(uint32_t page) {
+    return bga_lfb + (bga_first_line + page * bga_height) * bga_pitch;
+}
+
+// Bytes from the start of page 0 to the end of the last page
+uint32_t bga_pages_size(void) {
+    return bga_pages * bga_height * bga_pitch;
+}
+
+// Display 'page'; takes effect at the adapter's next refresh
+int bga_flip(uint32_t page) {
+    if (!bga_enabled || page >= bga_pages) {
+        return -1;
+    }
+    bga_write(VBE_DISPI_INDEX_X_OFFSET, 0);
+    bga_write(VBE_DISPI_INDEX_Y_OFFSET, bga_first_line + page * bga_height);
+    return 0;
+}
@@ -0,0 +1,185 @@
+#include "drivers/fb.h"
+#include "memory/pmm.h"
+#include "lib/blit.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+typedef struct {
+    blit_surface_t lfb;     // Pitch from the VBE mode info
+    blit_surface_t back_blit;
+    fb_surface_t back;
+    uint32_t back_pages;
+    fb_rect_t dirty[FB_MAX_DIRTY];
+    uint32_t ndirty;
+    fb_stats_t stats;
+    int active;
+} fb_t;
+
+static fb_t fb;
+
+// Clip a rectangle to the screen. Returns 0 if nothing is left.
+static int fb_clip(fb_rect_t* r) {
+    if (r->x >= fb.back.width || r->y >= fb.back.height || r->w == 0 || r->h == 0) {
+        return 0;
+    }
+    if (r->w > fb.back.width - r->x) {
+        r->w = fb.back.width - r->x;
+    }
+    if (r->h > fb.back.height - r->y) {
+        r->h = fb.back.height - r->y;
+    }
+    return 1;
+}
+
+static int fb_rects_touch(const fb_rect_t* a, const fb_rect_t* b) {
+    return a->x <= b->x + b->w && b->x <= a->x + a->w &&
+           a->y <= b->y + b->h && b->y <= a->y + a->h;
+}
+
+static void fb_rect_union(fb_rect_t* a, const fb_rect_t* b) {
+    uint32_t x1 = a->x + a->w > b->x + b->w ? a->x + a->w : b->x + b->w;
+    uint32_t y1 = a->y + a->h > b->y + b->h ? a->y + a->h : b->y + b->h;
+    a->x = a->x < b->x ? a->x : b->x;
+    a->y = a->y < b->y ? a->y : b->y;
+    a->w = x1 - a->x;
+    a->h = y1 - a->y;
+}
+
+// Record a changed area. Overlapping or adjacent rectangles are merged so
+// no pixel is copied twice by fb_present().
+void fb_mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h) {
+    fb_rect_t r = { x, y, w, h };
+
+    if (!fb.active || !fb_clip(&r)) {
+        return;
+    }
+
+    // Absorb every rectangle the new one touches; the union may then touch
+    // others, so rescan until nothing changes
+    int merged;
+    do {
+        merged = 0;
+        for (uint32_t i = 0; i < fb.ndirty; i++) {
+            if (fb_rects_touch(&fb.dirty[i], &r)) {
+                fb_rect_union(&r, &fb.dirty[i]);
+                fb.dirty[i] = fb.dirty[--fb.ndirty];
+                merged = 1;
+                break;
+            }
+        }
+    } while (merged);
+
+    if (fb.ndirty == FB_MAX_DIRTY) {
+        // Out of slots: collapse everything into one bounding box
+        for (uint32_t i = 0; i < fb.ndirty; i++) {
+            fb_rect_union(&r, &fb.dirty[i]);
+        }
+        fb.ndirty = 0;
+    }
+    fb.dirty[fb.ndirty++] = r;
+}
+
+void fb_fill_rect(uint32_t x, uint32_t y, uint32_t w, uint32_t h, uint32_t color) {
+    fb_rect_t r = { x, y, w, h };
+
+    if (!fb.active || !fb_clip(&r)) {
+        return;
+    }
+    blit_fill(&fb.back_blit, r.x, r.y, r.w, r.h, color);
+    fb_mark_dirty(r.x, r.y, r.w, r.h);
+}
+
+// Copy a w x h block of pixels from 'src' ('src_stride' pixels per line)
+void fb_blit(uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint32_t* src, uint32_t src_stride) {
+    fb_rect_t r = { x, y, w, h };
+
+    if (!fb.active || !fb_clip(&r)) {
+        return;
+    }
+    blit_surface_t from = { (void*)src, r.w, r.h, src_stride * 4, 32, 0 };
+    blit_copy(&fb.back_blit, r.x, r.y, &from, 0, 0, r.w, r.h);
+    fb_mark_dirty(r.x, r.y, r.w, r.h);
+}
+
+// Move the whole picture up by 'lines' scanlines and fill the gap. The
+// copy stays in RAM; the LFB is never read.
+void fb_scroll_up(uint32_t lines, uint32_t fill) {
+    if (!fb.active) {
+        return;
+    }
+    if (lines > fb.back.height) {
+        lines = fb.back.height;
+    }
+    uint32_t keep = fb.back.height - lines;
+    blit_copy(&fb.back_blit, 0, 0, &fb.back_blit, 0, lines, fb.back.width, keep);
+    blit_fill(&fb.back_blit, 0, keep, fb.back.width, lines, fill);
+    fb_mark_dirty(0, 0, fb.back.width, fb.back.height);
+}
+
+// Copy the dirty rectangles to the LFB. The LFB surface is marked as
+// device memory, so the blitter writes it with streaming stores.
+void fb_present(void) {
+    if (!fb.active || fb.ndirty == 0) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < fb.ndirty; i++) {
+        const fb_rect_t* r = &fb.dirty[i];
+        blit_copy(&fb.lfb, r->x, r->y, &fb.back_blit, r->x, r->y, r->w, r->h);
+        fb.stats.bytes += r->w * r->h * 4;
+    }
+
+    fb.stats.rects += fb.ndirty;
+    fb.stats.presents++;
+    fb.ndirty = 0;
+}
+
+// Set up a back buffer for a 32 bpp LFB (already mapped by the caller).
+// 'pitch' is the LFB's bytes per scanline, which may exceed width * 4.
+int fb_init(uint32_t lfb, uint32_t width, uint32_t height, uint32_t pitch, uint32_t bpp) {
+    if (bpp != 32 || lfb == 0 || width == 0 || height == 0 || pitch < width * 4) {
+        return -1;
+    }
+
+    fb_shutdown();
+
+    fb.back_pages = (width * height * 4 + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+    fb.back.pixels = (uint32_t*)pmm_alloc_pages(fb.back_pages);
+    if (fb.back.pixels == NULL) {
+        return -1;
+    }
+    fb.back.width = width;
+    fb.back.height = height;
+    fb.back.stride = width;
+    fb.back_blit = (blit_surface_t){ fb.back.pixels, width, height, width * 4, 32, 0 };
+    fb.lfb = (blit_surface_t){ (void*)lfb, width, height, pitch, 32, BLIT_SURFACE_DEVICE };
+    fb.ndirty = 0;
+    fb.active = 1;
+
+    fb_fill_rect(0, 0, width, height, 0);
+    fb_present();
+    return 0;
+}
+
+void fb_shutdown(void) {
+    if (!fb.active) {
+        return;
+    }
+    fb.active = 0;
+    fb.ndirty = 0;
+    pmm_free_pages(fb.back.pixels, fb.back_pages);
+    fb.back.pixels = NULL;
+}
+
+int fb_active(void) {
+    return fb.active;
+}
+
+const fb_surface_t* fb_surface(void) {
+    return &fb.back;
+}
+
+fb_stats_t fb_get_stats(void) {
+    return fb.stats;
+}
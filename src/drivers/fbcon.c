@@ -0,0 +1,228 @@
+#include "drivers/fbcon.h"
+#include "drivers/font.h"
+#include "drivers/fb.h"
+#include "memory/pmm.h"
+#include "lib/string.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Atlas slot drawn for characters the font does not cover
+#define FBCON_GLYPHS        (FONT_COUNT + 1)
+#define FBCON_FALLBACK      FONT_COUNT
+#define FBCON_GLYPH_PIXELS  (FBCON_CELL_WIDTH * FBCON_CELL_HEIGHT)
+
+typedef struct {
+    const fb_surface_t* fb;  // Back buffer; fb_present() shows it
+    uint32_t cols;
+    uint32_t rows;
+    uint32_t x;             // Cursor cell
+    uint32_t y;
+    uint32_t* atlas;        // FBCON_GLYPHS pre-expanded 8x16 glyphs
+    uint8_t* cells;         // cols * rows characters
+    uint16_t* dirty_lo;     // Per line: first dirty column
+    uint16_t* dirty_hi;     // Per line: one past the last dirty column
+    uint32_t atlas_pages;
+    uint32_t text_pages;
+    int active;
+} fbcon_t;
+
+static fbcon_t fbcon;
+
+static uint32_t fbcon_pages(uint32_t bytes) {
+    return (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+}
+
+// Expand every font glyph to 32 bpp once, doubling each row
+static void fbcon_build_atlas(void) {
+    for (uint32_t g = 0; g < FBCON_GLYPHS; g++) {
+        uint32_t* dst = fbcon.atlas + g * FBCON_GLYPH_PIXELS;
+        for (uint32_t y = 0; y < FBCON_CELL_HEIGHT; y++) {
+            uint8_t bits;
+            if (g == FBCON_FALLBACK) {
+                // Hollow box
+                uint32_t fy = y / 2;
+                bits = (fy == 0 || fy == FONT_HEIGHT - 1) ? 0x7E : 0x42;
+            } else {
+                bits = font8x8[g][y / 2];
+            }
+            for (uint32_t x = 0; x < FBCON_CELL_WIDTH; x++) {
+                *dst++ = (bits & (1 << x)) ? FBCON_FG : FBCON_BG;
+            }
+        }
+    }
+}
+
+static const uint32_t* fbcon_glyph(uint8_t c) {
+    uint32_t index = FBCON_FALLBACK;
+    if (c >= FONT_FIRST && c < FONT_FIRST + FONT_COUNT) {
+        index = c - FONT_FIRST;
+    }
+    return fbcon.atlas + index * FBCON_GLYPH_PIXELS;
+}
+
+static void fbcon_draw_cell(uint32_t col, uint32_t row) {
+    const uint32_t* src = fbcon_glyph(fbcon.cells[row * fbcon.cols + col]);
+    uint32_t* dst = fbcon.fb->pixels + row * FBCON_CELL_HEIGHT * fbcon.fb->stride +
+                    col * FBCON_CELL_WIDTH;
+
+    for (uint32_t y = 0; y < FBCON_CELL_HEIGHT; y++) {
+        memcpy(dst, src, FBCON_CELL_WIDTH * sizeof(uint32_t));
+        src += FBCON_CELL_WIDTH;
+        dst += fbcon.fb->stride;
+    }
+}
+
+static void fbcon_mark_dirty(uint32_t row, uint32_t lo, uint32_t hi) {
+    if (lo < fbcon.dirty_lo[row]) {
+        fbcon.dirty_lo[row] = lo;
+    }
+    if (hi > fbcon.dirty_hi[row]) {
+        fbcon.dirty_hi[row] = hi;
+    }
+}
+
+// Draw the dirty span of every line into the back buffer and mark
+// everything clean
+static void fbcon_flush(void) {
+    for (uint32_t row = 0; row < fbcon.rows; row++) {
+        uint32_t lo = fbcon.dirty_lo[row];
+        uint32_t hi = fbcon.dirty_hi[row];
+        if (lo >= hi) {
+            continue;
+        }
+        for (uint32_t col = lo; col < hi; col++) {
+            fbcon_draw_cell(col, row);
+        }
+        fb_mark_dirty(lo * FBCON_CELL_WIDTH, row * FBCON_CELL_HEIGHT,
+                      (hi - lo) * FBCON_CELL_WIDTH, FBCON_CELL_HEIGHT);
+        fbcon.dirty_lo[row] = fbcon.cols;
+        fbcon.dirty_hi[row] = 0;
+    }
+}
+
+static void fbcon_clear_line(uint32_t row) {
+    memset(fbcon.cells + row * fbcon.cols, ' ', fbcon.cols);
+    fbcon_mark_dirty(row, 0, fbcon.cols);
+}
+
+// Scroll up one text line: one block copy of the back buffer and of the
+// cell grid, then only the new bottom line needs drawing
+static void fbcon_scroll(void) {
+    fbcon_flush();
+    fb_scroll_up(FBCON_CELL_HEIGHT, FBCON_BG);
+
+    memmove(fbcon.cells, fbcon.cells + fbcon.cols, (fbcon.rows - 1) * fbcon.cols);
+    fbcon_clear_line(fbcon.rows - 1);
+}
+
+// Callers serialize (kprintf holds the console lock)
+void fbcon_write(const char* s, uint32_t len) {
+    if (!fbcon.active) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < len; i++) {
+        char c = s[i];
+
+        if (c == '\n') {
+            fbcon.x = 0;
+            fbcon.y++;
+        } else if (c == '\b') {
+            if (fbcon.x > 0) {
+                fbcon.x--;
+            } else if (fbcon.y > 0) {
+                fbcon.y--;
+                fbcon.x = fbcon.cols - 1;
+            }
+            fbcon.cells[fbcon.y * fbcon.cols + fbcon.x] = ' ';
+            fbcon_mark_dirty(fbcon.y, fbcon.x, fbcon.x + 1);
+        } else {
+            fbcon.cells[fbcon.y * fbcon.cols + fbcon.x] = c;
+            fbcon_mark_dirty(fbcon.y, fbcon.x, fbcon.x + 1);
+            if (++fbcon.x >= fbcon.cols) {
+                fbcon.x = 0;
+                fbcon.y++;
+            }
+        }
+
+        if (fbcon.y >= fbcon.rows) {
+            fbcon_scroll();
+            fbcon.y = fbcon.rows - 1;
+        }
+    }
+
+    fbcon_flush();
+    fb_present();
+}
+
+void fbcon_clear(void) {
+    if (!fbcon.active) {
+        return;
+    }
+    for (uint32_t row = 0; row < fbcon.rows; row++) {
+        fbcon_clear_line(row);
+    }
+    fbcon.x = 0;
+    fbcon.y = 0;
+    fbcon_flush();
+    fb_present();
+}
+
+// Take over the screen; fb_init() must have succeeded
+int fbcon_init(void) {
+    if (!fb_active()) {
+        return -1;
+    }
+
+    fbcon_shutdown();
+
+    fbcon.fb = fb_surface();
+    fbcon.cols = fbcon.fb->width / FBCON_CELL_WIDTH;
+    fbcon.rows = fbcon.fb->height / FBCON_CELL_HEIGHT;
+
+    fbcon.atlas_pages = fbcon_pages(FBCON_GLYPHS * FBCON_GLYPH_PIXELS * sizeof(uint32_t));
+    fbcon.text_pages = fbcon_pages(fbcon.cols * fbcon.rows + fbcon.rows * 2 * sizeof(uint16_t));
+    fbcon.atlas = (uint32_t*)pmm_alloc_pages(fbcon.atlas_pages);
+    uint8_t* text = (uint8_t*)pmm_alloc_pages(fbcon.text_pages);
+    if (fbcon.atlas == NULL || text == NULL) {
+        if (fbcon.atlas) {
+            pmm_free_pages(fbcon.atlas, fbcon.atlas_pages);
+        }
+        if (text) {
+            pmm_free_pages(text, fbcon.text_pages);
+        }
+        fbcon.atlas = NULL;
+        return -1;
+    }
+
+    fbcon.dirty_lo = (uint16_t*)text;
+    fbcon.dirty_hi = fbcon.dirty_lo + fbcon.rows;
+    fbcon.cells = (uint8_t*)(fbcon.dirty_hi + fbcon.rows);
+    for (uint32_t row = 0; row < fbcon.rows; row++) {
+        fbcon.dirty_lo[row] = fbcon.cols;
+        fbcon.dirty_hi[row] = 0;
+    }
+
+    fbcon_build_atlas();
+    fbcon.active = 1;
+    fbcon_clear();
+    return 0;
+}
+
+// Release the console when leaving graphics mode
+void fbcon_shutdown(void) {
+    if (!fbcon.active) {
+        return;
+    }
+    fbcon.active = 0;
+    pmm_free_pages(fbcon.atlas, fbcon.atlas_pages);
+    pmm_free_pages(fbcon.dirty_lo, fbcon.text_pages);
+    fbcon.atlas = NULL;
+}
+
+int fbcon_active(void) {
+    return fbcon.active;
+}
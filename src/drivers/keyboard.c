@@ -1,6 +1,18 @@
 #include "drivers/keyboard.h"
 #include "drivers/vga.h"
 #include "lib/kprintf.h"
+#include "lib/klog.h"
+#include "lib/timing.h"
+#include "kernel/task.h"
+#include "kernel/wait.h"
+#include "kernel/profile.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Lines moved per Shift+PageUp/PageDown in the console scrollback
+#define KBD_SCROLL_LINES 12
 
 // Scancode to ASCII conversion table (US QWERTY layout)
 static char scancode_to_ascii[] = {
@@ -29,18 +41,87 @@ static int caps_lock = 0;
 static int alt_pressed = 0;
 static int vesa_mode_active = 0;  // Track current mode
 
+// Raw scancode as captured by IRQ1
+typedef struct {
+    uint64_t timestamp;
+    uint8_t scancode;
+} kbd_raw_t;
+
+// Lock-free single-producer/single-consumer ring. IRQ1 is the only writer
+// of kbd_head and the consumer the only writer of kbd_tail, so each side
+// only needs acquire/release ordering on the other side's index.
+static kbd_raw_t kbd_ring[KBD_RING_SIZE];
+static volatile uint32_t kbd_head = 0;
+static volatile uint32_t kbd_tail = 0;
+static volatile uint32_t kbd_dropped = 0;
+
+// Blocking readers sleep here until IRQ1 queues a scancode
+static wait_queue_t kbd_wait = WAIT_QUEUE_INIT("kbd_wait");
+
+// Console echo runs as a deferred task; set while one is queued
+static volatile uint32_t kbd_echo_queued = 0;
+static int kbd_console_echo = 1;
+
+static void keyboard_echo_task(void* arg);
+
 void keyboard_init(void) {
     // Initialize keyboard state
     shift_pressed = 0;
     caps_lock = 0;
     alt_pressed = 0;
     vesa_mode_active = 0;
+    kbd_head = 0;
+    kbd_tail = 0;
+    kbd_dropped = 0;
+    kbd_echo_queued = 0;
+    kbd_console_echo = 1;
 }
 
+// IRQ1 handler: timestamp the scancode and queue it. Translation and echo
+// happen later, outside interrupt context.
 void keyboard_handler(uint8_t scancode) {
+    uint32_t head = kbd_head;
+    uint32_t tail = __atomic_load_n(&kbd_tail, __ATOMIC_ACQUIRE);
+    
+    if (head - tail >= KBD_RING_SIZE) {
+        kbd_dropped++;
+    } else {
+        kbd_ring[head & (KBD_RING_SIZE - 1)].timestamp = timing_read_tsc();
+        kbd_ring[head & (KBD_RING_SIZE - 1)].scancode = scancode;
+        __atomic_store_n(&kbd_head, head + 1, __ATOMIC_RELEASE);
+        wake_up_all(&kbd_wait);
+    }
+    
+    if (kbd_console_echo && !__atomic_exchange_n(&kbd_echo_queued, 1, __ATOMIC_ACQ_REL)) {
+        task_spawn(keyboard_echo_task, NULL);
+    }
+}
+
+static int kbd_ring_pop(kbd_raw_t* raw) {
+    uint32_t tail = kbd_tail;
+    if (tail == __atomic_load_n(&kbd_head, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    *raw = kbd_ring[tail & (KBD_RING_SIZE - 1)];
+    __atomic_store_n(&kbd_tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+static int kbd_ring_empty(void) {
+    return kbd_tail == __atomic_load_n(&kbd_head, __ATOMIC_ACQUIRE);
+}
+
+// Update modifier state and translate one raw scancode
+static void kbd_translate(const kbd_raw_t* raw, kbd_event_t* event) {
+    uint8_t scancode = raw->scancode;
+    
+    event->timestamp = raw->timestamp;
+    event->ascii = 0;
+    
     // Handle key releases (scancode with bit 7 set)
     if (scancode & 0x80) {
         scancode &= 0x7F;  // Remove release bit
+        event->pressed = 0;
         
         // Handle modifier key releases
         if (scancode == 0x2A || scancode == 0x36) {  // Left or right shift
@@ -49,74 +130,151 @@ void keyboard_handler(uint8_t scancode) {
             alt_pressed = 0;
         }
     } else {
-        // Handle key presses
+        event->pressed = 1;
         
         // Handle modifier keys
         if (scancode == 0x2A || scancode == 0x36) {  // Left or right shift
             shift_pressed = 1;
         } else if (scancode == 0x38) {  // Left Alt
             alt_pressed = 1;
-        } else if (scancode == 0x01) {  // Escape key
-            // Remove old Shift+Escape handling since we're using Alt+G now
-            // Just process escape normally
-            if (!alt_pressed) {
-                kputchar(27);  // ESC character
-            }
         } else if (scancode == 0x3A) {  // Caps lock
             caps_lock = !caps_lock;
         } else if (scancode < sizeof(scancode_to_ascii)) {
-            // Check for Alt+G combination
-            if (alt_pressed && (scancode == 0x22)) {  // 0x22 is scancode for 'G'
-                // Toggle between VESA mode and text mode
-                if (vesa_mode_active) {
-                    // Switch back to text mode
-                    vga_set_text_mode_80x25();
-                    vesa_mode_active = 0;
-                    kprintf("\n[DEBUG] Switched back to text mode via Alt+G\n");
-                } else {
-                    // Switch to VESA mode
-                    kprintf("\nSwitching to VESA mode via Alt+G...\n");
-                    if (vga_set_vesa_mode_1024x768() == 0) {
-                        vesa_mode_active = 1;
-                        // Mode set successfully, blue screen is drawn automatically
-                        // We're now in graphics mode - no more text output will be visible
-                    } else {
-                        kprintf("VESA mode failed.\n");
-                    }
-                }
-                return;  // Don't process the 'G' as a regular character
-            }
-            
-            // Convert scancode to ASCII (only if Alt is not pressed)
-            if (!alt_pressed) {
-                char ascii = 0;
-                
-                if (shift_pressed) {
-                    ascii = scancode_to_ascii_shift[scancode];
-                } else {
-                    ascii = scancode_to_ascii[scancode];
-                    
-                    // Apply caps lock for letters
-                    if (caps_lock && ascii >= 'a' && ascii <= 'z') {
-                        ascii = ascii - 'a' + 'A';
-                    }
-                }
+            if (shift_pressed) {
+                event->ascii = scancode_to_ascii_shift[scancode];
+            } else {
+                event->ascii = scancode_to_ascii[scancode];
                 
-                // Print the character if it's printable
-                if (ascii != 0) {
-                    if (ascii == '\n') {
-                        kprintf("\n");
-                    } else if (ascii == '\b') {
-                        // Send backspace character directly to kputchar for proper handling
-                        kputchar('\b');
-                    } else if (ascii == '\t') {
-                        kprintf("    ");  // 4 spaces for tab
-                    } else {
-                        // Remove special handling for 'g' since we now use Alt+G
-                        kputchar(ascii);
-                    }
+                // Apply caps lock for letters
+                if (caps_lock && event->ascii >= 'a' && event->ascii <= 'z') {
+                    event->ascii = event->ascii - 'a' + 'A';
                 }
             }
         }
     }
+    
+    event->scancode = scancode;
+    event->modifiers = (shift_pressed ? KBD_MOD_SHIFT : 0) |
+                       (alt_pressed ? KBD_MOD_ALT : 0) |
+                       (caps_lock ? KBD_MOD_CAPS : 0);
+}
+
+// Read the next key event. With KBD_BLOCK the caller sleeps on kbd_wait
+// until IRQ1 delivers a scancode; otherwise returns -1 when empty.
+int kbd_read_event(kbd_event_t* event, int flags) {
+    kbd_raw_t raw;
+    
+    while (!kbd_ring_pop(&raw)) {
+        if (!(flags & KBD_BLOCK)) {
+            return -1;
+        }
+        wait_event(&kbd_wait, !kbd_ring_empty());
+    }
+    
+    kbd_translate(&raw, event);
+    return 0;
+}
+
+// Number of scancodes lost because the ring was full
+uint32_t kbd_dropped_scancodes(void) {
+    return kbd_dropped;
+}
+
+// The built-in console echo is the ring's consumer by default. Disable it
+// before reading events elsewhere, since the ring has a single consumer.
+void keyboard_set_console_echo(int enable) {
+    kbd_console_echo = enable;
+}
+
+// Toggle between VESA mode and text mode (Alt+G)
+static void keyboard_toggle_video_mode(void) {
+    if (vesa_mode_active) {
+        // Switch back to text mode
+        vga_set_text_mode_80x25();
+        vesa_mode_active = 0;
+        kprintf("\n[DEBUG] Switched back to text mode via Alt+G\n");
+    } else {
+        // Switch to VESA mode
+        kprintf("\nSwitching to VESA mode via Alt+G...\n");
+        if (vga_set_vesa_mode_1024x768() == 0) {
+            vesa_mode_active = 1;
+            // The framebuffer console shows kernel output from here on
+        } else {
+            kprintf("VESA mode failed.\n");
+        }
+    }
+}
+
+// Start the sampling profiler, or stop it and print the results (Alt+P)
+static void keyboard_toggle_profiler(void) {
+    if (!profile_is_running()) {
+        profile_start(PROFILE_DEFAULT_HZ, PROFILE_CALLCHAIN);
+        return;
+    }
+    profile_stop();
+    profile_dump_flat(20);
+    profile_dump_folded();
+}
+
+// Echo one translated key press to the console
+static void keyboard_echo_event(const kbd_event_t* event) {
+    if (!event->pressed) {
+        return;
+    }
+    
+    if (event->scancode == 0x01) {  // Escape key
+        if (!(event->modifiers & KBD_MOD_ALT)) {
+            kputchar(27);  // ESC character
+        }
+        return;
+    }
+    
+    // Check for Alt+G combination
+    if ((event->modifiers & KBD_MOD_ALT) && event->scancode == 0x22) {  // 0x22 is scancode for 'G'
+        keyboard_toggle_video_mode();
+        return;  // Don't process the 'G' as a regular character
+    }
+
+    // Shift+PageUp/PageDown page through the console scrollback
+    if ((event->modifiers & KBD_MOD_SHIFT) && (event->scancode == 0x49 || event->scancode == 0x51)) {
+        kprintf_scroll_view(event->scancode == 0x49 ? KBD_SCROLL_LINES : -KBD_SCROLL_LINES);
+        return;
+    }
+
+    if ((event->modifiers & KBD_MOD_ALT) && event->scancode == 0x19) {  // 0x19 is scancode for 'P'
+        keyboard_toggle_profiler();
+        return;
+    }
+
+    if ((event->modifiers & KBD_MOD_ALT) && event->scancode == 0x20) {  // 0x20 is scancode for 'D'
+        klog_dmesg();
+        return;
+    }
+    
+    // Print the character if it's printable (only if Alt is not pressed)
+    if (event->ascii != 0 && !(event->modifiers & KBD_MOD_ALT)) {
+        if (event->ascii == '\n') {
+            kprintf("\n");
+        } else if (event->ascii == '\b') {
+            // Send backspace character directly to kputchar for proper handling
+            kputchar('\b');
+        } else if (event->ascii == '\t') {
+            kprintf("    ");  // 4 spaces for tab
+        } else {
+            kputchar(event->ascii);
+        }
+    }
+}
+
+// Deferred console echo: drain the ring outside interrupt context
+static void keyboard_echo_task(void* arg) {
+    (void)arg;
+    kbd_event_t event;
+    
+    // Clear the flag first: a scancode arriving after this point queues a
+    // new task, so nothing is left behind in the ring
+    __atomic_store_n(&kbd_echo_queued, 0, __ATOMIC_RELEASE);
+    while (kbd_console_echo && kbd_read_event(&event, KBD_NONBLOCK) == 0) {
+        keyboard_echo_event(&event);
+    }
 }
@@ -0,0 +1,169 @@
+#include "drivers/pci.h"
+#include "lib/kprintf.h"
+#include "kernel/spinlock.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA    0xCFC
+
+#define PCI_BAR_IO       0x01
+#define PCI_BAR_IO_MASK  0xFFFFFFFC
+#define PCI_BAR_MEM_MASK 0xFFFFFFF0
+
+static pci_device_t pci_devices[PCI_MAX_DEVICES];
+static uint32_t pci_count = 0;
+
+// The address/data port pair is shared state
+static spinlock_t pci_lock = SPINLOCK_INIT("pci");
+
+static void outl(uint16_t port, uint32_t value) {
+    __asm__ __volatile__("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint32_t inl(uint16_t port) {
+    uint32_t value;
+    __asm__ __volatile__("inl %1, %0" : "=a"(value) : "Nd"(port));
+    return value;
+}
+
+static uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    return 0x80000000 | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) |
+           ((uint32_t)func << 8) | (offset & 0xFC);
+}
+
+static uint32_t pci_config_read(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset) {
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&pci_lock, flags);
+    return value;
+}
+
+static void pci_config_write(uint8_t bus, uint8_t slot, uint8_t func, uint8_t offset, uint32_t value) {
+    uint32_t flags = spin_lock_irqsave(&pci_lock);
+    outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, func, offset));
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&pci_lock, flags);
+}
+
+uint32_t pci_read32(const pci_device_t* dev, uint8_t offset) {
+    return pci_config_read(dev->bus, dev->slot, dev->func, offset);
+}
+
+uint16_t pci_read16(const pci_device_t* dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+void pci_write32(const pci_device_t* dev, uint8_t offset, uint32_t value) {
+    pci_config_write(dev->bus, dev->slot, dev->func, offset, value);
+}
+
+void pci_write16(const pci_device_t* dev, uint8_t offset, uint16_t value) {
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t old = pci_read32(dev, offset);
+    pci_write32(dev, offset, (old & ~(0xFFFF << shift)) | ((uint32_t)value << shift));
+}
+
+static void pci_add_function(uint8_t bus, uint8_t slot, uint8_t func, uint32_t id) {
+    if (pci_count == PCI_MAX_DEVICES) {
+        kprintf("PCI: device table full, ignoring %02x:%02x.%u\n", bus, slot, func);
+        return;
+    }
+
+    uint32_t class_rev = pci_config_read(bus, slot, func, PCI_CLASS_REV);
+    pci_device_t* dev = &pci_devices[pci_count++];
+    dev->bus = bus;
+    dev->slot = slot;
+    dev->func = func;
+    dev->vendor = id & 0xFFFF;
+    dev->device = id >> 16;
+    dev->class_code = class_rev >> 24;
+    dev->subclass = (class_rev >> 16) & 0xFF;
+    dev->prog_if = (class_rev >> 8) & 0xFF;
+    dev->irq = pci_config_read(bus, slot, func, PCI_INTERRUPT_LINE) & 0xFF;
+
+    kprintf("PCI: %02x:%02x.%u %04x:%04x class %02x.%02x.%02x irq %u\n",
+            bus, slot, func, dev->vendor, dev->device,
+            dev->class_code, dev->subclass, dev->prog_if, dev->irq);
+}
+
+// Brute-force scan of all buses. Function 0 answers for every present
+// device; the others are only probed on multi-function devices.
+void pci_init(void) {
+    kprintf("PCI: scanning buses...\n");
+    pci_count = 0;
+
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint32_t slot = 0; slot < 32; slot++) {
+            uint32_t id = pci_config_read(bus, slot, 0, PCI_VENDOR_ID);
+            if ((id & 0xFFFF) == 0xFFFF) {
+                continue;
+            }
+            pci_add_function(bus, slot, 0, id);
+
+            uint8_t header = pci_config_read(bus, slot, 0, PCI_HEADER_TYPE) >> 16;
+            if (!(header & 0x80)) {
+                continue;
+            }
+            for (uint32_t func = 1; func < 8; func++) {
+                id = pci_config_read(bus, slot, func, PCI_VENDOR_ID);
+                if ((id & 0xFFFF) != 0xFFFF) {
+                    pci_add_function(bus, slot, func, id);
+                }
+            }
+        }
+    }
+    kprintf("PCI: %u functions found\n", pci_count);
+}
+
+const pci_device_t* pci_find_device(uint16_t vendor, uint16_t device) {
+    for (uint32_t i = 0; i < pci_count; i++) {
+        if (pci_devices[i].vendor == vendor && pci_devices[i].device == device) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+const pci_device_t* pci_find_class(uint8_t class_code, uint8_t subclass) {
+    for (uint32_t i = 0; i < pci_count; i++) {
+        if (pci_devices[i].class_code == class_code && pci_devices[i].subclass == subclass) {
+            return &pci_devices[i];
+        }
+    }
+    return NULL;
+}
+
+// Base address of a BAR: a memory address or an I/O port number
+uint32_t pci_bar_address(const pci_device_t* dev, uint32_t bar) {
+    uint32_t value = pci_read32(dev, PCI_BAR0 + bar * 4);
+    return (value & PCI_BAR_IO) ? (value & PCI_BAR_IO_MASK) : (value & PCI_BAR_MEM_MASK);
+}
+
+// Turn on I/O, memory and/or bus master decoding
+void pci_enable(const pci_device_t* dev, uint16_t command_bits) {
+    uint16_t command = pci_read16(dev, PCI_COMMAND);
+    if ((command & command_bits) != command_bits) {
+        pci_write16(dev, PCI_COMMAND, command | command_bits);
+    }
+}
+
+uint8_t pci_find_capability(const pci_device_t* dev, uint8_t id, uint8_t after) {
+    if (!(pci_read16(dev, PCI_STATUS) & PCI_STATUS_CAP_LIST)) {
+        return 0;
+    }
+
+    uint8_t offset = after ? pci_read32(dev, after) >> 8 : pci_read32(dev, PCI_CAPABILITY_LIST);
+    // Bounded walk: a broken list could loop
+    for (uint32_t i = 0; i < 48 && offset >= 0x40; i++) {
+        offset &= 0xFC;
+        uint32_t header = pci_read32(dev, offset);
+        if ((header & 0xFF) == id) {
+            return offset;
+        }
+        offset = header >> 8;
+    }
+    return 0;
+}
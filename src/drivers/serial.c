@@ -0,0 +1,450 @@
+#include "drivers/serial.h"
+#include "interrupt/idt.h"
+#include "lib/kprintf.h"
+#include "lib/klog.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include "kernel/spinlock.h"
+#include "kernel/task.h"
+#include "kernel/wait.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+// Register offsets from the base port
+#define UART_DATA 0  // RBR (read) / THR (write); DLL when DLAB is set
+#define UART_IER  1  // Interrupt enable; DLM when DLAB is set
+#define UART_IIR  2  // Interrupt identification (read)
+#define UART_FCR  2  // FIFO control (write)
+#define UART_LCR  3
+#define UART_MCR  4
+#define UART_LSR  5
+#define UART_MSR  6
+#define UART_SCR  7
+
+#define IER_RDA  0x01  // Received data available (and character timeout)
+#define IER_THRE 0x02  // Transmit holding register empty
+#define IER_RLS  0x04  // Receiver line status
+
+#define IIR_NO_INT  0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_RLS     0x06
+#define IIR_RDA     0x04
+#define IIR_TIMEOUT 0x0C
+#define IIR_THRE    0x02
+#define IIR_FIFO_OK 0xC0  // Both bits set on a 16550A with working FIFOs
+
+#define LCR_8N1  0x03
+#define LCR_DLAB 0x80
+
+#define MCR_DTR_RTS_OUT2 0x0B  // OUT2 gates the IRQ line on PC hardware
+#define MCR_LOOPBACK     0x1E
+
+#define LSR_DR   0x01
+#define LSR_OE   0x02
+#define LSR_THRE 0x20
+
+// FIFO enable and RX trigger levels. Idle lines interrupt on every byte
+// for low latency; during a flood the trigger goes up to 14 bytes so one
+// interrupt moves a whole FIFO.
+#define FCR_ENABLE     0x01
+#define FCR_CLEAR      0x06
+#define FCR_TRIGGER_1  0x00
+#define FCR_TRIGGER_14 0xC0
+
+#define UART_FIFO_SIZE 16
+
+// RX interrupts within one flood window before coalescing kicks in
+#define SERIAL_FLOOD_IRQS      32
+#define SERIAL_FLOOD_WINDOW_US 10000
+
+#define SERIAL_TX_MASK (SERIAL_TX_RING_SIZE - 1)
+#define SERIAL_RX_MASK (SERIAL_RX_RING_SIZE - 1)
+
+static uint16_t serial_port = SERIAL_COM1;
+static int serial_ok = 0;
+
+// TX ring: writers append under serial_lock, the THRE interrupt drains it
+static char tx_ring[SERIAL_TX_RING_SIZE];
+static uint32_t tx_head = 0;
+static uint32_t tx_tail = 0;
+static int tx_active = 0;  // THRE interrupt enabled and FIFO draining
+static spinlock_t serial_lock = SPINLOCK_INIT("serial");
+
+// RX ring: single producer (IRQ4), single consumer
+static char rx_ring[SERIAL_RX_RING_SIZE];
+static volatile uint32_t rx_head = 0;
+static volatile uint32_t rx_tail = 0;
+static wait_queue_t rx_wait = WAIT_QUEUE_INIT("serial_rx");
+
+// Flood detection state (IRQ context only)
+static int rx_flood = 0;
+static uint32_t flood_irqs = 0;
+static uint64_t flood_window_start = 0;
+
+static int console_input = 1;
+static volatile uint32_t input_queued = 0;
+
+static serial_stats_t stats;
+
+static void serial_sink_write(const char* text, uint32_t len);
+static void serial_sink_write_sync(const char* text, uint32_t len);
+
+static klog_sink_t serial_sink = {
+    .name = "serial",
+    .write = serial_sink_write,
+    .write_sync = serial_sink_write_sync,
+    .enabled = 1,
+};
+
+static void outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint8_t inb(uint16_t port) {
+    uint8_t result;
+    __asm__ __volatile__("inb %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static void serial_set_ier(uint8_t ier) {
+    outb(serial_port + UART_IER, ier);
+}
+
+// Move up to one FIFO's worth of bytes from the TX ring to the UART.
+// Called with serial_lock held and only when THR is empty.
+static void serial_fill_fifo_locked(void) {
+    uint32_t n = 0;
+    while (n < UART_FIFO_SIZE && tx_tail != tx_head) {
+        outb(serial_port + UART_DATA, tx_ring[tx_tail & SERIAL_TX_MASK]);
+        tx_tail++;
+        n++;
+    }
+    stats.tx_bytes += n;
+
+    if (tx_tail == tx_head) {
+        // Nothing left: stop THRE interrupts until the next write
+        tx_active = 0;
+        serial_set_ier(IER_RDA | IER_RLS);
+    } else if (!tx_active) {
+        tx_active = 1;
+        serial_set_ier(IER_RDA | IER_RLS | IER_THRE);
+    }
+}
+
+// Append as much as fits to the TX ring and make sure the transmitter is
+// running. Called with serial_lock held; returns the bytes queued.
+static uint32_t serial_queue_locked(const char* data, uint32_t len) {
+    uint32_t space = SERIAL_TX_RING_SIZE - (tx_head - tx_tail);
+    uint32_t count = len < space ? len : space;
+
+    for (uint32_t i = 0; i < count; i++) {
+        tx_ring[(tx_head + i) & SERIAL_TX_MASK] = data[i];
+    }
+    tx_head += count;
+
+    // An idle transmitter gets no THRE interrupt; start it by hand. If the
+    // FIFO is still draining the last fill, arm THRE to send the rest.
+    if (!tx_active && tx_tail != tx_head) {
+        if (inb(serial_port + UART_LSR) & LSR_THRE) {
+            serial_fill_fifo_locked();
+        } else {
+            tx_active = 1;
+            serial_set_ier(IER_RDA | IER_RLS | IER_THRE);
+        }
+    }
+    return count;
+}
+
+// Queue bytes for transmission without waiting. Returns the number of
+// bytes accepted; the rest are dropped if the TX ring is full.
+uint32_t serial_write(const char* data, uint32_t len) {
+    if (!serial_ok) {
+        return 0;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    uint32_t count = serial_queue_locked(data, len);
+    stats.tx_dropped += len - count;
+    spin_unlock_irqrestore(&serial_lock, flags);
+    return count;
+}
+
+// Queue bytes, waiting for the line while the TX ring is full. The FIFO
+// is fed by polling meanwhile, so this also works with interrupts off.
+void serial_write_sync(const char* data, uint32_t len) {
+    if (!serial_ok) {
+        return;
+    }
+
+    while (len > 0) {
+        uint32_t flags = spin_lock_irqsave(&serial_lock);
+        uint32_t count = serial_queue_locked(data, len);
+        data += count;
+        len -= count;
+        if (len > 0 && (inb(serial_port + UART_LSR) & LSR_THRE)) {
+            serial_fill_fifo_locked();
+        }
+        spin_unlock_irqrestore(&serial_lock, flags);
+        if (len > 0) {
+            __asm__ __volatile__("pause");
+        }
+    }
+}
+
+// Drain the TX ring by polling, for the panic path where interrupts stay
+// disabled for good
+void serial_flush_polled(void) {
+    if (!serial_ok) {
+        return;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&serial_lock);
+    while (tx_tail != tx_head) {
+        while (!(inb(serial_port + UART_LSR) & LSR_THRE)) {
+            __asm__ __volatile__("pause");
+        }
+        serial_fill_fifo_locked();
+    }
+    spin_unlock_irqrestore(&serial_lock, flags);
+}
+
+static void serial_put(const char* data, uint32_t len, int sync) {
+    if (sync) {
+        serial_write_sync(data, len);
+    } else {
+        serial_write(data, len);
+    }
+}
+
+// Log sink: terminals expect CRLF line endings
+static void serial_sink_text(const char* text, uint32_t len, int sync) {
+    uint32_t start = 0;
+    for (uint32_t i = 0; i < len; i++) {
+        if (text[i] == '\n') {
+            serial_put(text + start, i - start, sync);
+            serial_put("\r\n", 2, sync);
+            start = i + 1;
+        }
+    }
+    serial_put(text + start, len - start, sync);
+}
+
+static void serial_sink_write(const char* text, uint32_t len) {
+    serial_sink_text(text, len, 0);
+}
+
+static void serial_sink_write_sync(const char* text, uint32_t len) {
+    serial_sink_text(text, len, 1);
+}
+
+static void serial_set_trigger(uint8_t trigger) {
+    outb(serial_port + UART_FCR, FCR_ENABLE | trigger);
+}
+
+// Echo serial input to the console and back to the terminal
+static void serial_input_task(void* arg) {
+    (void)arg;
+    char buf[32];
+    int n;
+
+    __atomic_store_n(&input_queued, 0, __ATOMIC_RELEASE);
+    while (console_input && (n = serial_read(buf, sizeof(buf), SERIAL_NONBLOCK)) > 0) {
+        for (int i = 0; i < n; i++) {
+            char c = buf[i];
+            if (c == '\r') {
+                kputchar('\n');
+                serial_write("\r\n", 2);
+            } else if (c == 0x7F || c == '\b') {
+                kputchar('\b');
+                serial_write("\b \b", 3);
+            } else if (c >= ' ' && c < 0x7F) {
+                kputchar(c);
+                serial_write(&c, 1);
+            }
+        }
+    }
+}
+
+// Move everything in the RX FIFO into the ring
+static uint32_t serial_drain_rx(void) {
+    uint32_t count = 0;
+    uint8_t lsr;
+
+    while ((lsr = inb(serial_port + UART_LSR)) & LSR_DR) {
+        char c = inb(serial_port + UART_DATA);
+        uint32_t head = rx_head;
+
+        if (lsr & LSR_OE) {
+            stats.rx_overruns++;
+        }
+        if (head - __atomic_load_n(&rx_tail, __ATOMIC_ACQUIRE) >= SERIAL_RX_RING_SIZE) {
+            stats.rx_dropped++;
+            continue;
+        }
+        rx_ring[head & SERIAL_RX_MASK] = c;
+        __atomic_store_n(&rx_head, head + 1, __ATOMIC_RELEASE);
+        count++;
+    }
+    stats.rx_bytes += count;
+    return count;
+}
+
+// Switch to the 14-byte trigger when RX interrupts arrive faster than
+// SERIAL_FLOOD_IRQS per window. A character timeout means the line has
+// gone quiet, so it switches back to per-byte interrupts.
+static void serial_rx_coalesce(uint8_t iir_id) {
+    if (rx_flood) {
+        if (iir_id == IIR_TIMEOUT) {
+            rx_flood = 0;
+            serial_set_trigger(FCR_TRIGGER_1);
+        }
+        return;
+    }
+
+    uint64_t now = timing_read_tsc();
+    uint64_t window = div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL) * SERIAL_FLOOD_WINDOW_US;
+    if (now - flood_window_start > window) {
+        flood_window_start = now;
+        flood_irqs = 0;
+    }
+    if (++flood_irqs > SERIAL_FLOOD_IRQS) {
+        rx_flood = 1;
+        stats.flood_entries++;
+        serial_set_trigger(FCR_TRIGGER_14);
+    }
+}
+
+void serial_irq_handler(void) {
+    uint32_t received = 0;
+    uint8_t iir;
+
+    if (!serial_ok) {
+        return;
+    }
+    stats.irqs++;
+
+    // Service every pending cause; the UART raises a new edge otherwise
+    while (!((iir = inb(serial_port + UART_IIR)) & IIR_NO_INT)) {
+        switch (iir & IIR_ID_MASK) {
+            case IIR_RLS:
+                if (inb(serial_port + UART_LSR) & LSR_OE) {
+                    stats.rx_overruns++;
+                }
+                break;
+            case IIR_RDA:
+            case IIR_TIMEOUT:
+                received += serial_drain_rx();
+                serial_rx_coalesce(iir & IIR_ID_MASK);
+                break;
+            case IIR_THRE:
+                spin_lock(&serial_lock);
+                serial_fill_fifo_locked();
+                spin_unlock(&serial_lock);
+                break;
+            default:
+                inb(serial_port + UART_MSR);  // Modem status: read to clear
+                break;
+        }
+    }
+
+    // One wakeup per interrupt, not per byte
+    if (received > 0) {
+        wake_up_all(&rx_wait);
+        if (console_input && !__atomic_exchange_n(&input_queued, 1, __ATOMIC_ACQ_REL)) {
+            task_spawn(serial_input_task, NULL);
+        }
+    }
+}
+
+static int serial_rx_empty(void) {
+    return rx_tail == __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE);
+}
+
+// Read up to 'len' received bytes. With SERIAL_BLOCK, sleeps until at
+// least one byte is available; otherwise returns 0 when there is none.
+int serial_read(char* buf, uint32_t len, int flags) {
+    uint32_t count = 0;
+
+    if (!serial_ok) {
+        return -1;
+    }
+    if ((flags & SERIAL_BLOCK) && len > 0) {
+        wait_event(&rx_wait, !serial_rx_empty());
+    }
+
+    uint32_t tail = rx_tail;
+    uint32_t head = __atomic_load_n(&rx_head, __ATOMIC_ACQUIRE);
+    while (count < len && tail != head) {
+        buf[count++] = rx_ring[tail & SERIAL_RX_MASK];
+        tail++;
+    }
+    __atomic_store_n(&rx_tail, tail, __ATOMIC_RELEASE);
+    return count;
+}
+
+// The console echo is the RX ring's consumer by default. Disable it before
+// calling serial_read() elsewhere, since the ring has a single consumer.
+void serial_set_console_input(int enable) {
+    console_input = enable;
+}
+
+int serial_present(void) {
+    return serial_ok;
+}
+
+int serial_init(void) {
+    uint16_t port = serial_port;
+
+    outb(port + UART_IER, 0);
+
+    // Divisor latch: 115200 / divisor = baud rate
+    uint16_t divisor = 115200 / SERIAL_BAUD;
+    outb(port + UART_LCR, LCR_DLAB);
+    outb(port + UART_DATA, divisor & 0xFF);
+    outb(port + UART_IER, divisor >> 8);
+    outb(port + UART_LCR, LCR_8N1);
+
+    // Loopback self-test: no UART (or a broken one) fails to echo
+    outb(port + UART_MCR, MCR_LOOPBACK);
+    outb(port + UART_DATA, 0xAE);
+    if (inb(port + UART_DATA) != 0xAE) {
+        kprintf("Serial: no UART at 0x%x\n", port);
+        return -1;
+    }
+
+    outb(port + UART_FCR, FCR_ENABLE | FCR_CLEAR | FCR_TRIGGER_1);
+    if ((inb(port + UART_IIR) & IIR_FIFO_OK) != IIR_FIFO_OK) {
+        kprintf("Serial: UART at 0x%x has no working FIFO\n", port);
+        return -1;
+    }
+
+    outb(port + UART_MCR, MCR_DTR_RTS_OUT2);
+    while (inb(port + UART_LSR) & LSR_DR) {
+        inb(port + UART_DATA);
+    }
+
+    serial_ok = 1;
+    serial_set_ier(IER_RDA | IER_RLS);
+    irq_clear_mask(SERIAL_COM1_IRQ);
+
+    kprintf("Serial: 16550A at 0x%x, %u baud, IRQ%u\n", port, SERIAL_BAUD, SERIAL_COM1_IRQ);
+
+    // About 10 KB/s leaves the line: cap the log well below that, with
+    // room for the boot log that is replayed on registration
+    klog_sink_set_rate(&serial_sink, 100, 256);
+    klog_register_sink(&serial_sink);
+    return 0;
+}
+
+serial_stats_t serial_get_stats(void) {
+    return stats;
+}
+
+void serial_print_stats(void) {
+    kprintf("Serial Statistics:\n");
+    kprintf("  TX %u bytes (%u dropped), RX %u bytes (%u dropped, %u overruns)\n",
+            stats.tx_bytes, stats.tx_dropped, stats.rx_bytes, stats.rx_dropped,
+            stats.rx_overruns);
+    kprintf("  %u interrupts, %u RX floods coalesced\n", stats.irqs, stats.flood_entries);
+}
@@ -1,6 +1,15 @@
 #include "drivers/vga.h"
 #include "lib/kprintf.h"
 #include "memory/paging.h"
+#include "memory/vmalloc.h"
+#include "drivers/fb.h"
+#include "drivers/fbcon.h"
+#include "lib/blit.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include "drivers/bga.h"
+#include "kernel/boot_info.h"
+#include "kernel/initcall.h"
 #include <stdint.h>
 
 #ifndef NULL
@@ -16,106 +25,186 @@ extern uint32_t vesa_get_mode_bpp(void);
 extern uint32_t vesa_get_pitch(void);
 extern int vesa_set_text_mode_80x25(void);
 
+void vga_clear_screen_(void);
+
 // VGA driver state
 static int current_mode = 0;  // 0 = text, 1 = VESA graphics
+static int mode_via_bga = 0;  // Graphics mode was set natively, not by the BIOS
+static uint32_t mode_lfb = 0;        // Mapped address of the framebuffer
+static uint32_t mode_lfb_phys = 0;
+static uint32_t mode_width = 0;
+static uint32_t mode_height = 0;
+static uint32_t mode_pitch = 0;
+static uint32_t mode_bpp = 0;
+
+// Microseconds since 'start' for the mode switch messages
+static uint32_t vga_elapsed_us(uint64_t start) {
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+    uint64_t elapsed = timing_get_elapsed_ticks(start);
+    return cycles_per_us ? (uint32_t)div_u64_u32(elapsed, cycles_per_us, NULL) : 0;
+}
+
+static int vga_map_framebuffer(uint32_t size);
+static int vga_use_boot_framebuffer(const boot_framebuffer_t* boot_fb);
 
 // Initialize VGA driver
 int vga_init(void) {
     kprintf("VGA: Initializing graphics driver...\n");
     current_mode = 0;  // Start in text mode
+    if (bga_init() == 0) {
+        kprintf("VGA: Using the native BGA interface for mode switches\n");
+    } else {
+        kprintf("VGA: No BGA, mode switches go through the video BIOS\n");
+    }
+    
+    // A Multiboot loader may already have set a graphics mode
+    const boot_framebuffer_t* boot_fb = &boot_info_get()->framebuffer;
+    if (boot_fb->type == BOOT_FRAMEBUFFER_RGB && vga_use_boot_framebuffer(boot_fb) == 0) {
+        return 0;
+    }
     kprintf("VGA: Driver initialized in text mode\n");
     return 0;
 }
 
-// Set VESA 1024x768x32 mode
-int vga_set_vesa_mode_1024x768(void) {
-    kprintf("VGA: Attempting to set VESA 1024x768 mode...\n");
+// Map 'size' bytes of the linear framebuffer at 'mode_lfb_phys' (uncached)
+// so it can be drawn to; mode_lfb gets the mapped address
+static int vga_map_framebuffer(uint32_t size) {
+    if (mode_lfb != 0) {
+        iounmap((void*)mode_lfb);
+    }
+    mode_lfb = (uint32_t)ioremap(mode_lfb_phys, size);
+    return mode_lfb != 0 ? 0 : -1;
+}
+
+static void vga_unmap_framebuffer(void) {
+    if (mode_lfb != 0) {
+        iounmap((void*)mode_lfb);
+        mode_lfb = 0;
+    }
+}
+
+// Draw to the mode the boot loader left behind as if it had been set here.
+// Going back to text mode then takes the BIOS path.
+static int vga_use_boot_framebuffer(const boot_framebuffer_t* boot_fb) {
+    if ((boot_fb->addr >> 32) != 0 || boot_fb->width == 0 || boot_fb->height == 0) {
+        return -1;
+    }
+    mode_lfb_phys = (uint32_t)boot_fb->addr;
+    mode_width = boot_fb->width;
+    mode_height = boot_fb->height;
+    mode_pitch = boot_fb->pitch;
+    mode_bpp = boot_fb->bpp;
+    if (vga_map_framebuffer(mode_pitch * mode_height) != 0) {
+        return -1;
+    }
+    mode_via_bga = 0;
+    current_mode = 1;
+    
+    if (fb_init(mode_lfb, mode_width, mode_height, mode_pitch, mode_bpp) != 0 ||
+        fbcon_init() != 0) {
+        vga_clear_screen_();
+    }
+    kprintf("VGA: Using the boot loader's %ux%ux%u mode, LFB at 0x%08X\n",
+            mode_width, mode_height, mode_bpp, mode_lfb_phys);
+    return 0;
+}
+
+// Set the mode from protected mode through the BGA ports
+static int vga_set_mode_bga(uint32_t width, uint32_t height, uint32_t bpp) {
+    uint64_t start = timing_read_tsc();
     
+    if (bga_set_mode(width, height, bpp, BGA_MAX_PAGES) != 0) {
+        kprintf("VGA: BGA rejected %ux%ux%u\n", width, height, bpp);
+        return -1;
+    }
+    mode_lfb_phys = bga_page_address(0);
+    mode_width = width;
+    mode_height = height;
+    mode_bpp = bpp;
+    mode_pitch = bga_get_pitch();
+    
+    if (vga_map_framebuffer(bga_pages_size()) != 0) {
+        bga_disable();
+        return -1;
+    }
+    mode_via_bga = 1;
+    kprintf("VGA: BGA mode %ux%ux%u set in %u us\n", width, height, bpp, vga_elapsed_us(start));
+    return 0;
+}
+
+// Set the mode with INT 10h through a real-mode round trip
+static int vga_set_mode_bios(void) {
     // Call the assembly function that does the real mode switching
     int result = vesa_set_mode_1024x768();
     
-    if (result == 0) {
-        // Get and display the mode information for debugging
-        uint32_t lfb_addr = vesa_get_lfb_address();
-        uint32_t width = vesa_get_mode_width();
-        uint32_t height = vesa_get_mode_height();
-        uint32_t bpp = vesa_get_mode_bpp();
-        
-        kprintf("VGA: VESA mode set successfully!\n");
-        kprintf("VGA: Resolution: %dx%d, %d bpp, LFB at 0x%08X\n", width, height, bpp, lfb_addr);
-        
-        // IMPORTANT: Once we're in VESA mode, kprintf won't work anymore!
-        // We need to draw the screen immediately
-        current_mode = 1;
-        
-        // Draw screen immediately - no debug output after this point
-        vga_clear_screen();
-        
-        return 0;
-    } else {
+    if (result != 0) {
         kprintf("VGA: Failed to set VESA mode (error %d)\n", result);
         return -1;
     }
-}
-
-// Clear screen immediately without any debug output (for use after VESA mode switch)
-void vga_clear_screen_(void) {
-    // Get the actual mode information from VESA BIOS
-    uint32_t lfb_addr = vesa_get_lfb_address();
-    uint32_t width = vesa_get_mode_width();
-    uint32_t height = vesa_get_mode_height();
-    uint32_t bpp = vesa_get_mode_bpp();
+    
+    // Get and display the mode information for debugging
+    mode_lfb_phys = vesa_get_lfb_address();
+    mode_width = vesa_get_mode_width();
+    mode_height = vesa_get_mode_height();
+    mode_bpp = vesa_get_mode_bpp();
     
     // If LFB address is 0, fall back to common address
-    if (lfb_addr == 0) {
-        lfb_addr = 0xE0000000;  // Fallback to common address
+    if (mode_lfb_phys == 0) {
+        mode_lfb_phys = 0xE0000000;  // Fallback to common address
     }
     
     // If we don't have valid dimensions, use defaults
-    if (width == 0 || height == 0) {
-        width = 1024;
-        height = 768;
-    }
-    
-    // Calculate framebuffer size based on actual mode info
-    uint32_t bytes_per_pixel = (bpp + 7) / 8;  // Round up to nearest byte
-    uint32_t fb_size = width * height * bytes_per_pixel;
-    uint32_t pages_needed = (fb_size + PAGE_SIZE - 1) / PAGE_SIZE;
-    
-    // Map the framebuffer memory into our virtual address space
-    for (uint32_t i = 0; i < pages_needed; i++) {
-        uint32_t virtual_addr = lfb_addr + (i * PAGE_SIZE);
-        uint64_t physical_addr = lfb_addr + (i * PAGE_SIZE);
-        
-        // Map with present, writable, and cache-disabled flags
-        int result = map_page(virtual_addr, physical_addr, 
-                             PAGE_PRESENT | PAGE_WRITABLE | PAGE_CACHE_DISABLE);
-        
-        if (result != 0) {
-            // Mapping failed - can't draw to framebuffer
-            return;
-        }
-    }
-    
-    // Handle different color depths
-    if (bpp == 16) {
-        // 16-bit color mode
-        uint16_t *framebuffer = (uint16_t*)lfb_addr;
-        uint16_t white = 0xFFFF;  // White in RGB565
-        
-        uint32_t total_pixels = width * height;
-        for (uint32_t i = 0; i < total_pixels; i++) {
-            framebuffer[i] = white;
-        }
-    } else if (bpp == 24 || bpp == 32) {
-        // 24-bit or 32-bit color mode
-        uint32_t *framebuffer = (uint32_t*)lfb_addr;
-        uint32_t white = 0x00FFFFFF;  // White in RGB
-        
-        uint32_t total_pixels = width * height;
-        for (uint32_t i = 0; i < total_pixels; i++) {
-            framebuffer[i] = white;
-        }
+    if (mode_width == 0 || mode_height == 0) {
+        mode_width = 1024;
+        mode_height = 768;
+    }
+    
+    // Scanlines may be padded beyond the visible width
+    uint32_t bytes_per_pixel = (mode_bpp + 7) / 8;  // Round up to nearest byte
+    mode_pitch = vesa_get_pitch();
+    if (mode_pitch < mode_width * bytes_per_pixel) {
+        mode_pitch = mode_width * bytes_per_pixel;
+    }
+    
+    kprintf("VGA: VESA mode set successfully!\n");
+    kprintf("VGA: Resolution: %dx%d, %d bpp, LFB at 0x%08X\n", mode_width, mode_height, mode_bpp, mode_lfb_phys);
+    
+    if (vga_map_framebuffer(mode_pitch * mode_height) != 0) {
+        // Mapping failed - can't draw to framebuffer
+        return -1;
+    }
+    mode_via_bga = 0;
+    return 0;
+}
+
+// Set VESA 1024x768x32 mode
+int vga_set_vesa_mode_1024x768(void) {
+    // vga_init() is deferred at boot and may not have run yet
+    initcall_require("vga");
+    kprintf("VGA: Attempting to set VESA 1024x768 mode...\n");
+    
+    // The BIOS path stays as the fallback when BGA is missing or refuses
+    if ((!bga_present() || vga_set_mode_bga(1024, 768, 32) != 0) && vga_set_mode_bios() != 0) {
+        return -1;
+    }
+    current_mode = 1;
+    
+    // Keep kprintf visible: the framebuffer console takes over the screen
+    if (fb_init(mode_lfb, mode_width, mode_height, mode_pitch, mode_bpp) != 0 ||
+        fbcon_init() != 0) {
+        // No console for this mode; at least show that the switch worked
+        vga_clear_screen_();
+    }
+    return 0;
+}
+
+// Clear screen immediately without any debug output (for use after VESA mode switch)
+void vga_clear_screen_(void) {
+    // The blitter converts the colour for 16, 24 and 32 bpp modes
+    if (mode_bpp == 16 || mode_bpp == 24 || mode_bpp == 32) {
+        blit_surface_t screen = { (void*)mode_lfb, mode_width, mode_height, mode_pitch, mode_bpp,
+                                  BLIT_SURFACE_DEVICE };
+        blit_fill(&screen, 0, 0, mode_width, mode_height, 0x00FFFFFF);  // White
     }
 }
 
@@ -135,18 +224,41 @@ int vga_get_mode(void) {
     return current_mode;
 }
 
-// Get the linear framebuffer address
+// Get the linear framebuffer address of the current graphics mode
 uint32_t vga_get_lfb_address(void) {
-    return vesa_get_lfb_address();
+    return mode_lfb;
+}
+
+// Bytes per scanline of the current graphics mode
+uint32_t vga_get_pitch(void) {
+    return mode_pitch;
 }
 
 // Switch back to VGA text mode (80x25, 16 color)
 void vga_set_text_mode_80x25(void) {
+    if (current_mode == 1 && mode_via_bga) {
+        // The VGA registers and planes were preserved, so text mode comes
+        // back without the BIOS
+        uint64_t start = timing_read_tsc();
+        fbcon_shutdown();
+        fb_shutdown();
+        vga_unmap_framebuffer();
+        bga_disable();
+        current_mode = 0;
+        kprintf_redraw();
+        kprintf("VGA: Switched back to 80x25 text mode in %u us\n", vga_elapsed_us(start));
+        return;
+    }
+    
     // Call the assembly function that does proper real mode switching
     int result = vesa_set_text_mode_80x25();
     
     if (result == 0) {
+        fbcon_shutdown();
+        fb_shutdown();
+        vga_unmap_framebuffer();
         current_mode = 0;  // Set mode back to text
+        kprintf_redraw();  // The mode set cleared the screen and reset the CRTC
         kprintf("VGA: Switched back to 80x25 text mode\n");
     } else {
         kprintf("VGA: Failed to switch to text mode\n");
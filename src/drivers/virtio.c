@@ -0,0 +1,455 @@
+#include "drivers/virtio.h"
+#include "drivers/pci.h"
+#include "memory/paging.h"
+#include "memory/pmm.h"
+#include "memory/vmalloc.h"
+#include "kernel/cpu.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Legacy I/O register offsets (no MSI-X)
+#define VIRTIO_LEGACY_DEVICE_FEATURES 0
+#define VIRTIO_LEGACY_DRIVER_FEATURES 4
+#define VIRTIO_LEGACY_QUEUE_PFN       8
+#define VIRTIO_LEGACY_QUEUE_SIZE      12
+#define VIRTIO_LEGACY_QUEUE_SELECT    14
+#define VIRTIO_LEGACY_QUEUE_NOTIFY    16
+#define VIRTIO_LEGACY_STATUS          18
+#define VIRTIO_LEGACY_ISR             19
+#define VIRTIO_LEGACY_CONFIG          20
+
+// Modern common configuration offsets
+#define VIRTIO_COMMON_DFSELECT      0
+#define VIRTIO_COMMON_DF            4
+#define VIRTIO_COMMON_GFSELECT      8
+#define VIRTIO_COMMON_GF            12
+#define VIRTIO_COMMON_STATUS        20
+#define VIRTIO_COMMON_Q_SELECT      22
+#define VIRTIO_COMMON_Q_SIZE        24
+#define VIRTIO_COMMON_Q_ENABLE      28
+#define VIRTIO_COMMON_Q_NOFF        30
+#define VIRTIO_COMMON_Q_DESCLO      32
+#define VIRTIO_COMMON_Q_DESCHI      36
+#define VIRTIO_COMMON_Q_AVAILLO     40
+#define VIRTIO_COMMON_Q_AVAILHI     44
+#define VIRTIO_COMMON_Q_USEDLO      48
+#define VIRTIO_COMMON_Q_USEDHI      52
+
+// Vendor capability layout and structure types
+#define VIRTIO_CAP_CFG_TYPE   3
+#define VIRTIO_CAP_BAR        4
+#define VIRTIO_CAP_OFFSET     8
+#define VIRTIO_CAP_LENGTH     12
+#define VIRTIO_CAP_MULTIPLIER 16   // Notify capability only
+
+#define VIRTIO_PCI_CAP_COMMON_CFG 1
+#define VIRTIO_PCI_CAP_NOTIFY_CFG 2
+#define VIRTIO_PCI_CAP_ISR_CFG    3
+#define VIRTIO_PCI_CAP_DEVICE_CFG 4
+
+#define VIRTQ_ALIGN 4096
+
+static void outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint8_t inb(uint16_t port) {
+    uint8_t result;
+    __asm__ __volatile__("inb %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static void outw(uint16_t port, uint16_t value) {
+    __asm__ __volatile__("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint16_t inw(uint16_t port) {
+    uint16_t result;
+    __asm__ __volatile__("inw %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static void outl(uint16_t port, uint32_t value) {
+    __asm__ __volatile__("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static uint32_t inl(uint16_t port) {
+    uint32_t result;
+    __asm__ __volatile__("inl %1, %0" : "=a"(result) : "Nd"(port));
+    return result;
+}
+
+static uint8_t mmio_read8(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint8_t*)(base + offset);
+}
+
+static uint16_t mmio_read16(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint16_t*)(base + offset);
+}
+
+static uint32_t mmio_read32(volatile uint8_t* base, uint32_t offset) {
+    return *(volatile uint32_t*)(base + offset);
+}
+
+static void mmio_write8(volatile uint8_t* base, uint32_t offset, uint8_t value) {
+    *(volatile uint8_t*)(base + offset) = value;
+}
+
+static void mmio_write16(volatile uint8_t* base, uint32_t offset, uint16_t value) {
+    *(volatile uint16_t*)(base + offset) = value;
+}
+
+static void mmio_write32(volatile uint8_t* base, uint32_t offset, uint32_t value) {
+    *(volatile uint32_t*)(base + offset) = value;
+}
+
+static uint8_t virtio_get_status(virtio_device_t* dev) {
+    return dev->modern ? mmio_read8(dev->common, VIRTIO_COMMON_STATUS)
+                       : inb(dev->io_base + VIRTIO_LEGACY_STATUS);
+}
+
+static void virtio_set_status(virtio_device_t* dev, uint8_t status) {
+    if (dev->modern) {
+        mmio_write8(dev->common, VIRTIO_COMMON_STATUS, status);
+    } else {
+        outb(dev->io_base + VIRTIO_LEGACY_STATUS, status);
+    }
+}
+
+// Full 64-bit physical address of a memory BAR, or 0 for I/O BARs
+static uint64_t virtio_bar_address(const pci_device_t* pci, uint32_t bar) {
+    uint32_t raw = pci_read32(pci, PCI_BAR0 + bar * 4);
+    if (raw & 0x1) {
+        return 0;
+    }
+    uint64_t addr = raw & 0xFFFFFFF0;
+    if ((raw & 0x6) == 0x4 && bar < 5) {
+        addr |= (uint64_t)pci_read32(pci, PCI_BAR0 + (bar + 1) * 4) << 32;
+    }
+    return addr;
+}
+
+// Map the register blocks the vendor capabilities describe. All four are
+// needed; a device missing one is driven through the legacy interface.
+static int virtio_map_modern(virtio_device_t* dev, const pci_device_t* pci) {
+    for (uint8_t cap = pci_find_capability(pci, PCI_CAP_ID_VENDOR, 0); cap != 0;
+         cap = pci_find_capability(pci, PCI_CAP_ID_VENDOR, cap)) {
+        uint8_t type = (pci_read32(pci, cap) >> (VIRTIO_CAP_CFG_TYPE * 8)) & 0xFF;
+        uint8_t bar = pci_read32(pci, cap + VIRTIO_CAP_BAR) & 0xFF;
+        uint32_t offset = pci_read32(pci, cap + VIRTIO_CAP_OFFSET);
+        uint32_t length = pci_read32(pci, cap + VIRTIO_CAP_LENGTH);
+
+        if (type < VIRTIO_PCI_CAP_COMMON_CFG || type > VIRTIO_PCI_CAP_DEVICE_CFG || bar > 5) {
+            continue;   // PCI config access window or an unknown type
+        }
+        volatile uint8_t** slot = type == VIRTIO_PCI_CAP_COMMON_CFG ? &dev->common :
+                                  type == VIRTIO_PCI_CAP_NOTIFY_CFG ? &dev->notify :
+                                  type == VIRTIO_PCI_CAP_ISR_CFG ? &dev->isr : &dev->device;
+        if (*slot != NULL) {
+            continue;   // The first capability of a type is the preferred one
+        }
+        uint64_t base = virtio_bar_address(pci, bar);
+        if (base == 0 || length == 0) {
+            continue;
+        }
+        *slot = (volatile uint8_t*)ioremap(base + offset, length);
+        if (type == VIRTIO_PCI_CAP_NOTIFY_CFG) {
+            dev->notify_multiplier = pci_read32(pci, cap + VIRTIO_CAP_MULTIPLIER);
+        }
+    }
+
+    if (dev->common && dev->notify && dev->isr && dev->device) {
+        return 0;
+    }
+    volatile uint8_t* blocks[] = { dev->common, dev->notify, dev->isr, dev->device };
+    for (uint32_t i = 0; i < 4; i++) {
+        if (blocks[i] != NULL) {
+            iounmap((void*)blocks[i]);
+        }
+    }
+    dev->common = dev->notify = dev->isr = dev->device = NULL;
+    return -1;
+}
+
+int virtio_pci_init(virtio_device_t* dev, const pci_device_t* pci) {
+    dev->pci = pci;
+    dev->modern = 0;
+    dev->io_base = 0;
+    dev->common = dev->notify = dev->isr = dev->device = NULL;
+    dev->notify_multiplier = 0;
+    dev->features = 0;
+
+    if (virtio_map_modern(dev, pci) == 0) {
+        dev->modern = 1;
+        pci_enable(pci, PCI_COMMAND_MEMORY | PCI_COMMAND_MASTER);
+    } else {
+        // Modern-only IDs have no legacy interface to fall back on
+        uint32_t bar0 = pci_read32(pci, PCI_BAR0);
+        if (pci->device >= 0x1040 || !(bar0 & 0x1)) {
+            kprintf("virtio: %04x:%04x has no usable transport\n", pci->vendor, pci->device);
+            return -1;
+        }
+        dev->io_base = (uint16_t)pci_bar_address(pci, 0);
+        pci_enable(pci, PCI_COMMAND_IO | PCI_COMMAND_MASTER);
+    }
+
+    virtio_reset(dev);
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE);
+    virtio_set_status(dev, VIRTIO_STATUS_ACKNOWLEDGE | VIRTIO_STATUS_DRIVER);
+    return 0;
+}
+
+// A modern device reads back 0 once the reset has finished
+void virtio_reset(virtio_device_t* dev) {
+    virtio_set_status(dev, 0);
+    for (uint32_t i = 0; i < 100000 && virtio_get_status(dev) != 0; i++) {
+        cpu_relax();
+    }
+}
+
+static uint64_t virtio_device_features(virtio_device_t* dev) {
+    if (!dev->modern) {
+        return inl(dev->io_base + VIRTIO_LEGACY_DEVICE_FEATURES);
+    }
+    mmio_write32(dev->common, VIRTIO_COMMON_DFSELECT, 0);
+    uint64_t low = mmio_read32(dev->common, VIRTIO_COMMON_DF);
+    mmio_write32(dev->common, VIRTIO_COMMON_DFSELECT, 1);
+    return low | ((uint64_t)mmio_read32(dev->common, VIRTIO_COMMON_DF) << 32);
+}
+
+int virtio_negotiate_features(virtio_device_t* dev, uint64_t wanted) {
+    if (dev->modern) {
+        wanted |= 1ULL << VIRTIO_F_VERSION_1;
+    }
+    dev->features = virtio_device_features(dev) & wanted;
+
+    if (!dev->modern) {
+        outl(dev->io_base + VIRTIO_LEGACY_DRIVER_FEATURES, (uint32_t)dev->features);
+        return 0;
+    }
+    if (!virtio_has_feature(dev, VIRTIO_F_VERSION_1)) {
+        virtio_fail(dev);
+        return -1;
+    }
+    mmio_write32(dev->common, VIRTIO_COMMON_GFSELECT, 0);
+    mmio_write32(dev->common, VIRTIO_COMMON_GF, (uint32_t)dev->features);
+    mmio_write32(dev->common, VIRTIO_COMMON_GFSELECT, 1);
+    mmio_write32(dev->common, VIRTIO_COMMON_GF, (uint32_t)(dev->features >> 32));
+
+    uint8_t status = virtio_get_status(dev) | VIRTIO_STATUS_FEATURES_OK;
+    virtio_set_status(dev, status);
+    if (!(virtio_get_status(dev) & VIRTIO_STATUS_FEATURES_OK)) {
+        virtio_fail(dev);
+        return -1;
+    }
+    return 0;
+}
+
+int virtio_has_feature(const virtio_device_t* dev, uint32_t bit) {
+    return (dev->features >> bit) & 1;
+}
+
+uint32_t virtio_config_read32(virtio_device_t* dev, uint32_t offset) {
+    return dev->modern ? mmio_read32(dev->device, offset)
+                       : inl(dev->io_base + VIRTIO_LEGACY_CONFIG + offset);
+}
+
+uint64_t virtio_config_read64(virtio_device_t* dev, uint32_t offset) {
+    return virtio_config_read32(dev, offset) | ((uint64_t)virtio_config_read32(dev, offset + 4) << 32);
+}
+
+void virtio_driver_ok(virtio_device_t* dev) {
+    virtio_set_status(dev, virtio_get_status(dev) | VIRTIO_STATUS_DRIVER_OK);
+}
+
+void virtio_fail(virtio_device_t* dev) {
+    virtio_set_status(dev, virtio_get_status(dev) | VIRTIO_STATUS_FAILED);
+}
+
+uint8_t virtio_read_isr(virtio_device_t* dev) {
+    return dev->modern ? mmio_read8(dev->isr, 0) : inb(dev->io_base + VIRTIO_LEGACY_ISR);
+}
+
+// ---- Split virtqueues ----
+
+static uint32_t virtq_align(uint32_t value) {
+    return (value + VIRTQ_ALIGN - 1) & ~(VIRTQ_ALIGN - 1);
+}
+
+// used_event sits after the available ring, avail_event after the used ring
+static volatile uint16_t* virtq_used_event(virtqueue_t* vq) {
+    return &vq->avail->ring[vq->size];
+}
+
+static volatile uint16_t* virtq_avail_event(virtqueue_t* vq) {
+    return (volatile uint16_t*)&vq->used->ring[vq->size];
+}
+
+int virtq_init(virtqueue_t* vq, virtio_device_t* dev, uint16_t index, uint16_t max_size) {
+    uint16_t size;
+
+    if (dev->modern) {
+        mmio_write16(dev->common, VIRTIO_COMMON_Q_SELECT, index);
+        size = mmio_read16(dev->common, VIRTIO_COMMON_Q_SIZE);
+        if (size > max_size) {
+            size = max_size;   // Modern devices accept any smaller power of two
+        }
+    } else {
+        outw(dev->io_base + VIRTIO_LEGACY_QUEUE_SELECT, index);
+        size = inw(dev->io_base + VIRTIO_LEGACY_QUEUE_SIZE);
+        if (size > VIRTQ_MAX_SIZE) {
+            kprintf("virtio: legacy queue %u has %u entries, more than %u\n", index, size,
+                    VIRTQ_MAX_SIZE);
+            return -1;
+        }
+    }
+    if (size == 0 || (size & (size - 1)) != 0) {
+        return -1;
+    }
+
+    uint32_t used_offset = virtq_align(sizeof(virtq_desc_t) * size + sizeof(virtq_avail_t) +
+                                       sizeof(uint16_t) * (size + 1));
+    uint32_t bytes = used_offset + virtq_align(sizeof(virtq_used_t) +
+                                               sizeof(virtq_used_elem_t) * size + sizeof(uint16_t));
+    uint8_t* mem = (uint8_t*)pmm_alloc_pages(bytes / PMM_PAGE_SIZE);
+    if (mem == NULL) {
+        return -1;
+    }
+
+    vq->dev = dev;
+    vq->index = index;
+    vq->size = size;
+    vq->pages = bytes / PMM_PAGE_SIZE;
+    vq->desc = (virtq_desc_t*)mem;
+    vq->avail = (virtq_avail_t*)(mem + sizeof(virtq_desc_t) * size);
+    vq->used = (virtq_used_t*)(mem + used_offset);
+    vq->last_used = 0;
+    vq->kicked_avail = 0;
+    for (uint16_t i = 0; i < size; i++) {
+        vq->desc[i].next = (uint16_t)(i + 1);
+    }
+    vq->free_head = 0;
+    vq->num_free = size;
+
+    uint64_t phys = get_physical_addr((uint32_t)mem);
+    if (dev->modern) {
+        mmio_write16(dev->common, VIRTIO_COMMON_Q_SIZE, size);
+        mmio_write32(dev->common, VIRTIO_COMMON_Q_DESCLO, (uint32_t)phys);
+        mmio_write32(dev->common, VIRTIO_COMMON_Q_DESCHI, (uint32_t)(phys >> 32));
+        phys += (uint8_t*)vq->avail - mem;
+        mmio_write32(dev->common, VIRTIO_COMMON_Q_AVAILLO, (uint32_t)phys);
+        mmio_write32(dev->common, VIRTIO_COMMON_Q_AVAILHI, (uint32_t)(phys >> 32));
+        phys = get_physical_addr((uint32_t)mem) + used_offset;
+        mmio_write32(dev->common, VIRTIO_COMMON_Q_USEDLO, (uint32_t)phys);
+        mmio_write32(dev->common, VIRTIO_COMMON_Q_USEDHI, (uint32_t)(phys >> 32));
+        uint16_t notify_off = mmio_read16(dev->common, VIRTIO_COMMON_Q_NOFF);
+        vq->notify_addr = (volatile uint16_t*)(dev->notify + notify_off * dev->notify_multiplier);
+        mmio_write16(dev->common, VIRTIO_COMMON_Q_ENABLE, 1);
+    } else {
+        outl(dev->io_base + VIRTIO_LEGACY_QUEUE_PFN, (uint32_t)(phys / VIRTQ_ALIGN));
+        vq->notify_addr = NULL;
+    }
+    return 0;
+}
+
+int virtq_add(virtqueue_t* vq, const virtq_sg_t* sg, uint32_t count) {
+    if (count == 0 || count > vq->num_free) {
+        return -1;
+    }
+
+    uint16_t head = vq->free_head;
+    uint16_t last = head;
+    uint16_t i = head;
+    for (uint32_t n = 0; n < count; n++) {
+        vq->desc[i].addr = sg[n].addr;
+        vq->desc[i].len = sg[n].len;
+        vq->desc[i].flags = (sg[n].write ? VIRTQ_DESC_F_WRITE : 0) |
+                            (n + 1 < count ? VIRTQ_DESC_F_NEXT : 0);
+        last = i;
+        i = vq->desc[i].next;
+    }
+    vq->free_head = vq->desc[last].next;
+    vq->num_free -= count;
+
+    // The device may read the ring entry as soon as idx moves past it
+    vq->avail->ring[vq->avail->idx & (vq->size - 1)] = head;
+    __asm__ __volatile__("" : : : "memory");
+    vq->avail->idx++;
+    return head;
+}
+
+int virtq_kick(virtqueue_t* vq) {
+    uint16_t old = vq->kicked_avail;
+    uint16_t new_idx = vq->avail->idx;
+    int notify;
+
+    if (old == new_idx) {
+        return 0;
+    }
+    vq->kicked_avail = new_idx;
+
+    // Order the idx store before reading what the device asked for
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (virtio_has_feature(vq->dev, VIRTIO_F_EVENT_IDX)) {
+        // Notify only if the device's avail_event lies in [old, new)
+        uint16_t event = *virtq_avail_event(vq);
+        notify = (uint16_t)(new_idx - event - 1) < (uint16_t)(new_idx - old);
+    } else {
+        notify = !(((volatile virtq_used_t*)vq->used)->flags & VIRTQ_USED_F_NO_NOTIFY);
+    }
+
+    if (notify) {
+        if (vq->dev->modern) {
+            *vq->notify_addr = vq->index;
+        } else {
+            outw(vq->dev->io_base + VIRTIO_LEGACY_QUEUE_NOTIFY, vq->index);
+        }
+    }
+    return notify;
+}
+
+int virtq_has_used(virtqueue_t* vq) {
+    return vq->last_used != ((volatile virtq_used_t*)vq->used)->idx;
+}
+
+int virtq_get_used(virtqueue_t* vq, uint32_t* len) {
+    if (!virtq_has_used(vq)) {
+        return -1;
+    }
+    // Read the entry only after seeing idx move
+    __asm__ __volatile__("" : : : "memory");
+    virtq_used_elem_t* elem = &vq->used->ring[vq->last_used & (vq->size - 1)];
+    uint16_t head = (uint16_t)elem->id;
+    if (len) {
+        *len = elem->len;
+    }
+    vq->last_used++;
+
+    // Return the chain to the free list
+    uint16_t i = head;
+    uint16_t freed = 1;
+    while (vq->desc[i].flags & VIRTQ_DESC_F_NEXT) {
+        i = vq->desc[i].next;
+        freed++;
+    }
+    vq->desc[i].next = vq->free_head;
+    vq->free_head = head;
+    vq->num_free += freed;
+    return head;
+}
+
+void virtq_interrupt_after(virtqueue_t* vq, uint16_t pending) {
+    if (virtio_has_feature(vq->dev, VIRTIO_F_EVENT_IDX)) {
+        // The device interrupts when its used idx moves past used_event;
+        // for "never", put that a full wrap of the index away
+        *virtq_used_event(vq) = (uint16_t)(vq->last_used + pending - 1);
+    } else {
+        vq->avail->flags = pending ? 0 : VIRTQ_AVAIL_F_NO_INTERRUPT;
+    }
+    // Publish before the caller re-checks the used ring
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
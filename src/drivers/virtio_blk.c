@@ -0,0 +1,458 @@
+#include "drivers/virtio_blk.h"
+#include "drivers/virtio.h"
+#include "drivers/pci.h"
+#include "interrupt/idt.h"
+#include "memory/paging.h"
+#include "memory/pmm.h"
+#include "kernel/cpu.h"
+#include "kernel/task.h"
+#include "kernel/wait.h"
+#include "lib/kprintf.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// PCI device IDs: transitional and modern virtio-blk
+#define VIRTIO_BLK_PCI_LEGACY 0x1001
+#define VIRTIO_BLK_PCI_MODERN 0x1042
+
+// Feature bits
+#define VIRTIO_BLK_F_SEG_MAX 2
+#define VIRTIO_BLK_F_RO      5
+#define VIRTIO_BLK_F_FLUSH   9
+
+// Device configuration offsets
+#define VIRTIO_BLK_CFG_CAPACITY 0
+#define VIRTIO_BLK_CFG_SEG_MAX  12
+
+// Request status values written by the device
+#define VIRTIO_BLK_S_OK     0
+#define VIRTIO_BLK_S_IOERR  1
+#define VIRTIO_BLK_S_UNSUPP 2
+
+// Header, data and status; a 128K request at most spans 33 pages
+#define VIRTIO_BLK_MAX_SEGMENTS (VIRTIO_BLK_MAX_SECTORS * VIRTIO_BLK_SECTOR_SIZE / PMM_PAGE_SIZE + 1)
+#define VIRTIO_BLK_MAX_CHAIN    (VIRTIO_BLK_MAX_SEGMENTS + 2)
+
+#define VIRTIO_BLK_TIMEOUT_MS 5000
+
+typedef struct __attribute__((packed)) {
+    uint32_t type;
+    uint32_t reserved;
+    uint64_t sector;
+} virtio_blk_header_t;
+
+static virtio_device_t vblk_dev;
+static virtqueue_t vblk_vq;
+static int vblk_ready = 0;
+static uint64_t vblk_capacity = 0;
+static uint32_t vblk_seg_max = VIRTIO_BLK_MAX_SEGMENTS;
+
+// Indexed by a chain's head descriptor. The headers and status bytes are
+// read and written by the device, so they live in PMM pages.
+static virtio_blk_header_t* vblk_headers;
+static volatile uint8_t* vblk_status;
+static virtio_blk_request_t* vblk_owner[VIRTQ_MAX_SIZE];
+
+// One batch in flight at a time; the IRQ handler completes it
+static mutex_t vblk_lock = MUTEX_INIT("virtio_blk");
+static completion_t vblk_done = COMPLETION_INIT("virtio_blk");
+static volatile uint32_t vblk_inflight = 0;
+
+static virtio_blk_stats_t vblk_stats;
+
+// Reap finished chains. With work still outstanding, re-arm the interrupt
+// for the rest of the batch and check again: a chain used between the
+// last reap and the re-arm would not interrupt. Interrupts must be off.
+static void vblk_reap(void) {
+    for (;;) {
+        int head;
+        while ((head = virtq_get_used(&vblk_vq, NULL)) >= 0) {
+            virtio_blk_request_t* req = vblk_owner[head];
+            vblk_owner[head] = NULL;
+            if (req == NULL) {
+                continue;
+            }
+            switch (vblk_status[head]) {
+                case VIRTIO_BLK_S_OK:
+                    req->result = VIRTIO_BLK_SUCCESS;
+                    break;
+                case VIRTIO_BLK_S_UNSUPP:
+                    req->result = VIRTIO_BLK_ERROR_INVALID;
+                    break;
+                default:
+                    req->result = VIRTIO_BLK_ERROR_IO;
+                    break;
+            }
+            vblk_inflight--;
+        }
+
+        if (vblk_inflight == 0) {
+            complete(&vblk_done);
+            return;
+        }
+        virtq_interrupt_after(&vblk_vq, (uint16_t)vblk_inflight);
+        if (!virtq_has_used(&vblk_vq)) {
+            return;
+        }
+    }
+}
+
+static void vblk_irq_handler(uint8_t irq) {
+    (void)irq;
+    // Reading the ISR status deasserts the line; 0 means another device
+    // on a shared line interrupted
+    if (!vblk_ready || virtio_read_isr(&vblk_dev) == 0) {
+        vblk_stats.spurious_irqs++;
+        return;
+    }
+    vblk_stats.irqs++;
+    if (vblk_inflight != 0) {
+        vblk_reap();
+    }
+}
+
+// Sleep until the IRQ handler reaps the whole batch. Used chains are
+// also checked before every halt, which covers interrupts being off. On
+// timeout the device is reset so it stops using the caller's buffers.
+static int vblk_wait(void) {
+    uint64_t start = timing_read_tsc();
+    uint64_t timeout = div_u64_u32(timing_get_tsc_frequency(), 1000, NULL) * VIRTIO_BLK_TIMEOUT_MS;
+
+    while (!try_wait_for_completion(&vblk_done)) {
+        if (timing_get_elapsed_ticks(start) > timeout) {
+            kprintf("virtio-blk: request timed out, disabling the device\n");
+            vblk_ready = 0;
+            virtio_reset(&vblk_dev);
+            return VIRTIO_BLK_ERROR_TIMEOUT;
+        }
+        if (task_run_one()) {
+            continue;
+        }
+
+        uint32_t flags = cpu_irq_save();
+        if (vblk_inflight != 0) {
+            vblk_reap();
+        }
+        if (vblk_inflight != 0) {
+            if (flags & CPU_EFLAGS_IF) {
+                // sti takes effect after hlt starts, so no IRQ is missed
+                __asm__ __volatile__("sti; hlt" : : : "memory");
+            } else {
+                cpu_relax();
+            }
+        }
+        cpu_irq_restore(flags);
+    }
+    return VIRTIO_BLK_SUCCESS;
+}
+
+// Describe the buffer page by page, merging physically adjacent pages
+static int vblk_map_buffer(virtq_sg_t* sg, uint32_t max, uint8_t* buf, uint32_t bytes, int write) {
+    uint32_t count = 0;
+    uint32_t virt = (uint32_t)buf;
+
+    while (bytes > 0) {
+        uint64_t phys = get_physical_addr(virt);
+        uint32_t in_page = PMM_PAGE_SIZE - (virt & (PMM_PAGE_SIZE - 1));
+        uint32_t len = bytes < in_page ? bytes : in_page;
+        if (phys == 0) {
+            return -1;
+        }
+        if (count > 0 && sg[count - 1].addr + sg[count - 1].len == phys) {
+            sg[count - 1].len += len;
+        } else {
+            if (count == max) {
+                return -1;
+            }
+            sg[count].addr = phys;
+            sg[count].len = len;
+            sg[count].write = write;
+            count++;
+        }
+        virt += len;
+        bytes -= len;
+    }
+    return (int)count;
+}
+
+// Queue one request without notifying the device. Returns 1 if queued,
+// 0 if the ring has no room for it yet, or -1 with req->result set.
+static int vblk_queue(virtio_blk_request_t* req) {
+    virtq_sg_t sg[VIRTIO_BLK_MAX_CHAIN];
+    uint16_t head = virtq_next_head(&vblk_vq);
+    uint32_t n = 1;
+
+    if (vblk_vq.num_free < 2) {
+        return 0;
+    }
+
+    vblk_headers[head].type = req->op;
+    vblk_headers[head].reserved = 0;
+    vblk_headers[head].sector = req->sector;
+    vblk_status[head] = 0xFF;
+    sg[0].addr = get_physical_addr((uint32_t)&vblk_headers[head]);
+    sg[0].len = sizeof(virtio_blk_header_t);
+    sg[0].write = 0;
+
+    if (req->op != VIRTIO_BLK_OP_FLUSH) {
+        int segments = vblk_map_buffer(&sg[1], vblk_seg_max, (uint8_t*)req->buf,
+                                       req->count * VIRTIO_BLK_SECTOR_SIZE,
+                                       req->op == VIRTIO_BLK_OP_READ);
+        if (segments < 0) {
+            req->result = VIRTIO_BLK_ERROR_INVALID;
+            return -1;
+        }
+        n += (uint32_t)segments;
+    }
+    sg[n].addr = get_physical_addr((uint32_t)&vblk_status[head]);
+    sg[n].len = 1;
+    sg[n].write = 1;
+    n++;
+
+    if (n > vblk_vq.size) {
+        req->result = VIRTIO_BLK_ERROR_INVALID;
+        return -1;
+    }
+    if (n > vblk_vq.num_free) {
+        return 0;
+    }
+    vblk_owner[head] = req;
+    virtq_add(&vblk_vq, sg, n);
+    return 1;
+}
+
+static int vblk_check(virtio_blk_request_t* req) {
+    switch (req->op) {
+        case VIRTIO_BLK_OP_FLUSH:
+            return virtio_has_feature(&vblk_dev, VIRTIO_BLK_F_FLUSH) ? VIRTIO_BLK_SUCCESS
+                                                                     : VIRTIO_BLK_ERROR_INVALID;
+        case VIRTIO_BLK_OP_WRITE:
+            if (virtio_has_feature(&vblk_dev, VIRTIO_BLK_F_RO)) {
+                return VIRTIO_BLK_ERROR_READ_ONLY;
+            }
+            // Fall through
+        case VIRTIO_BLK_OP_READ:
+            if (req->buf == NULL || req->count == 0 || req->sector + req->count > vblk_capacity ||
+                req->sector + req->count < req->sector) {
+                return VIRTIO_BLK_ERROR_INVALID;
+            }
+            return VIRTIO_BLK_SUCCESS;
+        default:
+            return VIRTIO_BLK_ERROR_INVALID;
+    }
+}
+
+void virtio_blk_batch_init(virtio_blk_batch_t* batch) {
+    batch->count = 0;
+}
+
+int virtio_blk_batch_add(virtio_blk_batch_t* batch, uint32_t op, uint64_t sector,
+                         uint32_t count, void* buf) {
+    if (batch->count == VIRTIO_BLK_BATCH_MAX || count > VIRTIO_BLK_MAX_SECTORS) {
+        return -1;
+    }
+    virtio_blk_request_t* req = &batch->requests[batch->count++];
+    req->op = op;
+    req->count = count;
+    req->sector = sector;
+    req->buf = buf;
+    req->result = VIRTIO_BLK_SUCCESS;
+    return 0;
+}
+
+// Whatever fits in the ring goes out under one notification; a batch
+// larger than the ring is sent in several rounds
+int virtio_blk_submit(virtio_blk_batch_t* batch) {
+    int result = VIRTIO_BLK_SUCCESS;
+    uint32_t next = 0;
+
+    mutex_lock(&vblk_lock);
+    if (!vblk_ready) {
+        mutex_unlock(&vblk_lock);
+        return VIRTIO_BLK_ERROR_NO_DEVICE;
+    }
+
+    while (next < batch->count && vblk_ready) {
+        uint32_t queued = 0;
+        for (; next < batch->count; next++) {
+            virtio_blk_request_t* req = &batch->requests[next];
+            req->result = vblk_check(req);
+            if (req->result != VIRTIO_BLK_SUCCESS) {
+                continue;
+            }
+            int status = vblk_queue(req);
+            if (status == 0 && queued == 0) {
+                req->result = VIRTIO_BLK_ERROR_INVALID;   // Can never fit
+                continue;
+            }
+            if (status == 0) {
+                break;   // Ring full: send this round first
+            }
+            queued += status > 0;
+        }
+        if (queued == 0) {
+            continue;
+        }
+
+        completion_reinit(&vblk_done);
+        uint32_t flags = cpu_irq_save();
+        vblk_inflight = queued;
+        virtq_interrupt_after(&vblk_vq, (uint16_t)queued);
+        if (virtq_kick(&vblk_vq)) {
+            vblk_stats.kicks++;
+        } else {
+            vblk_stats.kicks_suppressed++;
+        }
+        cpu_irq_restore(flags);
+        vblk_stats.requests += queued;
+        vblk_stats.batches++;
+
+        if (vblk_wait() != VIRTIO_BLK_SUCCESS) {
+            // Anything not yet reaped never completes
+            for (uint32_t i = 0; i < VIRTQ_MAX_SIZE; i++) {
+                if (vblk_owner[i] != NULL) {
+                    vblk_owner[i]->result = VIRTIO_BLK_ERROR_TIMEOUT;
+                    vblk_owner[i] = NULL;
+                }
+            }
+            vblk_inflight = 0;
+        }
+    }
+
+    for (uint32_t i = 0; i < batch->count; i++) {
+        if (batch->requests[i].result != VIRTIO_BLK_SUCCESS) {
+            vblk_stats.errors++;
+            if (result == VIRTIO_BLK_SUCCESS) {
+                result = batch->requests[i].result;
+            }
+        }
+    }
+    mutex_unlock(&vblk_lock);
+    return result;
+}
+
+static int vblk_transfer(uint32_t op, uint64_t sector, uint32_t count, uint8_t* buf) {
+    virtio_blk_batch_t batch;
+
+    if (count == 0 || buf == NULL) {
+        return VIRTIO_BLK_ERROR_INVALID;
+    }
+    while (count > 0) {
+        virtio_blk_batch_init(&batch);
+        while (count > 0 && batch.count < VIRTIO_BLK_BATCH_MAX) {
+            uint32_t chunk = count > VIRTIO_BLK_MAX_SECTORS ? VIRTIO_BLK_MAX_SECTORS : count;
+            virtio_blk_batch_add(&batch, op, sector, chunk, buf);
+            sector += chunk;
+            count -= chunk;
+            buf += chunk * VIRTIO_BLK_SECTOR_SIZE;
+        }
+        int result = virtio_blk_submit(&batch);
+        if (result != VIRTIO_BLK_SUCCESS) {
+            return result;
+        }
+    }
+    return VIRTIO_BLK_SUCCESS;
+}
+
+int virtio_blk_read(uint64_t sector, uint32_t count, void* buf) {
+    return vblk_transfer(VIRTIO_BLK_OP_READ, sector, count, (uint8_t*)buf);
+}
+
+int virtio_blk_write(uint64_t sector, uint32_t count, const void* buf) {
+    return vblk_transfer(VIRTIO_BLK_OP_WRITE, sector, count, (uint8_t*)buf);
+}
+
+int virtio_blk_flush(void) {
+    if (vblk_ready && !virtio_has_feature(&vblk_dev, VIRTIO_BLK_F_FLUSH)) {
+        return VIRTIO_BLK_SUCCESS;   // Writes go straight to the backing store
+    }
+    virtio_blk_batch_t batch;
+    virtio_blk_batch_init(&batch);
+    virtio_blk_batch_add(&batch, VIRTIO_BLK_OP_FLUSH, 0, 0, NULL);
+    return virtio_blk_submit(&batch);
+}
+
+int virtio_blk_init(void) {
+    if (vblk_ready) {
+        return VIRTIO_BLK_SUCCESS;
+    }
+
+    const pci_device_t* pci = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_BLK_PCI_MODERN);
+    if (pci == NULL) {
+        pci = pci_find_device(VIRTIO_PCI_VENDOR, VIRTIO_BLK_PCI_LEGACY);
+    }
+    if (pci == NULL) {
+        kprintf("virtio-blk: no device found\n");
+        return VIRTIO_BLK_ERROR_NO_DEVICE;
+    }
+    if (virtio_pci_init(&vblk_dev, pci) != 0) {
+        return VIRTIO_BLK_ERROR_NO_DEVICE;
+    }
+
+    uint64_t wanted = (1ULL << VIRTIO_BLK_F_SEG_MAX) | (1ULL << VIRTIO_BLK_F_RO) |
+                      (1ULL << VIRTIO_BLK_F_FLUSH) | (1ULL << VIRTIO_F_EVENT_IDX);
+    if (virtio_negotiate_features(&vblk_dev, wanted) != 0) {
+        kprintf("virtio-blk: feature negotiation failed\n");
+        return VIRTIO_BLK_ERROR_NO_DEVICE;
+    }
+    if (virtq_init(&vblk_vq, &vblk_dev, 0, VIRTQ_MAX_SIZE) != 0) {
+        kprintf("virtio-blk: cannot set up the request queue\n");
+        virtio_fail(&vblk_dev);
+        return VIRTIO_BLK_ERROR_NO_DEVICE;
+    }
+
+    uint32_t bytes = vblk_vq.size * (sizeof(virtio_blk_header_t) + 1);
+    uint32_t pages = (bytes + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+    uint8_t* mem = (uint8_t*)pmm_alloc_pages(pages);
+    if (mem == NULL) {
+        virtio_fail(&vblk_dev);
+        return VIRTIO_BLK_ERROR_NO_DEVICE;
+    }
+    vblk_headers = (virtio_blk_header_t*)mem;
+    vblk_status = mem + vblk_vq.size * sizeof(virtio_blk_header_t);
+
+    vblk_capacity = virtio_config_read64(&vblk_dev, VIRTIO_BLK_CFG_CAPACITY);
+    if (virtio_has_feature(&vblk_dev, VIRTIO_BLK_F_SEG_MAX)) {
+        uint32_t seg_max = virtio_config_read32(&vblk_dev, VIRTIO_BLK_CFG_SEG_MAX);
+        if (seg_max != 0 && seg_max < vblk_seg_max) {
+            vblk_seg_max = seg_max;
+        }
+    }
+
+    // Without an IRQ line requests still complete, found by polling
+    if (pci->irq != 0 && pci->irq < 16 && irq_register_handler(pci->irq, vblk_irq_handler) != 0) {
+        kprintf("virtio-blk: IRQ %u is taken, polling for completions\n", pci->irq);
+    }
+    virtio_driver_ok(&vblk_dev);
+    vblk_ready = 1;
+
+    kprintf("virtio-blk: %s transport, %u MB, queue %u, irq %u%s%s\n",
+            vblk_dev.modern ? "modern" : "legacy", (uint32_t)(vblk_capacity >> 11), vblk_vq.size,
+            pci->irq, virtio_has_feature(&vblk_dev, VIRTIO_F_EVENT_IDX) ? ", event idx" : "",
+            virtio_has_feature(&vblk_dev, VIRTIO_BLK_F_RO) ? ", read-only" : "");
+    return VIRTIO_BLK_SUCCESS;
+}
+
+int virtio_blk_present(void) {
+    return vblk_ready;
+}
+
+uint64_t virtio_blk_capacity(void) {
+    return vblk_capacity;
+}
+
+virtio_blk_stats_t virtio_blk_get_stats(void) {
+    return vblk_stats;
+}
+
+void virtio_blk_print_stats(void) {
+    kprintf("virtio-blk: %u requests in %u batches, %u kicks (%u suppressed), %u IRQs "
+            "(%u spurious), %u errors\n",
+            vblk_stats.requests, vblk_stats.batches, vblk_stats.kicks, vblk_stats.kicks_suppressed,
+            vblk_stats.irqs, vblk_stats.spurious_irqs, vblk_stats.errors);
+}
@@ -1,6 +1,17 @@
 #include "interrupt/idt.h"
 #include "lib/kprintf.h"
 #include "drivers/keyboard.h"
+#include "drivers/serial.h"
+#include "drivers/ata.h"
+#include "lib/timing.h"
+#include "kernel/profile.h"
+#include "kernel/ksyms.h"
+#include "kernel/static_call.h"
+#include "memory/address_space.h"
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
 
 struct idt_entry {
     uint16_t offset_low;
@@ -106,6 +117,11 @@ void pic_send_eoi(uint8_t irq) {
     outb(PIC1_COMMAND, PIC_EOI);
 }
 
+// IRQs are routed through the PIC only, so it is the one EOI candidate;
+// local APIC / x2APIC variants belong here once interrupts use them
+STATIC_CALL_DEFINE(irq_eoi, pic_send_eoi);
+STATIC_CALL_CANDIDATE(irq_eoi, pic_send_eoi, 0);
+
 // Remap PIC interrupts to avoid conflict with CPU exceptions
 void pic_remap(void) {
     // Save masks
@@ -147,6 +163,21 @@ void irq_set_mask(unsigned char irq_line) {
     outb(port, value);
 }
 
+// Handlers for lines whose number is only known at run time (PCI INTx)
+static irq_handler_t irq_handlers[16];
+
+int irq_register_handler(uint8_t irq, irq_handler_t handler) {
+    if (irq >= 16 || irq_handlers[irq] != NULL) {
+        return -1;
+    }
+    irq_handlers[irq] = handler;
+    if (irq >= 8) {
+        irq_clear_mask(2);  // Slave PIC cascade
+    }
+    irq_clear_mask(irq);
+    return 0;
+}
+
 void irq_clear_mask(unsigned char irq_line) {
     uint16_t port;
     uint8_t value;
@@ -181,6 +212,18 @@ void irq_install(void) {
 }
 
 void isr_common_stub(struct interrupt_frame* frame) {
+    // Copy-on-write faults are resolved and the access retried
+    if (frame->interrupt_number == 14) {
+        uint32_t faulting_address;
+        __asm__ __volatile__("mov %%cr2, %0" : "=r"(faulting_address));
+        if (address_space_handle_fault(faulting_address, frame->error_code) == 0) {
+            return;
+        }
+    }
+    
+    // The exception may have hit while the console lock was held
+    kprintf_bust_lock();
+    
     // Clear screen first for better visibility of the exception
     kclear_screen();
     
@@ -278,24 +321,33 @@ void irq_common_stub(struct interrupt_frame* frame) {
     switch (irq) {
         case 0:
             // Timer interrupt - happens ~18.2 times per second
-            // kprintf("Timer tick\n");
+            timing_tick();
+            profile_tick(frame);
             break;
         case 1:
             // Keyboard interrupt
             {
                 uint8_t scancode = inb(0x60);  // Read scancode from keyboard controller
-                keyboard_handler(scancode);
+                keyboard_handler(scancode);    // Queued; translated outside the IRQ
             }
             break;
+        case 4:
+            // COM1
+            serial_irq_handler();
+            break;
         case 14:
             // Primary ATA hard disk
-            //kprintf("Primary ATA interrupt\n");
+            ata_irq_handler(0);
             break;
         case 15:
             // Secondary ATA hard disk
-            // kprintf("Secondary ATA interrupt\n");
+            ata_irq_handler(1);
             break;
         default:
+            if (irq < 16 && irq_handlers[irq] != NULL) {
+                irq_handlers[irq](irq);
+                break;
+            }
             // Other IRQs
             // kprintf("IRQ ");
             char irq_str[4];
@@ -320,8 +372,8 @@ void irq_common_stub(struct interrupt_frame* frame) {
             break;
     }
     
-    // Send EOI (End Of Interrupt) to PIC
-    pic_send_eoi(irq);
+    // Send EOI (End Of Interrupt) to the interrupt controller
+    irq_eoi(irq);
 }
 
 void kernel_panic(struct interrupt_frame* frame) {
@@ -360,6 +412,11 @@ void kernel_panic(struct interrupt_frame* frame) {
     // Show fault address (EIP where exception occurred)
     kprintf("- Fault Address (EIP): ");
     print_hex(frame->eip);
+    uint32_t sym_offset;
+    const char* sym = ksym_lookup(frame->eip, &sym_offset);
+    if (sym) {
+        kprintf(" (%s+0x%x)", sym, sym_offset);
+    }
     kprintf("\n");
     
     // Show error code if present
@@ -377,6 +434,7 @@ void kernel_panic(struct interrupt_frame* frame) {
     
     // Halt the system completely - this function never returns
     kprintf("\nSystem halted.\n");
+    serial_flush_polled();  // No more THRE interrupts once halted
     __asm__ __volatile__(
         "cli\n"           // Disable interrupts completely
         "1: hlt\n"        // Halt processor  
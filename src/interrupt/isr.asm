@@ -26,6 +26,7 @@ isr_common:
     ; Create interrupt frame structure and pass pointer to C handler
     mov eax, esp          ; ESP now points to our register structure
     push eax              ; Pass pointer to registers as parameter
+    cld                   ; C code expects DF clear; iretd restores the old value
     call isr_common_stub
     add esp, 4            ; Clean up parameter
     
@@ -99,6 +100,7 @@ irq_common:
     ; Create interrupt frame structure and pass pointer to C handler
     mov eax, esp          ; ESP now points to our register structure
     push eax              ; Pass pointer to registers as parameter
+    cld                   ; C code expects DF clear; iretd restores the old value
     call irq_common_stub
     add esp, 4            ; Clean up parameter
     
@@ -0,0 +1,650 @@
+#include "kernel/bench.h"
+#include "lib/kprintf.h"
+#include "lib/ksnprintf.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include "drivers/vga.h"
+#include "drivers/fb.h"
+#include "drivers/ata.h"
+#include "drivers/virtio_blk.h"
+#include "lib/blit.h"
+#include "memory/pmm.h"
+#include "memory/paging.h"
+#include "memory/address_space.h"
+#include "memory/vmalloc.h"
+#include "lib/string.h"
+#include "kernel/cpu.h"
+#include "kernel/initcall.h"
+#include <stdint.h>
+
+#ifdef CONFIG_BENCHMARKS
+
+#define BENCH_KPRINTF_LINES 200
+
+// Typical boot log line (~60 characters)
+static void bench_boot_line(uint32_t i) {
+    kprintf("[bench] line %u: initializing subsystem at 0x%08x ... ok\n", i, i * 0x1000);
+}
+
+// The same line through kputchar(), which syncs the cursor per character
+static void bench_boot_line_per_char(uint32_t i) {
+    static const char line[] = "[bench] line: initializing subsystem at 0x00000000 ... ok\n";
+    (void)i;
+    for (const char* p = line; *p; p++) {
+        kputchar(*p);
+    }
+}
+
+static void bench_kprintf_run(void (*emit)(uint32_t), int lazy,
+                              uint32_t* cycles_per_line, uint32_t* port_writes) {
+    kprintf_set_lazy_cursor(lazy);
+    uint32_t updates = kprintf_cursor_updates();
+    uint64_t start = timing_read_tsc();
+
+    for (uint32_t i = 0; i < BENCH_KPRINTF_LINES; i++) {
+        emit(i);
+    }
+    kprintf_sync_cursor();
+
+    uint64_t elapsed = timing_get_elapsed_ticks(start);
+    *cycles_per_line = (uint32_t)div_u64_u32(elapsed, BENCH_KPRINTF_LINES, NULL);
+    *port_writes = (kprintf_cursor_updates() - updates) * 4;
+}
+
+void bench_kprintf(void) {
+    static const char* names[] = { "kputchar per char", "kprintf batched", "kprintf lazy cursor" };
+    uint32_t cycles[3];
+    uint32_t ports[3];
+    int was_lazy = kprintf_set_lazy_cursor(0);
+
+    bench_kprintf_run(bench_boot_line_per_char, 0, &cycles[0], &ports[0]);
+    bench_kprintf_run(bench_boot_line, 0, &cycles[1], &ports[1]);
+    bench_kprintf_run(bench_boot_line, 1, &cycles[2], &ports[2]);
+    kprintf_set_lazy_cursor(was_lazy);
+
+    kprintf("Console benchmark (%u lines):\n", BENCH_KPRINTF_LINES);
+    for (int i = 0; i < 3; i++) {
+        kprintf("  %s: %u cycles/line, %u cursor port writes\n", names[i], cycles[i], ports[i]);
+    }
+}
+
+#define BENCH_FORMAT_ITERATIONS 10000
+
+// Formatting cost alone: ksnprintf into a stack buffer
+void bench_ksnprintf(void) {
+    char buf[128];
+    uint32_t len = 0;
+    uint64_t start = timing_read_tsc();
+
+    for (uint32_t i = 0; i < BENCH_FORMAT_ITERATIONS; i++) {
+        len += ksnprintf(buf, sizeof(buf), "[%6u.%06u] cpu%u: %-12s %08x %llu\n",
+                         i, i * 7, 0u, "subsystem", i * 0x1000, 0x123456789ULL * i);
+    }
+
+    uint64_t elapsed = timing_get_elapsed_ticks(start);
+    kprintf("Format benchmark: %u cycles per line (%u lines, %u bytes)\n",
+            (uint32_t)div_u64_u32(elapsed, BENCH_FORMAT_ITERATIONS, NULL),
+            BENCH_FORMAT_ITERATIONS, len);
+}
+
+#define BENCH_FB_FRAMES 30
+
+// Frames per second (x10) for 'frames' frames in 'cycles' TSC cycles
+static uint32_t bench_fps_x10(uint32_t frames, uint64_t cycles) {
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+    uint32_t us = cycles_per_us ? (uint32_t)div_u64_u32(cycles, cycles_per_us, NULL) : 0;
+    return us ? (uint32_t)div_u64_u32((uint64_t)frames * 10000000ULL, us, NULL) : 0;
+}
+
+static uint32_t bench_pattern(uint32_t x, uint32_t y, uint32_t frame) {
+    return ((x + frame) & 0xFF) | (((y + frame) & 0xFF) << 8) | ((frame & 0xFF) << 16);
+}
+
+// Full-frame redraw rate: pixel by pixel into the uncached LFB, as
+// vga_clear_screen_() does, against drawing into the back buffer and
+// presenting it. Also times a one-text-line update, the common console case.
+void bench_fb(void) {
+    if (vga_set_vesa_mode_1024x768() != 0 || !fb_active()) {
+        kprintf("Framebuffer benchmark: no 32 bpp VESA mode, skipped\n");
+        return;
+    }
+
+    const fb_surface_t* surf = fb_surface();
+    uint8_t* lfb = (uint8_t*)vga_get_lfb_address();
+    uint32_t pitch = vga_get_pitch();
+    uint32_t width = surf->width;
+    uint32_t height = surf->height;
+    uint64_t cycles[3];
+
+    uint64_t start = timing_read_tsc();
+    for (uint32_t f = 0; f < BENCH_FB_FRAMES; f++) {
+        for (uint32_t y = 0; y < height; y++) {
+            volatile uint32_t* line = (uint32_t*)(lfb + y * pitch);
+            for (uint32_t x = 0; x < width; x++) {
+                line[x] = bench_pattern(x, y, f);
+            }
+        }
+    }
+    cycles[0] = timing_get_elapsed_ticks(start);
+
+    start = timing_read_tsc();
+    for (uint32_t f = 0; f < BENCH_FB_FRAMES; f++) {
+        for (uint32_t y = 0; y < height; y++) {
+            uint32_t* line = surf->pixels + y * surf->stride;
+            for (uint32_t x = 0; x < width; x++) {
+                line[x] = bench_pattern(x, y, f);
+            }
+        }
+        fb_mark_dirty(0, 0, width, height);
+        fb_present();
+    }
+    cycles[1] = timing_get_elapsed_ticks(start);
+
+    start = timing_read_tsc();
+    for (uint32_t f = 0; f < BENCH_FB_FRAMES; f++) {
+        fb_fill_rect(0, (f % (height / 16)) * 16, width, 16, bench_pattern(f, f, f));
+        fb_present();
+    }
+    cycles[2] = timing_get_elapsed_ticks(start);
+
+    vga_set_text_mode_80x25();
+
+    static const char* names[] = { "direct to LFB", "back buffer + present", "one text line + present" };
+    kprintf("Framebuffer benchmark (%ux%u, %u frames):\n", width, height, BENCH_FB_FRAMES);
+    for (int i = 0; i < 3; i++) {
+        uint32_t fps = bench_fps_x10(BENCH_FB_FRAMES, cycles[i]);
+        kprintf("  %s: %u.%u fps\n", names[i], fps / 10, fps % 10);
+    }
+}
+
+#define BENCH_BLIT_WIDTH  1024
+#define BENCH_BLIT_HEIGHT 768
+#define BENCH_BLIT_ROUNDS 8
+#define BENCH_BLIT_PAGES  ((BENCH_BLIT_WIDTH * BENCH_BLIT_HEIGHT * 4 + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+
+// Megapixels per second for 'pixels' pixels in 'cycles' TSC cycles
+static uint32_t bench_mpixels(uint64_t pixels, uint64_t cycles) {
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+    uint32_t us = cycles_per_us ? (uint32_t)div_u64_u32(cycles, cycles_per_us, NULL) : 0;
+    return us ? (uint32_t)div_u64_u32(pixels, us, NULL) : 0;
+}
+
+// Time one blitter operation over BENCH_BLIT_ROUNDS full screens
+static uint32_t bench_blit_op(int op, blit_surface_t* dst, blit_surface_t* src, const uint8_t* glyphs) {
+    uint32_t w = BENCH_BLIT_WIDTH;
+    uint32_t h = BENCH_BLIT_HEIGHT;
+    uint64_t start = timing_read_tsc();
+
+    for (uint32_t round = 0; round < BENCH_BLIT_ROUNDS; round++) {
+        switch (op) {
+        case 0:
+            blit_fill(dst, 0, 0, w, h, 0xFF204080 + round);
+            break;
+        case 1:
+            // Scroll by one 16-pixel text line: overlapping copy
+            blit_copy(dst, 0, 0, dst, 0, 16, w, h - 16);
+            blit_copy(dst, 0, h - 16, src, 0, 0, w, 16);
+            break;
+        case 2:
+            // A full screen of 8x16 glyphs
+            for (uint32_t y = 0; y < h; y += 16) {
+                for (uint32_t x = 0; x < w; x += 8) {
+                    blit_glyph(dst, x, y, 8, 16, glyphs + ((x / 8 + y) & 15) * 16, 1,
+                               0xFFAAAAAA, 0xFF000000, 0);
+                }
+            }
+            break;
+        case 3:
+            blit_blend(dst, 0, 0, w, h, (const uint32_t*)src->pixels, w);
+            break;
+        }
+    }
+    return bench_mpixels((uint64_t)w * h * BENCH_BLIT_ROUNDS, timing_get_elapsed_ticks(start));
+}
+
+// Blitter throughput on RAM surfaces, scalar against SIMD kernels
+void bench_blit(void) {
+    static const char* names[] = { "fill", "copy (scroll)", "glyph 1->32 bpp", "alpha blend" };
+    uint32_t* dst_pixels = (uint32_t*)pmm_alloc_pages(BENCH_BLIT_PAGES);
+    uint32_t* src_pixels = (uint32_t*)pmm_alloc_pages(BENCH_BLIT_PAGES);
+    uint8_t glyphs[16 * 16];
+
+    if (dst_pixels == NULL || src_pixels == NULL) {
+        kprintf("Blit benchmark: cannot allocate surfaces\n");
+        if (dst_pixels) {
+            pmm_free_pages(dst_pixels, BENCH_BLIT_PAGES);
+        }
+        if (src_pixels) {
+            pmm_free_pages(src_pixels, BENCH_BLIT_PAGES);
+        }
+        return;
+    }
+
+    blit_surface_t dst = { dst_pixels, BENCH_BLIT_WIDTH, BENCH_BLIT_HEIGHT, BENCH_BLIT_WIDTH * 4, 32, 0 };
+    blit_surface_t src = { src_pixels, BENCH_BLIT_WIDTH, BENCH_BLIT_HEIGHT, BENCH_BLIT_WIDTH * 4, 32, 0 };
+    for (uint32_t i = 0; i < BENCH_BLIT_WIDTH * BENCH_BLIT_HEIGHT; i++) {
+        src_pixels[i] = (i * 0x9E3779B1) | ((i & 1) ? 0 : 0x80000000);  // Mixed alpha
+    }
+    for (uint32_t i = 0; i < sizeof(glyphs); i++) {
+        glyphs[i] = (uint8_t)(i * 37);
+    }
+
+    uint32_t mpix[2][4];
+    int was_simd = blit_set_simd(0);
+    for (int op = 0; op < 4; op++) {
+        mpix[0][op] = bench_blit_op(op, &dst, &src, glyphs);
+    }
+    blit_set_simd(1);
+    const char* simd = blit_backend();
+    for (int op = 0; op < 4; op++) {
+        mpix[1][op] = bench_blit_op(op, &dst, &src, glyphs);
+    }
+    blit_set_simd(was_simd);
+
+    kprintf("Blit benchmark (%ux%u x32, MPixels/s): scalar vs %s\n",
+            BENCH_BLIT_WIDTH, BENCH_BLIT_HEIGHT, simd);
+    for (int op = 0; op < 4; op++) {
+        kprintf("  %-16s %6u %6u\n", names[op], mpix[0][op], mpix[1][op]);
+    }
+
+    pmm_free_pages(dst_pixels, BENCH_BLIT_PAGES);
+    pmm_free_pages(src_pixels, BENCH_BLIT_PAGES);
+}
+
+#define BENCH_MEM_BUFFER (1024 * 1024)
+#define BENCH_MEM_PAGES  (BENCH_MEM_BUFFER / PMM_PAGE_SIZE)
+#define BENCH_MEM_TOTAL  (16 * 1024 * 1024)  // Bytes moved per measurement
+
+// The open-coded dword loops the kernel used before (built -O0, like them)
+static void* bench_copy_loop(void* dst, const void* src, size_t n) {
+    uint32_t* d = dst;
+    const uint32_t* s = src;
+    for (size_t i = 0; i < n / 4; i++) {
+        d[i] = s[i];
+    }
+    return dst;
+}
+
+static void* bench_set_loop(void* dst, int c, size_t n) {
+    uint32_t* d = dst;
+    uint32_t value = (uint8_t)c * 0x01010101u;
+    for (size_t i = 0; i < n / 4; i++) {
+        d[i] = value;
+    }
+    return dst;
+}
+
+// MB/s for 'bytes' bytes in 'cycles' TSC cycles
+static uint32_t bench_mbytes(uint64_t bytes, uint64_t cycles) {
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+    uint32_t us = cycles_per_us ? (uint32_t)div_u64_u32(cycles, cycles_per_us, NULL) : 0;
+    return us ? (uint32_t)div_u64_u32(bytes, us, NULL) : 0;
+}
+
+typedef struct {
+    const char* name;
+    void* (*copy)(void*, const void*, size_t);
+    void* (*set)(void*, int, size_t);
+    uint32_t features;  // CPU_FEATURE_* bits the variant needs
+} bench_mem_variant_t;
+
+// memcpy and memset throughput per implementation and size class
+void bench_memory(void) {
+    static const bench_mem_variant_t variants[] = {
+        { "dword loop", bench_copy_loop, bench_set_loop, 0 },
+        { "rep movsd", memcpy_rep, memset_rep, 0 },
+        { "rep movsb", memcpy_erms, memset_erms, CPU_FEATURE_ERMS },
+        { "sse2", memcpy_sse2, memset_sse2, CPU_FEATURE_SSE2 },
+        { "sse2 stream", memcpy_sse2_stream, memset_sse2_stream, CPU_FEATURE_SSE2 },
+        { "dispatch", memcpy, memset, 0 },
+    };
+    static const uint32_t sizes[] = { 64, 4096, BENCH_MEM_BUFFER };
+    uint8_t* a = (uint8_t*)pmm_alloc_pages(BENCH_MEM_PAGES);
+    uint8_t* b = (uint8_t*)pmm_alloc_pages(BENCH_MEM_PAGES);
+
+    if (a == NULL || b == NULL) {
+        kprintf("Memory benchmark: cannot allocate buffers\n");
+        if (a) {
+            pmm_free_pages(a, BENCH_MEM_PAGES);
+        }
+        if (b) {
+            pmm_free_pages(b, BENCH_MEM_PAGES);
+        }
+        return;
+    }
+
+    kprintf("Memory benchmark (MB/s, copy/set at 64 B, 4 KB, 1 MB):\n");
+    for (uint32_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        const bench_mem_variant_t* var = &variants[v];
+        if (!cpu_has(var->features)) {
+            continue;
+        }
+        uint32_t copy_rate[3];
+        uint32_t set_rate[3];
+        for (uint32_t s = 0; s < 3; s++) {
+            uint32_t rounds = BENCH_MEM_TOTAL / sizes[s];
+
+            uint64_t start = timing_read_tsc();
+            for (uint32_t r = 0; r < rounds; r++) {
+                var->copy(a, b, sizes[s]);
+            }
+            copy_rate[s] = bench_mbytes(BENCH_MEM_TOTAL, timing_get_elapsed_ticks(start));
+
+            start = timing_read_tsc();
+            for (uint32_t r = 0; r < rounds; r++) {
+                var->set(a, r, sizes[s]);
+            }
+            set_rate[s] = bench_mbytes(BENCH_MEM_TOTAL, timing_get_elapsed_ticks(start));
+        }
+        kprintf("  %-12s %6u/%-6u %6u/%-6u %6u/%u\n", var->name,
+                copy_rate[0], set_rate[0], copy_rate[1], set_rate[1], copy_rate[2], set_rate[2]);
+    }
+
+    pmm_free_pages(a, BENCH_MEM_PAGES);
+    pmm_free_pages(b, BENCH_MEM_PAGES);
+}
+
+#define BENCH_TLB_PAGES  256        // Kernel pages touched after each flush
+#define BENCH_TLB_BASE   0x1000000  // Identity-mapped, inside the heap
+#define BENCH_TLB_ROUNDS 64
+
+// Cycles to touch BENCH_TLB_PAGES kernel pages right after 'flush'
+static uint64_t bench_tlb_round(void (*flush)(void)) {
+    volatile uint32_t sink = 0;
+    uint64_t total = 0;
+
+    for (uint32_t r = 0; r < BENCH_TLB_ROUNDS; r++) {
+        flush();
+        uint64_t start = timing_read_tsc();
+        for (uint32_t i = 0; i < BENCH_TLB_PAGES; i++) {
+            sink += *(volatile uint32_t*)(BENCH_TLB_BASE + i * PAGE_SIZE);
+        }
+        total += timing_get_elapsed_ticks(start);
+    }
+    (void)sink;
+    return total;
+}
+
+// Cost of refilling the kernel working set after a CR3 reload, which
+// keeps global entries, against a full flush that drops them
+void bench_tlb(void) {
+    uint32_t touches = BENCH_TLB_PAGES * BENCH_TLB_ROUNDS;
+    uint64_t cr3 = bench_tlb_round(tlb_flush);
+    uint64_t full = bench_tlb_round(tlb_flush_global);
+
+    kprintf("TLB benchmark (%u kernel pages, global pages %s):\n", BENCH_TLB_PAGES,
+            paging_global_pages_enabled() ? "on" : "off");
+    kprintf("  after CR3 reload:  %u cycles/page\n", (uint32_t)div_u64_u32(cr3, touches, NULL));
+    kprintf("  after full flush:  %u cycles/page\n", (uint32_t)div_u64_u32(full, touches, NULL));
+}
+
+#define BENCH_AS_ROUNDS 32
+#define BENCH_AS_PAGES  256        // User pages (1 MB) mapped before cloning
+#define BENCH_AS_BASE   AS_USER_START
+
+static uint32_t bench_per(uint64_t cycles, uint32_t count) {
+    return (uint32_t)div_u64_u32(cycles, count, NULL);
+}
+
+// Cycles to write one word into each of the benchmark pages of the
+// current space (every write takes a copy-on-write fault after a clone)
+static uint64_t bench_as_touch(void) {
+    uint64_t start = timing_read_tsc();
+    for (uint32_t i = 0; i < BENCH_AS_PAGES; i++) {
+        *(volatile uint32_t*)(BENCH_AS_BASE + i * PAGE_SIZE) = i;
+    }
+    return timing_get_elapsed_ticks(start);
+}
+
+// Address space creation and cloning cost, and copy-on-write fault cost
+// for the copy and the sole-owner paths
+void bench_address_space(void) {
+    address_space_t* kernel = address_space_kernel();
+    uint64_t create = 0;
+    uint64_t clone = 0;
+    uint64_t copy_faults = 0;
+    uint64_t reuse_faults = 0;
+    uint32_t free_before = pmm_get_stats().free_pages;
+
+    address_space_t* parent = address_space_create();
+    if (parent == NULL) {
+        kprintf("Address space benchmark: out of memory\n");
+        return;
+    }
+    for (uint32_t i = 0; i < BENCH_AS_PAGES; i++) {
+        if (address_space_alloc(parent, BENCH_AS_BASE + i * PAGE_SIZE, PAGE_WRITABLE) != AS_SUCCESS) {
+            kprintf("Address space benchmark: out of memory\n");
+            address_space_destroy(parent);
+            return;
+        }
+    }
+
+    for (uint32_t r = 0; r < BENCH_AS_ROUNDS; r++) {
+        uint64_t start = timing_read_tsc();
+        address_space_t* as = address_space_create();
+        create += timing_get_elapsed_ticks(start);
+        address_space_destroy(as);
+
+        start = timing_read_tsc();
+        address_space_t* child = address_space_clone(parent);
+        clone += timing_get_elapsed_ticks(start);
+        if (child == NULL) {
+            kprintf("Address space benchmark: clone failed\n");
+            break;
+        }
+
+        // The child's writes copy the shared pages; the parent is then the
+        // only owner and just gets its pages back writable
+        address_space_switch(child);
+        copy_faults += bench_as_touch();
+        address_space_switch(parent);
+        reuse_faults += bench_as_touch();
+        address_space_switch(kernel);
+        address_space_destroy(child);
+    }
+
+    address_space_destroy(parent);
+
+    uint32_t faults = BENCH_AS_ROUNDS * BENCH_AS_PAGES;
+    kprintf("Address space benchmark (%u user pages):\n", BENCH_AS_PAGES);
+    kprintf("  create+destroy:   %u cycles\n", bench_per(create, BENCH_AS_ROUNDS));
+    kprintf("  clone:            %u cycles\n", bench_per(clone, BENCH_AS_ROUNDS));
+    kprintf("  COW fault, copy:  %u cycles\n", bench_per(copy_faults, faults));
+    kprintf("  COW fault, reuse: %u cycles\n", bench_per(reuse_faults, faults));
+    kprintf("  pages leaked:     %d\n", (int32_t)(free_before - pmm_get_stats().free_pages));
+}
+
+#define BENCH_VM_ROUNDS 256
+#define BENCH_VM_SIZE   (16 * PAGE_SIZE)
+
+// Cycles per vmalloc/vfree pair, purging after every free or lazily
+static uint64_t bench_vmalloc_round(int purge_each) {
+    uint64_t start = timing_read_tsc();
+    for (uint32_t r = 0; r < BENCH_VM_ROUNDS; r++) {
+        void* p = vmalloc(BENCH_VM_SIZE);
+        if (p == NULL) {
+            return 0;
+        }
+        *(volatile uint32_t*)p = r;
+        vfree(p);
+        if (purge_each) {
+            vmalloc_purge();
+        }
+    }
+    vmalloc_purge();
+    return timing_get_elapsed_ticks(start);
+}
+
+// vmalloc/vfree cost with batched TLB purging against a flush per free
+void bench_vmalloc(void) {
+    uint32_t purges = vmalloc_get_stats().purges;
+    uint64_t lazy = bench_vmalloc_round(0);
+    uint32_t lazy_purges = vmalloc_get_stats().purges - purges;
+    uint64_t eager = bench_vmalloc_round(1);
+
+    kprintf("vmalloc benchmark (%u KB areas):\n", BENCH_VM_SIZE / 1024);
+    kprintf("  lazy purge:  %u cycles/pair (%u flushes)\n",
+            bench_per(lazy, BENCH_VM_ROUNDS), lazy_purges);
+    kprintf("  eager purge: %u cycles/pair (%u flushes)\n",
+            bench_per(eager, BENCH_VM_ROUNDS), BENCH_VM_ROUNDS);
+}
+
+#define BENCH_ATA_PAGES  64       // 256K per command batch
+#define BENCH_ATA_ROUNDS 16
+
+static uint64_t bench_ata_round(int (*read)(uint32_t, uint64_t, uint32_t, void*),
+                                uint32_t drive, uint32_t sectors, void* buf, int* result) {
+    uint64_t start = timing_read_tsc();
+    for (uint32_t r = 0; r < BENCH_ATA_ROUNDS && *result == ATA_SUCCESS; r++) {
+        *result = read(drive, 0, sectors, buf);
+    }
+    return timing_get_elapsed_ticks(start);
+}
+
+// Read throughput of the first disk, PIO against bus master DMA. Reads
+// only, from the start of the disk, so the boot disk is safe to use; QEMU
+// serves repeats from the host page cache, leaving the transfer path.
+void bench_ata(void) {
+    initcall_require("ata");
+    const ata_drive_t* drive = NULL;
+    uint32_t index = 0;
+    for (; index < ATA_MAX_DRIVES && drive == NULL; index++) {
+        drive = ata_get_drive(index);
+    }
+    if (drive == NULL) {
+        kprintf("ATA benchmark: no disk, skipped\n");
+        return;
+    }
+    index--;
+
+    uint32_t sectors = BENCH_ATA_PAGES * PMM_PAGE_SIZE / ATA_SECTOR_SIZE;
+    if (drive->sectors < sectors) {
+        sectors = (uint32_t)drive->sectors;
+    }
+    void* buf = pmm_alloc_pages(BENCH_ATA_PAGES);
+    if (buf == NULL) {
+        kprintf("ATA benchmark: out of memory\n");
+        return;
+    }
+
+    uint64_t bytes = (uint64_t)sectors * ATA_SECTOR_SIZE * BENCH_ATA_ROUNDS;
+    int result = ATA_SUCCESS;
+    uint64_t pio = bench_ata_round(ata_read_pio, index, sectors, buf, &result);
+    kprintf("ATA read, %u KB x %u: PIO %u MB/s", sectors / 2, BENCH_ATA_ROUNDS,
+            result == ATA_SUCCESS ? bench_mbytes(bytes, pio) : 0);
+    if (drive->dma) {
+        result = ATA_SUCCESS;
+        uint64_t dma = bench_ata_round(ata_read_dma, index, sectors, buf, &result);
+        kprintf(", DMA %u MB/s", result == ATA_SUCCESS ? bench_mbytes(bytes, dma) : 0);
+    } else {
+        kprintf(", no DMA");
+    }
+    kprintf("\n");
+    ata_print_stats();
+
+    pmm_free_pages(buf, BENCH_ATA_PAGES);
+}
+
+#define BENCH_VBLK_PAGES    64    // 256K buffer
+#define BENCH_VBLK_REQUESTS 1024  // 4K requests per pass
+
+typedef struct {
+    uint64_t cycles;
+    uint32_t kicks;
+    uint32_t irqs;
+    int result;
+} bench_vblk_pass_t;
+
+// BENCH_VBLK_REQUESTS 4K reads, 'depth' per batch, cycling through the
+// buffer and the start of the disk
+static bench_vblk_pass_t bench_vblk_4k(uint8_t* buf, uint32_t depth, uint64_t sectors) {
+    virtio_blk_stats_t before = virtio_blk_get_stats();
+    bench_vblk_pass_t pass = { 0, 0, 0, VIRTIO_BLK_SUCCESS };
+    virtio_blk_batch_t batch;
+    uint32_t slots = BENCH_VBLK_PAGES;
+    uint32_t blocks = (uint32_t)(sectors / 8);
+
+    uint64_t start = timing_read_tsc();
+    for (uint32_t i = 0; i < BENCH_VBLK_REQUESTS && pass.result == VIRTIO_BLK_SUCCESS; i += depth) {
+        virtio_blk_batch_init(&batch);
+        for (uint32_t j = 0; j < depth; j++) {
+            uint32_t n = i + j;
+            virtio_blk_batch_add(&batch, VIRTIO_BLK_OP_READ, (uint64_t)(n % blocks) * 8, 8,
+                                 buf + (n % slots) * PMM_PAGE_SIZE);
+        }
+        pass.result = virtio_blk_submit(&batch);
+    }
+    pass.cycles = timing_get_elapsed_ticks(start);
+
+    virtio_blk_stats_t after = virtio_blk_get_stats();
+    pass.kicks = after.kicks - before.kicks;
+    pass.irqs = after.irqs - before.irqs;
+    return pass;
+}
+
+static void bench_vblk_report(const char* name, bench_vblk_pass_t pass, uint64_t bytes, uint32_t requests) {
+    if (pass.result != VIRTIO_BLK_SUCCESS) {
+        kprintf("  %-18s failed (%d)\n", name, pass.result);
+        return;
+    }
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+    uint32_t us = cycles_per_us ? (uint32_t)div_u64_u32(pass.cycles, cycles_per_us, NULL) : 0;
+    kprintf("  %-18s %5u MB/s %7u IOPS %5u kicks %5u IRQs\n", name, bench_mbytes(bytes, pass.cycles),
+            us ? (uint32_t)div_u64_u32((uint64_t)requests * 1000000, us, NULL) : 0, pass.kicks, pass.irqs);
+}
+
+// virtio-blk reads from the disk image behind "make run-virtio": 4K
+// requests one per batch against a full batch per notification, then
+// whole 128K requests. Reads only.
+void bench_virtio_blk(void) {
+    initcall_require("virtio_blk");
+    uint64_t sectors = virtio_blk_capacity();
+    if (!virtio_blk_present() || sectors < BENCH_VBLK_PAGES * 8) {
+        kprintf("virtio-blk benchmark: no disk, skipped\n");
+        return;
+    }
+    uint8_t* buf = (uint8_t*)pmm_alloc_pages(BENCH_VBLK_PAGES);
+    if (buf == NULL) {
+        kprintf("virtio-blk benchmark: out of memory\n");
+        return;
+    }
+
+    uint64_t bytes = (uint64_t)BENCH_VBLK_REQUESTS * PMM_PAGE_SIZE;
+    kprintf("virtio-blk reads, %u x 4K:\n", BENCH_VBLK_REQUESTS);
+    bench_vblk_report("1 per batch", bench_vblk_4k(buf, 1, sectors), bytes, BENCH_VBLK_REQUESTS);
+    bench_vblk_report("32 per batch", bench_vblk_4k(buf, VIRTIO_BLK_BATCH_MAX, sectors), bytes,
+                      BENCH_VBLK_REQUESTS);
+
+    // 128K requests, two per 256K buffer
+    virtio_blk_stats_t before = virtio_blk_get_stats();
+    bench_vblk_pass_t pass = { 0, 0, 0, VIRTIO_BLK_SUCCESS };
+    uint32_t large = BENCH_VBLK_REQUESTS / 32;
+    uint64_t start = timing_read_tsc();
+    for (uint32_t i = 0; i < large && pass.result == VIRTIO_BLK_SUCCESS; i += 2) {
+        pass.result = virtio_blk_read(0, BENCH_VBLK_PAGES * 8, buf);
+    }
+    pass.cycles = timing_get_elapsed_ticks(start);
+    virtio_blk_stats_t after = virtio_blk_get_stats();
+    pass.kicks = after.kicks - before.kicks;
+    pass.irqs = after.irqs - before.irqs;
+    bench_vblk_report("128K requests", pass, (uint64_t)large * 128 * 1024, large);
+    virtio_blk_print_stats();
+
+    pmm_free_pages(buf, BENCH_VBLK_PAGES);
+}
+
+void bench_run_all(void) {
+    kprintf("Running benchmarks...\n");
+    bench_kprintf();
+    bench_ksnprintf();
+    bench_memory();
+    bench_tlb();
+    bench_address_space();
+    bench_vmalloc();
+    bench_blit();
+    bench_fb();
+    bench_ata();
+    bench_virtio_blk();
+}
+
+#endif
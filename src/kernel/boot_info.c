@@ -0,0 +1,195 @@
+#include "kernel/boot_info.h"
+#include "lib/kprintf.h"
+#include "lib/string.h"
+#include <stdint.h>
+
+// Magic values the loaders leave in EAX
+#define MULTIBOOT_LOADER_MAGIC  0x2BADB002
+#define MULTIBOOT2_LOADER_MAGIC 0x36D76289
+
+// Multiboot information flags and field offsets
+#define MB1_INFO_MEMORY      0x00000001
+#define MB1_INFO_MMAP        0x00000040
+#define MB1_INFO_LOADER_NAME 0x00000200
+#define MB1_INFO_FRAMEBUFFER 0x00001000
+#define MB1_MEM_UPPER        8
+#define MB1_MMAP_LENGTH      44
+#define MB1_MMAP_ADDR        48
+#define MB1_LOADER_NAME      64
+#define MB1_FRAMEBUFFER      88
+
+// Multiboot2 tags
+#define MB2_TAG_END         0
+#define MB2_TAG_LOADER_NAME 2
+#define MB2_TAG_MMAP        6
+#define MB2_TAG_FRAMEBUFFER 8
+#define MB2_TAG_ALIGN       8
+
+// Set by multiboot_entry; 0 when the boot sector started the kernel
+extern uint32_t multiboot_magic;
+extern uint32_t multiboot_info;
+
+static boot_info_t boot_info;
+
+typedef struct __attribute__((packed)) {
+    uint32_t size;          // Of the rest of the entry
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+} mb1_mmap_entry_t;
+
+typedef struct __attribute__((packed)) {
+    uint64_t base;
+    uint64_t length;
+    uint32_t type;
+    uint32_t reserved;
+} mb2_mmap_entry_t;
+
+// Framebuffer fields, laid out the same in both specifications
+typedef struct __attribute__((packed)) {
+    uint64_t addr;
+    uint32_t pitch;
+    uint32_t width;
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t type;
+} mb_framebuffer_t;
+
+static void boot_add_region(uint64_t base, uint64_t length, uint32_t type) {
+    if (boot_info.memory_region_count >= BOOT_MAX_MEMORY_REGIONS || length == 0) {
+        return;
+    }
+    boot_memory_region_t* region = &boot_info.memory_regions[boot_info.memory_region_count++];
+    region->base = base;
+    region->length = length;
+    region->type = type;
+}
+
+static void boot_set_loader_name(const char* name) {
+    uint32_t i = 0;
+    for (; name[i] != '\0' && i < sizeof(boot_info.loader_name) - 1; i++) {
+        boot_info.loader_name[i] = name[i];
+    }
+    boot_info.loader_name[i] = '\0';
+}
+
+// Multiboot types: 0 indexed colour, 1 direct RGB, 2 EGA text. Indexed
+// modes are reported as no framebuffer; nothing here can draw to them.
+static void boot_set_framebuffer(const mb_framebuffer_t* fb) {
+    if (fb->type != 1 && fb->type != 2) {
+        return;
+    }
+    boot_info.framebuffer.addr = fb->addr;
+    boot_info.framebuffer.pitch = fb->pitch;
+    boot_info.framebuffer.width = fb->width;
+    boot_info.framebuffer.height = fb->height;
+    boot_info.framebuffer.bpp = fb->bpp;
+    boot_info.framebuffer.type = fb->type == 1 ? BOOT_FRAMEBUFFER_RGB : BOOT_FRAMEBUFFER_TEXT;
+}
+
+static void boot_parse_multiboot(const uint8_t* info) {
+    uint32_t flags = *(const uint32_t*)info;
+
+    if (flags & MB1_INFO_MMAP) {
+        uint32_t addr = *(const uint32_t*)(info + MB1_MMAP_ADDR);
+        uint32_t end = addr + *(const uint32_t*)(info + MB1_MMAP_LENGTH);
+        while (addr < end) {
+            const mb1_mmap_entry_t* entry = (const mb1_mmap_entry_t*)addr;
+            boot_add_region(entry->base, entry->length, entry->type);
+            addr += entry->size + sizeof(entry->size);
+        }
+    } else if (flags & MB1_INFO_MEMORY) {
+        // No map: mem_upper is the KB of RAM contiguous from 1MB
+        uint32_t upper_kb = *(const uint32_t*)(info + MB1_MEM_UPPER);
+        boot_add_region(0x100000, (uint64_t)upper_kb * 1024, BOOT_MEMORY_AVAILABLE);
+    }
+    if (flags & MB1_INFO_LOADER_NAME) {
+        boot_set_loader_name((const char*)*(const uint32_t*)(info + MB1_LOADER_NAME));
+    }
+    if (flags & MB1_INFO_FRAMEBUFFER) {
+        boot_set_framebuffer((const mb_framebuffer_t*)(info + MB1_FRAMEBUFFER));
+    }
+}
+
+static void boot_parse_multiboot2(const uint8_t* info) {
+    uint32_t total_size = *(const uint32_t*)info;
+    const uint8_t* tag = info + 8;
+
+    while (tag < info + total_size) {
+        uint32_t type = *(const uint32_t*)tag;
+        uint32_t size = *(const uint32_t*)(tag + 4);
+        if (type == MB2_TAG_END) {
+            break;
+        }
+
+        switch (type) {
+            case MB2_TAG_LOADER_NAME:
+                boot_set_loader_name((const char*)(tag + 8));
+                break;
+            case MB2_TAG_MMAP: {
+                uint32_t entry_size = *(const uint32_t*)(tag + 8);
+                for (uint32_t offset = 16; entry_size != 0 && offset + entry_size <= size;
+                     offset += entry_size) {
+                    const mb2_mmap_entry_t* entry = (const mb2_mmap_entry_t*)(tag + offset);
+                    boot_add_region(entry->base, entry->length, entry->type);
+                }
+                break;
+            }
+            case MB2_TAG_FRAMEBUFFER:
+                boot_set_framebuffer((const mb_framebuffer_t*)(tag + 8));
+                break;
+        }
+        tag += (size + MB2_TAG_ALIGN - 1) & ~(MB2_TAG_ALIGN - 1);
+    }
+}
+
+void boot_info_init(void) {
+    // .bss is not cleared on the legacy path, so start from scratch
+    memset(&boot_info, 0, sizeof(boot_info));
+
+    if (multiboot_magic == MULTIBOOT_LOADER_MAGIC) {
+        boot_info.loader = BOOT_LOADER_MULTIBOOT;
+        boot_parse_multiboot((const uint8_t*)multiboot_info);
+    } else if (multiboot_magic == MULTIBOOT2_LOADER_MAGIC) {
+        boot_info.loader = BOOT_LOADER_MULTIBOOT2;
+        boot_parse_multiboot2((const uint8_t*)multiboot_info);
+    } else {
+        boot_info.loader = BOOT_LOADER_LEGACY;
+        kprintf("Boot: started by the LikeOS boot sector\n");
+        return;
+    }
+
+    kprintf("Boot: Multiboot%s loader \"%s\", %u memory map entries\n",
+            boot_info.loader == BOOT_LOADER_MULTIBOOT2 ? "2" : "",
+            boot_info.loader_name[0] ? boot_info.loader_name : "unknown",
+            boot_info.memory_region_count);
+    for (uint32_t i = 0; i < boot_info.memory_region_count; i++) {
+        const boot_memory_region_t* region = &boot_info.memory_regions[i];
+        kprintf("  0x%08x%08x - %u KB %s\n", (uint32_t)(region->base >> 32), (uint32_t)region->base,
+                (uint32_t)(region->length >> 10),
+                region->type == BOOT_MEMORY_AVAILABLE ? "available" : "reserved");
+    }
+    if (boot_info.framebuffer.type == BOOT_FRAMEBUFFER_RGB) {
+        kprintf("Boot: framebuffer %ux%ux%u at 0x%08x\n", boot_info.framebuffer.width,
+                boot_info.framebuffer.height, boot_info.framebuffer.bpp,
+                (uint32_t)boot_info.framebuffer.addr);
+    }
+}
+
+const boot_info_t* boot_info_get(void) {
+    return &boot_info;
+}
+
+int boot_info_memory_usable(uint64_t base, uint64_t length) {
+    if (boot_info.memory_region_count == 0) {
+        return 1;
+    }
+    for (uint32_t i = 0; i < boot_info.memory_region_count; i++) {
+        const boot_memory_region_t* region = &boot_info.memory_regions[i];
+        if (region->type == BOOT_MEMORY_AVAILABLE && base >= region->base &&
+            base + length <= region->base + region->length) {
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,181 @@
+#include "kernel/cpu.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+// CPUID.1:EDX feature bits
+#define CPUID_EDX_TSC     0x00000010
+#define CPUID_EDX_PGE     0x00002000
+#define CPUID_EDX_PAT     0x00010000
+#define CPUID_EDX_CLFLUSH 0x00080000
+#define CPUID_EDX_FXSR    0x01000000
+#define CPUID_EDX_SSE     0x02000000
+#define CPUID_EDX_SSE2    0x04000000
+
+// CPUID.1:ECX feature bits
+#define CPUID_ECX_X2APIC       0x00200000
+#define CPUID_ECX_TSC_DEADLINE 0x01000000
+
+// CPUID.7.0:EBX feature bits
+#define CPUID_7_EBX_ERMS 0x00000200
+
+// Extended leaves
+#define CPUID_EXT_BASE       0x80000000
+#define CPUID_EXT_FEATURES   0x80000001
+#define CPUID_EXT_POWER      0x80000007
+#define CPUID_EXT_EDX_RDTSCP 0x08000000
+#define CPUID_POWER_EDX_INVARIANT_TSC 0x00000100
+
+// Control register bits needed before the first SSE instruction
+#define CR0_MP         0x00000002
+#define CR0_EM         0x00000004
+#define CR4_OSFXSR     0x00000200
+#define CR4_OSXMMEXCPT 0x00000400
+
+// Used until leaf 1 reports the CLFLUSH line size
+#define CPU_DEFAULT_LINE_SIZE 64
+
+static uint32_t cpu_feature_bits = 0;
+static uint32_t cpu_line_size = CPU_DEFAULT_LINE_SIZE;
+static cpu_cache_t cpu_caches[CPU_MAX_CACHES];
+static uint32_t cpu_cache_count = 0;
+
+// SSE state is never saved or restored: tasks run to completion and
+// interrupt handlers do not touch XMM registers, so enabling it is all
+// that is needed before SSE2 code paths may run.
+static void cpu_enable_sse(void) {
+    uint32_t cr0, cr4;
+
+    __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
+    cr0 = (cr0 & ~CR0_EM) | CR0_MP;
+    __asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0));
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    cr4 |= CR4_OSFXSR | CR4_OSXMMEXCPT;
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4));
+}
+
+// Deterministic cache parameters (leaf 4), one subleaf per cache until
+// the type field reads 0. CPUs without leaf 4 simply report none.
+static void cpu_probe_caches(uint32_t max_leaf) {
+    uint32_t eax, ebx, ecx, edx;
+
+    if (max_leaf < 4) {
+        return;
+    }
+    for (uint32_t i = 0; cpu_cache_count < CPU_MAX_CACHES; i++) {
+        cpu_cpuid_count(4, i, &eax, &ebx, &ecx, &edx);
+        uint32_t type = eax & 0x1F;
+        if (type == 0) {
+            break;
+        }
+
+        cpu_cache_t* cache = &cpu_caches[cpu_cache_count++];
+        uint32_t partitions = ((ebx >> 12) & 0x3FF) + 1;
+        cache->type = type;
+        cache->level = (eax >> 5) & 0x7;
+        cache->shared_by = ((eax >> 14) & 0xFFF) + 1;
+        cache->ways = ((ebx >> 22) & 0x3FF) + 1;
+        cache->line_size = (ebx & 0xFFF) + 1;
+        cache->sets = ecx + 1;
+        cache->size = cache->ways * partitions * cache->line_size * cache->sets;
+    }
+}
+
+static void cpu_print_caches(void) {
+    for (uint32_t i = 0; i < cpu_cache_count; i++) {
+        const cpu_cache_t* cache = &cpu_caches[i];
+        const char* kind = cache->type == CPU_CACHE_DATA ? "d" :
+                           cache->type == CPU_CACHE_INSTRUCTION ? "i" : "";
+        kprintf("CPU: L%u%s %uK, %u-way, %u-byte lines, shared by %u\n", cache->level, kind,
+                cache->size / 1024, cache->ways, cache->line_size, cache->shared_by);
+    }
+}
+
+void cpu_init(void) {
+    uint32_t max_leaf, max_ext, eax, ebx, ecx, edx;
+    char vendor[13];
+
+    cpu_cpuid(0, &max_leaf, &ebx, &ecx, &edx);
+    *(uint32_t*)&vendor[0] = ebx;
+    *(uint32_t*)&vendor[4] = edx;
+    *(uint32_t*)&vendor[8] = ecx;
+    vendor[12] = '\0';
+
+    cpu_cpuid(1, &eax, &ebx, &ecx, &edx);
+    uint32_t need = CPUID_EDX_FXSR | CPUID_EDX_SSE | CPUID_EDX_SSE2;
+    if ((edx & need) == need) {
+        cpu_enable_sse();
+        cpu_feature_bits |= CPU_FEATURE_SSE2;
+    }
+    if (edx & CPUID_EDX_TSC) {
+        cpu_feature_bits |= CPU_FEATURE_TSC;
+    }
+    if (edx & CPUID_EDX_PGE) {
+        cpu_feature_bits |= CPU_FEATURE_PGE;
+    }
+    if (edx & CPUID_EDX_PAT) {
+        cpu_feature_bits |= CPU_FEATURE_PAT;
+    }
+    if (edx & CPUID_EDX_CLFLUSH) {
+        cpu_feature_bits |= CPU_FEATURE_CLFLUSH;
+        cpu_line_size = ((ebx >> 8) & 0xFF) * 8;
+    }
+    if (ecx & CPUID_ECX_X2APIC) {
+        cpu_feature_bits |= CPU_FEATURE_X2APIC;
+    }
+    if (ecx & CPUID_ECX_TSC_DEADLINE) {
+        cpu_feature_bits |= CPU_FEATURE_TSC_DEADLINE;
+    }
+
+    if (max_leaf >= 7) {
+        cpu_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx);
+        if (ebx & CPUID_7_EBX_ERMS) {
+            cpu_feature_bits |= CPU_FEATURE_ERMS;
+        }
+    }
+
+    cpu_cpuid(CPUID_EXT_BASE, &max_ext, &ebx, &ecx, &edx);
+    if (max_ext >= CPUID_EXT_FEATURES) {
+        cpu_cpuid(CPUID_EXT_FEATURES, &eax, &ebx, &ecx, &edx);
+        if (edx & CPUID_EXT_EDX_RDTSCP) {
+            cpu_feature_bits |= CPU_FEATURE_RDTSCP;
+        }
+    }
+    if (max_ext >= CPUID_EXT_POWER) {
+        cpu_cpuid(CPUID_EXT_POWER, &eax, &ebx, &ecx, &edx);
+        if (edx & CPUID_POWER_EDX_INVARIANT_TSC) {
+            cpu_feature_bits |= CPU_FEATURE_INVARIANT_TSC;
+        }
+    }
+
+    cpu_probe_caches(max_leaf);
+
+    kprintf("CPU: %s,%s%s%s%s%s%s%s%s\n", vendor,
+            cpu_has(CPU_FEATURE_SSE2) ? " sse2" : "",
+            cpu_has(CPU_FEATURE_ERMS) ? " erms" : "",
+            cpu_has(CPU_FEATURE_INVARIANT_TSC) ? " invariant-tsc" : "",
+            cpu_has(CPU_FEATURE_TSC_DEADLINE) ? " tsc-deadline" : "",
+            cpu_has(CPU_FEATURE_RDTSCP) ? " rdtscp" : "",
+            cpu_has(CPU_FEATURE_PAT) ? " pat" : "",
+            cpu_has(CPU_FEATURE_PGE) ? " pge" : "",
+            cpu_has(CPU_FEATURE_X2APIC) ? " x2apic" : "");
+    cpu_print_caches();
+}
+
+uint32_t cpu_features(void) {
+    return cpu_feature_bits;
+}
+
+int cpu_has_sse2(void) {
+    return cpu_has(CPU_FEATURE_SSE2);
+}
+
+// Coherency line size; 64 until cpu_init() has read CPUID
+uint32_t cpu_cache_line_size(void) {
+    return cpu_line_size;
+}
+
+// Caches found in leaf 4, L1 first. Returns how many there are.
+uint32_t cpu_get_caches(const cpu_cache_t** caches) {
+    *caches = cpu_caches;
+    return cpu_cache_count;
+}
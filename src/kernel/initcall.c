@@ -0,0 +1,137 @@
+#include "kernel/initcall.h"
+#include "kernel/task.h"
+#include "lib/kprintf.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Set by the linker script around the .initcall section
+extern initcall_t __initcall_start[];
+extern initcall_t __initcall_end[];
+
+static uint64_t boot_start_tsc = 0;
+static uint64_t boot_ready_tsc = 0;
+
+static int initcall_name_equal(const char* a, const char* b) {
+    while (*a != '\0' && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+static initcall_t* initcall_find(const char* name) {
+    for (initcall_t* call = __initcall_start; call < __initcall_end; call++) {
+        if (initcall_name_equal(call->name, name)) {
+            return call;
+        }
+    }
+    return NULL;
+}
+
+// Depth-first: a step still RUNNING when it is reached again is part of a
+// cycle
+static int initcall_run(initcall_t* call) {
+    if (call->state == INITCALL_DONE) {
+        return 0;
+    }
+    if (call->state == INITCALL_RUNNING) {
+        kprintf("Init: dependency cycle through %s\n", call->name);
+        return -1;
+    }
+
+    call->state = INITCALL_RUNNING;
+    for (uint32_t i = 0; i < INITCALL_MAX_DEPS && call->deps[i] != NULL; i++) {
+        initcall_t* dep = initcall_find(call->deps[i]);
+        if (dep == NULL) {
+            kprintf("Init: %s needs unknown step %s\n", call->name, call->deps[i]);
+            call->state = INITCALL_PENDING;
+            return -1;
+        }
+        if (initcall_run(dep) != 0) {
+            call->state = INITCALL_PENDING;
+            return -1;
+        }
+    }
+
+    call->start_tsc = timing_read_tsc();
+    call->fn();
+    call->end_tsc = timing_read_tsc();
+    call->state = INITCALL_DONE;
+    return 0;
+}
+
+int initcall_run_boot(void) {
+    int result = 0;
+
+    boot_start_tsc = timing_read_tsc();
+    for (initcall_t* call = __initcall_start; call < __initcall_end; call++) {
+        if (!(call->flags & INITCALL_DEFERRED) && initcall_run(call) != 0) {
+            result = -1;
+        }
+    }
+    boot_ready_tsc = timing_read_tsc();
+    return result;
+}
+
+int initcall_require(const char* name) {
+    initcall_t* call = initcall_find(name);
+    if (call == NULL) {
+        return -1;
+    }
+    return initcall_run(call);
+}
+
+static initcall_t* initcall_next_deferred(void) {
+    for (initcall_t* call = __initcall_start; call < __initcall_end; call++) {
+        if (call->state == INITCALL_PENDING && (call->flags & INITCALL_DEFERRED)) {
+            return call;
+        }
+    }
+    return NULL;
+}
+
+// One step per task, so keyboard input is handled between steps. Each
+// task queues the next; the last one prints the timeline.
+static void initcall_deferred_task(void* arg) {
+    (void)arg;
+    initcall_t* call = initcall_next_deferred();
+    if (call == NULL) {
+        initcall_print_timeline();
+        return;
+    }
+    if (initcall_run(call) != 0) {
+        // Keep a broken step from being picked again
+        call->state = INITCALL_DONE;
+    }
+    task_spawn(initcall_deferred_task, NULL);
+}
+
+void initcall_run_deferred(void) {
+    task_spawn(initcall_deferred_task, NULL);
+}
+
+static uint32_t initcall_us(uint64_t cycles, uint32_t cycles_per_us) {
+    return cycles_per_us ? (uint32_t)div_u64_u32(cycles, cycles_per_us, NULL) : 0;
+}
+
+void initcall_print_timeline(void) {
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+
+    kprintf("Boot timeline (us):\n");
+    kprintf("  %10s %10s  %s\n", "start", "duration", "step");
+    for (initcall_t* call = __initcall_start; call < __initcall_end; call++) {
+        if (call->start_tsc == 0) {
+            kprintf("  %10s %10s  %s\n", "-", "-", call->name);
+            continue;
+        }
+        kprintf("  %10u %10u  %s%s\n", initcall_us(call->start_tsc - boot_start_tsc, cycles_per_us),
+                initcall_us(call->end_tsc - call->start_tsc, cycles_per_us), call->name,
+                (call->flags & INITCALL_DEFERRED) ? " (deferred)" : "");
+    }
+    kprintf("  System ready after %u us\n", initcall_us(boot_ready_tsc - boot_start_tsc, cycles_per_us));
+}
@@ -4,52 +4,61 @@ void kernel_main(void) __attribute__((section(".text")));
 #include <stdint.h>
 #include "lib/kprintf.h"
 #include "lib/timing.h"
+#include "lib/klog.h"
+#include "lib/blit.h"
 #include "interrupt/idt.h"
 #include "drivers/keyboard.h"
 #include "drivers/vga.h"
+#include "drivers/serial.h"
+#include "drivers/pci.h"
+#include "drivers/ata.h"
+#include "drivers/virtio_blk.h"
 #include "memory/paging.h"
 #include "memory/pmm.h"
+#include "memory/address_space.h"
+#include "memory/vmalloc.h"
+#include "kernel/task.h"
+#include "kernel/spinlock.h"
+#include "kernel/cpu.h"
+#include "kernel/static_call.h"
+#include "kernel/bench.h"
+#include "kernel/boot_info.h"
+#include "kernel/initcall.h"
+
+// The bootloader jumps to the start of .text, so kernel_main must stay the
+// first function in this file; everything else goes below it. Multiboot
+// loaders enter through multiboot_entry (src/boot/multiboot.asm) instead.
+static void idle_loop(void) __attribute__((noreturn));
 
 void kernel_main(void) {
     kclear_screen();
+    // Boot messages leave the hardware cursor to the idle loop
+    kprintf_set_lazy_cursor(1);
     kprintf("LikeOS-NG kernel booting...\n");
     kprintf("Enabled protected mode.\n");
     
-    // Enable A20 gate early to access memory above 1MB
-    enable_a20_gate();
-    
-    // Initialize timing subsystem early
-    timing_init();
-    
-    idt_install();
-    kprintf("IDT initialized.\n");
-    
-    kprintf("Initializing memory management...\n");
-    pmm_init();
-    pmm_print_stats();
-    pmm_print_memory_map();
-    
-    paging_init();
-    setup_identity_mapping();
-    setup_kernel_heap();
-    enable_pae_paging();
-    kprintf("PAE paging is now active.\n");
-    get_memory_stats();
-    
-    keyboard_init();
-    kprintf("Keyboard initialized.\n");
-    
-    vga_init();
-    kprintf("VGA driver initialized.\n");
-    
-    irq_install();
-    kprintf("IRQ handlers installed.\n");
+    // The boot steps and what each needs are the INITCALL table below
+    if (initcall_run_boot() != 0) {
+        kprintf("Init: some boot steps were skipped\n");
+    }
     kprintf("Enabling interrupts...\n");
     
     // Enable interrupts
     __asm__ __volatile__("sti");
     
     kprintf("System ready.\n");    
+    
+#ifdef CONFIG_LOCK_STATS
+    lock_stats_print();
+#endif
+
+    // The rest of init runs from the idle loop, which then prints the
+    // boot timeline
+    initcall_run_deferred();
+    
+#ifdef CONFIG_BENCHMARKS
+    bench_run_all();
+#endif
 
 #if 0
     kprintf("Switching to VESA 1024x768 graphics mode in 3 seconds...\n");
@@ -69,5 +78,111 @@ void kernel_main(void) {
     // Just halt the system
 #endif
 
-    for (;;) { __asm__ __volatile__("hlt"); }
+    // From here on sinks drain the log from a deferred task
+    klog_set_deferred(1);
+    idle_loop();
+}
+
+// Boot steps, in the order they ran before the table existed. Dependencies
+// are listed in full so the table order only breaks ties.
+
+// Copy what a Multiboot loader passed before anything can overwrite it
+INITCALL(boot_info, boot_info_init, 0);
+
+// Enable A20 gate early to access memory above 1MB
+INITCALL(a20, enable_a20_gate, 0);
+
+// Probe CPUID, then patch memcpy, page zeroing, the TSC read and EOI to
+// the best variants before anything hot runs
+INITCALL(cpu, cpu_init, 0);
+INITCALL(static_call, static_call_init, 0, "cpu");
+INITCALL(timing, timing_init, 0, "static_call");
+
+// Per-CPU run queues are needed before memory init zeroes its pools
+INITCALL(task, task_init, 0);
+
+static void init_idt(void) {
+    idt_install();
+    kprintf("IDT initialized.\n");
+}
+INITCALL(idt, init_idt, 0);
+
+static void init_pmm(void) {
+    kprintf("Initializing memory management...\n");
+    pmm_init();
+}
+INITCALL(pmm, init_pmm, 0, "boot_info", "a20", "static_call", "task");
+
+static void init_paging(void) {
+    paging_init();
+    setup_identity_mapping();
+    setup_kernel_heap();
+    enable_pae_paging();
+    kprintf("PAE paging is now active.\n");
+}
+INITCALL(paging, init_paging, 0, "pmm");
+INITCALL(address_space, address_space_init, 0, "paging");
+INITCALL(vmalloc, vmalloc_init, 0, "paging");
+
+static void init_keyboard(void) {
+    keyboard_init();
+    kprintf("Keyboard initialized.\n");
+}
+INITCALL(keyboard, init_keyboard, 0, "idt", "task");
+
+static void init_irq(void) {
+    irq_install();
+    kprintf("IRQ handlers installed.\n");
+}
+INITCALL(irq, init_irq, 0, "idt", "timing", "keyboard");
+
+// Registers the serial log sink, which replays the boot log so far
+static void init_serial(void) {
+    serial_init();
+}
+INITCALL(serial, init_serial, 0, "irq");
+
+// Not needed before the console is interactive. A mode switch that comes
+// first pulls in the video steps itself (vga_set_vesa_mode_1024x768()).
+static void init_memory_report(void) {
+    pmm_print_stats();
+    pmm_print_memory_map();
+    get_memory_stats();
+}
+INITCALL(memory_report, init_memory_report, INITCALL_DEFERRED, "address_space", "vmalloc");
+INITCALL(pci, pci_init, INITCALL_DEFERRED);
+INITCALL(blit, blit_init, INITCALL_DEFERRED, "cpu");
+
+static void init_vga(void) {
+    vga_init();
+    kprintf("VGA driver initialized.\n");
+}
+INITCALL(vga, init_vga, INITCALL_DEFERRED, "pci", "blit", "vmalloc");
+
+// No disk is needed to boot; ata_init() reports what it finds
+static void init_ata(void) {
+    ata_init();
+}
+INITCALL(ata, init_ata, INITCALL_DEFERRED, "pci", "irq", "paging");
+
+static void init_virtio_blk(void) {
+    virtio_blk_init();
+}
+INITCALL(virtio_blk, init_virtio_blk, INITCALL_DEFERRED, "pci", "irq", "vmalloc");
+
+// Run deferred tasks, halt when there is nothing left to do
+static void idle_loop(void) {
+    for (;;) {
+        task_run_pending();
+        kprintf_sync_cursor();
+        
+        // Only halt if no IRQ queued work since the last check; "sti; hlt"
+        // opens the interrupt window on the hlt itself, so no wakeup is lost
+        __asm__ __volatile__("cli");
+        if (task_pending()) {
+            __asm__ __volatile__("sti");
+            continue;
+        }
+        __asm__ __volatile__("sti; hlt");
+    }
 }
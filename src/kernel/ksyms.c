@@ -0,0 +1,54 @@
+#include "kernel/ksyms.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+// Provided by the generated ksyms_table.c
+extern const uint32_t ksym_count;
+extern const uint32_t ksym_addrs[];
+extern const uint32_t ksym_name_offsets[];
+extern const char ksym_names[];
+
+// End of kernel code (kernel.ld)
+extern char __text_end[];
+
+uint32_t ksym_total(void) {
+    return ksym_count;
+}
+
+const char* ksym_name(uint32_t index) {
+    if (index >= ksym_count) {
+        return NULL;
+    }
+    return &ksym_names[ksym_name_offsets[index]];
+}
+
+// Binary search for the last symbol at or below addr
+int32_t ksym_index(uint32_t addr) {
+    if (ksym_count == 0 || addr < ksym_addrs[0] || addr >= (uint32_t)__text_end) {
+        return -1;
+    }
+
+    uint32_t lo = 0;
+    uint32_t hi = ksym_count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ksym_addrs[mid] <= addr) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    return (int32_t)lo;
+}
+
+const char* ksym_lookup(uint32_t addr, uint32_t* offset) {
+    int32_t index = ksym_index(addr);
+    if (index < 0) {
+        return NULL;
+    }
+    if (offset) {
+        *offset = addr - ksym_addrs[index];
+    }
+    return ksym_name((uint32_t)index);
+}
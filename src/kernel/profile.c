@@ -0,0 +1,275 @@
+#include "kernel/profile.h"
+#include "kernel/ksyms.h"
+#include "kernel/cpu.h"
+#include "lib/kprintf.h"
+#include "lib/klog.h"
+#include "lib/ksnprintf.h"
+#include "lib/timing.h"
+#include "memory/pmm.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+#define PROFILE_RING_MASK  (PROFILE_RING_SIZE - 1)
+#define PROFILE_RING_PAGES ((PROFILE_RING_SIZE * sizeof(profile_sample_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+
+// Frame pointers are only followed inside identity-mapped low memory
+#define PROFILE_STACK_LIMIT 0x2000000
+
+// One folded-stack line: up to PROFILE_MAX_DEPTH + 1 symbols and a count
+#define PROFILE_LINE_MAX 512
+
+// Per-CPU sample ring. Only the timer IRQ on the owning CPU writes it; once
+// full, the oldest samples are overwritten so the ring holds the most
+// recent PROFILE_RING_SIZE ticks.
+typedef struct {
+    profile_sample_t* samples;
+    volatile uint32_t count;  // Samples recorded since the last reset
+} profile_cpu_t;
+
+static profile_cpu_t profile_cpus[CPU_MAX];
+static volatile int profile_running = 0;
+static uint32_t profile_flags = 0;
+static uint32_t profile_hz = 0;
+
+void profile_reset(void) {
+    for (uint32_t cpu = 0; cpu < CPU_MAX; cpu++) {
+        profile_cpus[cpu].count = 0;
+    }
+}
+
+// Start sampling at 'hz' ticks per second (0 = PROFILE_DEFAULT_HZ)
+int profile_start(uint32_t hz, uint32_t flags) {
+    if (profile_running) {
+        return 0;
+    }
+
+    // Sample buffers come from the PMM on first use to keep .bss small
+    for (uint32_t cpu = 0; cpu < cpu_online_count(); cpu++) {
+        if (profile_cpus[cpu].samples == NULL) {
+            profile_cpus[cpu].samples = (profile_sample_t*)pmm_alloc_pages(PROFILE_RING_PAGES);
+            if (profile_cpus[cpu].samples == NULL) {
+                kprintf("Profile: cannot allocate sample buffer for CPU%u\n", cpu);
+                return -1;
+            }
+        }
+    }
+
+    profile_reset();
+    profile_flags = flags;
+    profile_hz = timing_set_timer_frequency(hz ? hz : PROFILE_DEFAULT_HZ);
+    __atomic_store_n(&profile_running, 1, __ATOMIC_RELEASE);
+
+    kprintf("Profile: sampling at %u Hz%s\n", profile_hz,
+            (flags & PROFILE_CALLCHAIN) ? " with call chains" : "");
+    return 0;
+}
+
+void profile_stop(void) {
+    if (!profile_running) {
+        return;
+    }
+    __atomic_store_n(&profile_running, 0, __ATOMIC_RELEASE);
+    timing_set_timer_frequency(0);
+}
+
+int profile_is_running(void) {
+    return profile_running;
+}
+
+// Called from the timer IRQ with the interrupted context
+void profile_tick(struct interrupt_frame* frame) {
+    if (!__atomic_load_n(&profile_running, __ATOMIC_ACQUIRE)) {
+        return;
+    }
+
+    profile_cpu_t* pc = &profile_cpus[cpu_current_id()];
+    if (pc->samples == NULL) {
+        return;
+    }
+
+    profile_sample_t* sample = &pc->samples[pc->count & PROFILE_RING_MASK];
+    sample->eip = frame->eip;
+    sample->depth = 0;
+
+    if (profile_flags & PROFILE_CALLCHAIN) {
+        // Each frame holds the caller's EBP at [ebp] and the return
+        // address at [ebp + 4]; frames must move up the stack
+        uint32_t ebp = frame->ebp;
+        while (sample->depth < PROFILE_MAX_DEPTH && ebp != 0 && !(ebp & 3) &&
+               ebp < PROFILE_STACK_LIMIT - 8) {
+            uint32_t* fp = (uint32_t*)ebp;
+            if (fp[1] == 0) {
+                break;
+            }
+            sample->callchain[sample->depth++] = fp[1];
+            if (fp[0] <= ebp) {
+                break;
+            }
+            ebp = fp[0];
+        }
+    }
+
+    pc->count++;
+}
+
+// Append a symbol for a code address and 'suffix' to line[*len]; return
+// addresses are looked up at addr - 1 so calls at the very end of a
+// function resolve correctly. Truncates at the end of the line buffer.
+static void profile_format_symbol(char* line, uint32_t* len, uint32_t addr, int is_return,
+                                  const char* suffix) {
+    const char* name = ksym_lookup(is_return ? addr - 1 : addr, NULL);
+    uint32_t room = PROFILE_LINE_MAX - *len;
+    int n = name ? ksnprintf(line + *len, room, "%s%s", name, suffix)
+                 : ksnprintf(line + *len, room, "0x%08x%s", addr, suffix);
+
+    *len += (uint32_t)n < room ? (uint32_t)n : room - 1;
+}
+
+// Number of valid samples on a CPU and the index of the oldest one
+static uint32_t profile_cpu_window(profile_cpu_t* pc, uint32_t* first) {
+    uint32_t count = pc->count;
+    uint32_t valid = count > PROFILE_RING_SIZE ? PROFILE_RING_SIZE : count;
+    *first = count - valid;
+    return valid;
+}
+
+// Flat profile: self samples per function, highest first
+void profile_dump_flat(uint32_t max_entries) {
+    uint32_t nsyms = ksym_total();
+    uint32_t buckets = nsyms + 1;  // Last bucket collects unknown addresses
+    uint32_t pages = (buckets * sizeof(uint32_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE;
+    uint32_t* hits = (uint32_t*)pmm_alloc_pages(pages);
+    uint32_t total = 0;
+    uint32_t lost = 0;
+
+    if (hits == NULL) {
+        kprintf("Profile: cannot allocate histogram\n");
+        return;
+    }
+
+    for (uint32_t cpu = 0; cpu < cpu_online_count(); cpu++) {
+        profile_cpu_t* pc = &profile_cpus[cpu];
+        if (pc->samples == NULL) {
+            continue;
+        }
+        uint32_t first;
+        uint32_t valid = profile_cpu_window(pc, &first);
+        lost += pc->count - valid;
+        for (uint32_t i = 0; i < valid; i++) {
+            int32_t index = ksym_index(pc->samples[(first + i) & PROFILE_RING_MASK].eip);
+            hits[index < 0 ? nsyms : (uint32_t)index]++;
+            total++;
+        }
+    }
+
+    kprintf("Flat profile: %u samples at %u Hz (%u overwritten)\n", total, profile_hz, lost);
+    kprintf("  %6s %8s  %s\n", "self%", "samples", "function");
+    if (total == 0) {
+        pmm_free_pages(hits, pages);
+        return;
+    }
+
+    // Repeatedly pick the hottest bucket; fine for a few dozen lines
+    for (uint32_t n = 0; n < max_entries; n++) {
+        uint32_t best = 0;
+        for (uint32_t i = 1; i < buckets; i++) {
+            if (hits[i] > hits[best]) {
+                best = i;
+            }
+        }
+        if (hits[best] == 0) {
+            break;
+        }
+        kprintf("  %5u%% %8u  %s\n", (hits[best] * 100) / total, hits[best],
+                best < nsyms ? ksym_name(best) : "[unknown]");
+        hits[best] = 0;
+    }
+
+    pmm_free_pages(hits, pages);
+}
+
+// Symbol indices of a sample's frames, outermost first. Returns the count.
+static uint32_t profile_sample_frames(const profile_sample_t* sample, int32_t* frames) {
+    uint32_t n = 0;
+    for (uint32_t i = sample->depth; i > 0; i--) {
+        frames[n++] = ksym_index(sample->callchain[i - 1] - 1);
+    }
+    frames[n++] = ksym_index(sample->eip);
+    return n;
+}
+
+// Folded stacks ("outer;inner;leaf count"), as consumed by flamegraph.pl.
+// Runs of identical consecutive stacks are merged into one line. Each
+// line is formatted whole and handed to klog_dump(), so a long dump is
+// neither split across log records nor throttled by the serial sink.
+void profile_dump_folded(void) {
+    static const char begin[] = "# folded stacks begin\n";
+    static const char end[] = "# folded stacks end\n";
+    char line[PROFILE_LINE_MAX];
+    int32_t frames[PROFILE_MAX_DEPTH + 1];
+    int32_t prev[PROFILE_MAX_DEPTH + 1];
+    uint32_t prev_n = 0;
+    uint32_t run = 0;
+    const profile_sample_t* prev_sample = NULL;
+
+    klog_dump(begin, sizeof(begin) - 1);
+    for (uint32_t cpu = 0; cpu < cpu_online_count(); cpu++) {
+        profile_cpu_t* pc = &profile_cpus[cpu];
+        if (pc->samples == NULL) {
+            continue;
+        }
+        uint32_t first;
+        uint32_t valid = profile_cpu_window(pc, &first);
+
+        for (uint32_t i = 0; i <= valid; i++) {
+            const profile_sample_t* sample = NULL;
+            uint32_t n = 0;
+            int same = 0;
+
+            if (i < valid) {
+                sample = &pc->samples[(first + i) & PROFILE_RING_MASK];
+                n = profile_sample_frames(sample, frames);
+                same = (run > 0 && n == prev_n);
+                for (uint32_t f = 0; same && f < n; f++) {
+                    same = (frames[f] == prev[f]);
+                }
+            }
+
+            if (same) {
+                run++;
+                continue;
+            }
+
+            // Flush the previous run
+            if (run > 0) {
+                uint32_t len = 0;
+                for (uint32_t f = prev_sample->depth; f > 0; f--) {
+                    profile_format_symbol(line, &len, prev_sample->callchain[f - 1], 1, ";");
+                }
+                profile_format_symbol(line, &len, prev_sample->eip, 0, "");
+
+                // Keep the count and newline even if the stack was cut short
+                if (len > PROFILE_LINE_MAX - 16) {
+                    len = PROFILE_LINE_MAX - 16;
+                }
+                len += ksnprintf(line + len, PROFILE_LINE_MAX - len, " %u\n", run);
+                klog_dump(line, len);
+            }
+
+            if (sample) {
+                for (uint32_t f = 0; f < n; f++) {
+                    prev[f] = frames[f];
+                }
+                prev_n = n;
+                prev_sample = sample;
+                run = 1;
+            } else {
+                run = 0;
+            }
+        }
+    }
+    klog_dump(end, sizeof(end) - 1);
+}
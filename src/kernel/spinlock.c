@@ -0,0 +1,65 @@
+#include "kernel/spinlock.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+#ifdef CONFIG_LOCK_STATS
+
+#define NULL ((void*)0)
+
+// Every lock that has been taken at least once, newest first
+static lock_stats_t* lock_stats_list = NULL;
+
+// Called with the lock held, so only one CPU can register a given lock
+static void lock_stats_register(lock_stats_t* stats) {
+    stats->registered = 1;
+    lock_stats_t* head = __atomic_load_n(&lock_stats_list, __ATOMIC_ACQUIRE);
+    do {
+        stats->next = head;
+    } while (!__atomic_compare_exchange_n(&lock_stats_list, &head, stats, 0,
+                                          __ATOMIC_RELEASE, __ATOMIC_ACQUIRE));
+}
+
+void lock_stats_acquired(lock_stats_t* stats, uint64_t wait_start, int contended) {
+    uint64_t now = timing_read_tsc();
+
+    if (!stats->registered) {
+        lock_stats_register(stats);
+    }
+
+    stats->acquisitions++;
+    if (contended) {
+        stats->contended++;
+        stats->spin_cycles += now - wait_start;
+    }
+    stats->hold_start = now;
+}
+
+void lock_stats_released(lock_stats_t* stats) {
+    uint64_t held = timing_read_tsc() - stats->hold_start;
+
+    if (held > 0xFFFFFFFFULL) {
+        held = 0xFFFFFFFFULL;
+    }
+    if ((uint32_t)held > stats->max_hold_cycles) {
+        stats->max_hold_cycles = (uint32_t)held;
+    }
+}
+
+void lock_stats_print(void) {
+    kprintf("Lock Statistics:\n");
+
+    for (lock_stats_t* s = lock_stats_list; s != NULL; s = s->next) {
+        kprintf("  %s: %u acquired, %u contended, %u Kcycles spinning, max hold %u cycles\n",
+                s->name ? s->name : "(anon)",
+                s->acquisitions, s->contended,
+                (uint32_t)(s->spin_cycles >> 10), s->max_hold_cycles);
+    }
+}
+
+#else
+
+void lock_stats_print(void) {
+    kprintf("Lock statistics disabled (build with LOCK_STATS=1)\n");
+}
+
+#endif
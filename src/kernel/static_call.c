@@ -0,0 +1,67 @@
+#include "kernel/static_call.h"
+#include "kernel/cpu.h"
+#include "kernel/ksyms.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+#define STATIC_CALL_JMP 0xE9
+
+extern const static_call_entry_t __static_call_start[];
+extern const static_call_entry_t __static_call_end[];
+
+static const char* static_call_name(void* addr) {
+    const char* name = ksym_lookup((uint32_t)addr, NULL);
+    return name ? name : "?";
+}
+
+// Point one jump at 'target'. Only the BSP runs at this point, with
+// interrupts off, so the four-byte store cannot be observed half done.
+static void static_call_patch(uint8_t* site, void* target) {
+    int32_t rel = (int32_t)((uint32_t)target - ((uint32_t)site + 5));
+    uint32_t flags = cpu_irq_save();
+    *(volatile int32_t*)(site + 1) = rel;
+    cpu_irq_restore(flags);
+}
+
+// Pick and install the best candidate for every static call
+void static_call_init(void) {
+    uint32_t features = cpu_features();
+    uint32_t calls = 0;
+
+    for (const static_call_entry_t* e = __static_call_start; e < __static_call_end; e++) {
+        // Handle each call at its first candidate only
+        int seen = 0;
+        for (const static_call_entry_t* prev = __static_call_start; prev < e && !seen; prev++) {
+            seen = (prev->site == e->site);
+        }
+        if (seen) {
+            continue;
+        }
+
+        if (e->site[0] != STATIC_CALL_JMP) {
+            kprintf("Static call: %s is not a jump, not patched\n", static_call_name(e->site));
+            continue;
+        }
+
+        const static_call_entry_t* best = NULL;
+        for (const static_call_entry_t* c = e; c < __static_call_end && best == NULL; c++) {
+            if (c->site == e->site && (c->features & features) == c->features) {
+                best = c;
+            }
+        }
+        if (best == NULL) {
+            continue;  // Keep the default
+        }
+
+        static_call_patch(e->site, best->target);
+        kprintf("Static call: %s -> %s\n", static_call_name(e->site), static_call_name(best->target));
+        calls++;
+    }
+
+    // Serialize so the new jumps are fetched fresh
+    uint32_t eax, ebx, ecx, edx;
+    cpu_cpuid(0, &eax, &ebx, &ecx, &edx);
+    kprintf("Static call: %u calls patched\n", calls);
+}
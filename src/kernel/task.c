@@ -0,0 +1,266 @@
+#include "kernel/task.h"
+#include "kernel/cpu.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+#define TASK_DEQUE_MASK (TASK_DEQUE_SIZE - 1)
+
+typedef struct {
+    task_fn_t fn;
+    void* arg;
+} task_t;
+
+// Chase-Lev deque. Only the owning CPU moves bottom; thieves race on top
+// with compare-and-swap. A slot is only reused once top has moved past it,
+// so a thief that read a stale slot always loses its CAS.
+typedef struct {
+    volatile uint32_t top;
+    volatile uint32_t bottom;
+    task_t slots[TASK_DEQUE_SIZE];
+    task_stats_t stats;
+} __attribute__((aligned(64))) task_deque_t;
+
+static task_deque_t task_deques[CPU_MAX];
+
+// Shared state for one task_parallel_for() call (lives on the caller's stack)
+typedef struct {
+    task_range_fn_t fn;
+    void* arg;
+    uint32_t start;
+    uint32_t end;
+    uint32_t grain;
+    uint32_t chunks;
+    volatile uint32_t next_chunk;
+    volatile uint32_t refs;
+} parallel_for_t;
+
+void task_init(void) {
+    for (int i = 0; i < CPU_MAX; i++) {
+        task_deques[i].top = 0;
+        task_deques[i].bottom = 0;
+        task_stats_t empty = {0};
+        task_deques[i].stats = empty;
+    }
+    kprintf("Task: %u CPU run queue(s), %u slots each\n",
+            cpu_online_count(), TASK_DEQUE_SIZE);
+}
+
+// Owner-side push. Interrupts are disabled so an IRQ on this CPU that
+// spawns work cannot interleave with a push or pop in progress.
+static int deque_push(task_deque_t* dq, task_fn_t fn, void* arg) {
+    uint32_t flags = cpu_irq_save();
+    uint32_t b = dq->bottom;
+    uint32_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+
+    if (b - t >= TASK_DEQUE_SIZE) {
+        cpu_irq_restore(flags);
+        return -1;
+    }
+
+    dq->slots[b & TASK_DEQUE_MASK].fn = fn;
+    dq->slots[b & TASK_DEQUE_MASK].arg = arg;
+    __atomic_store_n(&dq->bottom, b + 1, __ATOMIC_RELEASE);
+
+    dq->stats.spawned++;
+    if (b + 1 - t > dq->stats.max_depth) {
+        dq->stats.max_depth = b + 1 - t;
+    }
+    cpu_irq_restore(flags);
+    return 0;
+}
+
+// Owner-side pop from the bottom
+static int deque_pop(task_deque_t* dq, task_t* out) {
+    uint32_t flags = cpu_irq_save();
+    uint32_t b = dq->bottom - 1;
+    __atomic_store_n(&dq->bottom, b, __ATOMIC_SEQ_CST);
+    uint32_t t = __atomic_load_n(&dq->top, __ATOMIC_SEQ_CST);
+    int found = 1;
+
+    if ((int32_t)(b - t) < 0) {
+        // Deque was empty
+        dq->bottom = t;
+        found = 0;
+    } else {
+        *out = dq->slots[b & TASK_DEQUE_MASK];
+        if (b == t) {
+            // Last element: race against thieves for it. A failed CAS
+            // overwrites 'expected', so restore bottom from b.
+            uint32_t expected = t;
+            if (!__atomic_compare_exchange_n(&dq->top, &expected, t + 1, 0,
+                                             __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+                found = 0;
+            }
+            dq->bottom = b + 1;
+        }
+    }
+    cpu_irq_restore(flags);
+    return found;
+}
+
+// Thief-side steal from the top
+static int deque_steal(task_deque_t* dq, task_t* out) {
+    uint32_t t = __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE);
+    uint32_t b = __atomic_load_n(&dq->bottom, __ATOMIC_ACQUIRE);
+
+    if ((int32_t)(b - t) <= 0) {
+        return 0;
+    }
+
+    task_t item = dq->slots[t & TASK_DEQUE_MASK];
+    if (!__atomic_compare_exchange_n(&dq->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    *out = item;
+    return 1;
+}
+
+// Queue a task on the current CPU. Returns 0 if it was queued, or 1 if the
+// deque was full and the task was run immediately instead.
+int task_spawn(task_fn_t fn, void* arg) {
+    if (fn == NULL) {
+        return -1;
+    }
+
+    task_deque_t* dq = &task_deques[cpu_current_id()];
+    if (deque_push(dq, fn, arg) == 0) {
+        return 0;
+    }
+
+    // Interrupt handlers spawn tasks too and may run them right here, so
+    // counters they share with task context use atomic increments
+    __atomic_fetch_add(&dq->stats.overflows, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&dq->stats.executed, 1, __ATOMIC_RELAXED);
+    fn(arg);
+    return 1;
+}
+
+// Run a single task: local work first, then try to steal from other CPUs
+int task_run_one(void) {
+    uint32_t self = cpu_current_id();
+    task_deque_t* dq = &task_deques[self];
+    task_t task;
+
+    if (deque_pop(dq, &task)) {
+        __atomic_fetch_add(&dq->stats.executed, 1, __ATOMIC_RELAXED);
+        task.fn(task.arg);
+        return 1;
+    }
+
+    uint32_t online = cpu_online_count();
+    for (uint32_t i = 1; i < online; i++) {
+        uint32_t victim = (self + i) % online;
+        dq->stats.steal_attempts++;
+        if (deque_steal(&task_deques[victim], &task)) {
+            dq->stats.stolen++;
+            __atomic_fetch_add(&dq->stats.executed, 1, __ATOMIC_RELAXED);
+            task.fn(task.arg);
+            return 1;
+        }
+        dq->stats.steal_failures++;
+    }
+    return 0;
+}
+
+// Run tasks until no work is left anywhere. Returns the number executed.
+uint32_t task_run_pending(void) {
+    uint32_t count = 0;
+    while (task_run_one()) {
+        count++;
+    }
+    return count;
+}
+
+// Check whether the current CPU has queued work
+int task_pending(void) {
+    task_deque_t* dq = &task_deques[cpu_current_id()];
+    return (int32_t)(dq->bottom - __atomic_load_n(&dq->top, __ATOMIC_ACQUIRE)) > 0;
+}
+
+// Claim and run chunks until the range is exhausted
+static void parallel_for_run_chunks(parallel_for_t* pf) {
+    for (;;) {
+        uint32_t chunk = __atomic_fetch_add(&pf->next_chunk, 1, __ATOMIC_RELAXED);
+        if (chunk >= pf->chunks) {
+            return;
+        }
+        uint32_t lo = pf->start + chunk * pf->grain;
+        uint32_t hi = lo + pf->grain;
+        if (hi > pf->end || hi < lo) {
+            hi = pf->end;
+        }
+        pf->fn(lo, hi, pf->arg);
+    }
+}
+
+static void parallel_for_helper(void* arg) {
+    parallel_for_t* pf = (parallel_for_t*)arg;
+    parallel_for_run_chunks(pf);
+    __atomic_fetch_sub(&pf->refs, 1, __ATOMIC_RELEASE);
+}
+
+// Split [start, end) into chunks of 'grain' iterations and run them on all
+// online CPUs. Chunks are claimed dynamically, so uneven chunks balance out.
+// The caller takes part and returns once every chunk has completed.
+void task_parallel_for(uint32_t start, uint32_t end, uint32_t grain,
+                       task_range_fn_t fn, void* arg) {
+    if (fn == NULL || end <= start) {
+        return;
+    }
+    if (grain == 0) {
+        grain = 1;
+    }
+
+    parallel_for_t pf;
+    pf.fn = fn;
+    pf.arg = arg;
+    pf.start = start;
+    pf.end = end;
+    pf.grain = grain;
+    pf.chunks = (end - start + grain - 1) / grain;
+    pf.next_chunk = 0;
+
+    // One helper per additional CPU, never more than there are chunks
+    uint32_t helpers = cpu_online_count() - 1;
+    if (helpers > pf.chunks - 1) {
+        helpers = pf.chunks - 1;
+    }
+    pf.refs = helpers + 1;
+
+    for (uint32_t i = 0; i < helpers; i++) {
+        task_spawn(parallel_for_helper, &pf);
+    }
+
+    parallel_for_run_chunks(&pf);
+    __atomic_fetch_sub(&pf.refs, 1, __ATOMIC_RELEASE);
+
+    // Helpers still reference pf; run them (or other work) until they finish
+    while (__atomic_load_n(&pf.refs, __ATOMIC_ACQUIRE) != 0) {
+        if (!task_run_one()) {
+            cpu_relax();
+        }
+    }
+}
+
+task_stats_t task_get_stats(uint32_t cpu) {
+    task_stats_t stats = {0};
+    if (cpu < CPU_MAX) {
+        stats = task_deques[cpu].stats;
+    }
+    return stats;
+}
+
+void task_print_stats(void) {
+    kprintf("Task Statistics:\n");
+    for (uint32_t cpu = 0; cpu < cpu_online_count(); cpu++) {
+        task_deque_t* dq = &task_deques[cpu];
+        kprintf("  CPU%u: spawned %u, executed %u, stolen %u, steal attempts %u (%u failed)\n",
+                cpu, dq->stats.spawned, dq->stats.executed, dq->stats.stolen,
+                dq->stats.steal_attempts, dq->stats.steal_failures);
+        kprintf("        queued %u, max depth %u, inline overflows %u\n",
+                dq->bottom - dq->top, dq->stats.max_depth, dq->stats.overflows);
+    }
+}
@@ -0,0 +1,201 @@
+#include "kernel/wait.h"
+#include "kernel/task.h"
+#include "kernel/cpu.h"
+#include <stdint.h>
+
+#define NULL ((void*)0)
+
+// complete_all() sets done to this; waiters never consume it
+#define COMPLETION_DONE_ALL 0x80000000U
+
+void wait_queue_init(wait_queue_t* wq, const char* name) {
+    spin_lock_init(&wq->lock, name);
+    wq->head = NULL;
+    wq->tail = NULL;
+}
+
+// Queue the entry (if it isn't already) and clear its woken flag
+void wait_prepare(wait_queue_t* wq, wait_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    entry->woken = 0;
+    if (!entry->queued) {
+        entry->next = NULL;
+        entry->queued = 1;
+        if (wq->tail) {
+            wq->tail->next = entry;
+        } else {
+            wq->head = entry;
+        }
+        wq->tail = entry;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Remove the entry if no waker has dequeued it yet
+void wait_finish(wait_queue_t* wq, wait_entry_t* entry) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    if (entry->queued) {
+        wait_entry_t* prev = NULL;
+        for (wait_entry_t* cur = wq->head; cur != NULL; prev = cur, cur = cur->next) {
+            if (cur == entry) {
+                if (prev) {
+                    prev->next = cur->next;
+                } else {
+                    wq->head = cur->next;
+                }
+                if (wq->tail == cur) {
+                    wq->tail = prev;
+                }
+                break;
+            }
+        }
+        entry->queued = 0;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Sleep until the entry is woken. Queued tasks are run first since the
+// waker may be one of them; with nothing to run the CPU halts until the
+// next interrupt. Without interrupts enabled we can only spin.
+void wait_sleep(wait_entry_t* entry) {
+    while (!__atomic_load_n(&entry->woken, __ATOMIC_ACQUIRE)) {
+        if (task_run_one()) {
+            continue;
+        }
+
+        uint32_t flags = cpu_irq_save();
+        if (!entry->woken && !task_pending()) {
+            if (flags & CPU_EFLAGS_IF) {
+                // sti takes effect after hlt starts, so no IRQ is missed
+                __asm__ __volatile__("sti; hlt" : : : "memory");
+            } else {
+                cpu_relax();
+            }
+        }
+        cpu_irq_restore(flags);
+    }
+}
+
+// Dequeue and wake up to 'max' waiters in FIFO order
+static uint32_t wake_up_n(wait_queue_t* wq, uint32_t max) {
+    uint32_t count = 0;
+
+    // Cheap check so IRQ handlers don't take the lock with nobody waiting
+    if (__atomic_load_n(&wq->head, __ATOMIC_ACQUIRE) == NULL) {
+        return 0;
+    }
+
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    while (wq->head != NULL && count < max) {
+        wait_entry_t* entry = wq->head;
+        wq->head = entry->next;
+        if (wq->head == NULL) {
+            wq->tail = NULL;
+        }
+        entry->queued = 0;
+        __atomic_store_n(&entry->woken, 1, __ATOMIC_RELEASE);
+        count++;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+    return count;
+}
+
+uint32_t wake_up_one(wait_queue_t* wq) {
+    return wake_up_n(wq, 1);
+}
+
+uint32_t wake_up_all(wait_queue_t* wq) {
+    return wake_up_n(wq, 0xFFFFFFFF);
+}
+
+// Mutex: may sleep, so never take one from interrupt context
+
+void mutex_init(mutex_t* mutex, const char* name) {
+    mutex->locked = 0;
+    wait_queue_init(&mutex->waiters, name);
+}
+
+void mutex_lock(mutex_t* mutex) {
+    while (__atomic_exchange_n(&mutex->locked, 1, __ATOMIC_ACQUIRE)) {
+        wait_event(&mutex->waiters, !__atomic_load_n(&mutex->locked, __ATOMIC_RELAXED));
+    }
+}
+
+int mutex_trylock(mutex_t* mutex) {
+    return !__atomic_exchange_n(&mutex->locked, 1, __ATOMIC_ACQUIRE);
+}
+
+void mutex_unlock(mutex_t* mutex) {
+    __atomic_store_n(&mutex->locked, 0, __ATOMIC_RELEASE);
+    wake_up_one(&mutex->waiters);
+}
+
+// Counting semaphore: semaphore_up() is safe from interrupt context
+
+void semaphore_init(semaphore_t* sem, const char* name, int32_t count) {
+    sem->count = count;
+    wait_queue_init(&sem->waiters, name);
+}
+
+int semaphore_trydown(semaphore_t* sem) {
+    int32_t count = __atomic_load_n(&sem->count, __ATOMIC_RELAXED);
+    while (count > 0) {
+        if (__atomic_compare_exchange_n(&sem->count, &count, count - 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void semaphore_down(semaphore_t* sem) {
+    while (!semaphore_trydown(sem)) {
+        wait_event(&sem->waiters, __atomic_load_n(&sem->count, __ATOMIC_RELAXED) > 0);
+    }
+}
+
+void semaphore_up(semaphore_t* sem) {
+    __atomic_fetch_add(&sem->count, 1, __ATOMIC_RELEASE);
+    wake_up_one(&sem->waiters);
+}
+
+// Completion: complete() and complete_all() are safe from interrupt context
+
+void completion_init(completion_t* comp, const char* name) {
+    comp->done = 0;
+    wait_queue_init(&comp->waiters, name);
+}
+
+void completion_reinit(completion_t* comp) {
+    __atomic_store_n(&comp->done, 0, __ATOMIC_RELEASE);
+}
+
+int try_wait_for_completion(completion_t* comp) {
+    uint32_t done = __atomic_load_n(&comp->done, __ATOMIC_ACQUIRE);
+    while (done != 0) {
+        if (done & COMPLETION_DONE_ALL) {
+            return 1;
+        }
+        if (__atomic_compare_exchange_n(&comp->done, &done, done - 1, 0,
+                                        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void wait_for_completion(completion_t* comp) {
+    while (!try_wait_for_completion(comp)) {
+        wait_event(&comp->waiters, __atomic_load_n(&comp->done, __ATOMIC_ACQUIRE) != 0);
+    }
+}
+
+void complete(completion_t* comp) {
+    __atomic_fetch_add(&comp->done, 1, __ATOMIC_RELEASE);
+    wake_up_one(&comp->waiters);
+}
+
+void complete_all(completion_t* comp) {
+    __atomic_store_n(&comp->done, COMPLETION_DONE_ALL, __ATOMIC_RELEASE);
+    wake_up_all(&comp->waiters);
+}
@@ -0,0 +1,331 @@
+#include "lib/blit.h"
+#include "lib/kprintf.h"
+#include "kernel/cpu.h"
+#include "lib/string.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+static const blit_ops_t* blit_ops = &blit_ops_scalar;
+
+// Blend one 8-bit channel: (s * a + d * (255 - a)) / 255, rounded. The
+// SSE2 kernel uses the same arithmetic, so both give identical pixels.
+static inline uint32_t blit_blend_channel(uint32_t s, uint32_t d, uint32_t a) {
+    uint32_t v = s * a + d * (255 - a) + 128;
+    return (v + (v >> 8)) >> 8;
+}
+
+static inline uint32_t blit_blend_pixel(uint32_t s, uint32_t d) {
+    uint32_t a = s >> 24;
+    uint32_t out = 0;
+
+    if (a == 255) {
+        return s;
+    }
+    for (uint32_t shift = 0; shift < 32; shift += 8) {
+        out |= blit_blend_channel((s >> shift) & 0xFF, (d >> shift) & 0xFF, a) << shift;
+    }
+    return out;
+}
+
+// ---------------------------------------------------------------------------
+// Scalar 32 bpp kernels
+
+static void scalar_fill32(uint32_t* dst, uint32_t color, uint32_t n, int stream) {
+    (void)stream;
+    __asm__ __volatile__("rep stosl"
+                         : "+D"(dst), "+c"(n)
+                         : "a"(color)
+                         : "memory");
+}
+
+static void scalar_copy32(uint32_t* dst, const uint32_t* src, uint32_t n, int stream) {
+    (void)stream;
+    if (dst <= src || dst >= src + n) {
+        __asm__ __volatile__("rep movsl"
+                             : "+D"(dst), "+S"(src), "+c"(n)
+                             :
+                             : "memory");
+    } else if (n > 0) {
+        // Destination overlaps the tail of the source: copy backwards
+        dst += n - 1;
+        src += n - 1;
+        __asm__ __volatile__("std; rep movsl; cld"
+                             : "+D"(dst), "+S"(src), "+c"(n)
+                             :
+                             : "memory");
+    }
+}
+
+static void scalar_glyph32(uint32_t* dst, const uint8_t* bits, uint32_t n,
+                           uint32_t fg, uint32_t bg, int transparent) {
+    for (uint32_t i = 0; i < n; i++) {
+        if (bits[i / 8] & (1 << (i % 8))) {
+            dst[i] = fg;
+        } else if (!transparent) {
+            dst[i] = bg;
+        }
+    }
+}
+
+static void scalar_blend32(uint32_t* dst, const uint32_t* src, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t a = src[i] >> 24;
+        if (a != 0) {
+            dst[i] = blit_blend_pixel(src[i], dst[i]);
+        }
+    }
+}
+
+const blit_ops_t blit_ops_scalar = {
+    .name = "scalar",
+    .fill = scalar_fill32,
+    .copy = scalar_copy32,
+    .glyph = scalar_glyph32,
+    .blend = scalar_blend32,
+};
+
+// ---------------------------------------------------------------------------
+// 16 and 24 bpp pixel access
+
+static inline uint32_t blit_pack(uint32_t bpp, uint32_t color) {
+    if (bpp == 16) {
+        return ((color >> 8) & 0xF800) | ((color >> 5) & 0x07E0) | ((color >> 3) & 0x001F);
+    }
+    return color;
+}
+
+static inline uint32_t blit_unpack(uint32_t bpp, uint32_t pixel) {
+    if (bpp == 16) {
+        uint32_t r = (pixel >> 11) & 0x1F;
+        uint32_t g = (pixel >> 5) & 0x3F;
+        uint32_t b = pixel & 0x1F;
+        return ((r << 3 | r >> 2) << 16) | ((g << 2 | g >> 4) << 8) | (b << 3 | b >> 2);
+    }
+    return pixel;
+}
+
+static inline void blit_store(uint8_t* p, uint32_t bpp, uint32_t value) {
+    if (bpp == 16) {
+        *(uint16_t*)p = (uint16_t)value;
+    } else if (bpp == 24) {
+        p[0] = value & 0xFF;
+        p[1] = (value >> 8) & 0xFF;
+        p[2] = (value >> 16) & 0xFF;
+    } else {
+        *(uint32_t*)p = value;
+    }
+}
+
+static inline uint32_t blit_load(const uint8_t* p, uint32_t bpp) {
+    if (bpp == 16) {
+        return *(const uint16_t*)p;
+    } else if (bpp == 24) {
+        return p[0] | (p[1] << 8) | (p[2] << 16);
+    }
+    return *(const uint32_t*)p;
+}
+
+// ---------------------------------------------------------------------------
+// Clipping
+
+// Clip a rectangle at (x, y) to a surface. *skip_x and *skip_y return how
+// far the origin moved, so a source can be moved by the same amount.
+static int blit_clip(const blit_surface_t* s, int32_t* x, int32_t* y, uint32_t* w, uint32_t* h,
+                     uint32_t* skip_x, uint32_t* skip_y) {
+    *skip_x = 0;
+    *skip_y = 0;
+    if (*x < 0) {
+        if ((uint32_t)-*x >= *w) {
+            return 0;
+        }
+        *skip_x = -*x;
+        *w -= *skip_x;
+        *x = 0;
+    }
+    if (*y < 0) {
+        if ((uint32_t)-*y >= *h) {
+            return 0;
+        }
+        *skip_y = -*y;
+        *h -= *skip_y;
+        *y = 0;
+    }
+    if ((uint32_t)*x >= s->width || (uint32_t)*y >= s->height || *w == 0 || *h == 0) {
+        return 0;
+    }
+    if (*w > s->width - *x) {
+        *w = s->width - *x;
+    }
+    if (*h > s->height - *y) {
+        *h = s->height - *y;
+    }
+    return 1;
+}
+
+static inline uint8_t* blit_addr(const blit_surface_t* s, uint32_t x, uint32_t y) {
+    return (uint8_t*)s->pixels + y * s->pitch + x * (s->bpp / 8);
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+
+void blit_fill(const blit_surface_t* dst, int32_t x, int32_t y, uint32_t w, uint32_t h, uint32_t color) {
+    uint32_t skip_x, skip_y;
+
+    if (!blit_clip(dst, &x, &y, &w, &h, &skip_x, &skip_y)) {
+        return;
+    }
+
+    uint8_t* line = blit_addr(dst, x, y);
+    int stream = (dst->flags & BLIT_SURFACE_DEVICE) != 0;
+
+    if (dst->bpp == 32) {
+        for (uint32_t row = 0; row < h; row++) {
+            blit_ops->fill((uint32_t*)line, color, w, stream);
+            line += dst->pitch;
+        }
+        return;
+    }
+
+    uint32_t bytes = dst->bpp / 8;
+    uint32_t value = blit_pack(dst->bpp, color);
+    for (uint32_t row = 0; row < h; row++) {
+        uint8_t* p = line;
+        for (uint32_t col = 0; col < w; col++) {
+            blit_store(p, dst->bpp, value);
+            p += bytes;
+        }
+        line += dst->pitch;
+    }
+}
+
+void blit_copy(const blit_surface_t* dst, int32_t dx, int32_t dy,
+               const blit_surface_t* src, int32_t sx, int32_t sy, uint32_t w, uint32_t h) {
+    uint32_t skip_x, skip_y;
+
+    if (dst->bpp != src->bpp) {
+        return;
+    }
+
+    // Clip against the destination, then against the source
+    if (!blit_clip(dst, &dx, &dy, &w, &h, &skip_x, &skip_y)) {
+        return;
+    }
+    sx += skip_x;
+    sy += skip_y;
+    if (!blit_clip(src, &sx, &sy, &w, &h, &skip_x, &skip_y)) {
+        return;
+    }
+    dx += skip_x;
+    dy += skip_y;
+
+    uint8_t* d = blit_addr(dst, dx, dy);
+    const uint8_t* s = blit_addr(src, sx, sy);
+    int32_t dpitch = dst->pitch;
+    int32_t spitch = src->pitch;
+
+    // Moving down within one buffer: go bottom-up so no source row is
+    // overwritten before it is read
+    if (d > s && d < s + h * src->pitch) {
+        d += (h - 1) * dst->pitch;
+        s += (h - 1) * src->pitch;
+        dpitch = -dpitch;
+        spitch = -spitch;
+    }
+
+    int stream = (dst->flags & BLIT_SURFACE_DEVICE) != 0;
+    for (uint32_t row = 0; row < h; row++) {
+        if (dst->bpp == 32) {
+            blit_ops->copy((uint32_t*)d, (const uint32_t*)s, w, stream);
+        } else {
+            memmove(d, s, w * (dst->bpp / 8));
+        }
+        d += dpitch;
+        s += spitch;
+    }
+}
+
+void blit_glyph(const blit_surface_t* dst, int32_t x, int32_t y, uint32_t w, uint32_t h,
+                const uint8_t* bits, uint32_t stride, uint32_t fg, uint32_t bg, uint32_t flags) {
+    uint32_t skip_x, skip_y;
+    int transparent = (flags & BLIT_GLYPH_TRANSPARENT) != 0;
+
+    if (!blit_clip(dst, &x, &y, &w, &h, &skip_x, &skip_y)) {
+        return;
+    }
+    bits += skip_y * stride;
+
+    uint8_t* line = blit_addr(dst, x, y);
+    for (uint32_t row = 0; row < h; row++) {
+        if (dst->bpp == 32 && (skip_x & 7) == 0) {
+            blit_ops->glyph((uint32_t*)line, bits + skip_x / 8, w, fg, bg, transparent);
+        } else {
+            uint32_t bytes = dst->bpp / 8;
+            uint32_t fg_value = blit_pack(dst->bpp, fg);
+            uint32_t bg_value = blit_pack(dst->bpp, bg);
+            uint8_t* p = line;
+            for (uint32_t col = 0; col < w; col++) {
+                uint32_t bit = skip_x + col;
+                if (bits[bit / 8] & (1 << (bit % 8))) {
+                    blit_store(p, dst->bpp, fg_value);
+                } else if (!transparent) {
+                    blit_store(p, dst->bpp, bg_value);
+                }
+                p += bytes;
+            }
+        }
+        bits += stride;
+        line += dst->pitch;
+    }
+}
+
+void blit_blend(const blit_surface_t* dst, int32_t x, int32_t y, uint32_t w, uint32_t h,
+                const uint32_t* src, uint32_t src_stride) {
+    uint32_t skip_x, skip_y;
+
+    if (!blit_clip(dst, &x, &y, &w, &h, &skip_x, &skip_y)) {
+        return;
+    }
+    src += skip_y * src_stride + skip_x;
+
+    uint8_t* line = blit_addr(dst, x, y);
+    for (uint32_t row = 0; row < h; row++) {
+        if (dst->bpp == 32) {
+            blit_ops->blend((uint32_t*)line, src, w);
+        } else {
+            uint32_t bytes = dst->bpp / 8;
+            uint8_t* p = line;
+            for (uint32_t col = 0; col < w; col++) {
+                uint32_t a = src[col] >> 24;
+                if (a != 0) {
+                    uint32_t d = blit_unpack(dst->bpp, blit_load(p, dst->bpp));
+                    blit_store(p, dst->bpp, blit_pack(dst->bpp, blit_blend_pixel(src[col], d)));
+                }
+                p += bytes;
+            }
+        }
+        src += src_stride;
+        line += dst->pitch;
+    }
+}
+
+// Use the SSE2 kernels (if the CPU has them) or the scalar ones. Returns
+// the previous setting.
+int blit_set_simd(int enable) {
+    int was_simd = (blit_ops == &blit_ops_sse2);
+    blit_ops = (enable && cpu_has_sse2()) ? &blit_ops_sse2 : &blit_ops_scalar;
+    return was_simd;
+}
+
+const char* blit_backend(void) {
+    return blit_ops->name;
+}
+
+// Pick the kernels for this CPU; cpu_init() must have run
+void blit_init(void) {
+    blit_set_simd(1);
+    kprintf("Blit: using %s kernels\n", blit_backend());
+}
@@ -0,0 +1,151 @@
+// SSE2 row kernels for 32 bpp surfaces. This file alone is built with
+// -msse2; blit_init() only selects these kernels on CPUs that have SSE2.
+#include "lib/blit.h"
+#include <stdint.h>
+
+// gcc's xmmintrin.h pulls in mm_malloc.h, which needs a hosted libc. The
+// kernel never uses _mm_malloc(), so pretend it is already included.
+#define _MM_MALLOC_H_INCLUDED
+#include <emmintrin.h>
+
+// Streaming stores only pay off once a row is larger than a few lines
+#define SSE2_STREAM_MIN 64  // Pixels
+
+static void sse2_fill32(uint32_t* dst, uint32_t color, uint32_t n, int stream) {
+    __m128i v = _mm_set1_epi32(color);
+
+    // Align the destination to 16 bytes
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = color;
+        n--;
+    }
+
+    if (stream && n >= SSE2_STREAM_MIN) {
+        for (; n >= 16; n -= 16, dst += 16) {
+            _mm_stream_si128((__m128i*)dst, v);
+            _mm_stream_si128((__m128i*)(dst + 4), v);
+            _mm_stream_si128((__m128i*)(dst + 8), v);
+            _mm_stream_si128((__m128i*)(dst + 12), v);
+        }
+        _mm_sfence();
+    }
+    for (; n >= 4; n -= 4, dst += 4) {
+        _mm_store_si128((__m128i*)dst, v);
+    }
+    while (n > 0) {
+        *dst++ = color;
+        n--;
+    }
+}
+
+static void sse2_copy32(uint32_t* dst, const uint32_t* src, uint32_t n, int stream) {
+    if (dst > src && dst < src + n) {
+        // Destination overlaps the tail of the source: copy backwards, each
+        // block loaded before anything below it is stored
+        while (n >= 4) {
+            n -= 4;
+            _mm_storeu_si128((__m128i*)(dst + n), _mm_loadu_si128((const __m128i*)(src + n)));
+        }
+        while (n > 0) {
+            n--;
+            dst[n] = src[n];
+        }
+        return;
+    }
+
+    while (n > 0 && ((uintptr_t)dst & 15)) {
+        *dst++ = *src++;
+        n--;
+    }
+
+    if (stream && n >= SSE2_STREAM_MIN && !(dst < src + n && src < dst + n)) {
+        for (; n >= 16; n -= 16, dst += 16, src += 16) {
+            __m128i a = _mm_loadu_si128((const __m128i*)src);
+            __m128i b = _mm_loadu_si128((const __m128i*)(src + 4));
+            __m128i c = _mm_loadu_si128((const __m128i*)(src + 8));
+            __m128i d = _mm_loadu_si128((const __m128i*)(src + 12));
+            _mm_stream_si128((__m128i*)dst, a);
+            _mm_stream_si128((__m128i*)(dst + 4), b);
+            _mm_stream_si128((__m128i*)(dst + 8), c);
+            _mm_stream_si128((__m128i*)(dst + 12), d);
+        }
+        _mm_sfence();
+    }
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        _mm_store_si128((__m128i*)dst, _mm_loadu_si128((const __m128i*)src));
+    }
+    while (n > 0) {
+        *dst++ = *src++;
+        n--;
+    }
+}
+
+// Eight pixels per bitmap byte: broadcast the byte, test one bit per lane
+// and select fg/bg (or the old pixel) with the resulting masks
+static void sse2_glyph32(uint32_t* dst, const uint8_t* bits, uint32_t n,
+                         uint32_t fg, uint32_t bg, int transparent) {
+    const __m128i lo_bits = _mm_set_epi32(8, 4, 2, 1);
+    const __m128i hi_bits = _mm_set_epi32(128, 64, 32, 16);
+    const __m128i vfg = _mm_set1_epi32(fg);
+    const __m128i vbg = _mm_set1_epi32(bg);
+
+    for (; n >= 8; n -= 8, dst += 8) {
+        __m128i b = _mm_set1_epi32(*bits++);
+        __m128i m0 = _mm_cmpeq_epi32(_mm_and_si128(b, lo_bits), lo_bits);
+        __m128i m1 = _mm_cmpeq_epi32(_mm_and_si128(b, hi_bits), hi_bits);
+        __m128i back0 = transparent ? _mm_loadu_si128((const __m128i*)dst) : vbg;
+        __m128i back1 = transparent ? _mm_loadu_si128((const __m128i*)(dst + 4)) : vbg;
+
+        _mm_storeu_si128((__m128i*)dst,
+                         _mm_or_si128(_mm_and_si128(m0, vfg), _mm_andnot_si128(m0, back0)));
+        _mm_storeu_si128((__m128i*)(dst + 4),
+                         _mm_or_si128(_mm_and_si128(m1, vfg), _mm_andnot_si128(m1, back1)));
+    }
+
+    for (uint32_t i = 0; i < n; i++) {
+        if (*bits & (1 << i)) {
+            dst[i] = fg;
+        } else if (!transparent) {
+            dst[i] = bg;
+        }
+    }
+}
+
+// Two pixels widened to 16-bit channels: (s * a + d * (255 - a)) / 255
+// with the same rounding as the scalar kernel
+static inline __m128i sse2_blend_wide(__m128i s, __m128i d) {
+    const __m128i c255 = _mm_set1_epi16(255);
+    const __m128i c128 = _mm_set1_epi16(128);
+
+    __m128i a = _mm_shufflehi_epi16(_mm_shufflelo_epi16(s, 0xFF), 0xFF);
+    __m128i v = _mm_add_epi16(_mm_mullo_epi16(s, a),
+                              _mm_mullo_epi16(d, _mm_sub_epi16(c255, a)));
+    v = _mm_add_epi16(v, c128);
+    return _mm_srli_epi16(_mm_add_epi16(v, _mm_srli_epi16(v, 8)), 8);
+}
+
+static void sse2_blend32(uint32_t* dst, const uint32_t* src, uint32_t n) {
+    const __m128i zero = _mm_setzero_si128();
+
+    for (; n >= 4; n -= 4, dst += 4, src += 4) {
+        __m128i s = _mm_loadu_si128((const __m128i*)src);
+        __m128i d = _mm_loadu_si128((const __m128i*)dst);
+        __m128i lo = sse2_blend_wide(_mm_unpacklo_epi8(s, zero), _mm_unpacklo_epi8(d, zero));
+        __m128i hi = sse2_blend_wide(_mm_unpackhi_epi8(s, zero), _mm_unpackhi_epi8(d, zero));
+        _mm_storeu_si128((__m128i*)dst, _mm_packus_epi16(lo, hi));
+    }
+
+    for (; n > 0; n--, dst++, src++) {
+        __m128i s = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*src), zero);
+        __m128i d = _mm_unpacklo_epi8(_mm_cvtsi32_si128(*dst), zero);
+        *dst = _mm_cvtsi128_si32(_mm_packus_epi16(sse2_blend_wide(s, d), zero));
+    }
+}
+
+const blit_ops_t blit_ops_sse2 = {
+    .name = "sse2",
+    .fill = sse2_fill32,
+    .copy = sse2_copy32,
+    .glyph = sse2_glyph32,
+    .blend = sse2_blend32,
+};
@@ -0,0 +1,376 @@
+#include "lib/klog.h"
+#include "lib/kprintf.h"
+#include "lib/ksnprintf.h"
+#include "lib/timing.h"
+#include "lib/div64.h"
+#include "lib/string.h"
+#include "kernel/cpu.h"
+#include "kernel/spinlock.h"
+#include "kernel/task.h"
+#include <stdint.h>
+
+#define KLOG_MASK (KLOG_RECORDS - 1)
+
+// In deferred mode, a writer that finds this many records unprinted by
+// some sink flushes inline instead of letting the ring wrap
+#define KLOG_BACKLOG_LIMIT (KLOG_RECORDS * 3 / 4)
+
+// QEMU/Bochs debug console: every byte written appears on the host
+#define DEBUGCON_PORT 0xE9
+
+static klog_record_t klog_ring[KLOG_RECORDS];
+static volatile uint32_t klog_head = 0;  // Next sequence number to hand out
+static uint64_t klog_base_tsc = 0;       // Timestamps are relative to the first record
+
+// Serializes draining; writers never take it
+static spinlock_t klog_flush_lock = SPINLOCK_INIT("klog_flush");
+static volatile uint32_t klog_flush_pending = 0;
+static volatile uint32_t klog_flush_queued = 0;
+
+// Until boot reaches the idle loop, and again after a panic, every message
+// is flushed by the CPU that wrote it
+static volatile int klog_deferred = 0;
+
+static void vga_sink_write(const char* text, uint32_t len) {
+    kconsole_write(text, len);
+}
+
+static void debugcon_sink_write(const char* text, uint32_t len) {
+    __asm__ __volatile__("rep outsb"
+                         : "+S"(text), "+c"(len)
+                         : "d"((uint16_t)DEBUGCON_PORT)
+                         : "memory");
+}
+
+klog_sink_t klog_debugcon_sink = {
+    .name = "debugcon",
+    .write = debugcon_sink_write,
+    .enabled = 1,
+};
+
+klog_sink_t klog_vga_sink = {
+    .name = "vga",
+    .write = vga_sink_write,
+    .enabled = 1,
+    .next = &klog_debugcon_sink,
+};
+
+static klog_sink_t* klog_sinks = &klog_vga_sink;
+
+static void klog_format_flush(kformat_out_t* out) {
+    if (out->len > 0) {
+        klog_write((int)(uintptr_t)out->ctx, out->buf, out->len);
+    }
+    out->len = 0;
+}
+
+// Format a message at 'level' into the log. Text longer than one record
+// is split across several.
+void kvlog(int level, const char* format, va_list args) {
+    char buf[KLOG_TEXT_MAX];
+    kformat_out_t out = { buf, sizeof(buf), 0, 0, klog_format_flush, (void*)(uintptr_t)level };
+
+    kvformat(&out, format, args);
+    klog_format_flush(&out);
+}
+
+void klog(int level, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    kvlog(level, format, args);
+    va_end(args);
+}
+
+static void klog_flush_task(void* arg) {
+    (void)arg;
+    // Clear first: a message logged after this point queues a new flush
+    __atomic_store_n(&klog_flush_queued, 0, __ATOMIC_RELEASE);
+    klog_flush();
+}
+
+// Records the slowest sink has not consumed yet. Read without the flush
+// lock; a stale value only moves the inline flush by a record or two.
+static uint32_t klog_backlog(uint32_t head) {
+    uint32_t backlog = 0;
+
+    for (klog_sink_t* sink = klog_sinks; sink != NULL; sink = sink->next) {
+        uint32_t pending = head - __atomic_load_n(&sink->next_seq, __ATOMIC_RELAXED);
+        if (pending > backlog) {
+            backlog = pending;
+        }
+    }
+    return backlog;
+}
+
+// Append one record. Safe from any context, including IRQ handlers and
+// other CPUs; the text is copied and printed later by the sinks.
+void klog_write(int level, const char* text, uint32_t len) {
+    if (len > KLOG_TEXT_MAX) {
+        len = KLOG_TEXT_MAX;
+    }
+
+    uint64_t now = timing_read_tsc();
+    if (klog_base_tsc == 0) {
+        klog_base_tsc = now;
+    }
+
+    uint32_t seq = __atomic_fetch_add(&klog_head, 1, __ATOMIC_RELAXED);
+    klog_record_t* rec = &klog_ring[seq & KLOG_MASK];
+
+    // Readers copy a record and then check that seq did not change, so
+    // mark it as in progress before touching the contents
+    __atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    rec->len = len;
+    rec->level = level;
+    rec->cpu = cpu_current_id();
+    rec->tsc = now;
+    memcpy(rec->text, text, len);
+    __atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+
+    // A task that logs a burst (a profile dump, say) would otherwise
+    // overwrite its own unread records before the flush task gets to run
+    if (!klog_deferred || klog_backlog(seq + 1) >= KLOG_BACKLOG_LIMIT) {
+        klog_flush();
+    } else if (!__atomic_exchange_n(&klog_flush_queued, 1, __ATOMIC_ACQ_REL)) {
+        task_spawn(klog_flush_task, NULL);
+    }
+}
+
+// Copy record 'seq' out of the ring. Returns 0 on success, 1 if it has
+// already been overwritten, or -1 if it has not been committed yet.
+static int klog_read(uint32_t seq, klog_record_t* out) {
+    const klog_record_t* rec = &klog_ring[seq & KLOG_MASK];
+    uint32_t first = __atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE);
+
+    if (first != seq + 1) {
+        return (first != 0 && (int32_t)(first - (seq + 1)) > 0) ? 1 : -1;
+    }
+
+    *out = *rec;
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&rec->seq, __ATOMIC_RELAXED) == first ? 0 : 1;
+}
+
+// Tell a sink about records it did not print
+static void klog_sink_notice(klog_sink_t* sink) {
+    char buf[64];
+    int len = ksnprintf(buf, sizeof(buf), "[klog: %u suppressed, %u lost]\n",
+                        sink->suppressed, sink->lost);
+
+    sink->write(buf, len);
+    sink->suppressed = 0;
+    sink->lost = 0;
+}
+
+// Token bucket: refill at 'rate' per second up to 'burst'
+static int klog_rate_allow(klog_sink_t* sink) {
+    if (sink->rate == 0) {
+        return 1;
+    }
+
+    uint64_t now = timing_read_tsc();
+    uint64_t cycles_per_token = div_u64_u32(timing_get_tsc_frequency(), sink->rate, NULL);
+    if (cycles_per_token == 0) {
+        return 1;  // TSC not calibrated yet
+    }
+    if (cycles_per_token > 0xFFFFFFFFULL) {
+        cycles_per_token = 0xFFFFFFFFULL;
+    }
+
+    uint64_t refill = div_u64_u32(now - sink->last_refill, (uint32_t)cycles_per_token, NULL);
+    if (refill >= sink->burst - sink->tokens) {
+        sink->tokens = sink->burst;
+        sink->last_refill = now;
+    } else if (refill > 0) {
+        sink->tokens += (uint32_t)refill;
+        sink->last_refill += refill * cycles_per_token;
+    }
+
+    if (sink->tokens == 0) {
+        return 0;
+    }
+    sink->tokens--;
+    return 1;
+}
+
+// Print everything a sink has not seen yet. Called with klog_flush_lock held.
+static void klog_drain_sink(klog_sink_t* sink) {
+    klog_record_t rec;
+
+    for (;;) {
+        uint32_t head = __atomic_load_n(&klog_head, __ATOMIC_ACQUIRE);
+        if (sink->next_seq == head) {
+            return;
+        }
+        if (head - sink->next_seq > KLOG_RECORDS) {
+            sink->lost += head - KLOG_RECORDS - sink->next_seq;
+            sink->next_seq = head - KLOG_RECORDS;
+        }
+
+        int result = klog_read(sink->next_seq, &rec);
+        if (result < 0) {
+            return;  // Its writer flushes again once it commits
+        }
+        sink->next_seq++;
+        if (result > 0) {
+            sink->lost++;
+            continue;
+        }
+
+        if (!sink->enabled) {
+            continue;
+        }
+        if (!klog_rate_allow(sink)) {
+            sink->suppressed++;
+            continue;
+        }
+        if (sink->suppressed || sink->lost) {
+            klog_sink_notice(sink);
+        }
+        sink->write(rec.text, rec.len);
+    }
+}
+
+// Drain the ring into every sink. If another CPU (or an interrupted context
+// on this one) is already flushing, it picks up the new records instead.
+void klog_flush(void) {
+    __atomic_store_n(&klog_flush_pending, 1, __ATOMIC_SEQ_CST);
+
+    while (__atomic_load_n(&klog_flush_pending, __ATOMIC_SEQ_CST)) {
+        if (!spin_trylock(&klog_flush_lock)) {
+            return;
+        }
+        do {
+            __atomic_store_n(&klog_flush_pending, 0, __ATOMIC_SEQ_CST);
+            for (klog_sink_t* sink = klog_sinks; sink != NULL; sink = sink->next) {
+                klog_drain_sink(sink);
+            }
+        } while (__atomic_load_n(&klog_flush_pending, __ATOMIC_SEQ_CST));
+        spin_unlock(&klog_flush_lock);
+    }
+}
+
+// Add a sink. It starts with the oldest record still in the ring, so it
+// receives the boot log as well.
+void klog_register_sink(klog_sink_t* sink) {
+    spin_lock(&klog_flush_lock);
+    uint32_t head = klog_head;
+    sink->next_seq = head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+    sink->next = klog_sinks;
+    klog_sinks = sink;
+    spin_unlock(&klog_flush_lock);
+    klog_flush();
+}
+
+void klog_sink_set_rate(klog_sink_t* sink, uint32_t rate, uint32_t burst) {
+    spin_lock(&klog_flush_lock);
+    sink->rate = rate;
+    sink->burst = burst ? burst : 1;
+    sink->tokens = sink->burst;
+    sink->last_refill = timing_read_tsc();
+    spin_unlock(&klog_flush_lock);
+
+    // Messages logged meanwhile found the lock taken
+    klog_flush();
+}
+
+// Switch between flushing from a deferred task and flushing inline
+void klog_set_deferred(int enable) {
+    klog_deferred = enable;
+    klog_flush();
+}
+
+// The panic path may have interrupted a flush in progress; take over and
+// print everything synchronously from now on
+void klog_panic_mode(void) {
+    klog_deferred = 0;
+    spin_lock_init(&klog_flush_lock, "klog_flush");
+    klog_flush();
+}
+
+// "[    12.345678] " relative to the first record
+static uint32_t klog_format_timestamp(char* buf, uint32_t size, uint64_t tsc) {
+    uint32_t cycles_per_us = (uint32_t)div_u64_u32(timing_get_tsc_frequency(), 1000000, NULL);
+    uint64_t us = cycles_per_us ? div_u64_u32(tsc - klog_base_tsc, cycles_per_us, NULL) : 0;
+    uint32_t frac;
+    uint64_t secs = div_u64_u32(us, 1000000, &frac);
+
+    return ksnprintf(buf, size, "[%6llu.%06u] ", secs, frac);
+}
+
+// Bulk output, where a sink would rather wait than drop text
+static void klog_sink_write_sync(klog_sink_t* sink, const char* text, uint32_t len) {
+    if (sink->write_sync) {
+        sink->write_sync(text, len);
+    } else {
+        sink->write(text, len);
+    }
+}
+
+// Print the whole ring with timestamps to every enabled sink, bypassing
+// the ring itself and the rate limits
+void klog_dmesg(void) {
+    klog_record_t rec;
+    char stamp[24];
+
+    klog_flush();
+    spin_lock(&klog_flush_lock);
+
+    uint32_t head = klog_head;
+    uint32_t seq = head > KLOG_RECORDS ? head - KLOG_RECORDS : 0;
+    int line_start = 1;
+
+    for (; seq != head; seq++) {
+        if (klog_read(seq, &rec) != 0) {
+            continue;
+        }
+        uint32_t stamp_len = klog_format_timestamp(stamp, sizeof(stamp), rec.tsc);
+
+        // Split at newlines so every line gets the timestamp of its record
+        uint32_t start = 0;
+        while (start < rec.len) {
+            uint32_t end = start;
+            while (end < rec.len && rec.text[end] != '\n') {
+                end++;
+            }
+            if (end < rec.len) {
+                end++;  // Include the newline
+            }
+            for (klog_sink_t* sink = klog_sinks; sink != NULL; sink = sink->next) {
+                if (!sink->enabled) {
+                    continue;
+                }
+                if (line_start) {
+                    klog_sink_write_sync(sink, stamp, stamp_len);
+                }
+                klog_sink_write_sync(sink, rec.text + start, end - start);
+            }
+            line_start = (rec.text[end - 1] == '\n');
+            start = end;
+        }
+    }
+
+    spin_unlock(&klog_flush_lock);
+
+    // Messages logged meanwhile found the lock taken
+    klog_flush();
+}
+
+// Print text straight to every enabled sink, bypassing the ring and the
+// rate limits, for dumps too large to go through the log. Earlier
+// messages are printed first. Not for interrupt handlers.
+void klog_dump(const char* text, uint32_t len) {
+    klog_flush();
+    spin_lock(&klog_flush_lock);
+    for (klog_sink_t* sink = klog_sinks; sink != NULL; sink = sink->next) {
+        if (sink->enabled) {
+            klog_sink_write_sync(sink, text, len);
+        }
+    }
+    spin_unlock(&klog_flush_lock);
+
+    // Messages logged meanwhile found the lock taken
+    klog_flush();
+}
@@ -1,263 +1,249 @@
 #include <stdarg.h>
 #include "kprintf.h"
-
-// Helper function declarations
-static void kprint_number(int num, int base, int uppercase);
-static void kprint_unsigned(unsigned int num, int base, int uppercase);
-static void kprint_number_padded(int num, int base, int padding);
-static void kprint_unsigned_padded(unsigned int num, int base, int uppercase, int padding);
+#include "klog.h"
+#include "kernel/spinlock.h"
+#include "lib/string.h"
+#include "drivers/vga.h"
+#include "drivers/fbcon.h"
 
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
+#define VGA_ATTR 0x07  // Light gray on black
+
+// The 32KB text window at 0xB8000 holds VGA_PLANE_ROWS rows. The CRTC start
+// address selects which 25 of them are displayed, so scrolling moves the
+// start address instead of copying the screen through slow MMIO.
+#define VGA_PLANE_ROWS 204  // 32KB / 160 bytes per row
+#define VGA_BLANK ((VGA_ATTR << 8) | ' ')
+
+// RAM copy of the most recent lines (power of two). It is the source of
+// truth: VGA memory is only ever written, and redraws and the scrollback
+// view are rebuilt from here.
+#define CONSOLE_SHADOW_LINES 256
+
+static uint16_t shadow[CONSOLE_SHADOW_LINES][VGA_WIDTH];
 
 static int kprint_x = 0;
 static int kprint_y = 0;
 
-// Function to scroll the screen up by one line
-static void scroll_screen(void) {
-    volatile char *video = (char*)0xb8000;
-    
-    // Move all lines up by one line
-    for (int line = 0; line < VGA_HEIGHT - 1; line++) {
-        for (int col = 0; col < VGA_WIDTH; col++) {
-            int dest_pos = (line * VGA_WIDTH + col) * 2;
-            int src_pos = ((line + 1) * VGA_WIDTH + col) * 2;
-            
-            video[dest_pos] = video[src_pos];         // Character
-            video[dest_pos + 1] = video[src_pos + 1]; // Attribute
-        }
-    }
-    
-    // Clear the last line
-    for (int col = 0; col < VGA_WIDTH; col++) {
-        int pos = ((VGA_HEIGHT - 1) * VGA_WIDTH + col) * 2;
-        video[pos] = ' ';      // Space character
-        video[pos + 1] = 0x07; // Attribute (light gray on black)
-    }
+static uint32_t con_top = 0;    // Absolute line number of live screen row 0
+static uint32_t plane_top = 0;  // Plane row that shows line con_top
+static uint32_t view_back = 0;  // Lines the view is scrolled back (0 = live)
+
+// Last values written to the CRTC, or -1 if unknown. Each update costs
+// four port writes (a VM exit apiece under virtualization), so unchanged
+// values are skipped.
+static int hw_cursor_pos = -1;
+static int hw_start = -1;
+static int lazy_cursor = 0;
+static uint32_t cursor_updates = 0;
+
+// Set while a graphics mode is active and the framebuffer console shows
+// the output. The shadow buffer keeps recording so text mode can be
+// repainted on return, but VGA memory and the CRTC are left alone.
+static int on_fbcon = 0;
+
+// Protects the cursor position and the screen contents. Taken with
+// interrupts disabled so IRQ handlers can print without deadlocking.
+static spinlock_t console_lock = SPINLOCK_INIT("console");
+
+static void crtc_write(uint8_t index, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(index), "Nd"((unsigned short)0x3D4));
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"((unsigned short)0x3D5));
 }
 
 // Function to set hardware cursor position
 static void update_hardware_cursor(void) {
-    unsigned short position = (kprint_y * VGA_WIDTH) + kprint_x;
+    if (on_fbcon) {
+        return;
+    }
+    unsigned short position = (plane_top + kprint_y) * VGA_WIDTH + kprint_x;
     
-    // Send the high byte
-    __asm__ __volatile__("outb %0, %1" : : "a"((unsigned char)0x0E), "Nd"((unsigned short)0x3D4));
-    __asm__ __volatile__("outb %0, %1" : : "a"((unsigned char)(position >> 8)), "Nd"((unsigned short)0x3D5));
+    if (position == hw_cursor_pos) {
+        return;
+    }
+    hw_cursor_pos = position;
+    cursor_updates++;
     
-    // Send the low byte
-    __asm__ __volatile__("outb %0, %1" : : "a"((unsigned char)0x0F), "Nd"((unsigned short)0x3D4));
-    __asm__ __volatile__("outb %0, %1" : : "a"((unsigned char)(position & 0xFF)), "Nd"((unsigned short)0x3D5));
+    crtc_write(0x0E, position >> 8);    // Cursor location high byte
+    crtc_write(0x0F, position & 0xFF);  // Cursor location low byte
 }
 
-void kputchar(char c) {
-    volatile char *video = (char*)0xb8000;
-    
-    if (c == '\n') {
-        kprint_x = 0;
-        kprint_y++;
-    } else if (c == '\b') {
-        // Handle backspace
-        if (kprint_x > 0) {
-            kprint_x--;
-        } else if (kprint_y > 0) {
-            // Move to end of previous line
-            kprint_y--;
-            kprint_x = VGA_WIDTH - 1;
-        }
-        // Clear the character at the new cursor position
-        int pos = (kprint_y * VGA_WIDTH + kprint_x) * 2;
-        video[pos] = ' ';      // Replace with space
-        video[pos + 1] = 0x07; // Keep same attribute
-    } else {
-        int pos = (kprint_y * VGA_WIDTH + kprint_x) * 2;
-        video[pos] = c;
-        video[pos + 1] = 0x07;
-        kprint_x++;
-        if (kprint_x >= VGA_WIDTH) {
-            kprint_x = 0;
-            kprint_y++;
-        }
+// Display the 25 plane rows starting at 'row'
+static void set_display_start(uint32_t row) {
+    if (on_fbcon) {
+        return;
     }
-    if (kprint_y >= VGA_HEIGHT) {
-        scroll_screen();
-        kprint_y = VGA_HEIGHT - 1; // Keep cursor on the last line
+    unsigned short start = row * VGA_WIDTH;
+    
+    if (start == hw_start) {
+        return;
     }
+    hw_start = start;
     
-    // Update hardware cursor after each character
-    update_hardware_cursor();
+    crtc_write(0x0C, start >> 8);    // Start address high byte
+    crtc_write(0x0D, start & 0xFF);  // Start address low byte
 }
 
-void kprintf(const char *format, ...) {
-    va_list args;
-    va_start(args, format);
+static uint16_t* shadow_line(uint32_t line) {
+    return shadow[line & (CONSOLE_SHADOW_LINES - 1)];
+}
+
+// Copy one shadow line into a plane row
+static void plane_draw_row(uint32_t row, uint32_t line) {
+    memcpy((uint16_t*)0xb8000 + row * VGA_WIDTH, shadow_line(line), VGA_WIDTH * sizeof(uint16_t));
+}
+
+// Lines of history that can be shown above the live screen
+static uint32_t console_history(void) {
+    uint32_t history = con_top;
     
-    while (*format) {
-        if (*format == '%') {
-            format++;
-            switch (*format) {
-                case 'd': {
-                    int num = va_arg(args, int);
-                    kprint_number(num, 10, 0);
-                    break;
-                }
-                case 'u': {
-                    unsigned int num = va_arg(args, unsigned int);
-                    kprint_unsigned(num, 10, 0);
-                    break;
-                }
-                case 'x': {
-                    unsigned int num = va_arg(args, unsigned int);
-                    kprint_unsigned(num, 16, 0);
-                    break;
-                }
-                case 'X': {
-                    unsigned int num = va_arg(args, unsigned int);
-                    kprint_unsigned(num, 16, 1);
-                    break;
-                }
-                case 'p': {
-                    void* ptr = va_arg(args, void*);
-                    kputchar('0');
-                    kputchar('x');
-                    kprint_unsigned((unsigned int)ptr, 16, 0);
-                    break;
-                }
-                case 'c': {
-                    char c = (char)va_arg(args, int);
-                    kputchar(c);
-                    break;
-                }
-                case 's': {
-                    const char* str = va_arg(args, const char*);
-                    if (str) {
-                        while (*str) {
-                            kputchar(*str++);
-                        }
-                    } else {
-                        // Print "(null)" without recursion
-                        kputchar('(');
-                        kputchar('n');
-                        kputchar('u');
-                        kputchar('l');
-                        kputchar('l');
-                        kputchar(')');
-                    }
-                    break;
-                }
-                case '%': {
-                    kputchar('%');
-                    break;
-                }
-                case '0': {
-                    // Handle zero-padding (e.g., %08x)
-                    int padding = 0;
-                    format++;
-                    while (*format >= '0' && *format <= '9') {
-                        padding = padding * 10 + (*format - '0');
-                        format++;
-                    }
-                    if (*format == 'x') {
-                        unsigned int num = va_arg(args, unsigned int);
-                        kprint_unsigned_padded(num, 16, 0, padding);
-                    } else if (*format == 'X') {
-                        unsigned int num = va_arg(args, unsigned int);
-                        kprint_unsigned_padded(num, 16, 1, padding);
-                    } else if (*format == 'd') {
-                        int num = va_arg(args, int);
-                        kprint_number_padded(num, 10, padding);
-                    }
-                    break;
-                }
-                default:
-                    kputchar('%');
-                    kputchar(*format);
-                    break;
-            }
-        } else {
-            kputchar(*format);
-        }
-        format++;
+    if (history > CONSOLE_SHADOW_LINES - VGA_HEIGHT) {
+        history = CONSOLE_SHADOW_LINES - VGA_HEIGHT;
     }
-    
-    va_end(args);
+    if (history > VGA_PLANE_ROWS - VGA_HEIGHT) {
+        history = VGA_PLANE_ROWS - VGA_HEIGHT;
+    }
+    return history;
 }
 
-static void kprint_number(int num, int base, int uppercase) {
-    if (num < 0) {
-        kputchar('-');
-        num = -num;
+// Redraw the plane from the shadow buffer with 'history' lines above the
+// live screen, which then starts at plane row 'history'
+static void plane_rebase(uint32_t history) {
+    plane_top = history;
+    if (on_fbcon) {
+        return;
+    }
+    for (uint32_t row = 0; row < history + VGA_HEIGHT; row++) {
+        plane_draw_row(row, con_top - history + row);
     }
-    kprint_unsigned((unsigned int)num, base, uppercase);
 }
 
-static void kprint_unsigned(unsigned int num, int base, int uppercase) {
-    char digits[] = "0123456789abcdef";
-    char upper_digits[] = "0123456789ABCDEF";
-    char* digit_set = uppercase ? upper_digits : digits;
+// Function to scroll the screen up by one line
+static void scroll_screen(void) {
+    con_top++;
     
-    if (num == 0) {
-        kputchar('0');
-        return;
+    uint16_t *line = shadow_line(con_top + VGA_HEIGHT - 1);
+    for (int col = 0; col < VGA_WIDTH; col++) {
+        line[col] = VGA_BLANK;
     }
     
-    char buffer[32];
-    int i = 0;
-    
-    while (num > 0) {
-        buffer[i++] = digit_set[num % base];
-        num /= base;
+    if (on_fbcon) {
+        // The plane is rebuilt by kprintf_redraw() on return to text mode
+        return;
+    }
+    if (plane_top + 1 + VGA_HEIGHT > VGA_PLANE_ROWS) {
+        // Bottom of the plane: wrap to the top. This rewrites one screen
+        // once every ~180 lines instead of on every scroll.
+        plane_rebase(0);
+    } else {
+        plane_top++;
+        plane_draw_row(plane_top + VGA_HEIGHT - 1, con_top + VGA_HEIGHT - 1);
     }
+    set_display_start(plane_top);
+}
+
+static void put_cell(int x, int y, uint16_t cell) {
+    volatile uint16_t *video = (uint16_t*)0xb8000;
     
-    while (i > 0) {
-        kputchar(buffer[--i]);
+    shadow_line(con_top + y)[x] = cell;
+    if (on_fbcon) {
+        return;
     }
+    video[(plane_top + y) * VGA_WIDTH + x] = cell;
 }
 
-static void kprint_number_padded(int num, int base, int padding) {
-    if (num < 0) {
-        kputchar('-');
-        num = -num;
-        padding--;
+// Sync the hardware cursor at the end of an output call unless it is
+// deferred to the idle loop
+static void finish_output_locked(void) {
+    if (!lazy_cursor) {
+        update_hardware_cursor();
     }
-    kprint_unsigned_padded((unsigned int)num, base, 0, padding);
 }
 
-static void kprint_unsigned_padded(unsigned int num, int base, int uppercase, int padding) {
-    char digits[] = "0123456789abcdef";
-    char upper_digits[] = "0123456789ABCDEF";
-    char* digit_set = uppercase ? upper_digits : digits;
-    
-    char buffer[32];
-    int i = 0;
-    
-    if (num == 0) {
-        buffer[i++] = '0';
-    } else {
-        while (num > 0) {
-            buffer[i++] = digit_set[num % base];
-            num /= base;
-        }
+// Write a run of characters to the screen. Printable characters are stored
+// as whole cells; the hardware cursor is not touched.
+static void console_write_locked(const char* s, uint32_t len) {
+    // New output returns a scrolled-back view to the live screen
+    if (view_back != 0) {
+        view_back = 0;
+        set_display_start(plane_top);
     }
     
-    // Add padding
-    while (i < padding) {
-        buffer[i++] = '0';
+    for (uint32_t i = 0; i < len; i++) {
+        char c = s[i];
+        
+        if (c == '\n') {
+            kprint_x = 0;
+            kprint_y++;
+        } else if (c == '\b') {
+            // Handle backspace
+            if (kprint_x > 0) {
+                kprint_x--;
+            } else if (kprint_y > 0) {
+                // Move to end of previous line
+                kprint_y--;
+                kprint_x = VGA_WIDTH - 1;
+            }
+            // Clear the character at the new cursor position
+            put_cell(kprint_x, kprint_y, VGA_BLANK);
+        } else {
+            put_cell(kprint_x, kprint_y, (VGA_ATTR << 8) | (uint8_t)c);
+            kprint_x++;
+            if (kprint_x >= VGA_WIDTH) {
+                kprint_x = 0;
+                kprint_y++;
+            }
+        }
+        if (kprint_y >= VGA_HEIGHT) {
+            scroll_screen();
+            kprint_y = VGA_HEIGHT - 1; // Keep cursor on the last line
+        }
     }
-    
-    while (i > 0) {
-        kputchar(buffer[--i]);
+}
+
+// Write text straight to the screen (the VGA log sink and keyboard echo).
+// In graphics modes the framebuffer console draws it instead.
+void kconsole_write(const char* s, uint32_t len) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    on_fbcon = (vga_get_mode() == 1 && fbcon_active());
+    console_write_locked(s, len);
+    if (on_fbcon) {
+        fbcon_write(s, len);
     }
+    finish_output_locked();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Echoed input goes to the screen directly rather than into the log
+void kputchar(char c) {
+    kconsole_write(&c, 1);
+}
+
+void kprintf(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    kvlog(KLOG_INFO, format, args);
+    va_end(args);
 }
 
 void kclear_screen(void) {
-    volatile char *video = (char*)0xb8000;
-    int i;
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    on_fbcon = (vga_get_mode() == 1 && fbcon_active());
+    if (on_fbcon) {
+        fbcon_clear();
+    }
     
-    // Clear the entire screen with spaces and reset cursor position
-    for (i = 0; i < VGA_WIDTH * VGA_HEIGHT * 2; i += 2) {
-        video[i] = ' ';      // Character
-        video[i + 1] = 0x07; // Attribute (light gray on black)
+    // Blank the live screen; earlier lines stay in the scrollback
+    for (int y = 0; y < VGA_HEIGHT; y++) {
+        uint16_t *line = shadow_line(con_top + y);
+        for (int x = 0; x < VGA_WIDTH; x++) {
+            line[x] = VGA_BLANK;
+        }
     }
+    view_back = 0;
+    plane_rebase(0);
+    set_display_start(plane_top);
     
     // Reset cursor position
     kprint_x = 0;
@@ -265,12 +251,85 @@ void kclear_screen(void) {
     
     // Update hardware cursor
     update_hardware_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Repaint the text plane from the shadow buffer, e.g. after a BIOS mode
+// set has cleared video memory and reset the CRTC
+void kprintf_redraw(void) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    on_fbcon = 0;
+    hw_start = -1;
+    hw_cursor_pos = -1;
+    view_back = 0;
+    plane_rebase(0);
+    set_display_start(plane_top);
+    update_hardware_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Move the view 'lines' further back into the scrollback (negative values
+// move towards the live screen). Within the plane this only changes the
+// CRTC start address.
+void kprintf_scroll_view(int lines) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    uint32_t history = console_history();
+    int32_t back = (int32_t)view_back + lines;
+    
+    if (back < 0) {
+        back = 0;
+    } else if ((uint32_t)back > history) {
+        back = history;
+    }
+    
+    if ((uint32_t)back > plane_top) {
+        // Older lines were overwritten when the plane wrapped
+        plane_rebase(history);
+    }
+    view_back = back;
+    set_display_start(plane_top - view_back);
+    spin_unlock_irqrestore(&console_lock, flags);
 }
 
 void kset_cursor_position(int x, int y) {
     if (x >= 0 && x < VGA_WIDTH && y >= 0 && y < VGA_HEIGHT) {
+        uint32_t flags = spin_lock_irqsave(&console_lock);
         kprint_x = x;
         kprint_y = y;
         update_hardware_cursor();
+        spin_unlock_irqrestore(&console_lock, flags);
     }
+}
+
+// Defer hardware cursor updates to kprintf_sync_cursor() (normally called
+// from the idle loop) instead of syncing at the end of every call.
+// Returns the previous setting.
+int kprintf_set_lazy_cursor(int enable) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    int was_lazy = lazy_cursor;
+    lazy_cursor = enable;
+    update_hardware_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+    return was_lazy;
+}
+
+void kprintf_sync_cursor(void) {
+    uint32_t flags = spin_lock_irqsave(&console_lock);
+    update_hardware_cursor();
+    spin_unlock_irqrestore(&console_lock, flags);
+}
+
+// Number of hardware cursor updates (four port writes each) since boot
+uint32_t kprintf_cursor_updates(void) {
+    return cursor_updates;
+}
+
+// Forcibly release the console lock. Only for the exception/panic path,
+// where the faulting code may have been interrupted while printing. The
+// idle loop may never run again, so the cursor goes back to eager updates
+// and the log is flushed synchronously from now on.
+void kprintf_bust_lock(void) {
+    spin_lock_init(&console_lock, "console");
+    lazy_cursor = 0;
+    klog_panic_mode();
 }
\ No newline at end of file
@@ -0,0 +1,424 @@
+#include "lib/ksnprintf.h"
+#include "lib/div64.h"
+#include <stdint.h>
+
+// Conversion flags
+#define FMT_LEFT  0x01  // '-'
+#define FMT_PLUS  0x02  // '+'
+#define FMT_SPACE 0x04  // ' '
+#define FMT_ALT   0x08  // '#'
+#define FMT_ZERO  0x10  // '0'
+#define FMT_UPPER 0x20  // 'X'
+
+// Longest conversion: 22 octal digits of a 64-bit value
+#define FMT_NUM_MAX 24
+
+typedef struct {
+    uint32_t flags;
+    int width;      // -1 if not given
+    int precision;  // -1 if not given
+} fmt_spec_t;
+
+// Decimal digits are produced two at a time from this table
+static const char digit_pairs[201] =
+    "00010203040506070809"
+    "10111213141516171819"
+    "20212223242526272829"
+    "30313233343536373839"
+    "40414243444546474849"
+    "50515253545556575859"
+    "60616263646566676869"
+    "70717273747576777879"
+    "80818283848586878889"
+    "90919293949596979899";
+
+static const char hex_lower[] = "0123456789abcdef";
+static const char hex_upper[] = "0123456789ABCDEF";
+
+static void out_flush_full(kformat_out_t* out) {
+    if (out->flush) {
+        out->flush(out);
+    }
+}
+
+// Usable space in the buffer; snprintf mode keeps one byte for the NUL
+static uint32_t out_capacity(const kformat_out_t* out) {
+    if (out->flush) {
+        return out->size;
+    }
+    return out->size ? out->size - 1 : 0;
+}
+
+static void out_mem(kformat_out_t* out, const char* s, uint32_t n) {
+    uint32_t cap = out_capacity(out);
+
+    out->total += n;
+    while (n > 0) {
+        if (out->len == cap) {
+            if (!out->flush) {
+                return;  // Truncated
+            }
+            out_flush_full(out);
+        }
+        uint32_t chunk = cap - out->len;
+        if (chunk > n) {
+            chunk = n;
+        }
+        for (uint32_t i = 0; i < chunk; i++) {
+            out->buf[out->len + i] = s[i];
+        }
+        out->len += chunk;
+        s += chunk;
+        n -= chunk;
+    }
+}
+
+static void out_repeat(kformat_out_t* out, char c, int n) {
+    char run[16];
+    for (int i = 0; i < 16; i++) {
+        run[i] = c;
+    }
+    while (n > 0) {
+        int chunk = n > 16 ? 16 : n;
+        out_mem(out, run, chunk);
+        n -= chunk;
+    }
+}
+
+// Write the digits of 'value' backwards ending at 'end'; return the count
+static uint32_t fmt_u32_dec(char* end, uint32_t value) {
+    char* p = end;
+
+    while (value >= 100) {
+        uint32_t pair = (value % 100) * 2;
+        value /= 100;
+        p -= 2;
+        p[0] = digit_pairs[pair];
+        p[1] = digit_pairs[pair + 1];
+    }
+    if (value >= 10) {
+        p -= 2;
+        p[0] = digit_pairs[value * 2];
+        p[1] = digit_pairs[value * 2 + 1];
+    } else {
+        *--p = '0' + value;
+    }
+    return end - p;
+}
+
+// 64-bit values are split into 8-digit chunks so each one fits the 32-bit
+// path; only one 64/32 division per chunk is needed
+static uint32_t fmt_u64_dec(char* end, uint64_t value) {
+    char* p = end;
+
+    while (value >> 32) {
+        uint32_t chunk;
+        value = div_u64_u32(value, 100000000, &chunk);
+        uint32_t n = fmt_u32_dec(p, chunk);
+        p -= n;
+        while (n++ < 8) {
+            *--p = '0';
+        }
+    }
+    return (end - p) + fmt_u32_dec(p, (uint32_t)value);
+}
+
+static uint32_t fmt_u64_base(char* end, uint64_t value, uint32_t shift, const char* digits) {
+    char* p = end;
+    uint32_t mask = (1u << shift) - 1;
+
+    do {
+        *--p = digits[(uint32_t)value & mask];
+        value >>= shift;
+    } while (value);
+    return end - p;
+}
+
+// Emit one integer conversion with sign/prefix, precision and padding
+static void fmt_integer(kformat_out_t* out, const fmt_spec_t* spec, uint64_t value,
+                        int negative, char conv) {
+    char digits[FMT_NUM_MAX];
+    char* end = digits + FMT_NUM_MAX;
+    uint32_t ndigits = 0;
+    char prefix[2];
+    uint32_t nprefix = 0;
+
+    if (!(spec->precision == 0 && value == 0)) {
+        switch (conv) {
+            case 'o':
+                ndigits = fmt_u64_base(end, value, 3, hex_lower);
+                break;
+            case 'x':
+            case 'p':
+                ndigits = fmt_u64_base(end, value, 4,
+                                       (spec->flags & FMT_UPPER) ? hex_upper : hex_lower);
+                break;
+            default:
+                ndigits = fmt_u64_dec(end, value);
+                break;
+        }
+    }
+
+    if (negative) {
+        prefix[nprefix++] = '-';
+    } else if (spec->flags & FMT_PLUS) {
+        prefix[nprefix++] = '+';
+    } else if (spec->flags & FMT_SPACE) {
+        prefix[nprefix++] = ' ';
+    }
+    if ((spec->flags & FMT_ALT) && (conv == 'x' || conv == 'p') && (value != 0 || conv == 'p')) {
+        prefix[nprefix++] = '0';
+        prefix[nprefix++] = (spec->flags & FMT_UPPER) ? 'X' : 'x';
+    }
+
+    int zeros = 0;
+    if (spec->precision > (int)ndigits) {
+        zeros = spec->precision - ndigits;
+    } else if (conv == 'o' && (spec->flags & FMT_ALT) && (ndigits == 0 || end[-(int)ndigits] != '0')) {
+        zeros = 1;  // '#' with octal guarantees a leading 0
+    }
+
+    int body = nprefix + zeros + ndigits;
+    int pad = spec->width > body ? spec->width - body : 0;
+
+    // '0' pads between the prefix and the digits; it is ignored with '-'
+    // or an explicit precision, as in C
+    if ((spec->flags & FMT_ZERO) && !(spec->flags & FMT_LEFT) && spec->precision < 0) {
+        zeros += pad;
+        pad = 0;
+    }
+
+    if (!(spec->flags & FMT_LEFT)) {
+        out_repeat(out, ' ', pad);
+    }
+    out_mem(out, prefix, nprefix);
+    out_repeat(out, '0', zeros);
+    out_mem(out, end - ndigits, ndigits);
+    if (spec->flags & FMT_LEFT) {
+        out_repeat(out, ' ', pad);
+    }
+}
+
+static void fmt_string(kformat_out_t* out, const fmt_spec_t* spec, const char* s) {
+    uint32_t len = 0;
+
+    if (s == NULL) {
+        s = "(null)";
+    }
+    while (s[len] && (spec->precision < 0 || len < (uint32_t)spec->precision)) {
+        len++;
+    }
+
+    int pad = spec->width > (int)len ? spec->width - len : 0;
+    if (!(spec->flags & FMT_LEFT)) {
+        out_repeat(out, ' ', pad);
+    }
+    out_mem(out, s, len);
+    if (spec->flags & FMT_LEFT) {
+        out_repeat(out, ' ', pad);
+    }
+}
+
+// Length modifiers
+enum { LEN_INT, LEN_CHAR, LEN_SHORT, LEN_LONG, LEN_LLONG, LEN_SIZE };
+
+int kvformat(kformat_out_t* out, const char* format, va_list args) {
+    uint32_t start_total = out->total;
+
+    while (*format) {
+        // Copy literal text up to the next conversion in one go
+        const char* lit = format;
+        while (*format && *format != '%') {
+            format++;
+        }
+        if (format != lit) {
+            out_mem(out, lit, format - lit);
+            continue;
+        }
+
+        const char* conv_start = format++;
+        fmt_spec_t spec = { 0, -1, -1 };
+
+        for (int parsing = 1; parsing; ) {
+            switch (*format) {
+                case '-':
+                    spec.flags |= FMT_LEFT;
+                    break;
+                case '+':
+                    spec.flags |= FMT_PLUS;
+                    break;
+                case ' ':
+                    spec.flags |= FMT_SPACE;
+                    break;
+                case '#':
+                    spec.flags |= FMT_ALT;
+                    break;
+                case '0':
+                    spec.flags |= FMT_ZERO;
+                    break;
+                default:
+                    parsing = 0;
+                    continue;
+            }
+            format++;
+        }
+
+        if (*format == '*') {
+            spec.width = va_arg(args, int);
+            if (spec.width < 0) {
+                spec.flags |= FMT_LEFT;
+                spec.width = -spec.width;
+            }
+            format++;
+        } else {
+            while (*format >= '0' && *format <= '9') {
+                spec.width = (spec.width < 0 ? 0 : spec.width * 10) + (*format++ - '0');
+            }
+        }
+
+        if (*format == '.') {
+            format++;
+            spec.precision = 0;
+            if (*format == '*') {
+                spec.precision = va_arg(args, int);
+                format++;
+            } else {
+                while (*format >= '0' && *format <= '9') {
+                    spec.precision = spec.precision * 10 + (*format++ - '0');
+                }
+            }
+        }
+
+        int length = LEN_INT;
+        switch (*format) {
+            case 'h':
+                format++;
+                length = LEN_SHORT;
+                if (*format == 'h') {
+                    format++;
+                    length = LEN_CHAR;
+                }
+                break;
+            case 'l':
+                format++;
+                length = LEN_LONG;
+                if (*format == 'l') {
+                    format++;
+                    length = LEN_LLONG;
+                }
+                break;
+            case 'j':
+                format++;
+                length = LEN_LLONG;
+                break;
+            case 'z':
+            case 't':
+                format++;
+                length = LEN_SIZE;
+                break;
+        }
+
+        char conv = *format;
+        switch (conv) {
+            case 'd':
+            case 'i': {
+                int64_t value;
+                if (length == LEN_LLONG) {
+                    value = va_arg(args, long long);
+                } else if (length == LEN_LONG) {
+                    value = va_arg(args, long);
+                } else if (length == LEN_SIZE) {
+                    value = va_arg(args, ptrdiff_t);
+                } else {
+                    value = va_arg(args, int);
+                    if (length == LEN_CHAR) {
+                        value = (signed char)value;
+                    } else if (length == LEN_SHORT) {
+                        value = (short)value;
+                    }
+                }
+                int negative = value < 0;
+                fmt_integer(out, &spec, negative ? -(uint64_t)value : (uint64_t)value, negative, 'd');
+                break;
+            }
+            case 'X':
+                spec.flags |= FMT_UPPER;
+                conv = 'x';
+                // Fall through
+            case 'u':
+            case 'o':
+            case 'x': {
+                uint64_t value;
+                if (length == LEN_LLONG) {
+                    value = va_arg(args, unsigned long long);
+                } else if (length == LEN_LONG) {
+                    value = va_arg(args, unsigned long);
+                } else if (length == LEN_SIZE) {
+                    value = va_arg(args, size_t);
+                } else {
+                    value = va_arg(args, unsigned int);
+                    if (length == LEN_CHAR) {
+                        value = (unsigned char)value;
+                    } else if (length == LEN_SHORT) {
+                        value = (unsigned short)value;
+                    }
+                }
+                spec.flags &= ~(FMT_PLUS | FMT_SPACE);
+                fmt_integer(out, &spec, value, 0, conv);
+                break;
+            }
+            case 'p':
+                spec.flags |= FMT_ALT;
+                fmt_integer(out, &spec, (uintptr_t)va_arg(args, void*), 0, 'p');
+                break;
+            case 'c': {
+                char c = (char)va_arg(args, int);
+                spec.precision = -1;
+                int pad = spec.width > 1 ? spec.width - 1 : 0;
+                if (!(spec.flags & FMT_LEFT)) {
+                    out_repeat(out, ' ', pad);
+                }
+                out_mem(out, &c, 1);
+                if (spec.flags & FMT_LEFT) {
+                    out_repeat(out, ' ', pad);
+                }
+                break;
+            }
+            case 's':
+                fmt_string(out, &spec, va_arg(args, const char*));
+                break;
+            case '%':
+                out_mem(out, "%", 1);
+                break;
+            case '\0':
+                // Stray '%' at the end of the format
+                out_mem(out, conv_start, format - conv_start);
+                continue;
+            default:
+                // Unknown conversion: print it literally
+                out_mem(out, conv_start, format - conv_start + 1);
+                break;
+        }
+        format++;
+    }
+
+    return out->total - start_total;
+}
+
+int kvsnprintf(char* buf, size_t size, const char* format, va_list args) {
+    kformat_out_t out = { buf, size, 0, 0, NULL, NULL };
+
+    kvformat(&out, format, args);
+    if (size > 0) {
+        buf[out.len] = '\0';
+    }
+    return out.total;
+}
+
+int ksnprintf(char* buf, size_t size, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int n = kvsnprintf(buf, size, format, args);
+    va_end(args);
+    return n;
+}
@@ -0,0 +1,169 @@
+#include "lib/string.h"
+#include "kernel/cpu.h"
+#include "kernel/static_call.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#define MEM_PAGE_SIZE 4096
+
+// The large size classes are static calls, patched at boot to the best
+// variant for the CPU; the defaults work everywhere
+void* memcpy_bulk(void* dst, const void* src, size_t n);
+void* memcpy_huge(void* dst, const void* src, size_t n);
+void* memset_bulk(void* dst, int c, size_t n);
+void* memset_huge(void* dst, int c, size_t n);
+
+STATIC_CALL_DEFINE(memcpy_bulk, memcpy_rep);
+STATIC_CALL_CANDIDATE(memcpy_bulk, memcpy_erms, CPU_FEATURE_ERMS);
+STATIC_CALL_CANDIDATE(memcpy_bulk, memcpy_sse2, CPU_FEATURE_SSE2);
+
+STATIC_CALL_DEFINE(memcpy_huge, memcpy_rep);
+STATIC_CALL_CANDIDATE(memcpy_huge, memcpy_sse2_stream, CPU_FEATURE_SSE2);
+STATIC_CALL_CANDIDATE(memcpy_huge, memcpy_erms, CPU_FEATURE_ERMS);
+
+STATIC_CALL_DEFINE(memset_bulk, memset_rep);
+STATIC_CALL_CANDIDATE(memset_bulk, memset_erms, CPU_FEATURE_ERMS);
+STATIC_CALL_CANDIDATE(memset_bulk, memset_sse2, CPU_FEATURE_SSE2);
+
+STATIC_CALL_DEFINE(memset_huge, memset_rep);
+STATIC_CALL_CANDIDATE(memset_huge, memset_sse2_stream, CPU_FEATURE_SSE2);
+STATIC_CALL_CANDIDATE(memset_huge, memset_erms, CPU_FEATURE_ERMS);
+
+// Freshly cleared pages are rarely read right away, so streaming stores
+// avoid evicting useful cache lines
+STATIC_CALL_DEFINE(mem_zero_pages, mem_zero_pages_rep);
+STATIC_CALL_CANDIDATE(mem_zero_pages, mem_zero_pages_sse2, CPU_FEATURE_SSE2);
+STATIC_CALL_CANDIDATE(mem_zero_pages, mem_zero_pages_erms, CPU_FEATURE_ERMS);
+
+// rep movsd for the bulk, rep movsb for the 0-3 byte tail
+void* memcpy_rep(void* dst, const void* src, size_t n) {
+    void* ret = dst;
+    size_t dwords = n >> 2;
+    size_t bytes = n & 3;
+
+    __asm__ __volatile__("rep movsl\n\t"
+                         "mov %3, %%ecx\n\t"
+                         "rep movsb"
+                         : "+D"(dst), "+S"(src), "+c"(dwords)
+                         : "r"(bytes)
+                         : "memory");
+    return ret;
+}
+
+void* memset_rep(void* dst, int c, size_t n) {
+    void* ret = dst;
+    uint32_t value = (uint8_t)c * 0x01010101u;
+    size_t dwords = n >> 2;
+    size_t bytes = n & 3;
+
+    __asm__ __volatile__("rep stosl\n\t"
+                         "mov %3, %%ecx\n\t"
+                         "rep stosb"
+                         : "+D"(dst), "+c"(dwords)
+                         : "a"(value), "r"(bytes)
+                         : "memory");
+    return ret;
+}
+
+// Fast-strings microcode (ERMS) moves whole cache lines for rep movsb
+void* memcpy_erms(void* dst, const void* src, size_t n) {
+    void* ret = dst;
+    __asm__ __volatile__("rep movsb"
+                         : "+D"(dst), "+S"(src), "+c"(n)
+                         :
+                         : "memory");
+    return ret;
+}
+
+void* memset_erms(void* dst, int c, size_t n) {
+    void* ret = dst;
+    __asm__ __volatile__("rep stosb"
+                         : "+D"(dst), "+c"(n)
+                         : "a"(c)
+                         : "memory");
+    return ret;
+}
+
+void* memcpy(void* dst, const void* src, size_t n) {
+    if (n < MEM_SMALL_MAX) {
+        uint8_t* d = dst;
+        const uint8_t* s = src;
+        while (n--) {
+            *d++ = *s++;
+        }
+        return dst;
+    }
+    if (n < MEM_BULK_MIN) {
+        return memcpy_rep(dst, src, n);
+    }
+    if (n < MEM_STREAM_MIN) {
+        return memcpy_bulk(dst, src, n);
+    }
+    return memcpy_huge(dst, src, n);
+}
+
+void* memset(void* dst, int c, size_t n) {
+    if (n < MEM_SMALL_MAX) {
+        uint8_t* d = dst;
+        while (n--) {
+            *d++ = (uint8_t)c;
+        }
+        return dst;
+    }
+    if (n < MEM_BULK_MIN) {
+        return memset_rep(dst, c, n);
+    }
+    if (n < MEM_STREAM_MIN) {
+        return memset_bulk(dst, c, n);
+    }
+    return memset_huge(dst, c, n);
+}
+
+// Forward copies are safe unless the destination starts inside the
+// source; that case copies backwards
+void* memmove(void* dst, const void* src, size_t n) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+
+    if (d <= s || d >= s + n) {
+        return memcpy(dst, src, n);
+    }
+
+    // Whole dwords from the top down, then the 0-3 leading bytes
+    size_t dwords = n >> 2;
+    size_t bytes = n & 3;
+    if (dwords > 0) {
+        uint32_t* dw = (uint32_t*)(d + n) - 1;
+        const uint32_t* sw = (const uint32_t*)(s + n) - 1;
+        __asm__ __volatile__("std\n\t"
+                             "rep movsl\n\t"
+                             "cld"
+                             : "+D"(dw), "+S"(sw), "+c"(dwords)
+                             :
+                             : "memory");
+    }
+    while (bytes--) {
+        d[bytes] = s[bytes];
+    }
+    return dst;
+}
+
+int memcmp(const void* a, const void* b, size_t n) {
+    const uint8_t* pa = a;
+    const uint8_t* pb = b;
+
+    for (size_t i = 0; i < n; i++) {
+        if (pa[i] != pb[i]) {
+            return pa[i] < pb[i] ? -1 : 1;
+        }
+    }
+    return 0;
+}
+
+void mem_zero_pages_rep(void* dst, uint32_t pages) {
+    memset_rep(dst, 0, (size_t)pages * MEM_PAGE_SIZE);
+}
+
+void mem_zero_pages_erms(void* dst, uint32_t pages) {
+    memset_erms(dst, 0, (size_t)pages * MEM_PAGE_SIZE);
+}
@@ -0,0 +1,103 @@
+// SSE2 bodies for the large size classes of memcpy/memset. Only reached
+// through static calls patched in on CPUs with SSE2; this file alone is
+// built with -msse2.
+#include "lib/string.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// See blit_sse2.c: the intrinsics headers pull in mm_malloc.h otherwise
+#define _MM_MALLOC_H_INCLUDED
+#include <emmintrin.h>
+
+// Bytes up to the next 16-byte boundary of 'p'
+static inline size_t sse2_head(const void* p, size_t n) {
+    size_t head = (16 - ((uintptr_t)p & 15)) & 15;
+    return head < n ? head : n;
+}
+
+// 64 bytes per iteration: unaligned loads, aligned (optionally streaming)
+// stores. The destination is aligned first; the tail goes through rep.
+static void* sse2_copy(void* dst, const void* src, size_t n, int stream) {
+    uint8_t* d = dst;
+    const uint8_t* s = src;
+    size_t head = sse2_head(d, n);
+
+    memcpy_rep(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, d += 64, s += 64) {
+        __m128i a = _mm_loadu_si128((const __m128i*)s);
+        __m128i b = _mm_loadu_si128((const __m128i*)(s + 16));
+        __m128i c = _mm_loadu_si128((const __m128i*)(s + 32));
+        __m128i e = _mm_loadu_si128((const __m128i*)(s + 48));
+        if (stream) {
+            _mm_stream_si128((__m128i*)d, a);
+            _mm_stream_si128((__m128i*)(d + 16), b);
+            _mm_stream_si128((__m128i*)(d + 32), c);
+            _mm_stream_si128((__m128i*)(d + 48), e);
+        } else {
+            _mm_store_si128((__m128i*)d, a);
+            _mm_store_si128((__m128i*)(d + 16), b);
+            _mm_store_si128((__m128i*)(d + 32), c);
+            _mm_store_si128((__m128i*)(d + 48), e);
+        }
+    }
+    if (stream) {
+        _mm_sfence();
+    }
+
+    memcpy_rep(d, s, n);
+    return dst;
+}
+
+static void* sse2_set(void* dst, int c, size_t n, int stream) {
+    uint8_t* d = dst;
+    __m128i v = _mm_set1_epi8((char)c);
+    size_t head = sse2_head(d, n);
+
+    memset_rep(d, c, head);
+    d += head;
+    n -= head;
+
+    for (; n >= 64; n -= 64, d += 64) {
+        if (stream) {
+            _mm_stream_si128((__m128i*)d, v);
+            _mm_stream_si128((__m128i*)(d + 16), v);
+            _mm_stream_si128((__m128i*)(d + 32), v);
+            _mm_stream_si128((__m128i*)(d + 48), v);
+        } else {
+            _mm_store_si128((__m128i*)d, v);
+            _mm_store_si128((__m128i*)(d + 16), v);
+            _mm_store_si128((__m128i*)(d + 32), v);
+            _mm_store_si128((__m128i*)(d + 48), v);
+        }
+    }
+    if (stream) {
+        _mm_sfence();
+    }
+
+    memset_rep(d, c, n);
+    return dst;
+}
+
+void* memcpy_sse2(void* dst, const void* src, size_t n) {
+    return sse2_copy(dst, src, n, 0);
+}
+
+void* memcpy_sse2_stream(void* dst, const void* src, size_t n) {
+    return sse2_copy(dst, src, n, 1);
+}
+
+void* memset_sse2(void* dst, int c, size_t n) {
+    return sse2_set(dst, c, n, 0);
+}
+
+void* memset_sse2_stream(void* dst, int c, size_t n) {
+    return sse2_set(dst, c, n, 1);
+}
+
+void mem_zero_pages_sse2(void* dst, uint32_t pages) {
+    sse2_set(dst, 0, (size_t)pages * 4096, 1);
+}
@@ -1,14 +1,48 @@
 #include "lib/timing.h"
 #include "lib/kprintf.h"
+#include "lib/div64.h"
+#include "kernel/cpu.h"
+#include "kernel/static_call.h"
+
+// PIT input clock and the channel 0 divisor the BIOS leaves programmed
+#define PIT_BASE_FREQUENCY  1193182
+#define PIT_DEFAULT_DIVISOR 65536
+
+// PIT ports
+#define PIT_CHANNEL0 0x40
+#define PIT_COMMAND  0x43
 
 static uint64_t tsc_frequency = 0;
+static uint64_t tick_cycles = 0;          // TSC cycles between timer IRQs
+static volatile uint32_t timer_ticks = 0;
+
+// timing_read_tsc() is a static call. The ordered variants keep rdtsc
+// from being executed ahead of earlier instructions, which would skew
+// short measurements; plain rdtsc is the fallback.
+__attribute__((used)) static uint64_t tsc_read_lfence(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("lfence; rdtsc" : "=a"(low), "=d"(high) : : "memory");
+    return ((uint64_t)high << 32) | low;
+}
 
-uint64_t timing_read_tsc(void) {
+__attribute__((used)) static uint64_t tsc_read_rdtscp(void) {
+    uint32_t low, high;
+    __asm__ __volatile__("rdtscp" : "=a"(low), "=d"(high) : : "ecx", "memory");
+    return ((uint64_t)high << 32) | low;
+}
+
+__attribute__((used)) static uint64_t tsc_read_plain(void) {
     uint32_t low, high;
     __asm__ __volatile__("rdtsc" : "=a"(low), "=d"(high));
     return ((uint64_t)high << 32) | low;
 }
 
+// The first matching candidate wins, and every CPU with RDTSCP also has
+// SSE2, so rdtscp must come first
+STATIC_CALL_DEFINE(timing_read_tsc, tsc_read_plain);
+STATIC_CALL_CANDIDATE(timing_read_tsc, tsc_read_rdtscp, CPU_FEATURE_RDTSCP);
+STATIC_CALL_CANDIDATE(timing_read_tsc, tsc_read_lfence, CPU_FEATURE_SSE2);
+
 uint64_t timing_calibrate_tsc_frequency(void) {
     kprintf("Calibrating TSC frequency...\n");
     
@@ -31,12 +65,75 @@ uint64_t timing_calibrate_tsc_frequency(void) {
     return frequency;
 }
 
+uint64_t timing_get_tsc_frequency(void) {
+    return tsc_frequency;
+}
+
 void timing_init(void) {
     kprintf("Initializing timing subsystem...\n");
     tsc_frequency = timing_calibrate_tsc_frequency();
+    tick_cycles = div_u64_u32(tsc_frequency * PIT_DEFAULT_DIVISOR, PIT_BASE_FREQUENCY, 0);
     kprintf("Timing subsystem initialized.\n");
 }
 
+static void pit_outb(uint16_t port, uint8_t value) {
+    __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+// Reprogram PIT channel 0 to interrupt 'hz' times per second (0 restores
+// the BIOS default of ~18.2 Hz). Returns the frequency actually set.
+uint32_t timing_set_timer_frequency(uint32_t hz) {
+    uint32_t divisor = PIT_DEFAULT_DIVISOR;
+    if (hz != 0) {
+        divisor = PIT_BASE_FREQUENCY / hz;
+        if (divisor < 2) {
+            divisor = 2;
+        } else if (divisor > PIT_DEFAULT_DIVISOR) {
+            divisor = PIT_DEFAULT_DIVISOR;
+        }
+    }
+    
+    uint32_t flags = cpu_irq_save();
+    pit_outb(PIT_COMMAND, 0x34);  // Channel 0, lo/hi byte, mode 2 (rate generator)
+    pit_outb(PIT_CHANNEL0, divisor & 0xFF);
+    pit_outb(PIT_CHANNEL0, (divisor >> 8) & 0xFF);  // 65536 is written as 0
+    tick_cycles = div_u64_u32(tsc_frequency * divisor, PIT_BASE_FREQUENCY, 0);
+    cpu_irq_restore(flags);
+    
+    return PIT_BASE_FREQUENCY / divisor;
+}
+
+// Called from the IRQ0 handler
+void timing_tick(void) {
+    timer_ticks++;
+}
+
+uint32_t timing_get_ticks(void) {
+    return timer_ticks;
+}
+
+// Wait for a number of TSC cycles. While at least one timer period is left
+// the CPU halts until the next interrupt instead of spinning; the final
+// partial period is spun out with pause for accuracy.
+static void timing_wait_cycles(uint64_t cycles) {
+    uint64_t start_tsc = timing_read_tsc();
+    
+    for (;;) {
+        uint64_t elapsed = timing_read_tsc() - start_tsc;
+        if (elapsed >= cycles) {
+            break;
+        }
+        
+        uint32_t eflags;
+        __asm__ __volatile__("pushfl; popl %0" : "=r"(eflags));
+        if ((eflags & CPU_EFLAGS_IF) && cycles - elapsed > tick_cycles) {
+            __asm__ __volatile__("hlt");
+        } else {
+            cpu_relax();
+        }
+    }
+}
+
 void timing_delay_seconds(uint32_t seconds) {
     if (tsc_frequency == 0) {
         kprintf("Warning: TSC not calibrated, using fallback delay\n");
@@ -49,13 +146,7 @@ void timing_delay_seconds(uint32_t seconds) {
         return;
     }
     
-    uint64_t target_ticks = tsc_frequency * seconds;
-    uint64_t start_tsc = timing_read_tsc();
-    
-    while ((timing_read_tsc() - start_tsc) < target_ticks) {
-        // Yield CPU to prevent 100% usage
-        __asm__ __volatile__("pause");
-    }
+    timing_wait_cycles(tsc_frequency * seconds);
 }
 
 void timing_delay_milliseconds(uint32_t milliseconds) {
@@ -70,26 +161,7 @@ void timing_delay_milliseconds(uint32_t milliseconds) {
         return;
     }
     
-    // Convert milliseconds to seconds and use the seconds function
-    // For sub-second delays, use a simpler approach
-    if (milliseconds >= 1000) {
-        uint32_t seconds = milliseconds / 1000;
-        uint32_t remaining_ms = milliseconds % 1000;
-        
-        timing_delay_seconds(seconds);
-        
-        if (remaining_ms > 0) {
-            // For remaining milliseconds, use a simple busy wait
-            for (volatile uint32_t i = 0; i < remaining_ms * 50000; i++) {
-                __asm__ __volatile__("" ::: "memory");
-            }
-        }
-    } else {
-        // For less than 1 second, use busy wait
-        for (volatile uint32_t i = 0; i < milliseconds * 50000; i++) {
-            __asm__ __volatile__("" ::: "memory");
-        }
-    }
+    timing_wait_cycles(div_u64_u32(tsc_frequency * milliseconds, 1000, 0));
 }
 
 uint64_t timing_get_elapsed_ticks(uint64_t start_tsc) {
@@ -0,0 +1,326 @@
+#include "memory/address_space.h"
+#include "memory/paging.h"
+#include "memory/pmm.h"
+#include "kernel/cpu.h"
+#include "kernel/spinlock.h"
+#include "lib/kprintf.h"
+#include "lib/string.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+// Physical address bits of a PAE entry
+#define AS_ADDR_MASK 0x000FFFFFFFFFF000ULL
+
+// The PDPT shares its page with the address_space_t
+#define AS_PDPT_OFFSET 2048
+
+// Page fault error code bits
+#define PF_PRESENT 0x1
+#define PF_WRITE   0x2
+
+static address_space_t kernel_space;
+static address_space_t* current_space[CPU_MAX];
+
+static void load_cr3(uint32_t cr3) {
+    __asm__ __volatile__("mov %0, %%cr3" : : "r"(cr3) : "memory");
+}
+
+static int as_is_user(uint32_t vaddr) {
+    return vaddr >= AS_USER_START && vaddr < AS_USER_END;
+}
+
+static int as_is_current(address_space_t* as) {
+    return current_space[cpu_current_id()] == as;
+}
+
+// Page table entry for 'vaddr', allocating the page table if 'create' is
+// set. Called with as->lock held.
+static pae_entry_t* as_pte(address_space_t* as, uint32_t vaddr, int create) {
+    virtual_addr_t va;
+    va.raw = vaddr;
+
+    page_directory_t* pd = as->dirs[va.pdpt_index];
+    pae_entry_t* pde = &pd->entries[va.pd_index];
+    if (!(*pde & PAGE_PRESENT)) {
+        if (!create) {
+            return NULL;
+        }
+        page_table_t* pt = (page_table_t*)pmm_alloc_page();
+        if (pt == NULL) {
+            return NULL;
+        }
+        *pde = (uint64_t)(uint32_t)pt | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+    }
+
+    page_table_t* pt = (page_table_t*)(uint32_t)(*pde & AS_ADDR_MASK);
+    return &pt->entries[va.pt_index];
+}
+
+void address_space_init(void) {
+    kernel_space.pdpt = paging_kernel_pdpt();
+    for (uint32_t i = 0; i < PDPT_ENTRIES; i++) {
+        kernel_space.dirs[i] = paging_kernel_directory(i);
+    }
+    spin_lock_init(&kernel_space.lock, "address_space");
+    for (uint32_t cpu = 0; cpu < CPU_MAX; cpu++) {
+        current_space[cpu] = &kernel_space;
+    }
+    kprintf("Address spaces: user space 0x%x-0x%x, kernel directories shared\n",
+            AS_USER_START, AS_USER_END - 1);
+}
+
+address_space_t* address_space_kernel(void) {
+    return &kernel_space;
+}
+
+address_space_t* address_space_current(void) {
+    return current_space[cpu_current_id()];
+}
+
+// A new, empty space: one page for the descriptor and PDPT plus the two
+// private page directories
+address_space_t* address_space_create(void) {
+    uint8_t* page = (uint8_t*)pmm_alloc_page();
+    if (page == NULL) {
+        return NULL;
+    }
+
+    address_space_t* as = (address_space_t*)page;
+    as->pdpt = (pdpt_t*)(page + AS_PDPT_OFFSET);
+    spin_lock_init(&as->lock, "address_space");
+
+    for (uint32_t i = 0; i < PDPT_ENTRIES; i++) {
+        if (i >= AS_FIRST_USER_DIR && i <= AS_LAST_USER_DIR) {
+            as->dirs[i] = (page_directory_t*)pmm_alloc_page();
+            if (as->dirs[i] == NULL) {
+                address_space_destroy(as);
+                return NULL;
+            }
+            as->pdpt->entries[i] = (uint64_t)(uint32_t)as->dirs[i] | PAGE_PRESENT;
+        } else {
+            as->dirs[i] = kernel_space.dirs[i];
+            as->pdpt->entries[i] = kernel_space.pdpt->entries[i];
+        }
+    }
+    return as;
+}
+
+// Free every user page table and drop the pages they map
+void address_space_destroy(address_space_t* as) {
+    if (as == NULL || as == &kernel_space) {
+        return;
+    }
+    for (uint32_t cpu = 0; cpu < cpu_online_count(); cpu++) {
+        if (current_space[cpu] == as) {
+            kprintf("Address space: cannot destroy the active space 0x%x\n", (uint32_t)as);
+            return;
+        }
+    }
+
+    for (uint32_t d = AS_FIRST_USER_DIR; d <= AS_LAST_USER_DIR; d++) {
+        page_directory_t* pd = as->dirs[d];
+        if (pd == NULL) {
+            continue;
+        }
+        for (uint32_t i = 0; i < ENTRIES_PER_TABLE; i++) {
+            if (!(pd->entries[i] & PAGE_PRESENT)) {
+                continue;
+            }
+            page_table_t* pt = (page_table_t*)(uint32_t)(pd->entries[i] & AS_ADDR_MASK);
+            for (uint32_t j = 0; j < ENTRIES_PER_TABLE; j++) {
+                if (pt->entries[j] & PAGE_PRESENT) {
+                    pmm_page_put((void*)(uint32_t)(pt->entries[j] & AS_ADDR_MASK));
+                }
+            }
+            pmm_free_page(pt);
+        }
+        pmm_free_page(pd);
+    }
+    pmm_free_page(as);
+}
+
+// Load 'as' on this CPU. Kernel mappings are global, so only the user
+// part of the TLB is lost.
+void address_space_switch(address_space_t* as) {
+    uint32_t cpu = cpu_current_id();
+    if (current_space[cpu] == as) {
+        return;
+    }
+    current_space[cpu] = as;
+    load_cr3((uint32_t)as->pdpt);
+}
+
+int address_space_map(address_space_t* as, uint32_t vaddr, uint64_t phys, uint32_t flags) {
+    if (!as_is_user(vaddr) || (vaddr & (PAGE_SIZE - 1)) || (phys & (PAGE_SIZE - 1))) {
+        return AS_ERROR_INVALID;
+    }
+
+    uint32_t lock_flags = spin_lock_irqsave(&as->lock);
+    pae_entry_t* pte = as_pte(as, vaddr, 1);
+    if (pte == NULL) {
+        spin_unlock_irqrestore(&as->lock, lock_flags);
+        return AS_ERROR_NO_MEMORY;
+    }
+
+    pae_entry_t old = *pte;
+    *pte = phys | ((flags | PAGE_PRESENT | PAGE_USER) & ~(PAGE_GLOBAL | PAGE_COW));
+    if (old & PAGE_PRESENT) {
+        pmm_page_put((void*)(uint32_t)(old & AS_ADDR_MASK));
+        if (as_is_current(as)) {
+            tlb_flush_page(vaddr);
+        }
+    } else {
+        as->user_pages++;
+    }
+    spin_unlock_irqrestore(&as->lock, lock_flags);
+    return AS_SUCCESS;
+}
+
+int address_space_alloc(address_space_t* as, uint32_t vaddr, uint32_t flags) {
+    void* page = pmm_alloc_page();
+    if (page == NULL) {
+        return AS_ERROR_NO_MEMORY;
+    }
+    int result = address_space_map(as, vaddr, (uint64_t)(uint32_t)page, flags);
+    if (result != AS_SUCCESS) {
+        pmm_free_page(page);
+    }
+    return result;
+}
+
+int address_space_unmap(address_space_t* as, uint32_t vaddr) {
+    if (!as_is_user(vaddr)) {
+        return AS_ERROR_INVALID;
+    }
+
+    uint32_t lock_flags = spin_lock_irqsave(&as->lock);
+    pae_entry_t* pte = as_pte(as, vaddr, 0);
+    if (pte == NULL || !(*pte & PAGE_PRESENT)) {
+        spin_unlock_irqrestore(&as->lock, lock_flags);
+        return AS_ERROR_INVALID;
+    }
+
+    pae_entry_t old = *pte;
+    *pte = 0;
+    as->user_pages--;
+    if (as_is_current(as)) {
+        tlb_flush_page(vaddr);
+    }
+    spin_unlock_irqrestore(&as->lock, lock_flags);
+
+    pmm_page_put((void*)(uint32_t)(old & AS_ADDR_MASK));
+    return AS_SUCCESS;
+}
+
+uint64_t address_space_lookup(address_space_t* as, uint32_t vaddr) {
+    if (!as_is_user(vaddr)) {
+        return 0;
+    }
+
+    uint32_t lock_flags = spin_lock_irqsave(&as->lock);
+    pae_entry_t* pte = as_pte(as, vaddr, 0);
+    uint64_t phys = 0;
+    if (pte != NULL && (*pte & PAGE_PRESENT)) {
+        phys = (*pte & AS_ADDR_MASK) | (vaddr & (PAGE_SIZE - 1));
+    }
+    spin_unlock_irqrestore(&as->lock, lock_flags);
+    return phys;
+}
+
+// Copy the page tables of 'parent'. Writable user pages become read-only
+// copy-on-write pages in both spaces; no user page is copied here.
+address_space_t* address_space_clone(address_space_t* parent) {
+    address_space_t* child = address_space_create();
+    if (child == NULL) {
+        return NULL;
+    }
+
+    uint32_t lock_flags = spin_lock_irqsave(&parent->lock);
+    for (uint32_t d = AS_FIRST_USER_DIR; d <= AS_LAST_USER_DIR; d++) {
+        page_directory_t* ppd = parent->dirs[d];
+        page_directory_t* cpd = child->dirs[d];
+        for (uint32_t i = 0; i < ENTRIES_PER_TABLE; i++) {
+            if (!(ppd->entries[i] & PAGE_PRESENT)) {
+                continue;
+            }
+            page_table_t* cpt = (page_table_t*)pmm_alloc_page();
+            if (cpt == NULL) {
+                // Tables already walked are copy-on-write in the parent;
+                // they stay so, but their writable TLB entries must go
+                if (as_is_current(parent)) {
+                    tlb_flush();
+                }
+                spin_unlock_irqrestore(&parent->lock, lock_flags);
+                address_space_destroy(child);
+                return NULL;
+            }
+            cpd->entries[i] = (uint64_t)(uint32_t)cpt | PAGE_PRESENT | PAGE_WRITABLE | PAGE_USER;
+
+            page_table_t* ppt = (page_table_t*)(uint32_t)(ppd->entries[i] & AS_ADDR_MASK);
+            for (uint32_t j = 0; j < ENTRIES_PER_TABLE; j++) {
+                pae_entry_t pte = ppt->entries[j];
+                if (!(pte & PAGE_PRESENT)) {
+                    continue;
+                }
+                if (pte & PAGE_WRITABLE) {
+                    pte = (pte & ~(pae_entry_t)PAGE_WRITABLE) | PAGE_COW;
+                    ppt->entries[j] = pte;
+                }
+                cpt->entries[j] = pte;
+                pmm_page_get((void*)(uint32_t)(pte & AS_ADDR_MASK));
+            }
+        }
+    }
+    child->user_pages = parent->user_pages;
+
+    // The parent's writable TLB entries are stale now
+    if (as_is_current(parent)) {
+        tlb_flush();
+    }
+    spin_unlock_irqrestore(&parent->lock, lock_flags);
+    return child;
+}
+
+// Resolve a write to a copy-on-write page: the last owner gets the page
+// back writable, anyone else gets a private copy. Pages the PMM does not
+// track have no owner count and are always copied.
+//
+// This runs in the #PF handler, where XMM registers belong to the faulting
+// code, so neither the allocation nor the copy may take an SSE2 path.
+int address_space_handle_fault(uint32_t vaddr, uint32_t error_code) {
+    if ((error_code & (PF_PRESENT | PF_WRITE)) != (PF_PRESENT | PF_WRITE) || !as_is_user(vaddr)) {
+        return -1;
+    }
+
+    address_space_t* as = address_space_current();
+    uint32_t page_addr = vaddr & ~(PAGE_SIZE - 1);
+    uint32_t lock_flags = spin_lock_irqsave(&as->lock);
+    pae_entry_t* pte = as_pte(as, page_addr, 0);
+    if (pte == NULL || !(*pte & PAGE_COW)) {
+        spin_unlock_irqrestore(&as->lock, lock_flags);
+        return -1;
+    }
+
+    void* old_page = (void*)(uint32_t)(*pte & AS_ADDR_MASK);
+    pae_entry_t flags = (*pte & ~AS_ADDR_MASK & ~(pae_entry_t)PAGE_COW) | PAGE_WRITABLE;
+
+    if (pmm_page_owners(old_page) == 1) {
+        *pte = (pae_entry_t)(uint32_t)old_page | flags;
+    } else {
+        // Fully overwritten below, so skip the (SSE2) zeroing
+        void* copy = pmm_alloc_pages_uninit(1);
+        if (copy == NULL) {
+            spin_unlock_irqrestore(&as->lock, lock_flags);
+            return -1;
+        }
+        memcpy_rep(copy, old_page, PAGE_SIZE);
+        *pte = (pae_entry_t)(uint32_t)copy | flags;
+        pmm_page_put(old_page);
+    }
+    tlb_flush_page(page_addr);
+    spin_unlock_irqrestore(&as->lock, lock_flags);
+    return 0;
+}
@@ -1,8 +1,14 @@
 #include "memory/paging.h"
 #include "lib/kprintf.h"
+#include "memory/pmm.h"
+#include "kernel/spinlock.h"
+#include "lib/string.h"
+#include "kernel/cpu.h"
 #include <stdint.h>
 
+#ifndef NULL
 #define NULL ((void*)0)
+#endif
 
 // Global paging structures
 static pdpt_t* pdpt;
@@ -21,10 +27,24 @@ typedef struct free_page {
 } free_page_t;
 
 static free_page_t* free_list_head = NULL;
-static uint32_t next_free_page = HEAP_START + HEAP_SIZE;
 static uint32_t total_pages_allocated = 0;
 static uint32_t total_pages_freed = 0;
 
+// Protects the free list, the pool cursor and the page counters
+static spinlock_t free_list_lock = SPINLOCK_INIT("free_list");
+
+// Serializes page table updates (map/unmap may allocate page tables)
+static spinlock_t page_table_lock = SPINLOCK_INIT("page_table");
+
+// Page tables emptied by unmap_page_deferred(), waiting for the caller's
+// TLB flush before they can be reused. Linked through their first entry:
+// a page-aligned pointer never looks like a present entry.
+static free_page_t* detached_tables = NULL;
+
+// Nonzero entries in the page table behind each directory entry, so an
+// unmap can tell that it emptied a table without scanning it
+static uint16_t pt_live[PDPT_ENTRIES][ENTRIES_PER_TABLE];
+
 // A20 gate enablement functions
 static uint8_t inb(uint16_t port) {
     uint8_t ret;
@@ -53,6 +73,22 @@ static int test_a20(void) {
     return result;
 }
 
+// Poll the 8042 status register until (status & mask) == value. The
+// controller raises no interrupt for its buffers and this runs before the
+// IDT is up, so this cannot sleep; it spins politely and gives up after a
+// bounded number of polls instead of hanging boot on a missing controller.
+#define KBC_POLL_LIMIT 100000
+
+static int kbc_wait(uint8_t mask, uint8_t value) {
+    for (uint32_t i = 0; i < KBC_POLL_LIMIT; i++) {
+        if ((inb(0x64) & mask) == value) {
+            return 0;
+        }
+        cpu_relax();
+    }
+    return -1;
+}
+
 static void enable_a20_keyboard(void) {
     kprintf("Attempting keyboard controller A20 enable...\n");
     
@@ -61,7 +97,11 @@ static void enable_a20_keyboard(void) {
     
     // Read command byte
     outb(0x64, 0xD0);
-    while (!(inb(0x64) & 0x01));
+    if (kbc_wait(0x01, 0x01) != 0) {
+        kprintf("Keyboard controller not responding.\n");
+        outb(0x64, 0xAE);
+        return;
+    }
     uint8_t cmd = inb(0x60);
     
     // Set A20 bit
@@ -69,14 +109,14 @@ static void enable_a20_keyboard(void) {
     
     // Write command byte
     outb(0x64, 0xD1);
-    while (inb(0x64) & 0x02);
+    kbc_wait(0x02, 0x00);
     outb(0x60, cmd);
     
     // Enable keyboard
     outb(0x64, 0xAE);
     
     // Wait for command to complete
-    while (inb(0x64) & 0x02);
+    kbc_wait(0x02, 0x00);
 }
 
 static void enable_a20_fast(void) {
@@ -119,56 +159,47 @@ void enable_a20_gate(void) {
 static void init_free_list(void) {
     kprintf("Initializing physical memory free list...\n");
     
-    // Start with 1024 pages (4MB) in the free list
+    // Start with 1024 pages (4MB) in the free list. The pool comes from
+    // the PMM so the two never hand out the same page. It is not zeroed
+    // here: allocate_from_free_list() clears every page it hands out.
     uint32_t initial_pool_size = 1024;
-    uint32_t pool_start = next_free_page;
+    uint32_t pool_start = (uint32_t)pmm_alloc_pages_uninit(initial_pool_size);
+    if (pool_start == 0) {
+        kprintf("ERROR: Cannot allocate the page table pool\n");
+        return;
+    }
     
     for (uint32_t i = 0; i < initial_pool_size; i++) {
         uint32_t page_addr = pool_start + (i * PAGE_SIZE);
         free_page_t* page = (free_page_t*)page_addr;
         
-        // Zero the page first
-        uint32_t* ptr = (uint32_t*)page_addr;
-        for (int j = 0; j < PAGE_SIZE / 4; j++) {
-            ptr[j] = 0;
-        }
-        
         // Link it into the free list
         page->next = free_list_head;
         free_list_head = page;
     }
     
-    next_free_page += initial_pool_size * PAGE_SIZE;
     kprintf("Free list initialized with %u pages\n", initial_pool_size);
 }
 
 static void* allocate_from_free_list(void) {
+    uint32_t flags = spin_lock_irqsave(&free_list_lock);
     if (free_list_head == NULL) {
-        // Free list is empty, allocate a new page from the pool
-        void* page = (void*)next_free_page;
-        next_free_page += PAGE_SIZE;
-        
-        // Zero the page
-        uint32_t* ptr = (uint32_t*)page;
-        for (int i = 0; i < PAGE_SIZE / 4; i++) {
-            ptr[i] = 0;
-        }
-        
+        // Free list is empty, take a (zeroed) page from the PMM
         total_pages_allocated++;
-        return page;
+        spin_unlock_irqrestore(&free_list_lock, flags);
+        
+        return pmm_alloc_page();
     }
     
     // Take a page from the free list
     free_page_t* page = free_list_head;
     free_list_head = page->next;
+    total_pages_allocated++;
+    spin_unlock_irqrestore(&free_list_lock, flags);
     
-    // Zero the page before returning it
-    uint32_t* ptr = (uint32_t*)page;
-    for (int i = 0; i < PAGE_SIZE / 4; i++) {
-        ptr[i] = 0;
-    }
+    // Zero the page before returning it (outside the lock)
+    mem_zero_pages(page, 1);
     
-    total_pages_allocated++;
     return (void*)page;
 }
 
@@ -185,10 +216,12 @@ static void add_to_free_list(void* page_addr) {
     free_page_t* page = (free_page_t*)page_addr;
     
     // Add to the front of the free list
+    uint32_t flags = spin_lock_irqsave(&free_list_lock);
     page->next = free_list_head;
     free_list_head = page;
     
     total_pages_freed++;
+    spin_unlock_irqrestore(&free_list_lock, flags);
 }
 
 // Get memory statistics
@@ -200,16 +233,22 @@ void get_memory_stats(void) {
     
     // Count free pages in the list
     uint32_t free_count = 0;
+    uint32_t flags = spin_lock_irqsave(&free_list_lock);
     free_page_t* current = free_list_head;
     while (current != NULL) {
         free_count++;
         current = current->next;
         // Prevent infinite loops in case of corruption
         if (free_count > 10000) {
-            kprintf("  Free pages: >10000 (list may be corrupted)\n");
-            return;
+            break;
         }
     }
+    spin_unlock_irqrestore(&free_list_lock, flags);
+    
+    if (free_count > 10000) {
+        kprintf("  Free pages: >10000 (list may be corrupted)\n");
+        return;
+    }
     kprintf("  Free pages available: %u\n", free_count);
 }
 
@@ -230,10 +269,61 @@ static void enable_pae(void) {
     __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4));
 }
 
+#define CR4_PGE 0x80
+
+static int global_pages = 0;
+
+static uint32_t read_cr4(void) {
+    uint32_t cr4;
+    __asm__ __volatile__("mov %%cr4, %0" : "=r"(cr4));
+    return cr4;
+}
+
+static void write_cr4(uint32_t cr4) {
+    __asm__ __volatile__("mov %0, %%cr4" : : "r"(cr4) : "memory");
+}
+
+void tlb_flush_page(uint32_t virtual_addr) {
+    __asm__ __volatile__("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+}
+
+// Reloading CR3 drops all non-global entries
+void tlb_flush(void) {
+    uint32_t cr3;
+    __asm__ __volatile__("mov %%cr3, %0; mov %0, %%cr3" : "=r"(cr3) : : "memory");
+}
+
+// Clearing and setting CR4.PGE flushes the whole TLB, global entries
+// included
+void tlb_flush_global(void) {
+    if (!global_pages) {
+        tlb_flush();
+        return;
+    }
+    uint32_t flags = cpu_irq_save();
+    uint32_t cr4 = read_cr4();
+    write_cr4(cr4 & ~CR4_PGE);
+    write_cr4(cr4);
+    cpu_irq_restore(flags);
+}
+
+int paging_global_pages_enabled(void) {
+    return global_pages;
+}
+
+pdpt_t* paging_kernel_pdpt(void) {
+    return pdpt;
+}
+
+page_directory_t* paging_kernel_directory(uint32_t pdpt_index) {
+    return pdpt_index < PDPT_ENTRIES ? page_directories[pdpt_index] : NULL;
+}
+
 static void enable_paging_bit(void) {
     uint32_t cr0;
     __asm__ __volatile__("mov %%cr0, %0" : "=r"(cr0));
     cr0 |= 0x80000000;  // Set PG bit (bit 31)
+    cr0 |= 0x10000;     // Set WP bit (bit 16): ring 0 honours read-only (copy-on-write) pages
     __asm__ __volatile__("mov %0, %%cr0" : : "r"(cr0));
 }
 
@@ -268,7 +358,7 @@ void setup_identity_mapping(void) {
     // Map first 32MB (8192 pages) identity mapped to cover our memory needs
     // This covers kernel, heap, and free list areas
     for (uint32_t addr = 0; addr < 0x2000000; addr += PAGE_SIZE) {
-        map_page(addr, addr, PAGE_PRESENT | PAGE_WRITABLE);
+        map_page(addr, addr, PAGE_KERNEL);
     }
     
     kprintf("Identity mapping complete (32MB mapped).\n");
@@ -285,6 +375,13 @@ int map_page(uint32_t virtual_addr, uint64_t physical_addr, uint32_t flags) {
         return -1;
     }
     
+    // Global entries would outlive the address space they belong to
+    if (flags & PAGE_USER) {
+        flags &= ~PAGE_GLOBAL;
+    }
+    
+    uint32_t lock_flags = spin_lock_irqsave(&page_table_lock);
+    
     // Check if page table exists
     if (!(pd->entries[vaddr.pd_index] & PAGE_PRESENT)) {
         // Allocate new page table
@@ -296,30 +393,95 @@ int map_page(uint32_t virtual_addr, uint64_t physical_addr, uint32_t flags) {
     page_table_t* pt = (page_table_t*)(uint32_t)(pd->entries[vaddr.pd_index] & 0xFFFFF000);
     
     // Set page table entry
+    if (pt->entries[vaddr.pt_index] == 0) {
+        pt_live[vaddr.pdpt_index][vaddr.pd_index]++;
+    }
     pt->entries[vaddr.pt_index] = physical_addr | flags;
     
-    // Invalidate TLB entry
-    __asm__ __volatile__("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+    // Invalidate TLB entry (invlpg drops global entries too)
+    tlb_flush_page(virtual_addr);
     
+    spin_unlock_irqrestore(&page_table_lock, lock_flags);
     return 0;
 }
 
-int unmap_page(uint32_t virtual_addr) {
+// Clear the PTE for 'virtual_addr' and detach its page table from the
+// directory if that left it empty. Returns the old PTE (0 if nothing was
+// mapped). Called with page_table_lock held.
+static uint64_t clear_pte(uint32_t virtual_addr, page_table_t** emptied) {
     virtual_addr_t vaddr;
     vaddr.raw = virtual_addr;
+    *emptied = NULL;
     
     page_directory_t* pd = page_directories[vaddr.pdpt_index];
     if (!pd || !(pd->entries[vaddr.pd_index] & PAGE_PRESENT)) {
-        return -1;  // Page not mapped
+        return 0;
     }
     
     page_table_t* pt = (page_table_t*)(uint32_t)(pd->entries[vaddr.pd_index] & 0xFFFFF000);
+    uint64_t old = pt->entries[vaddr.pt_index];
     pt->entries[vaddr.pt_index] = 0;
     
-    // Invalidate TLB entry
-    __asm__ __volatile__("invlpg (%0)" : : "r"(virtual_addr) : "memory");
+    if (old != 0 && --pt_live[vaddr.pdpt_index][vaddr.pd_index] == 0) {
+        pd->entries[vaddr.pd_index] = 0;
+        *emptied = pt;
+    }
+    return old;
+}
+
+int unmap_page(uint32_t virtual_addr) {
+    page_table_t* emptied;
     
-    return 0;
+    uint32_t flags = spin_lock_irqsave(&page_table_lock);
+    uint64_t old = clear_pte(virtual_addr, &emptied);
+    
+    // Invalidate TLB entry; this also drops the cached directory entry of
+    // a table that was just detached
+    if (old != 0) {
+        tlb_flush_page(virtual_addr);
+    }
+    
+    spin_unlock_irqrestore(&page_table_lock, flags);
+    
+    if (emptied) {
+        add_to_free_list(emptied);
+    }
+    return (old & PAGE_PRESENT) ? 0 : -1;
+}
+
+// Batched unmapping: clear the PTE without touching the TLB. Page tables
+// that become empty are kept until paging_free_detached_tables(), which
+// the caller runs after its tlb_flush_global(). Returns the old PTE.
+uint64_t unmap_page_deferred(uint32_t virtual_addr) {
+    page_table_t* emptied;
+    
+    uint32_t flags = spin_lock_irqsave(&page_table_lock);
+    uint64_t old = clear_pte(virtual_addr, &emptied);
+    if (emptied) {
+        free_page_t* page = (free_page_t*)emptied;
+        page->next = detached_tables;
+        detached_tables = page;
+    }
+    spin_unlock_irqrestore(&page_table_lock, flags);
+    return old;
+}
+
+// Free the page tables detached by unmap_page_deferred(). The TLB must
+// have been flushed since they were detached.
+uint32_t paging_free_detached_tables(void) {
+    uint32_t flags = spin_lock_irqsave(&page_table_lock);
+    free_page_t* page = detached_tables;
+    detached_tables = NULL;
+    spin_unlock_irqrestore(&page_table_lock, flags);
+    
+    uint32_t count = 0;
+    while (page) {
+        free_page_t* next = page->next;
+        add_to_free_list(page);
+        page = next;
+        count++;
+    }
+    return count;
 }
 
 uint64_t get_physical_addr(uint32_t virtual_addr) {
@@ -357,7 +519,16 @@ void enable_pae_paging(void) {
     // Enable paging
     enable_paging_bit();
     
+    // CR4.PGE may be set with paging on or off; what matters is that the
+    // G bits are only honoured from here on, so every entry marked global
+    // must already be final. The kernel mappings above are.
+    if (cpu_has(CPU_FEATURE_PGE)) {
+        write_cr4(read_cr4() | CR4_PGE);
+        global_pages = 1;
+    }
+    
     kprintf("PAE paging enabled successfully!\n");
+    kprintf("Global kernel pages %s\n", global_pages ? "enabled" : "not supported");
     kprintf("CR3 set to 0x%x\n", (uint32_t)pdpt);
 }
 
@@ -374,6 +545,6 @@ void setup_kernel_heap(void) {
     
     // Map heap area
     for (uint32_t addr = HEAP_START; addr < HEAP_START + HEAP_SIZE; addr += PAGE_SIZE) {
-        map_page(addr, addr, PAGE_PRESENT | PAGE_WRITABLE);
+        map_page(addr, addr, PAGE_KERNEL);
     }
 }
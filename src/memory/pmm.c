@@ -1,8 +1,14 @@
 #include "memory/pmm.h"
 #include "lib/kprintf.h"
+#include "kernel/task.h"
+#include "kernel/spinlock.h"
+#include "lib/string.h"
+#include "kernel/boot_info.h"
 #include <stdint.h>
 
+#ifndef NULL
 #define NULL ((void*)0)
+#endif
 
 // Global PMM state
 static uint32_t* pmm_bitmap = NULL;
@@ -12,6 +18,15 @@ static uint32_t pmm_free_page_count = 0;
 static uint32_t pmm_last_allocated = 0;
 static int pmm_initialized = 0;
 
+// Extra owners per page (0 = one owner), for pages shared between address
+// spaces. Lives right after the bitmap.
+static uint16_t* pmm_refs = NULL;
+
+// Protects the bitmap, the free page count and the next-fit cursor. Every
+// CPU allocates page tables, stacks and buffers through it, so it is an MCS
+// lock: waiters spin on their own stack node instead of the lock word.
+static mcs_lock_t pmm_lock = MCS_LOCK_INIT("pmm");
+
 // Memory regions
 static pmm_region_t pmm_regions[16];
 static uint32_t pmm_region_count = 0;
@@ -60,6 +75,14 @@ static inline int pmm_test_bit(uint32_t page) {
     return 1; // Assume allocated if out of range
 }
 
+// Set bits in a bitmap word (no libgcc for __builtin_popcount)
+static inline uint32_t pmm_popcount(uint32_t x) {
+    x = x - ((x >> 1) & 0x55555555);
+    x = (x & 0x33333333) + ((x >> 2) & 0x33333333);
+    x = (x + (x >> 4)) & 0x0F0F0F0F;
+    return (x * 0x01010101) >> 24;
+}
+
 // Add a memory region
 static int pmm_add_region(uint32_t start, uint32_t size, uint32_t type) {
     if (pmm_region_count >= 16) {
@@ -74,6 +97,22 @@ static int pmm_add_region(uint32_t start, uint32_t size, uint32_t type) {
     return PMM_SUCCESS;
 }
 
+// Reserve managed pages that the boot memory map, when the loader passed
+// one, does not report as usable RAM
+static void pmm_reserve_unusable(void) {
+    uint32_t reserved = 0;
+    for (uint32_t page = 0; page < pmm_total_pages; page++) {
+        uint32_t addr = PMM_MANAGED_START + pmm_page_to_addr(page);
+        if (!pmm_test_bit(page) && !boot_info_memory_usable(addr, PMM_PAGE_SIZE)) {
+            pmm_set_bit(page);
+            reserved++;
+        }
+    }
+    if (reserved != 0) {
+        kprintf("PMM: %u pages are not usable RAM in the boot memory map\n", reserved);
+    }
+}
+
 // Initialize the physical memory manager
 int pmm_init(void) {
     if (pmm_initialized) {
@@ -92,9 +131,7 @@ int pmm_init(void) {
     pmm_bitmap = (uint32_t*)PMM_MANAGED_START;
     
     // Clear the bitmap (all pages initially free)
-    for (uint32_t i = 0; i < pmm_bitmap_size; i++) {
-        pmm_bitmap[i] = 0;
-    }
+    memset(pmm_bitmap, 0, pmm_bitmap_size * sizeof(uint32_t));
     
     // Set up memory regions
     pmm_region_count = 0;
@@ -105,12 +142,17 @@ int pmm_init(void) {
     // Add heap region (reserved)
     pmm_add_region(PMM_HEAP_START, PMM_HEAP_SIZE, PMM_REGION_RESERVED);
     
-    // Add bitmap region (reserved)
+    // Sharing counts follow the bitmap
     uint32_t bitmap_bytes = pmm_bitmap_size * sizeof(uint32_t);
-    pmm_add_region(PMM_MANAGED_START, bitmap_bytes, PMM_REGION_RESERVED);
+    pmm_refs = (uint16_t*)(PMM_MANAGED_START + bitmap_bytes);
+    memset(pmm_refs, 0, pmm_total_pages * sizeof(uint16_t));
+    
+    // Add bitmap and sharing count region (reserved)
+    uint32_t metadata_bytes = bitmap_bytes + pmm_total_pages * sizeof(uint16_t);
+    pmm_add_region(PMM_MANAGED_START, metadata_bytes, PMM_REGION_RESERVED);
     
-    // Add available region (after bitmap)
-    uint32_t available_start = PMM_MANAGED_START + ((bitmap_bytes + PMM_PAGE_SIZE - 1) & ~(PMM_PAGE_SIZE - 1));
+    // Add available region (after the metadata)
+    uint32_t available_start = PMM_MANAGED_START + ((metadata_bytes + PMM_PAGE_SIZE - 1) & ~(PMM_PAGE_SIZE - 1));
     uint32_t available_size = PMM_MANAGED_SIZE - (available_start - PMM_MANAGED_START);
     pmm_add_region(available_start, available_size, PMM_REGION_AVAILABLE);
     
@@ -130,13 +172,15 @@ int pmm_init(void) {
         }
     }
     
-    // Count free pages
-    pmm_free_page_count = 0;
-    for (uint32_t i = 0; i < pmm_total_pages; i++) {
-        if (!pmm_test_bit(i)) {
-            pmm_free_page_count++;
-        }
+    pmm_reserve_unusable();
+    
+    // Count free pages a bitmap word at a time; bits past the last page
+    // are never set
+    uint32_t used_pages = 0;
+    for (uint32_t i = 0; i < pmm_bitmap_size; i++) {
+        used_pages += pmm_popcount(pmm_bitmap[i]);
     }
+    pmm_free_page_count = pmm_total_pages - used_pages;
     
     pmm_last_allocated = 0;
     pmm_initialized = 1;
@@ -151,7 +195,7 @@ int pmm_init(void) {
     return PMM_SUCCESS;
 }
 
-// Find a contiguous block of free pages
+// Find a contiguous block of free pages (caller must hold pmm_lock to act on the result)
 uint32_t pmm_find_free_pages(uint32_t count) {
     if (!pmm_initialized || count == 0) {
         return 0xFFFFFFFF;
@@ -182,6 +226,11 @@ uint32_t pmm_find_free_pages(uint32_t count) {
     return 0xFFFFFFFF; // Not found
 }
 
+// Zero pages [first, last) of the block starting at 'arg'
+static void pmm_zero_pages(uint32_t first, uint32_t last, void* arg) {
+    mem_zero_pages((void*)((uint32_t)arg + first * PMM_PAGE_SIZE), last - first);
+}
+
 // Allocate a single page
 void* pmm_alloc_page(void) {
     return pmm_alloc_pages(1);
@@ -189,12 +238,37 @@ void* pmm_alloc_page(void) {
 
 // Allocate multiple contiguous pages
 void* pmm_alloc_pages(uint32_t count) {
-    if (!pmm_initialized || count == 0 || pmm_free_page_count < count) {
+    void* pages = pmm_alloc_pages_uninit(count);
+    if (pages == NULL) {
+        return NULL;
+    }
+    
+    // Zero the allocated pages; large blocks are split across CPUs
+    if (count >= PMM_PARALLEL_ZERO_PAGES) {
+        task_parallel_for(0, count, PMM_PARALLEL_ZERO_PAGES / 2, pmm_zero_pages, pages);
+    } else {
+        pmm_zero_pages(0, count, pages);
+    }
+    return pages;
+}
+
+// Allocate contiguous pages without zeroing them, for callers that clear
+// each page when they hand it out
+void* pmm_alloc_pages_uninit(uint32_t count) {
+    if (!pmm_initialized || count == 0) {
+        return NULL;
+    }
+    
+    mcs_node_t node;
+    uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+    if (pmm_free_page_count < count) {
+        mcs_unlock_irqrestore(&pmm_lock, &node, flags);
         return NULL;
     }
     
     uint32_t start_page = pmm_find_free_pages(count);
     if (start_page == 0xFFFFFFFF) {
+        mcs_unlock_irqrestore(&pmm_lock, &node, flags);
         return NULL;
     }
     
@@ -205,18 +279,10 @@ void* pmm_alloc_pages(uint32_t count) {
     
     pmm_free_page_count -= count;
     pmm_last_allocated = (start_page + count) % pmm_total_pages;
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
     
     // Convert page to physical address
-    uint32_t phys_addr = PMM_MANAGED_START + (start_page * PMM_PAGE_SIZE);
-    
-    // Zero the allocated pages
-    uint32_t* ptr = (uint32_t*)phys_addr;
-    uint32_t total_words = (count * PMM_PAGE_SIZE) / sizeof(uint32_t);
-    for (uint32_t i = 0; i < total_words; i++) {
-        ptr[i] = 0;
-    }
-    
-    return (void*)phys_addr;
+    return (void*)(PMM_MANAGED_START + (start_page * PMM_PAGE_SIZE));
 }
 
 // Free a single page
@@ -251,15 +317,23 @@ int pmm_free_pages(void* pages, uint32_t count) {
     }
     
     // Mark pages as free
+    mcs_node_t node;
+    uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
+    uint32_t double_freed = 0;
     for (uint32_t i = 0; i < count; i++) {
         if (!pmm_test_bit(start_page + i)) {
-            kprintf("PMM: Warning - freeing already free page at 0x%x\n", 
-                    addr + (i * PMM_PAGE_SIZE));
+            double_freed++;
         }
         pmm_clear_bit(start_page + i);
     }
     
-    pmm_free_page_count += count;
+    pmm_free_page_count += count - double_freed;
+    mcs_unlock_irqrestore(&pmm_lock, &node, flags);
+    
+    if (double_freed) {
+        kprintf("PMM: Warning - freeing %u already free page(s) at 0x%x\n", 
+                double_freed, addr);
+    }
     
     return PMM_SUCCESS;
 }
@@ -276,12 +350,15 @@ int pmm_reserve_region(uint32_t start, uint32_t size) {
     // Adjust for our managed range
     if (start >= PMM_MANAGED_START) {
         start_page -= pmm_addr_to_page(PMM_MANAGED_START);
+        mcs_node_t node;
+        uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
         for (uint32_t i = 0; i < page_count && (start_page + i) < pmm_total_pages; i++) {
             if (!pmm_test_bit(start_page + i)) {
                 pmm_set_bit(start_page + i);
                 pmm_free_page_count--;
             }
         }
+        mcs_unlock_irqrestore(&pmm_lock, &node, flags);
     }
     
     return PMM_SUCCESS;
@@ -299,12 +376,15 @@ int pmm_mark_available(uint32_t start, uint32_t size) {
     // Adjust for our managed range
     if (start >= PMM_MANAGED_START) {
         start_page -= pmm_addr_to_page(PMM_MANAGED_START);
+        mcs_node_t node;
+        uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
         for (uint32_t i = 0; i < page_count && (start_page + i) < pmm_total_pages; i++) {
             if (pmm_test_bit(start_page + i)) {
                 pmm_clear_bit(start_page + i);
                 pmm_free_page_count++;
             }
         }
+        mcs_unlock_irqrestore(&pmm_lock, &node, flags);
     }
     
     return PMM_SUCCESS;
@@ -315,11 +395,14 @@ pmm_stats_t pmm_get_stats(void) {
     pmm_stats_t stats = {0};
     
     if (pmm_initialized) {
+        mcs_node_t node;
+        uint32_t flags = mcs_lock_irqsave(&pmm_lock, &node);
         stats.total_pages = pmm_total_pages;
         stats.free_pages = pmm_free_page_count;
         stats.used_pages = pmm_total_pages - pmm_free_page_count;
         stats.bitmap_size = pmm_bitmap_size * sizeof(uint32_t);
         stats.last_allocated_page = pmm_last_allocated;
+        mcs_unlock_irqrestore(&pmm_lock, &node, flags);
     }
     
     return stats;
@@ -392,6 +475,46 @@ int pmm_is_page_allocated(void* page) {
     return pmm_test_bit(page_num);
 }
 
+// Sharing count slot for an allocated page, or NULL if it is not ours
+static uint16_t* pmm_page_ref(void* page) {
+    uint32_t addr = (uint32_t)page;
+    if (!pmm_initialized || (addr & (PMM_PAGE_SIZE - 1)) ||
+        addr < PMM_MANAGED_START || addr >= PMM_MANAGED_START + PMM_MANAGED_SIZE) {
+        return NULL;
+    }
+    return &pmm_refs[(addr - PMM_MANAGED_START) / PMM_PAGE_SIZE];
+}
+
+// Add an owner to an allocated page
+void pmm_page_get(void* page) {
+    uint16_t* ref = pmm_page_ref(page);
+    if (ref) {
+        __atomic_add_fetch(ref, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Drop an owner; the last one frees the page. Returns the owners left.
+uint32_t pmm_page_put(void* page) {
+    uint16_t* ref = pmm_page_ref(page);
+    if (ref == NULL) {
+        return 0;
+    }
+
+    uint16_t old = __atomic_load_n(ref, __ATOMIC_ACQUIRE);
+    do {
+        if (old == 0) {
+            pmm_free_page(page);
+            return 0;
+        }
+    } while (!__atomic_compare_exchange_n(ref, &old, old - 1, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE));
+    return old;
+}
+
+uint32_t pmm_page_owners(void* page) {
+    uint16_t* ref = pmm_page_ref(page);
+    return ref ? __atomic_load_n(ref, __ATOMIC_ACQUIRE) + 1u : 0;
+}
+
 // Dump bitmap for debugging
 void pmm_dump_bitmap(uint32_t start_page, uint32_t count) {
     if (!pmm_initialized) {
@@ -0,0 +1,411 @@
+#include "memory/vmalloc.h"
+#include "memory/paging.h"
+#include "memory/pmm.h"
+#include "kernel/spinlock.h"
+#include "lib/kprintf.h"
+#include <stdint.h>
+
+#ifndef NULL
+#define NULL ((void*)0)
+#endif
+
+#define VM_NODE_PAGES ((VMALLOC_MAX_AREAS * sizeof(vm_area_t) + PMM_PAGE_SIZE - 1) / PMM_PAGE_SIZE)
+
+// Area flags
+#define VM_AREA_IOREMAP 0x01  // Device memory: the pages are not ours to free
+
+typedef struct vm_area {
+    uint32_t start;
+    uint32_t size;          // Bytes, guard page included
+    uint32_t flags;         // VM_AREA_*
+    uint32_t subtree_max;   // Largest size in this subtree
+    int32_t height;
+    struct vm_area* left;
+    struct vm_area* right;
+    struct vm_area* next;   // Lazy list or unused node list
+} vm_area_t;
+
+static vm_area_t* free_tree = NULL;   // Free ranges by address
+static vm_area_t* busy_tree = NULL;   // Allocated areas by address
+static vm_area_t* lazy_list = NULL;   // Freed, waiting for a TLB flush
+static vm_area_t* unused_nodes = NULL;
+static vmalloc_stats_t vm_stats;
+
+static spinlock_t vm_lock = SPINLOCK_INIT("vmalloc");
+
+// ---------------------------------------------------------------------------
+// AVL tree keyed by start address
+
+static int32_t vm_height(vm_area_t* n) {
+    return n ? n->height : 0;
+}
+
+static uint32_t vm_max(vm_area_t* n) {
+    return n ? n->subtree_max : 0;
+}
+
+static void vm_update(vm_area_t* n) {
+    int32_t hl = vm_height(n->left);
+    int32_t hr = vm_height(n->right);
+    uint32_t m = n->size;
+
+    n->height = (hl > hr ? hl : hr) + 1;
+    if (vm_max(n->left) > m) {
+        m = vm_max(n->left);
+    }
+    if (vm_max(n->right) > m) {
+        m = vm_max(n->right);
+    }
+    n->subtree_max = m;
+}
+
+static vm_area_t* vm_rotate_right(vm_area_t* n) {
+    vm_area_t* l = n->left;
+    n->left = l->right;
+    l->right = n;
+    vm_update(n);
+    vm_update(l);
+    return l;
+}
+
+static vm_area_t* vm_rotate_left(vm_area_t* n) {
+    vm_area_t* r = n->right;
+    n->right = r->left;
+    r->left = n;
+    vm_update(n);
+    vm_update(r);
+    return r;
+}
+
+static vm_area_t* vm_balance(vm_area_t* n) {
+    vm_update(n);
+    int32_t diff = vm_height(n->left) - vm_height(n->right);
+
+    if (diff > 1) {
+        if (vm_height(n->left->left) < vm_height(n->left->right)) {
+            n->left = vm_rotate_left(n->left);
+        }
+        return vm_rotate_right(n);
+    }
+    if (diff < -1) {
+        if (vm_height(n->right->right) < vm_height(n->right->left)) {
+            n->right = vm_rotate_right(n->right);
+        }
+        return vm_rotate_left(n);
+    }
+    return n;
+}
+
+static vm_area_t* vm_insert(vm_area_t* root, vm_area_t* node) {
+    if (root == NULL) {
+        node->left = NULL;
+        node->right = NULL;
+        vm_update(node);
+        return node;
+    }
+    if (node->start < root->start) {
+        root->left = vm_insert(root->left, node);
+    } else {
+        root->right = vm_insert(root->right, node);
+    }
+    return vm_balance(root);
+}
+
+static vm_area_t* vm_remove_min(vm_area_t* root, vm_area_t** min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+    root->left = vm_remove_min(root->left, min);
+    return vm_balance(root);
+}
+
+// Unlink the node starting at 'start'; *out receives it (or NULL)
+static vm_area_t* vm_remove(vm_area_t* root, uint32_t start, vm_area_t** out) {
+    if (root == NULL) {
+        *out = NULL;
+        return NULL;
+    }
+    if (start < root->start) {
+        root->left = vm_remove(root->left, start, out);
+    } else if (start > root->start) {
+        root->right = vm_remove(root->right, start, out);
+    } else {
+        *out = root;
+        if (root->left == NULL) {
+            return root->right;
+        }
+        if (root->right == NULL) {
+            return root->left;
+        }
+        vm_area_t* min;
+        vm_area_t* right = vm_remove_min(root->right, &min);
+        min->left = root->left;
+        min->right = right;
+        return vm_balance(min);
+    }
+    return vm_balance(root);
+}
+
+static vm_area_t* vm_find(vm_area_t* root, uint32_t start) {
+    while (root && root->start != start) {
+        root = start < root->start ? root->left : root->right;
+    }
+    return root;
+}
+
+// Lowest-addressed node of at least 'size' bytes
+static vm_area_t* vm_first_fit(vm_area_t* root, uint32_t size) {
+    vm_area_t* n = root;
+    while (n) {
+        if (vm_max(n->left) >= size) {
+            n = n->left;
+        } else if (n->size >= size) {
+            return n;
+        } else if (vm_max(n->right) >= size) {
+            n = n->right;
+        } else {
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+// Closest nodes below and above 'start'
+static void vm_neighbours(vm_area_t* root, uint32_t start, vm_area_t** prev, vm_area_t** next) {
+    *prev = NULL;
+    *next = NULL;
+    while (root) {
+        if (root->start < start) {
+            *prev = root;
+            root = root->right;
+        } else {
+            *next = root;
+            root = root->left;
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Ranges (called with vm_lock held)
+
+static vm_area_t* vm_node_alloc(void) {
+    vm_area_t* n = unused_nodes;
+    if (n) {
+        unused_nodes = n->next;
+    }
+    return n;
+}
+
+static void vm_node_free(vm_area_t* n) {
+    n->next = unused_nodes;
+    unused_nodes = n;
+}
+
+// Return a range to the free tree, merging it with free neighbours
+static void vm_free_range(vm_area_t* area) {
+    vm_area_t* prev;
+    vm_area_t* next;
+    vm_area_t* removed;
+
+    vm_neighbours(free_tree, area->start, &prev, &next);
+    if (prev && prev->start + prev->size == area->start) {
+        free_tree = vm_remove(free_tree, prev->start, &removed);
+        area->start = prev->start;
+        area->size += prev->size;
+        vm_node_free(prev);
+        vm_stats.free_ranges--;
+    }
+    if (next && area->start + area->size == next->start) {
+        free_tree = vm_remove(free_tree, next->start, &removed);
+        area->size += next->size;
+        vm_node_free(next);
+        vm_stats.free_ranges--;
+    }
+    area->flags = 0;
+    free_tree = vm_insert(free_tree, area);
+    vm_stats.free_ranges++;
+}
+
+// One global flush covers every lazily freed range and every page table
+// they left empty
+static void vm_purge_locked(void) {
+    if (lazy_list == NULL) {
+        return;
+    }
+    tlb_flush_global();
+    paging_free_detached_tables();
+
+    while (lazy_list) {
+        vm_area_t* area = lazy_list;
+        lazy_list = area->next;
+        vm_free_range(area);
+    }
+    vm_stats.lazy_pages = 0;
+    vm_stats.purges++;
+}
+
+// Carve 'size' bytes (plus a guard page) out of the free tree
+static uint32_t vm_alloc_area(uint32_t size, uint32_t flags) {
+    uint32_t total = size + PAGE_SIZE;
+    uint32_t lock_flags = spin_lock_irqsave(&vm_lock);
+
+    vm_area_t* fit = vm_first_fit(free_tree, total);
+    if (fit == NULL && lazy_list) {
+        vm_purge_locked();
+        fit = vm_first_fit(free_tree, total);
+    }
+    vm_area_t* area = NULL;
+    if (fit) {
+        area = fit->size > total ? vm_node_alloc() : fit;
+    }
+    if (area == NULL) {
+        spin_unlock_irqrestore(&vm_lock, lock_flags);
+        return 0;
+    }
+
+    vm_area_t* removed;
+    free_tree = vm_remove(free_tree, fit->start, &removed);
+    if (area != fit) {
+        // Keep the tail of the range free
+        area->start = fit->start;
+        fit->start += total;
+        fit->size -= total;
+        free_tree = vm_insert(free_tree, fit);
+    } else {
+        vm_stats.free_ranges--;
+    }
+    area->size = total;
+    area->flags = flags;
+    busy_tree = vm_insert(busy_tree, area);
+
+    vm_stats.areas++;
+    vm_stats.used_pages += total / PAGE_SIZE;
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+    return area->start;
+}
+
+// Unmap an area (freeing its pages unless it maps a device) and queue the
+// range for the next purge
+static void vm_free_area(uint32_t start, int ioremapped) {
+    vm_area_t* area;
+    uint32_t lock_flags = spin_lock_irqsave(&vm_lock);
+
+    area = vm_find(busy_tree, start);
+    if (area == NULL || ((area->flags & VM_AREA_IOREMAP) != 0) != ioremapped) {
+        spin_unlock_irqrestore(&vm_lock, lock_flags);
+        kprintf("vmalloc: bad %s of 0x%x\n", ioremapped ? "iounmap" : "vfree", start);
+        return;
+    }
+    busy_tree = vm_remove(busy_tree, start, &area);
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+
+    uint32_t pages = area->size / PAGE_SIZE - 1;  // The guard was never mapped
+    for (uint32_t i = 0; i < pages; i++) {
+        uint64_t pte = unmap_page_deferred(start + i * PAGE_SIZE);
+        if ((pte & PAGE_PRESENT) && !ioremapped) {
+            pmm_free_page((void*)(uint32_t)(pte & 0xFFFFF000));
+        }
+    }
+
+    lock_flags = spin_lock_irqsave(&vm_lock);
+    area->next = lazy_list;
+    lazy_list = area;
+    vm_stats.areas--;
+    vm_stats.used_pages -= pages + 1;
+    vm_stats.lazy_pages += pages + 1;
+    if (vm_stats.lazy_pages >= VMALLOC_LAZY_PAGES) {
+        vm_purge_locked();
+    }
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+}
+
+// ---------------------------------------------------------------------------
+// Public API
+
+void vmalloc_init(void) {
+    vm_area_t* nodes = (vm_area_t*)pmm_alloc_pages(VM_NODE_PAGES);
+    if (nodes == NULL) {
+        kprintf("vmalloc: cannot allocate area nodes\n");
+        return;
+    }
+    for (uint32_t i = 0; i < VMALLOC_MAX_AREAS; i++) {
+        vm_node_free(&nodes[i]);
+    }
+
+    vm_area_t* all = vm_node_alloc();
+    all->start = VMALLOC_START;
+    all->size = VMALLOC_END - VMALLOC_START;
+    vm_free_range(all);
+
+    kprintf("vmalloc: 0x%x-0x%x, %u areas\n", VMALLOC_START, VMALLOC_END - 1, VMALLOC_MAX_AREAS);
+}
+
+void* vmalloc(uint32_t size) {
+    uint32_t pages = (size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0 || pages >= (VMALLOC_END - VMALLOC_START) / PAGE_SIZE) {
+        return NULL;
+    }
+
+    uint32_t start = vm_alloc_area(pages * PAGE_SIZE, 0);
+    if (start == 0) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        void* page = pmm_alloc_page();
+        if (page == NULL || map_page(start + i * PAGE_SIZE, (uint32_t)page, PAGE_KERNEL) != 0) {
+            if (page) {
+                pmm_free_page(page);
+            }
+            vm_free_area(start, 0);  // Frees the pages mapped so far
+            return NULL;
+        }
+    }
+    return (void*)start;
+}
+
+void vfree(void* addr) {
+    if (addr != NULL) {
+        vm_free_area((uint32_t)addr, 0);
+    }
+}
+
+void* ioremap(uint64_t phys, uint32_t size) {
+    uint32_t offset = (uint32_t)phys & (PAGE_SIZE - 1);
+    uint64_t base = phys - offset;
+    uint32_t pages = (offset + size + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (pages == 0 || pages >= (VMALLOC_END - VMALLOC_START) / PAGE_SIZE) {
+        return NULL;
+    }
+
+    uint32_t start = vm_alloc_area(pages * PAGE_SIZE, VM_AREA_IOREMAP);
+    if (start == 0) {
+        return NULL;
+    }
+    for (uint32_t i = 0; i < pages; i++) {
+        if (map_page(start + i * PAGE_SIZE, base + i * PAGE_SIZE, PAGE_KERNEL | PAGE_CACHE_DISABLE) != 0) {
+            vm_free_area(start, 1);
+            return NULL;
+        }
+    }
+    return (void*)(start + offset);
+}
+
+void iounmap(void* addr) {
+    if (addr != NULL) {
+        vm_free_area((uint32_t)addr & ~(PAGE_SIZE - 1), 1);
+    }
+}
+
+void vmalloc_purge(void) {
+    uint32_t lock_flags = spin_lock_irqsave(&vm_lock);
+    vm_purge_locked();
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+}
+
+vmalloc_stats_t vmalloc_get_stats(void) {
+    uint32_t lock_flags = spin_lock_irqsave(&vm_lock);
+    vmalloc_stats_t stats = vm_stats;
+    spin_unlock_irqrestore(&vm_lock, lock_flags);
+    return stats;
+}